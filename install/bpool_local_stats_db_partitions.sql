@@ -0,0 +1,36 @@
+--
+-- Optional: partition the stats tables which have expired data by day.
+--
+-- slparser checks the partitions of the tables every hour: it creates the
+-- ones of today and the next 3 days, and drops the expired ones, rather than
+-- DELETE the expired rows. Tables which aren't partitioned are still cleaned
+-- by DELETE.
+--
+-- The first partition has all the current rows, its bound is tomorrow (UTC,
+-- `day`: YYYYMMDD, `hour`: YYYYMMDD00) of the time it runs. It rebuilds the
+-- tables, run it when slparser is stopped.
+--
+
+SET @today    = DATE_FORMAT(UTC_DATE(), '%Y%m%d');
+SET @tomorrow = DATE_FORMAT(UTC_DATE() + INTERVAL 1 DAY, '%Y%m%d');
+
+SET @sql = CONCAT('ALTER TABLE `stats_workers_day` PARTITION BY RANGE (`day`) (',
+                  '  PARTITION `p', @today, '` VALUES LESS THAN (', @tomorrow, '),',
+                  '  PARTITION `pmax` VALUES LESS THAN MAXVALUE)');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;
+
+SET @sql = CONCAT('ALTER TABLE `stats_workers_hour` PARTITION BY RANGE (`hour`) (',
+                  '  PARTITION `p', @today, '` VALUES LESS THAN (', @tomorrow, '00),',
+                  '  PARTITION `pmax` VALUES LESS THAN MAXVALUE)');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;
+
+SET @sql = CONCAT('ALTER TABLE `stats_users_hour` PARTITION BY RANGE (`hour`) (',
+                  '  PARTITION `p', @today, '` VALUES LESS THAN (', @tomorrow, '00),',
+                  '  PARTITION `pmax` VALUES LESS THAN MAXVALUE)');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;
@@ -0,0 +1,102 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "AdmissionControl.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+////////////////////////////////// TokenBucket /////////////////////////////////
+void TokenBucket::refill(uint64_t nowUs) {
+  if (nowUs <= lastUs_) {
+    return;
+  }
+  tokens_ += rate_ * (nowUs - lastUs_) / 1000000.0;
+  if (tokens_ > burst_) {
+    tokens_ = burst_;
+  }
+  lastUs_ = nowUs;
+}
+
+bool TokenBucket::tryConsume(uint64_t nowUs) {
+  refill(nowUs);
+  if (tokens_ < 1.0) {
+    return false;
+  }
+  tokens_ -= 1.0;
+  return true;
+}
+
+bool TokenBucket::isFull(uint64_t nowUs) {
+  refill(nowUs);
+  return tokens_ >= burst_;
+}
+
+///////////////////////////////// AcceptLimiter ////////////////////////////////
+bool AcceptLimiter::subnetOf(const struct sockaddr *saddr, uint64_t &subnet) {
+  // IPv4 in ffff::/16, which is never a global IPv6 address
+  static const uint64_t kIPv4Prefix = 0xffff000000000000ull;
+
+  if (saddr->sa_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)saddr;
+    subnet = kIPv4Prefix | (ntohl(sin->sin_addr.s_addr) >> 8);
+    return true;
+  }
+  if (saddr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)saddr;
+    const uint8_t *addr = sin6->sin6_addr.s6_addr;
+    if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+      subnet = kIPv4Prefix | ((uint32_t)addr[12] << 16) |
+               ((uint32_t)addr[13] << 8) | addr[14];
+      return true;
+    }
+    subnet = 0;
+    for (int i = 0; i < 8; i++) {
+      subnet = (subnet << 8) | addr[i];
+    }
+    return true;
+  }
+  return false;
+}
+
+bool AcceptLimiter::tryAccept(const struct sockaddr *saddr, uint64_t nowUs) {
+  uint64_t subnet;
+  if (rate_ <= 0 || !subnetOf(saddr, subnet)) {
+    return true;
+  }
+  auto itr = buckets_.find(subnet);
+  if (itr == buckets_.end()) {
+    itr = buckets_.insert(std::make_pair(subnet, TokenBucket(rate_, burst_, nowUs))).first;
+  }
+  return itr->second.tryConsume(nowUs);
+}
+
+void AcceptLimiter::cleanup(uint64_t nowUs) {
+  for (auto itr = buckets_.begin(); itr != buckets_.end(); ) {
+    if (itr->second.isFull(nowUs)) {
+      itr = buckets_.erase(itr);
+    } else {
+      itr++;
+    }
+  }
+}
@@ -0,0 +1,97 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#ifndef ADMISSION_CONTROL_H_
+#define ADMISSION_CONTROL_H_
+
+#include "Common.h"
+
+#include <unordered_map>
+
+#include <sys/socket.h>
+
+//
+// Settings of sserver's admission control, used when a whole farm reconnects
+// at once (failover, sserver restart). 0 means disabled.
+//
+struct AdmissionConfig {
+  // token bucket for each source subnet (/24)
+  double   acceptRatePerSubnet_;   // connections per second
+  double   acceptBurstPerSubnet_;
+  // connections accepted but not authorized yet
+  int32_t  maxPendingHandshakes_;
+  // connections over the limits: accepted by the listener, but no session
+  // is made for them yet. closed if the queue is full
+  int32_t  maxPendingAccepts_;
+  // the first mining job of new sessions, sent in 10ms ticks
+  int32_t  firstJobsPerSecond_;
+
+  AdmissionConfig(): acceptRatePerSubnet_(0), acceptBurstPerSubnet_(0),
+  maxPendingHandshakes_(0), maxPendingAccepts_(10000), firstJobsPerSecond_(0) {}
+
+  bool isAcceptLimited() const {
+    return acceptRatePerSubnet_ > 0 || maxPendingHandshakes_ > 0;
+  }
+};
+
+////////////////////////////////// TokenBucket /////////////////////////////////
+class TokenBucket {
+  double rate_;    // tokens per second
+  double burst_;   // max tokens
+  double tokens_;
+  uint64_t lastUs_;
+
+public:
+  TokenBucket(double rate = 0, double burst = 0, uint64_t nowUs = 0):
+  rate_(rate), burst_(burst < 1 ? 1 : burst), tokens_(burst_), lastUs_(nowUs) {}
+
+  void refill(uint64_t nowUs);
+  bool tryConsume(uint64_t nowUs);
+  bool isFull(uint64_t nowUs);
+};
+
+///////////////////////////////// AcceptLimiter ////////////////////////////////
+//
+// Token bucket of every source subnet. Not thread safe, only used in
+// the event loop.
+//
+class AcceptLimiter {
+  double rate_;
+  double burst_;
+  std::unordered_map<uint64_t, TokenBucket> buckets_;
+
+public:
+  AcceptLimiter(double rate, double burst): rate_(rate), burst_(burst) {}
+
+  // the /24 of IPv4 (and IPv4-mapped IPv6), the /64 of IPv6.
+  // returns false for the other families
+  static bool subnetOf(const struct sockaddr *saddr, uint64_t &subnet);
+
+  // always true if the rate is 0 or the subnet is unknown
+  bool tryAccept(const struct sockaddr *saddr, uint64_t nowUs);
+  // remove the buckets which are full, they're the same as new ones
+  void cleanup(uint64_t nowUs);
+  size_t size() const { return buckets_.size(); }
+};
+
+#endif
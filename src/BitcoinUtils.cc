@@ -28,6 +28,21 @@ std::string EncodeHexBlock(const CBlock &block) {
   ssBlock << block;
   return HexStr(ssBlock.begin(), ssBlock.end());
 }
+
+std::string EncodeHexBlock(const CBlockHeader &header,
+                           const std::vector<char> &coinbaseTx,
+                           size_t txCount, const std::string &txsHex) {
+  CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+  ssBlock << header;
+  WriteCompactSize(ssBlock, txCount + 1);  // with the coinbase tx
+  ssBlock.write(coinbaseTx.data(), coinbaseTx.size());
+
+  std::string hex = HexStr(ssBlock.begin(), ssBlock.end());
+  hex.reserve(hex.size() + txsHex.size());
+  hex.append(txsHex);
+  return hex;
+}
+
 std::string EncodeHexBlockHeader(const CBlockHeader &blkHeader) {
   CDataStream ssBlkHeader(SER_NETWORK, PROTOCOL_VERSION);
   ssBlkHeader << blkHeader;
@@ -51,6 +51,11 @@
 #endif
 
 std::string EncodeHexBlock(const CBlock &block);
+// the same hex from the parts of the block: txsHex is the serialized txs
+// after the coinbase tx, txCount is the number of them
+std::string EncodeHexBlock(const CBlockHeader &header,
+                           const std::vector<char> &coinbaseTx,
+                           size_t txCount, const std::string &txsHex);
 std::string EncodeHexBlockHeader(const CBlockHeader &blkHeader);
 
 int64_t GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
@@ -34,9 +34,11 @@
 
 
 ////////////////////////////////// BlockMaker //////////////////////////////////
-BlockMaker::BlockMaker(const char *kafkaBrokers, const MysqlConnectInfo &poolDB):
+BlockMaker::BlockMaker(const char *kafkaBrokers, const MysqlConnectInfo &poolDB,
+                       const string &sqlRetryFile):
 running_(true),
 kMaxRawGbtNum_(100),    /* if 5 seconds a rawgbt, will hold 100*5/60 = 8 mins rawgbt */
+rawGbtDecoder_(true),
 kMaxStratumJobNum_(120), /* if 30 seconds a stratum job, will hold 60 mins stratum job */
 lastSubmittedBlockTime(),
 submittedRskBlocks(0),
@@ -45,7 +47,13 @@ kafkaConsumerStratumJob_ (kafkaBrokers, KAFKA_TOPIC_STRATUM_JOB,  0/* patition *
 kafkaConsumerSovledShare_(kafkaBrokers, KAFKA_TOPIC_SOLVED_SHARE, 0/* patition */),
 kafkaConsumerNamecoinSovledShare_(kafkaBrokers, KAFKA_TOPIC_NMC_SOLVED_SHARE, 0/* patition */),
 kafkaConsumerRskSolvedShare_(kafkaBrokers, KAFKA_TOPIC_RSK_SOLVED_SHARE, 0/* patition */),
-poolDB_(poolDB)
+kSubmitBlockConns_(2),
+kHousekeepingInterval_(10), /* bitcoind closes idle connections after 30s (-rpcservertimeout) */
+kStatsInterval_(3600),
+poolDB_(poolDB),
+sqlRetryQueue_(sqlRetryFile),
+isSqlRetrying_(false),
+executor_(4/* threads */, 2/* high priority only */, 1000/* max queue size */)
 {
 }
 
@@ -61,6 +69,12 @@ BlockMaker::~BlockMaker() {
 
   if (threadConsumeRskSolvedShare_.joinable())
     threadConsumeRskSolvedShare_.join();
+
+  if (threadHousekeeping_.joinable())
+    threadHousekeeping_.join();
+
+  // run the queued tasks
+  executor_.stop();
 }
 
 void BlockMaker::stop() {
@@ -73,12 +87,28 @@ void BlockMaker::stop() {
 
 void BlockMaker::addBitcoind(const string &rpcAddress, const string &rpcUserpass) {
   bitcoindRpcUri_.push_back(make_pair(rpcAddress, rpcUserpass));
+  submitBlockClients_.push_back(std::make_shared<RpcClient>(rpcAddress, rpcUserpass));
 }
 
 bool BlockMaker::init() {
   if (!checkBitcoinds())
     return false;
 
+  //
+  // executor and the DB connections of its threads
+  //
+  // not connected here: a connection is opened by the first task of its
+  // thread, and the inserts are kept by sqlRetryQueue_ while DB is down
+  for (size_t i = 0; i < executor_.threadNum(); i++) {
+    if (!executor_.isLowPriorityThread(i)) {
+      dbConns_.push_back(nullptr);
+      continue;
+    }
+    dbConns_.push_back(std::make_shared<MySQLConnection>(poolDB_));
+  }
+  sqlRetryQueue_.load();
+  executor_.start();
+
   //
   // Raw Gbt
   //
@@ -176,7 +206,47 @@ void BlockMaker::consumeRawGbt(rd_kafka_message_t *rkmessage) {
   addRawgbt((const char *)rkmessage->payload, rkmessage->len);
 }
 
+void BlockMaker::addCompactRawgbt(const char *str, size_t len) {
+  const uint64_t startUs = getMonotonicTimeUs();
+
+  CompactGbt cgbt;
+  if (!rawGbtDecoder_.decode(str, len, cgbt)) {
+    LOG(ERROR) << "decode compact rawgbt fail";
+    return;
+  }
+  if (rawGbtMap_.find(cgbt.gbtHash_) != rawGbtMap_.end()) {
+    LOG(ERROR) << "already exist raw gbt, ignore: " << cgbt.gbtHash_.ToString();
+    return;
+  }
+
+  // transaction without coinbase_tx
+  size_t txsSize = 0;
+  for (const auto &tx : cgbt.txs_) {
+    txsSize += tx->size();
+  }
+  auto txs = std::make_shared<GbtBlockTxs>();
+  txs->txids_ = std::move(cgbt.txids_);
+  txs->txsHex_.reserve(txsSize * 2);
+  string hex;
+  for (const auto &tx : cgbt.txs_) {
+    Bin2Hex((const uint8 *)tx->data(), tx->size(), hex);
+    txs->txsHex_.append(hex);
+  }
+
+  LOG(INFO) << "insert compact rawgbt: " << cgbt.gbtHash_.ToString()
+  << ", txs: " << txs->txids_.size() << ", size: " << txsSize
+  << ", tx store: " << rawGbtDecoder_.txCount()
+  << ", decode time: " << (getMonotonicTimeUs() - startUs) << "us";
+  insertRawGbt(cgbt.gbtHash_, txs);
+}
+
 void BlockMaker::addRawgbt(const char *str, size_t len) {
+  if (CompactGbt::isCompactFormat(str, len)) {
+    addCompactRawgbt(str, len);
+    return;
+  }
+  const uint64_t startUs = getMonotonicTimeUs();
+
   JsonNode r;
   if (!JsonNode::parse(str, str + len, r)) {
     LOG(ERROR) << "parse rawgbt message to json fail";
@@ -205,24 +275,39 @@ void BlockMaker::addRawgbt(const char *str, size_t len) {
   }
   JsonNode jgbt = nodeGbt["result"];
 
-  // transaction without coinbase_tx
-  shared_ptr<vector<CTransactionRef>> vtxs = std::make_shared<vector<CTransactionRef>>();
-  for (JsonNode & node : jgbt["transactions"].array()) {
-    CMutableTransaction tx;
-    DecodeHexTx(tx, node["data"].str());
-    vtxs->push_back(MakeTransactionRef(std::move(tx)));
+  // transaction without coinbase_tx, "data" is the hex of the tx in block
+  vector<JsonNode> &jtxs = jgbt["transactions"].array();
+  size_t txsHexSize = 0;
+  for (JsonNode &node : jtxs) {
+    txsHexSize += node["data"].size();
+  }
+  auto txs = std::make_shared<GbtBlockTxs>();
+  txs->txids_.reserve(jtxs.size());
+  txs->txsHex_.reserve(txsHexSize);
+  for (JsonNode &node : jtxs) {
+    // "txid" since segwit ("hash" is the wtxid then), older nodes only
+    // have "hash" which is the txid
+    JsonNode jtxid = node["txid"];
+    if (jtxid.type() != Utilities::JS::type::Str) {
+      jtxid = node["hash"];
+    }
+    JsonNode jdata = node["data"];
+    txs->txids_.push_back(uint256S(jtxid.str()));
+    txs->txsHex_.append(jdata.start(), jdata.size());
   }
 
-  LOG(INFO) << "insert rawgbt: " << gbtHash.ToString() << ", txs: " << vtxs->size();
-  insertRawGbt(gbtHash, vtxs);
+  LOG(INFO) << "insert rawgbt: " << gbtHash.ToString() << ", txs: " << txs->txids_.size()
+  << ", size: " << txs->txsHex_.size() / 2
+  << ", decode time: " << (getMonotonicTimeUs() - startUs) << "us";
+  insertRawGbt(gbtHash, txs);
 }
 
 void BlockMaker::insertRawGbt(const uint256 &gbtHash,
-                              shared_ptr<vector<CTransactionRef>> vtxs) {
+                              shared_ptr<const GbtBlockTxs> txs) {
   ScopeLock ls(rawGbtLock_);
 
   // insert rawgbt
-  rawGbtMap_[gbtHash] = vtxs;
+  rawGbtMap_[gbtHash] = txs;
   rawGbtQ_.push_back(gbtHash);
 
   // remove rawgbt if need
@@ -234,6 +319,23 @@ void BlockMaker::insertRawGbt(const uint256 &gbtHash,
   }
 }
 
+shared_ptr<const GbtBlockTxs> BlockMaker::getRawGbt(uint64_t jobId) {
+  uint256 gbtHash;
+  {
+    ScopeLock sl(jobIdMapLock_);
+    if (jobId2GbtHash_.find(jobId) != jobId2GbtHash_.end()) {
+      gbtHash = jobId2GbtHash_[jobId];
+    }
+  }
+  ScopeLock ls(rawGbtLock_);
+  auto itr = rawGbtMap_.find(gbtHash);
+  if (itr == rawGbtMap_.end()) {
+    LOG(ERROR) << "can't find this gbthash in rawGbtMap_: " << gbtHash.ToString();
+    return nullptr;
+  }
+  return itr->second;
+}
+
 static
 string _buildAuxPow(const CBlock *block) {
   //
@@ -363,42 +465,20 @@ void BlockMaker::consumeNamecoinSovledShare(rd_kafka_message_t *rkmessage) {
   // coinbase tx, hex -> bin
   Hex2Bin(coinbaseTxHex.c_str(), coinbaseTxHex.length(), coinbaseTxBin);
 
-  // get gbtHash and rawgbt (vtxs)
-  uint256 gbtHash;
-  shared_ptr<vector<CTransactionRef>> vtxs;
-  {
-    ScopeLock sl(jobIdMapLock_);
-    if (jobId2GbtHash_.find(jobId) != jobId2GbtHash_.end()) {
-      gbtHash = jobId2GbtHash_[jobId];
-    }
-  }
-  {
-    ScopeLock ls(rawGbtLock_);
-    if (rawGbtMap_.find(gbtHash) == rawGbtMap_.end()) {
-      LOG(ERROR) << "can't find this gbthash in rawGbtMap_: " << gbtHash.ToString();
-      return;
-    }
-    vtxs = rawGbtMap_[gbtHash];
+  // get the txs of the gbt
+  shared_ptr<const GbtBlockTxs> txs = getRawGbt(jobId);
+  if (txs == nullptr) {
+    return;
   }
-  assert(vtxs.get() != nullptr);
 
   //
-  // build new block
+  // build new block, the txs are decoded only here for the merkle branch
   //
-  CBlock newblk(blkHeader);
-
-  // put coinbase tx
-  {
-    CSerializeData sdata;
-    sdata.insert(sdata.end(), coinbaseTxBin.begin(), coinbaseTxBin.end());
-    newblk.vtx.push_back(MakeTransactionRef());
-    CDataStream c(sdata, SER_NETWORK, PROTOCOL_VERSION);
-    c >> newblk.vtx[newblk.vtx.size() - 1];
-  }
-
-  // put other txs
-  if (vtxs->size()) {
-    newblk.vtx.insert(newblk.vtx.end(), vtxs->begin(), vtxs->end());
+  CBlock newblk;
+  if (!DecodeHexBlk(newblk, EncodeHexBlock(blkHeader, coinbaseTxBin,
+                                           txs->txids_.size(), txs->txsHex_))) {
+    LOG(ERROR) << "decode namecoin parent block failure";
+    return;
   }
 
   //
@@ -417,67 +497,56 @@ void BlockMaker::submitNamecoinBlockNonBlocking(const string &auxBlockHash,
                                                 const string &bitcoinBlockHash,
                                                 const string &rpcAddress,
                                                 const string &rpcUserpass) {
-  // use thread to submit
-  boost::thread t(boost::bind(&BlockMaker::_submitNamecoinBlockThread, this,
-                              auxBlockHash, auxPow, bitcoinBlockHash,
-                              rpcAddress, rpcUserpass));
+  // submit first
+  if (!executor_.post(PriorityExecutor::PRIORITY_HIGH,
+                      [=](size_t threadIdx) {
+                        _submitNamecoinBlockThread(auxBlockHash, auxPow,
+                                                   rpcAddress, rpcUserpass);
+                      })) {
+    LOG(ERROR) << "executor is full, submit namecoin block by a new thread";
+    boost::thread t(boost::bind(&BlockMaker::_submitNamecoinBlockThread, this,
+                                auxBlockHash, auxPow, rpcAddress, rpcUserpass));
+  }
+
+  //
+  // save to databse
+  //
+  const string nowStr = date("%F %T");
+  string sql;
+  sql = Strings::Format("INSERT INTO `found_nmc_blocks` "
+                        " (`bitcoin_block_hash`,`aux_block_hash`,"
+                        "  `aux_pow`,`created_at`) "
+                        " VALUES (\"%s\",\"%s\",\"%s\",\"%s\"); ",
+                        bitcoinBlockHash.c_str(),
+                        auxBlockHash.c_str(), auxPow.c_str(), nowStr.c_str());
+  executeSqlNonBlocking(sql);
 }
 
 void BlockMaker::_submitNamecoinBlockThread(const string &auxBlockHash,
                                             const string &auxPow,
-                                            const string &bitcoinBlockHash,
                                             const string &rpcAddress,
                                             const string &rpcUserpass) {
   //
   // request : submitauxblock <hash> <auxpow>
   //
-  {
-    const string request = Strings::Format("{\"id\":1,\"method\":\"submitauxblock\",\"params\":[\"%s\",\"%s\"]}",
-                                           auxBlockHash.c_str(),
-                                           auxPow.c_str());
-    DLOG(INFO) << "submitauxblock request: " << request;
-    // try N times
-    for (size_t i = 0; i < 3; i++) {
-      string response;
-      bool res = bitcoindRpcCall(rpcAddress.c_str(), rpcUserpass.c_str(),
-                                 request.c_str(), response);
-
-      // success
-      if (res == true) {
-        LOG(INFO) << "rpc call success, submit block response: " << response;
-        break;
-      }
-
-      // failure
-      LOG(ERROR) << "rpc call fail: " << response;
-    }
-  }
+  const string request = Strings::Format("{\"id\":1,\"method\":\"submitauxblock\",\"params\":[\"%s\",\"%s\"]}",
+                                         auxBlockHash.c_str(),
+                                         auxPow.c_str());
+  DLOG(INFO) << "submitauxblock request: " << request;
+  // try N times
+  for (size_t i = 0; i < 3; i++) {
+    string response;
+    bool res = bitcoindRpcCall(rpcAddress.c_str(), rpcUserpass.c_str(),
+                               request.c_str(), response);
 
-  //
-  // save to databse
-  //
-  {
-    const string nowStr = date("%F %T");
-    string sql;
-    sql = Strings::Format("INSERT INTO `found_nmc_blocks` "
-                          " (`bitcoin_block_hash`,`aux_block_hash`,"
-                          "  `aux_pow`,`created_at`) "
-                          " VALUES (\"%s\",\"%s\",\"%s\",\"%s\"); ",
-                          bitcoinBlockHash.c_str(),
-                          auxBlockHash.c_str(), auxPow.c_str(), nowStr.c_str());
-
-    // try connect to DB
-    MySQLConnection db(poolDB_);
-    for (size_t i = 0; i < 3; i++) {
-      if (db.ping())
-        break;
-      else
-        sleep(3);
+    // success
+    if (res == true) {
+      LOG(INFO) << "rpc call success, submit block response: " << response;
+      break;
     }
 
-    if (db.execute(sql) == false) {
-      LOG(ERROR) << "insert found block failure: " << sql;
-    }
+    // failure
+    LOG(ERROR) << "rpc call fail: " << response;
   }
 }
 
@@ -506,6 +575,7 @@ void BlockMaker::consumeSovledShare(rd_kafka_message_t *rkmessage) {
     return;
   }
 
+  const uint64_t recvTimeUs = getMonotonicTimeUs();
   LOG(INFO) << "received SolvedShare message, len: " << rkmessage->len;
 
   //
@@ -533,51 +603,32 @@ void BlockMaker::consumeSovledShare(rd_kafka_message_t *rkmessage) {
     memcpy((uint8_t *)&blkHeader, foundBlock.header80_, sizeof(CBlockHeader));
   }
 
-  // get gbtHash and rawgbt (vtxs)
-  uint256 gbtHash;
-  shared_ptr<vector<CTransactionRef>> vtxs;
-  {
-    ScopeLock sl(jobIdMapLock_);
-    if (jobId2GbtHash_.find(foundBlock.jobId_) != jobId2GbtHash_.end()) {
-      gbtHash = jobId2GbtHash_[foundBlock.jobId_];
-    }
-  }
-  {
-    ScopeLock ls(rawGbtLock_);
-    if (rawGbtMap_.find(gbtHash) == rawGbtMap_.end()) {
-      LOG(ERROR) << "can't find this gbthash in rawGbtMap_: " << gbtHash.ToString();
-      return;
-    }
-    vtxs = rawGbtMap_[gbtHash];
+  // get the txs of the gbt
+  shared_ptr<const GbtBlockTxs> txs = getRawGbt(foundBlock.jobId_);
+  if (txs == nullptr) {
+    return;
   }
-  assert(vtxs.get() != nullptr);
 
   //
-  // build new block
+  // build new block: header, coinbase tx and the serialized txs of gbt
   //
-  CBlock newblk(blkHeader);
+  const string blockHex = EncodeHexBlock(blkHeader, coinbaseTxBin,
+                                         txs->txids_.size(), txs->txsHex_);
 
-  // put coinbase tx
+  // submit to bitcoind
+  LOG(INFO) << "submit block: " << blkHeader.GetHash().ToString();
+  submitBlockNonBlocking(blockHex, recvTimeUs);  // using thread
+
+  uint64_t coinbaseValue = 0;
   {
     CSerializeData sdata;
     sdata.insert(sdata.end(), coinbaseTxBin.begin(), coinbaseTxBin.end());
-    newblk.vtx.push_back(MakeTransactionRef());
+    CMutableTransaction coinbaseTx;
     CDataStream c(sdata, SER_NETWORK, PROTOCOL_VERSION);
-    c >> newblk.vtx[newblk.vtx.size() - 1];
+    c >> coinbaseTx;
+    coinbaseValue = AMOUNT_SATOSHIS(CTransaction(coinbaseTx).GetValueOut());
   }
 
-  // put other txs
-  if (vtxs->size()) {
-    newblk.vtx.insert(newblk.vtx.end(), vtxs->begin(), vtxs->end());
-  }
-
-  // submit to bitcoind
-  LOG(INFO) << "submit block: " << newblk.GetHash().ToString();
-  const string blockHex = EncodeHexBlock(newblk);
-  submitBlockNonBlocking(blockHex);  // using thread
-
-  uint64_t coinbaseValue = AMOUNT_SATOSHIS(newblk.vtx[0]->GetValueOut());
-
   // save to DB, using thread
   saveBlockToDBNonBlocking(foundBlock, blkHeader,
                            coinbaseValue,  // coinbase value
@@ -588,14 +639,6 @@ void BlockMaker::saveBlockToDBNonBlocking(const FoundBlock &foundBlock,
                                           const CBlockHeader &header,
                                           const uint64_t coinbaseValue,
                                           const int32_t blksize) {
-  boost::thread t(boost::bind(&BlockMaker::_saveBlockToDBThread, this,
-                              foundBlock, header, coinbaseValue, blksize));
-}
-
-void BlockMaker::_saveBlockToDBThread(const FoundBlock &foundBlock,
-                                      const CBlockHeader &header,
-                                      const uint64_t coinbaseValue,
-                                      const int32_t blksize) {
   const string nowStr = date("%F %T");
   string sql;
   sql = Strings::Format("INSERT INTO `found_blocks` "
@@ -612,19 +655,26 @@ void BlockMaker::_saveBlockToDBThread(const FoundBlock &foundBlock,
                         coinbaseValue, blksize,
                         header.hashPrevBlock.ToString().c_str(),
                         header.nBits, header.nVersion, nowStr.c_str());
+  executeSqlNonBlocking(sql);
+}
 
-  // try connect to DB
-  MySQLConnection db(poolDB_);
-  for (size_t i = 0; i < 3; i++) {
-    if (db.ping())
-      break;
-    else
-      sleep(3);
+void BlockMaker::executeSqlNonBlocking(const string &sql) {
+  if (!executor_.post(PriorityExecutor::PRIORITY_LOW,
+                      [=](size_t threadIdx) { _executeSql(threadIdx, sql); })) {
+    LOG(ERROR) << "executor is full, retry the sql later: " << sql;
+    sqlRetryQueue_.push(sql);
   }
+}
+
+void BlockMaker::_executeSql(size_t threadIdx, const string &sql) {
+  MySQLConnection &db = *dbConns_[threadIdx];
 
-  if (db.execute(sql) == false) {
-    LOG(ERROR) << "insert found block failure: " << sql;
+  // the failed ones go first, keep the order
+  if (sqlRetryQueue_.size() == 0 && db.ping() && db.execute(sql)) {
+    return;
   }
+  LOG(ERROR) << "insert found block failure, retry it later: " << sql;
+  sqlRetryQueue_.push(sql);
 }
 
 bool BlockMaker::checkBitcoinds() {
@@ -641,37 +691,105 @@ bool BlockMaker::checkBitcoinds() {
   return true;
 }
 
-void BlockMaker::submitBlockNonBlocking(const string &blockHex) {
-  for (const auto &itr : bitcoindRpcUri_) {
-    // use thread to submit
+void BlockMaker::submitBlockNonBlocking(const string &blockHex,
+                                        uint64_t recvTimeUs) {
+  // the request is made once and sent to all bitcoinds
+  const string prefix = "{\"jsonrpc\":\"1.0\",\"id\":\"1\",\"method\":\"submitblock\",\"params\":[\"";
+  const string suffix = "\"]}";
+  auto request = std::make_shared<string>();
+  request->reserve(prefix.size() + blockHex.size() + suffix.size());
+  request->append(prefix).append(blockHex).append(suffix);
+
+  shared_ptr<const string> constRequest(request);
+  if (!executor_.post(PriorityExecutor::PRIORITY_HIGH,
+                      [=](size_t threadIdx) {
+                        _submitBlockThread(constRequest, recvTimeUs);
+                      })) {
+    LOG(ERROR) << "executor is full, submit block by a new thread";
     boost::thread t(boost::bind(&BlockMaker::_submitBlockThread, this,
-                                itr.first, itr.second, blockHex));
+                                constRequest, recvTimeUs));
   }
 }
 
-void BlockMaker::_submitBlockThread(const string &rpcAddress,
-                                    const string &rpcUserpass,
-                                    const string &blockHex) {
-  string request = "{\"jsonrpc\":\"1.0\",\"id\":\"1\",\"method\":\"submitblock\",\"params\":[\"";
-  request += blockHex + "\"]}";
+void BlockMaker::_submitBlockThread(shared_ptr<const string> request,
+                                    uint64_t recvTimeUs) {
+  LOG(INFO) << "submit block to " << submitBlockClients_.size() << " bitcoinds"
+  << ", solved share to submitblock: " << (getMonotonicTimeUs() - recvTimeUs) << "us";
+  DLOG(INFO) << "submitblock request: " << *request;
 
-  LOG(INFO) << "submit block to: " << rpcAddress;
-  DLOG(INFO) << "submitblock request: " << request;
-  // try N times
-  for (size_t i = 0; i < 3; i++) {
-    string response;
-    bool res = bitcoindRpcCall(rpcAddress.c_str(), rpcUserpass.c_str(),
-                               request.c_str(), response);
+  vector<RpcClient *> clients;
+  for (const auto &client : submitBlockClients_) {
+    clients.push_back(client.get());
+  }
 
+  // try N times, all bitcoinds at the same time
+  vector<bool> results;
+  vector<string> responses;
+  RpcClient::callAllRetry(clients, *request, 3, results, responses);
+
+  for (size_t j = 0; j < clients.size(); j++) {
     // success
-    if (res == true) {
-      LOG(INFO) << "rpc call success, submit block response: " << response;
-      break;
+    if (results[j]) {
+      LOG(INFO) << "rpc call success, submit block to: " << clients[j]->url()
+      << ", response: " << responses[j];
+      continue;
     }
 
     // failure
-    LOG(ERROR) << "rpc call fail: " << response;
+    LOG(ERROR) << "rpc call fail, submit block to: " << clients[j]->url()
+    << ", response: " << responses[j];
   }
+
+  LOG(INFO) << "solved share to submitblock done: "
+  << (getMonotonicTimeUs() - recvTimeUs) << "us";
+}
+
+void BlockMaker::runThreadHousekeeping() {
+  // a cheap call over the submitblock connections, so they are open
+  // when a block is found
+  const string request = "{\"jsonrpc\":\"1.0\",\"id\":\"1\",\"method\":\"getblockcount\",\"params\":[]}";
+  time_t lastStatsTime = time(nullptr);
+
+  while (running_) {
+    for (const auto &client : submitBlockClients_) {
+      const size_t alive = client->warmUp(kSubmitBlockConns_, request);
+      if (alive < kSubmitBlockConns_) {
+        LOG(WARNING) << "warm up submitblock connections of " << client->url()
+        << ", alive: " << alive << "/" << kSubmitBlockConns_;
+      }
+    }
+
+    // retry the failed inserts, one task at a time
+    if (sqlRetryQueue_.size() > 0 && !isSqlRetrying_.exchange(true)) {
+      const bool res = executor_.post(PriorityExecutor::PRIORITY_LOW,
+                                      [this](size_t threadIdx) {
+        const size_t left = sqlRetryQueue_.retry(*dbConns_[threadIdx]);
+        if (left > 0) {
+          LOG(WARNING) << "sql left to retry: " << left;
+        }
+        isSqlRetrying_ = false;
+      });
+      if (!res) {
+        isSqlRetrying_ = false;
+      }
+    }
+
+    if (time(nullptr) >= lastStatsTime + kStatsInterval_) {
+      for (const auto &client : submitBlockClients_) {
+        LOG(INFO) << "submitblock rpc: " << client->toString();
+        client->resetStats();
+      }
+      LOG(INFO) << "executor: " << executor_.toString()
+      << ", sql to retry: " << sqlRetryQueue_.size();
+      executor_.resetStats();
+      lastStatsTime = time(nullptr);
+    }
+
+    for (time_t i = 0; i < kHousekeepingInterval_ && running_; i++) {
+      sleep(1);
+    }
+  }
+  LOG(INFO) << "stop thread housekeeping";
 }
 
 void BlockMaker::consumeStratumJob(rd_kafka_message_t *rkmessage) {
@@ -702,8 +820,8 @@ void BlockMaker::consumeStratumJob(rd_kafka_message_t *rkmessage) {
   LOG(INFO) << "received StratumJob message, len: " << rkmessage->len;
 
   StratumJob *sjob = new StratumJob();
-  bool res = sjob->unserializeFromJson((const char *)rkmessage->payload,
-                                       rkmessage->len);
+  bool res = sjob->unserialize((const char *)rkmessage->payload,
+                               rkmessage->len);
   if (res == false) {
     LOG(ERROR) << "unserialize stratum job fail";
     delete sjob;
@@ -799,7 +917,14 @@ void BlockMaker::runThreadConsumeNamecoinSovledShare() {
 void BlockMaker::submitRskBlockPartialMerkleNonBlocking(const string &rpcAddress, const string &rpcUserPwd, const string &blockHashHex, 
                                                         const string &blockHeaderHex, const string &coinbaseHex, const string &merkleHashesHex, 
                                                         const string &totalTxCount) {
-  boost::thread t(boost::bind(&BlockMaker::_submitRskBlockPartialMerkleThread, this, rpcAddress, rpcUserPwd, blockHashHex, blockHeaderHex, coinbaseHex, merkleHashesHex, totalTxCount));
+  if (!executor_.post(PriorityExecutor::PRIORITY_HIGH,
+                      [=](size_t threadIdx) {
+                        _submitRskBlockPartialMerkleThread(rpcAddress, rpcUserPwd, blockHashHex, blockHeaderHex,
+                                                           coinbaseHex, merkleHashesHex, totalTxCount);
+                      })) {
+    LOG(ERROR) << "executor is full, submit RSK block by a new thread";
+    boost::thread t(boost::bind(&BlockMaker::_submitRskBlockPartialMerkleThread, this, rpcAddress, rpcUserPwd, blockHashHex, blockHeaderHex, coinbaseHex, merkleHashesHex, totalTxCount));
+  }
 }
 
 void BlockMaker::_submitRskBlockPartialMerkleThread(const string &rpcAddress, const string &rpcUserPwd, const string &blockHashHex, 
@@ -878,28 +1003,15 @@ void BlockMaker::consumeRskSolvedShare(rd_kafka_message_t *rkmessage) {
 
   LOG(INFO) << "submit RSK block: " << blkHeader.GetHash().ToString();
   
-  // get gbtHash and rawgbt (vtxs)
-  uint256 gbtHash;
-  shared_ptr<vector<CTransactionRef>> vtxs;
-  {
-    ScopeLock sl(jobIdMapLock_);
-    if (jobId2GbtHash_.find(shareData.jobId_) != jobId2GbtHash_.end()) {
-      gbtHash = jobId2GbtHash_[shareData.jobId_];
-    }
-  }
-  {
-    ScopeLock ls(rawGbtLock_);
-    if (rawGbtMap_.find(gbtHash) == rawGbtMap_.end()) {
-      LOG(ERROR) << "can't find this gbthash in rawGbtMap_: " << gbtHash.ToString();
-      return;
-    }
-    vtxs = rawGbtMap_[gbtHash];
+  // get the txs of the gbt
+  shared_ptr<const GbtBlockTxs> txs = getRawGbt(shareData.jobId_);
+  if (txs == nullptr) {
+    return;
   }
-  assert(vtxs.get() != nullptr);
 
 
   vector<uint256> vtxhashes;
-  vtxhashes.resize(1 + vtxs->size()); // coinbase + gbt txs
+  vtxhashes.resize(1 + txs->txids_.size()); // coinbase + gbt txs
 
   // put coinbase tx hash
   {
@@ -914,8 +1026,8 @@ void BlockMaker::consumeRskSolvedShare(rd_kafka_message_t *rkmessage) {
   }
 
   // put other tx hashes
-  for (size_t i = 0; i < vtxs->size(); i++) {
-    vtxhashes[i + 1] = (*vtxs)[i]->GetHash(); // vtxs is a shared_ptr<vector<CTransactionRef>>
+  for (size_t i = 0; i < txs->txids_.size(); i++) {
+    vtxhashes[i + 1] = txs->txids_[i];
   }
 
   string blockHashHex = blkHeader.GetHash().ToString();
@@ -1001,6 +1113,7 @@ void BlockMaker::run() {
   threadConsumeStratumJob_  = thread(&BlockMaker::runThreadConsumeStratumJob, this);
   threadConsumeNamecoinSovledShare_ = thread(&BlockMaker::runThreadConsumeNamecoinSovledShare, this);
   threadConsumeRskSolvedShare_ = thread(&BlockMaker::runThreadConsumeRskSolvedShare, this);
+  threadHousekeeping_       = thread(&BlockMaker::runThreadHousekeeping,      this);
   sleep(3);
 
   runThreadConsumeSovledShare();
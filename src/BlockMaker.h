@@ -27,6 +27,8 @@
 #include "Common.h"
 #include "Kafka.h"
 #include "MySQLConnection.h"
+#include "PriorityExecutor.h"
+#include "RpcClient.h"
 #include "Stratum.h"
 
 #include <deque>
@@ -42,6 +44,13 @@
 
 namespace bpt = boost::posix_time;
 
+// the txs of a gbt after the coinbase tx, already serialized as they are in
+// the block, so a found block is just put together, see EncodeHexBlock()
+struct GbtBlockTxs {
+  vector<uint256> txids_;  // for the merkle proof of RSK
+  string txsHex_;
+};
+
 ////////////////////////////////// BlockMaker //////////////////////////////////
 class BlockMaker {
   atomic<bool> running_;
@@ -50,8 +59,10 @@ class BlockMaker {
   size_t kMaxRawGbtNum_;  // how many rawgbt should we keep
   // key: gbthash
   std::deque<uint256> rawGbtQ_;
-  // key: gbthash, value: block template json
-  std::map<uint256, shared_ptr<vector<CTransactionRef> > > rawGbtMap_;
+  // key: gbthash, value: txs of the block template
+  std::map<uint256, shared_ptr<const GbtBlockTxs> > rawGbtMap_;
+  // compact RawGbt, the decoder keeps the raw txs by txid
+  RawGbtDecoder rawGbtDecoder_;
 
   mutex jobIdMapLock_;
   size_t kMaxStratumJobNum_;
@@ -70,22 +81,39 @@ class BlockMaker {
   // submit new block to bitcoind
   // pair: <RpcAddress, RpcUserpass>
   std::vector<std::pair<string, string>> bitcoindRpcUri_;
+  // connections only for submitblock, kept alive and warm
+  std::vector<shared_ptr<RpcClient>> submitBlockClients_;
+  const size_t kSubmitBlockConns_;     // warm connections of each bitcoind
+  const time_t kHousekeepingInterval_; // seconds
+  const time_t kStatsInterval_;        // seconds
 
   MysqlConnectInfo poolDB_;      // save blocks to table.found_blocks
+  // DB connection of each executor thread which runs low priority tasks,
+  // opened by the thread when it's used
+  vector<shared_ptr<MySQLConnection>> dbConns_;
+  // inserts failed, retried by the housekeeping thread
+  DurableSqlQueue sqlRetryQueue_;
+  atomic<bool> isSqlRetrying_;
+
+  // submitting blocks (high priority) and writing DB (low priority)
+  PriorityExecutor executor_;
 
-  void insertRawGbt(const uint256 &gbtHash,
-                    shared_ptr<vector<CTransactionRef>> vtxs);
+  void insertRawGbt(const uint256 &gbtHash, shared_ptr<const GbtBlockTxs> txs);
+  shared_ptr<const GbtBlockTxs> getRawGbt(uint64_t jobId);
 
   thread threadConsumeRawGbt_;
   thread threadConsumeStratumJob_;
   thread threadConsumeNamecoinSovledShare_;
   thread threadConsumeRskSolvedShare_;
+  thread threadHousekeeping_;
 
   void runThreadConsumeRawGbt();
   void runThreadConsumeSovledShare();
   void runThreadConsumeStratumJob();
   void runThreadConsumeNamecoinSovledShare();
   void runThreadConsumeRskSolvedShare();
+  // warm up the submitblock connections, retry the failed inserts
+  void runThreadHousekeeping();
 
   void consumeRawGbt     (rd_kafka_message_t *rkmessage);
   void consumeStratumJob (rd_kafka_message_t *rkmessage);
@@ -94,17 +122,17 @@ class BlockMaker {
   void consumeRskSolvedShare(rd_kafka_message_t *rkmessage);
 
   void addRawgbt(const char *str, size_t len);
+  void addCompactRawgbt(const char *str, size_t len);
 
   void saveBlockToDBNonBlocking(const FoundBlock &foundBlock,
                                 const CBlockHeader &header,
                                 const uint64_t coinbaseValue, const int32_t blksize);
-  void _saveBlockToDBThread(const FoundBlock &foundBlock,
-                            const CBlockHeader &header,
-                            const uint64_t coinbaseValue, const int32_t blksize);
+  void executeSqlNonBlocking(const string &sql);
+  void _executeSql(size_t threadIdx, const string &sql);
 
-  void submitBlockNonBlocking(const string &blockHex);
-  void _submitBlockThread(const string &rpcAddress, const string &rpcUserpass,
-                          const string &blockHex);
+  // recvTimeUs: when the solved share was received, monotonic time
+  void submitBlockNonBlocking(const string &blockHex, uint64_t recvTimeUs);
+  void _submitBlockThread(shared_ptr<const string> request, uint64_t recvTimeUs);
   bool checkBitcoinds();
 
   void submitNamecoinBlockNonBlocking(const string &auxBlockHash,
@@ -114,7 +142,6 @@ class BlockMaker {
                                       const string &rpcUserpass);
   void _submitNamecoinBlockThread(const string &auxBlockHash,
                                   const string &auxPow,
-                                  const string &bitcoinBlockHash,
                                   const string &rpcAddress,
                                   const string &rpcUserpass);
 
@@ -135,7 +162,8 @@ class BlockMaker {
   bool submitToRskNode();
 
 public:
-  BlockMaker(const char *kafkaBrokers, const MysqlConnectInfo &poolDB);
+  BlockMaker(const char *kafkaBrokers, const MysqlConnectInfo &poolDB,
+             const string &sqlRetryFile);
   ~BlockMaker();
 
   void addBitcoind(const string &rpcAddress, const string &rpcUserpass);
@@ -28,9 +28,13 @@
 #include <util.h>
 #include <utilstrencodings.h>
 
+#include <cinttypes>
+
 #include "Utils.h"
+#include "RpcClient.h"
 #include "utilities_js.hpp"
 #include "hash.h"
+#include "BitcoinUtils.h"
 
 //
 // bitcoind zmq pub msg type: "hashblock", "hashtx", "rawblock", "rawtx"
@@ -49,13 +53,16 @@
 GbtMaker::GbtMaker(const string &zmqBitcoindAddr,
                    const string &bitcoindRpcAddr, const string &bitcoindRpcUserpass,
                    const string &kafkaBrokers, uint32_t kRpcCallInterval,
-                   bool isCheckZmq)
+                   bool isCheckZmq, bool isCompactRawGbt,
+                   bool isEmptyGbtFastPath)
 : running_(true), zmqContext_(1/*i/o threads*/),
 zmqBitcoindAddr_(zmqBitcoindAddr), bitcoindRpcAddr_(bitcoindRpcAddr),
 bitcoindRpcUserpass_(bitcoindRpcUserpass), lastGbtMakeTime_(0), kRpcCallInterval_(kRpcCallInterval),
 kafkaBrokers_(kafkaBrokers),
 kafkaProducer_(kafkaBrokers_.c_str(), KAFKA_TOPIC_RAWGBT, 0/* partition */),
-isCheckZmq_(isCheckZmq)
+isCheckZmq_(isCheckZmq), isCompactRawGbt_(isCompactRawGbt),
+isEmptyGbtFastPath_(isEmptyGbtFastPath), lastGbtVersion_(0),
+lastLatencyStatsTime_(time(nullptr))
 {
 }
 
@@ -127,8 +134,15 @@ void GbtMaker::stop() {
   LOG(INFO) << "stop gbtmaker";
 }
 
-void GbtMaker::kafkaProduceMsg(const void *payload, size_t len) {
-  kafkaProducer_.produce(payload, len);
+bool GbtMaker::kafkaProduceMsg(const void *payload, size_t len) {
+  if (kafkaProducer_.produce(payload, len)) {
+    return true;
+  }
+  if (isCompactRawGbt_) {
+    // the consumers miss the txs of the dropped message, don't reference them
+    rawGbtEncoder_.forceFull();
+  }
+  return false;
 }
 
 bool GbtMaker::bitcoindRpcGBT(string &response) {
@@ -177,6 +191,22 @@ string GbtMaker::makeRawGbtMsg() {
   << ", version: " << r["result"]["version"].uint32()
   << "|0x" << Strings::Format("%08x", r["result"]["version"].uint32())
   << ", gbthash: " << gbtHash.ToString();
+  lastGbtVersion_ = r["result"]["version"].uint32();
+
+  return packRawGbtMsg(gbt, r, gbtHash);
+}
+
+string GbtMaker::packRawGbtMsg(const string &gbt, JsonNode &r,
+                               const uint256 &gbtHash) {
+  if (isCompactRawGbt_) {
+    string msg;
+    JsonNode jgbt = r["result"];
+    if (!rawGbtEncoder_.encode(gbt, jgbt, gbtHash, (uint32_t)time(nullptr), msg)) {
+      LOG(ERROR) << "make compact rawgbt failure";
+      return "";
+    }
+    return msg;
+  }
 
   return Strings::Format("{\"created_at_ts\":%u,"
                          "\"block_template_base64\":\"%s\","
@@ -189,24 +219,116 @@ string GbtMaker::makeRawGbtMsg() {
 //                         gbtHash.ToString().c_str());
 }
 
-void GbtMaker::submitRawGbtMsg(bool checkTime) {
+//
+// the template of an empty block on the new block, like the one the Watcher
+// makes from the stratum job of other pools. The block header is all we
+// need, except the bits which we know only when it is not adjusted.
+//
+string GbtMaker::makeEmptyGbt(const string &blockHash, const string &blockHeader,
+                              uint32_t version, uint32_t now) {
+  JsonNode r;
+  if (!JsonNode::parse(blockHeader.c_str(), blockHeader.c_str() + blockHeader.length(), r) ||
+      r["result"].type()               != Utilities::JS::type::Obj ||
+      r["result"]["height"].type()     != Utilities::JS::type::Int ||
+      r["result"]["bits"].type()       != Utilities::JS::type::Str ||
+      r["result"]["mediantime"].type() != Utilities::JS::type::Int) {
+    LOG(ERROR) << "getblockheader check fields failure: " << blockHeader;
+    return "";
+  }
+  JsonNode jheader = r["result"];
+
+  const int32_t height = jheader["height"].int32() + 1;
+  const Consensus::Params &consensus = Params().GetConsensus();
+  if (consensus.fPowAllowMinDifficultyBlocks ||
+      height % consensus.DifficultyAdjustmentInterval() == 0) {
+    LOG(INFO) << "bits of height " << height << " is unknown, skip empty gbt";
+    return "";
+  }
+
+  // must be later than the median time past of the last 11 blocks
+  const uint32_t minTime = jheader["mediantime"].uint32() + 1;
+  const uint32_t curTime = std::max(now, minTime);
+
+  string gbt;
+  gbt += Strings::Format("{\"result\":{");
+  gbt += Strings::Format("\"previousblockhash\":\"%s\"", blockHash.c_str());
+  gbt += Strings::Format(",\"height\":%d", height);
+  gbt += Strings::Format(",\"coinbasevalue\":%" PRId64"",
+                         GetBlockSubsidy(height, consensus));
+  gbt += Strings::Format(",\"bits\":\"%s\"", jheader["bits"].str().c_str());
+  gbt += Strings::Format(",\"mintime\":%" PRIu32"", minTime);
+  gbt += Strings::Format(",\"curtime\":%" PRIu32"", curTime);
+  gbt += Strings::Format(",\"version\":%" PRIu32"", version);
+  gbt += Strings::Format(",\"transactions\":[]");  // empty transactions
+  gbt += Strings::Format("}}");
+  return gbt;
+}
+
+string GbtMaker::makeEmptyRawGbtMsg(const string &blockHash) {
+#ifdef CHAIN_TYPE_BCH
+  // the difficulty is adjusted every block
+  return "";
+#else
+  if (lastGbtVersion_ == 0) {
+    LOG(WARNING) << "no gbt yet, skip empty gbt";
+    return "";
+  }
+
+  const string request = Strings::Format("{\"jsonrpc\":\"1.0\",\"id\":\"1\","
+                                         "\"method\":\"getblockheader\",\"params\":[\"%s\"]}",
+                                         blockHash.c_str());
+  string response;
+  if (!bitcoindRpcCall(bitcoindRpcAddr_.c_str(), bitcoindRpcUserpass_.c_str(),
+                       request.c_str(), response)) {
+    LOG(ERROR) << "bitcoind rpc getblockheader failure";
+    return "";
+  }
+  const string gbt = makeEmptyGbt(blockHash, response, lastGbtVersion_,
+                                  (uint32_t)time(nullptr));
+  if (gbt.empty()) {
+    return "";
+  }
+  LOG(INFO) << "empty gbt: " << gbt;
+
+  JsonNode rgbt;
+  JsonNode::parse(gbt.c_str(), gbt.c_str() + gbt.length(), rgbt);
+  return packRawGbtMsg(gbt, rgbt, Hash(gbt.begin(), gbt.end()));
+#endif
+}
+
+bool GbtMaker::submitRawGbtMsg(bool checkTime) {
   ScopeLock sl(lock_);
 
   if (checkTime &&
       lastGbtMakeTime_ + kRpcCallInterval_ > time(nullptr)) {
-    return;
+    return false;
   }
 
   const string rawGbtMsg = makeRawGbtMsg();
   if (rawGbtMsg.length() == 0) {
     LOG(ERROR) << "get rawgbt failure";
-    return;
+    return false;
   }
   lastGbtMakeTime_ = (uint32_t)time(nullptr);
 
   // submit to Kafka
   LOG(INFO) << "sumbit to Kafka, msg len: " << rawGbtMsg.length();
   kafkaProduceMsg(rawGbtMsg.c_str(), rawGbtMsg.length());
+  return true;
+}
+
+bool GbtMaker::submitEmptyRawGbtMsg(const string &blockHash) {
+  ScopeLock sl(lock_);
+
+  const string rawGbtMsg = makeEmptyRawGbtMsg(blockHash);
+  if (rawGbtMsg.length() == 0) {
+    return false;
+  }
+
+  // submit to Kafka
+  LOG(INFO) << "sumbit empty gbt to Kafka, msg len: " << rawGbtMsg.length();
+  kafkaProduceMsg(rawGbtMsg.c_str(), rawGbtMsg.length());
+  return true;
 }
 
 void GbtMaker::threadListenBitcoind() {
@@ -215,21 +337,24 @@ void GbtMaker::threadListenBitcoind() {
   subscriber.setsockopt(ZMQ_SUBSCRIBE,
                         BITCOIND_ZMQ_HASHBLOCK, strlen(BITCOIND_ZMQ_HASHBLOCK));
 
+  zmq::pollitem_t pollItems[] = {{(void *)subscriber, 0, ZMQ_POLLIN, 0}};
+
   while (running_) {
     zmq::message_t zType, zContent, zSequence;
     try {
-      // if we use block mode, can't quit this thread
-      if (subscriber.recv(&zType, ZMQ_DONTWAIT) == false) {
-        if (!running_) { break; }
-        usleep(20000);  // so we sleep and try again
+      // if we block in recv, can't quit this thread, so wait with a timeout
+      zmq::poll(pollItems, 1, 500/* ms */);
+      if ((pollItems[0].revents & ZMQ_POLLIN) == 0) {
         continue;
       }
+      subscriber.recv(&zType);
       subscriber.recv(&zContent);
       subscriber.recv(&zSequence);
     } catch (std::exception & e) {
       LOG(ERROR) << "bitcoind zmq recv exception: " << e.what();
       break;  // break big while
     }
+    const uint64_t recvTimeUs = getMonotonicTimeUs();
     const string type     = std::string(static_cast<char*>(zType.data()),     zType.size());
     const string content  = std::string(static_cast<char*>(zContent.data()),  zContent.size());
     const string sequence = std::string(static_cast<char*>(zSequence.data()), zSequence.size());
@@ -241,6 +366,13 @@ void GbtMaker::threadListenBitcoind() {
       string sequenceHex;
       Bin2Hex((const uint8 *)sequence.data(), sequence.size(), sequenceHex);
       LOG(INFO) << ">>>> bitcoind recv hashblock: " << hashHex << ", sequence: " << sequenceHex << " <<<<";
+
+      // miners could work on an empty block while bitcoind makes the template
+      if (isEmptyGbtFastPath_ && submitEmptyRawGbtMsg(hashHex)) {
+        const uint64_t latencyUs = getMonotonicTimeUs() - recvTimeUs;
+        emptyGbtLatency_.add(latencyUs);
+        LOG(INFO) << "zmq to empty gbt: " << latencyUs << "us";
+      }
     }
     else
     {
@@ -250,7 +382,11 @@ void GbtMaker::threadListenBitcoind() {
     // sometimes will decode zmq message fail, no matter what it is, we just
     // call gbt again
     LOG(INFO) << "get zmq message, call rpc getblocktemplate";
-    submitRawGbtMsg(false);
+    if (submitRawGbtMsg(false)) {
+      const uint64_t latencyUs = getMonotonicTimeUs() - recvTimeUs;
+      fullGbtLatency_.add(latencyUs);
+      LOG(INFO) << "zmq to gbt: " << latencyUs << "us";
+    }
 
   } /* /while */
 
@@ -264,6 +400,18 @@ void GbtMaker::run() {
   while (running_) {
     sleep(1);
     submitRawGbtMsg(true);
+
+    if (time(nullptr) >= lastLatencyStatsTime_ + kLatencyStatsInterval_) {
+      LOG(INFO) << "zmq to empty gbt latency: " << emptyGbtLatency_.toString();
+      LOG(INFO) << "zmq to gbt latency: " << fullGbtLatency_.toString();
+      emptyGbtLatency_.reset();
+      fullGbtLatency_.reset();
+
+      shared_ptr<RpcClient> rpcClient = RpcClient::get(bitcoindRpcAddr_, bitcoindRpcUserpass_);
+      LOG(INFO) << "bitcoind rpc: " << rpcClient->toString();
+      rpcClient->resetStats();
+      lastLatencyStatsTime_ = time(nullptr);
+    }
   }
 
   if (threadListenBitcoind.joinable())
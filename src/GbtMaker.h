@@ -26,6 +26,7 @@
 
 #include "Common.h"
 #include "Kafka.h"
+#include "Stratum.h"
 
 #include "zmq.hpp"
 
@@ -47,25 +48,48 @@ class GbtMaker {
   KafkaProducer kafkaProducer_;
   bool isCheckZmq_;
 
+  // send RawGbt in the compact format, see CompactGbt
+  bool isCompactRawGbt_;
+  RawGbtEncoder rawGbtEncoder_;
+
+  // on a new block, send an empty block template made from the block
+  // header before calling getblocktemplate
+  bool isEmptyGbtFastPath_;
+  uint32_t lastGbtVersion_;  // version of the latest gbt
+
+  // zmq hashblock -> RawGbt produced
+  LatencyHistogram emptyGbtLatency_;
+  LatencyHistogram fullGbtLatency_;
+  time_t lastLatencyStatsTime_;
+  static const time_t kLatencyStatsInterval_ = 3600;
+
   bool checkBitcoindZMQ();
   bool bitcoindRpcGBT(string &resp);
   string makeRawGbtMsg();
+  string makeEmptyRawGbtMsg(const string &blockHash);
+  string packRawGbtMsg(const string &gbt, JsonNode &r, const uint256 &gbtHash);
 
-  void submitRawGbtMsg(bool checkTime);
+  bool submitRawGbtMsg(bool checkTime);
+  bool submitEmptyRawGbtMsg(const string &blockHash);
   void threadListenBitcoind();
 
-  void kafkaProduceMsg(const void *payload, size_t len);
+  bool kafkaProduceMsg(const void *payload, size_t len);
 
 public:
   GbtMaker(const string &zmqBitcoindAddr,
            const string &bitcoindRpcAddr, const string &bitcoindRpcUserpass,
            const string &kafkaBrokers, uint32_t kRpcCallInterval,
-           bool isCheckZmq);
+           bool isCheckZmq, bool isCompactRawGbt, bool isEmptyGbtFastPath);
   ~GbtMaker();
 
   bool init();
   void stop();
   void run();
+
+  // the gbt json of an empty block on blockHash, made from the getblockheader
+  // response of it. "" if the bits of the block are unknown
+  static string makeEmptyGbt(const string &blockHash, const string &blockHeader,
+                             uint32_t version, uint32_t now);
 };
 
 
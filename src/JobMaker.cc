@@ -49,7 +49,8 @@ JobMaker::JobMaker(const string &kafkaBrokers,  uint32_t stratumJobInterval,
                    const string &payoutAddr, uint32_t gbtLifeTime,
                    uint32_t emptyGbtLifeTime, const string &fileLastJobTime,
                    uint32_t mergedMiningNotifyPolicy, uint32_t blockVersion,
-                   const string &poolCoinbaseInfo, uint8_t serverId):
+                   const string &poolCoinbaseInfo, uint8_t serverId,
+                   bool isStratumJobBinary, bool isVerifyGbtTxids):
 serverId_(serverId), running_(true),
 kafkaBrokers_(kafkaBrokers),
 kafkaProducer_(kafkaBrokers_.c_str(), KAFKA_TOPIC_STRATUM_JOB, RD_KAFKA_PARTITION_UA/* partition */),
@@ -64,16 +65,23 @@ stratumJobInterval_(stratumJobInterval),
 poolCoinbaseInfo_(poolCoinbaseInfo), poolPayoutAddrStr_(payoutAddr),
 kGbtLifeTime_(gbtLifeTime), kEmptyGbtLifeTime_(emptyGbtLifeTime),
 fileLastJobTime_(fileLastJobTime),
-blockVersion_(blockVersion)
+blockVersion_(blockVersion),
+isStratumJobBinary_(isStratumJobBinary),
+isVerifyGbtTxids_(isVerifyGbtTxids), isDecodeGbtTxs_(false),
+rawGbtDecoder_(isVerifyGbtTxids), gbtTemplateKey_(0), lastJobStatsTime_(time(nullptr))
 {
 	LOG(INFO) << "Block Version: " << std::hex << blockVersion_;
 	LOG(INFO) << "Coinbase Info: " << poolCoinbaseInfo_;
   LOG(INFO) << "Payout Address: " << poolPayoutAddrStr_;
+  LOG(INFO) << "StratumJob Format: " << (isStratumJobBinary_ ? "binary" : "json");
+  LOG(INFO) << "Verify GBT Txids: " << (isVerifyGbtTxids_ ? "yes" : "no");
 }
 
 JobMaker::~JobMaker() {
   if (threadConsumeNmcAuxBlock_.joinable())
     threadConsumeNmcAuxBlock_.join();
+  if (threadVerifyGbtTxids_.joinable())
+    threadVerifyGbtTxids_.join();
 }
 
 void JobMaker::stop() {
@@ -456,6 +464,11 @@ void JobMaker::run() {
   // start Rsk RawGw consumer thread
   threadConsumeRskRawGw_ = thread(&JobMaker::runThreadConsumeRawGw, this);
 
+  // start gbt txids verifier thread
+  if (isVerifyGbtTxids_) {
+    threadVerifyGbtTxids_ = thread(&JobMaker::runThreadVerifyGbtTxids, this);
+  }
+
   const int32_t timeoutMs = 1000;
 
   while (running_) {
@@ -472,20 +485,65 @@ void JobMaker::run() {
   } /* /while */
 }
 
-void JobMaker::addRawgbt(const char *str, size_t len) {
-  JsonNode r;
-  if (!JsonNode::parse(str, str + len, r)) {
-    LOG(ERROR) << "parse rawgbt message to json fail";
-    return;
+void JobMaker::runThreadVerifyGbtTxids() {
+  LOG(INFO) << "start gbt txids verifier thread";
+
+  while (running_) {
+    string gbt;
+    {
+      ScopeLock sl(verifyGbtLock_);
+      gbt.swap(verifyGbt_);
+    }
+    if (gbt.empty()) {
+      usleep(100000);
+      continue;
+    }
+
+    const uint64_t startUs = getMonotonicTimeUs();
+    if (!StratumJob::verifyGbtTxids(gbt.data(), gbt.size())) {
+      LOG(ERROR) << "txids in gbt are wrong, decode the txs of gbt from now on";
+      isDecodeGbtTxs_ = true;
+      break;
+    }
+    LOG(INFO) << "gbt txids verified in " << (getMonotonicTimeUs() - startUs) << "us";
   }
-  if (r["created_at_ts"].type()         != Utilities::JS::type::Int ||
-      r["block_template_base64"].type() != Utilities::JS::type::Str ||
-      r["gbthash"].type()               != Utilities::JS::type::Str) {
-    LOG(ERROR) << "invalid rawgbt: missing fields";
-    return;
+
+  LOG(INFO) << "stop gbt txids verifier thread";
+}
+
+void JobMaker::addRawgbt(const char *str, size_t len) {
+  const uint64_t recvTimeUs = getMonotonicTimeUs();
+
+  uint256 gbtHash;
+  uint32_t gbtTime = 0;
+  string gbt;
+  if (CompactGbt::isCompactFormat(str, len)) {
+    // the txs are needed only to verify the txids
+    CompactGbt cgbt;
+    if (!rawGbtDecoder_.decode(str, len, cgbt)) {
+      LOG(ERROR) << "decode compact rawgbt fail";
+      return;
+    }
+    gbtHash = cgbt.gbtHash_;
+    gbtTime = cgbt.createdAt_;
+    gbt     = cgbt.toGbt();
+  } else {
+    JsonNode r;
+    if (!JsonNode::parse(str, str + len, r)) {
+      LOG(ERROR) << "parse rawgbt message to json fail";
+      return;
+    }
+    if (r["created_at_ts"].type()         != Utilities::JS::type::Int ||
+        r["block_template_base64"].type() != Utilities::JS::type::Str ||
+        r["gbthash"].type()               != Utilities::JS::type::Str) {
+      LOG(ERROR) << "invalid rawgbt: missing fields";
+      return;
+    }
+    gbtHash = uint256S(r["gbthash"].str());
+    gbtTime = r["created_at_ts"].uint32();
+    gbt     = DecodeBase64(r["block_template_base64"].str());
   }
 
-  const uint256 gbtHash = uint256S(r["gbthash"].str());
   for (const auto &itr : lastestGbtHash_) {
     if (gbtHash == itr) {
       LOG(ERROR) << "duplicate gbt hash: " << gbtHash.ToString();
@@ -493,7 +551,6 @@ void JobMaker::addRawgbt(const char *str, size_t len) {
     }
   }
 
-  const uint32_t gbtTime = r["created_at_ts"].uint32();
   const int64_t timeDiff = (int64_t)time(nullptr) - (int64_t)gbtTime;
   if (labs(timeDiff) >= 60) {
     LOG(WARNING) << "rawgbt diff time is more than 60, ignore it";
@@ -503,7 +560,6 @@ void JobMaker::addRawgbt(const char *str, size_t len) {
     LOG(WARNING) << "rawgbt diff time is too large: " << timeDiff << " seconds";
   }
 
-  const string gbt = DecodeBase64(r["block_template_base64"].str());
   assert(gbt.length() > 64);  // valid gbt string's len at least 64 bytes
 
   JsonNode nodeGbt;
@@ -517,6 +573,11 @@ void JobMaker::addRawgbt(const char *str, size_t len) {
   assert(nodeGbt["result"]["transactions"].type() == Utilities::JS::type::Array);
   const bool isEmptyBlock = nodeGbt["result"]["transactions"].array().size() == 0;
 
+  const uint64_t decodeUs = getMonotonicTimeUs() - recvTimeUs;
+  rawGbtDecodeLatency_.add(decodeUs);
+  LOG(INFO) << "decode rawgbt: " << decodeUs << "us, msg len: " << len
+  << ", gbt len: " << gbt.length();
+
   {
     ScopeLock sl(lock_);
 
@@ -542,11 +603,17 @@ void JobMaker::addRawgbt(const char *str, size_t len) {
     const uint64_t key = makeGbtKey(gbtTime, isEmptyBlock, height);
     if (rawgbtMap_.find(key) == rawgbtMap_.end()) {
       rawgbtMap_.insert(std::make_pair(key, gbt));
+      rawgbtRecvTimeUs_[key] = recvTimeUs;
     } else {
       LOG(ERROR) << "key already exist in rawgbtMap: " << key;
     }
   }
 
+  if (isVerifyGbtTxids_ && !isDecodeGbtTxs_ && !isEmptyBlock) {
+    ScopeLock sl(verifyGbtLock_);
+    verifyGbt_ = gbt;  // only the latest one
+  }
+
   lastestGbtHash_.push_back(gbtHash);
   while (lastestGbtHash_.size() > 20) {
     lastestGbtHash_.pop_front();
@@ -584,12 +651,14 @@ void JobMaker::clearTimeoutGbt() {
       ", height:" << height << ", isEmptyBlock:" << (isEmpty ? 1 : 0);
 
       // c++11: returns an iterator to the next element in the map
+      rawgbtRecvTimeUs_.erase(itr->first);
       itr = rawgbtMap_.erase(itr);
     }
   }
 }
 
-void JobMaker::sendStratumJob(const char *gbt, bool isMergedMiningUpdate) {
+void JobMaker::sendStratumJob(uint64_t gbtKey, const string &gbt,
+                              bool isMergedMiningUpdate, uint64_t gbtRecvTimeUs) {
   string latestNmcAuxBlockJson;
   {
     ScopeLock sl(auxJsonlock_);
@@ -604,17 +673,47 @@ void JobMaker::sendStratumJob(const char *gbt, bool isMergedMiningUpdate) {
     }
   }
 
+  const uint64_t startUs = getMonotonicTimeUs();
+
+  // parse the gbt only when it is not the one of the last job, or when the
+  // txs have to be decoded but the template trusted the txids in gbt
+  const bool isRebuild = (gbtTemplate_ == nullptr || gbtTemplateKey_ != gbtKey ||
+                          (isDecodeGbtTxs_ && !gbtTemplate_->isTxsDecoded_));
+  if (isRebuild) {
+    auto gbtTpl = std::make_shared<GbtTemplate>();
+    if (!gbtTpl->initFromGbt(gbt.c_str(), isDecodeGbtTxs_, gbtTemplate_.get())) {
+      LOG(ERROR) << "init gbt template from gbt str fail";
+      return;
+    }
+    LOG(INFO) << "gbt template, txs: " << gbtTpl->txCount()
+    << ", merkle tree reused for the first " << gbtTpl->reusedTxCount_ << " txs";
+    gbtTemplate_    = gbtTpl;
+    gbtTemplateKey_ = gbtKey;
+  }
+
   StratumJob sjob;
-  if (!sjob.initFromGbt(gbt, poolCoinbaseInfo_, poolPayoutAddr_, blockVersion_,
-                        latestNmcAuxBlockJson, currentRskBlockJson, serverId_,
-                        isMergedMiningUpdate)) {
-    LOG(ERROR) << "init stratum job message from gbt str fail";
+  if (!sjob.initFromGbtTemplate(*gbtTemplate_, poolCoinbaseInfo_, poolPayoutAddr_,
+                                blockVersion_, latestNmcAuxBlockJson,
+                                currentRskBlockJson, serverId_, isMergedMiningUpdate)) {
+    LOG(ERROR) << "init stratum job message from gbt template fail";
     return;
   }
-  const string msg = sjob.serializeToJson();
+  const uint64_t madeUs = getMonotonicTimeUs();
+  const string msg = isStratumJobBinary_ ? sjob.serializeToBinary()
+                                         : sjob.serializeToJson();
 
   // sent to kafka
   kafkaProducer_.produce(msg.data(), msg.size());
+  const uint64_t sentUs = getMonotonicTimeUs();
+
+  if (isRebuild) {
+    rebuildJobLatency_.add(madeUs - startUs);
+  } else {
+    refreshJobLatency_.add(madeUs - startUs);
+  }
+  if (gbtRecvTimeUs != 0) {
+    gbtToJobLatency_.add(sentUs - gbtRecvTimeUs);
+  }
 
   // set last send time
   lastJobSendTime_ = (uint32_t)time(nullptr);
@@ -628,7 +727,22 @@ void JobMaker::sendStratumJob(const char *gbt, bool isMergedMiningUpdate) {
 
   LOG(INFO) << "--------producer stratum job, jobId: " << sjob.jobId_
   << ", height: " << sjob.height_ << "--------";
+  LOG(INFO) << (isRebuild ? "rebuild" : "refresh") << " job: " << (madeUs - startUs)
+  << "us, gbt to job: "
+  << (gbtRecvTimeUs != 0 ? std::to_string(sentUs - gbtRecvTimeUs) + "us" : "-");
   LOG(INFO) << "sjob: " << msg;
+
+  if (time(nullptr) >= lastJobStatsTime_ + kJobStatsInterval_) {
+    LOG(INFO) << "rawgbt decode latency: " << rawGbtDecodeLatency_.toString();
+    LOG(INFO) << "gbt to job latency: " << gbtToJobLatency_.toString();
+    LOG(INFO) << "rebuild job latency: " << rebuildJobLatency_.toString();
+    LOG(INFO) << "refresh job latency: " << refreshJobLatency_.toString();
+    rawGbtDecodeLatency_.reset();
+    gbtToJobLatency_.reset();
+    rebuildJobLatency_.reset();
+    refreshJobLatency_.reset();
+    lastJobStatsTime_ = time(nullptr);
+  }
 }
 
 bool JobMaker::isReachTimeout() {
@@ -687,10 +801,17 @@ void JobMaker::checkAndSendStratumJob(bool isMergedMiningUpdate) {
   }
 
   if (isFindNewHeight || needUpdateEmptyBlockJob || isMergedMiningUpdate || isReachTimeout()) {
+    // only the first job of a gbt counts in gbt to job latency
+    uint64_t gbtRecvTimeUs = 0;
+    if (bestKey != lastSendBestKey && rawgbtRecvTimeUs_.count(bestKey) != 0) {
+      gbtRecvTimeUs = rawgbtRecvTimeUs_[bestKey];
+    }
+
     lastSendBestKey     = bestKey;
     currBestHeight_     = bestHeight;
 
-    sendStratumJob(rawgbtMap_.rbegin()->second.c_str(), isMergedMiningUpdate);
+    sendStratumJob(bestKey, rawgbtMap_.rbegin()->second, isMergedMiningUpdate,
+                   gbtRecvTimeUs);
   }
 }
 
@@ -27,6 +27,7 @@
 #include "Common.h"
 #include "Kafka.h"
 #include "Stratum.h"
+#include "Utils.h"
 
 #include <uint256.h>
 #include <base58.h>
@@ -74,13 +75,44 @@ class JobMaker {
   string fileLastJobTime_;
 
   std::map<uint64_t/* @see makeGbtKey() */, string> rawgbtMap_;  // sorted gbt by timestamp
+  std::map<uint64_t/* @see makeGbtKey() */, uint64_t> rawgbtRecvTimeUs_;  // monotonic time
 
   deque<uint256> lastestGbtHash_;
   uint32_t blockVersion_;
 
+  // send StratumJob in binary format, all consumers should be able to read it
+  bool isStratumJobBinary_;
+
   thread threadConsumeNmcAuxBlock_;
   thread threadConsumeRskRawGw_;
 
+  // StratumJob uses the txids given by gbt. When asked to, they are checked
+  // in the background against the decoded txs, and jobs go back to
+  // decoding the txs once a mismatch is found.
+  bool isVerifyGbtTxids_;
+  atomic<bool> isDecodeGbtTxs_;
+  mutex verifyGbtLock_;
+  string verifyGbt_;  // the latest gbt waiting to be verified
+  thread threadVerifyGbtTxids_;
+
+  // compact RawGbt, the txs are kept only to verify the txids
+  RawGbtDecoder rawGbtDecoder_;
+
+  // the template of the gbt which the last job was made from, jobs
+  // refreshed from the same gbt reuse it
+  shared_ptr<GbtTemplate> gbtTemplate_;
+  uint64_t gbtTemplateKey_;  // @see makeGbtKey()
+
+  // rawgbt message -> gbt json
+  LatencyHistogram rawGbtDecodeLatency_;
+  // gbt received -> job produced, only the first job of each gbt
+  LatencyHistogram gbtToJobLatency_;
+  // job made from a new gbt, or refreshed from the last template
+  LatencyHistogram rebuildJobLatency_;
+  LatencyHistogram refreshJobLatency_;
+  time_t lastJobStatsTime_;
+  static const time_t kJobStatsInterval_ = 600;
+
   void consumeNmcAuxBlockMsg(rd_kafka_message_t *rkmessage);
   void consumeRawGwMsg(rd_kafka_message_t *rkmessage);
   void consumeRawGbtMsg(rd_kafka_message_t *rkmessage, bool needToSend);
@@ -88,13 +120,15 @@ class JobMaker {
 
   void clearTimeoutGbt();
   bool isReachTimeout();
-  void sendStratumJob(const char *gbt, bool isMergedMiningUpdate);
+  void sendStratumJob(uint64_t gbtKey, const string &gbt,
+                      bool isMergedMiningUpdate, uint64_t gbtRecvTimeUs);
 
   void clearTimeoutGw();
   bool triggerRskUpdate();
   void checkAndSendStratumJob(bool isMergedMiningUpdate);
   void runThreadConsumeNmcAuxBlock();
   void runThreadConsumeRawGw();
+  void runThreadVerifyGbtTxids();
 
   inline uint64_t makeGbtKey(uint32_t gbtTime, bool isEmptyBlock, uint32_t height);
   inline uint32_t gbtKeyGetTime(uint64_t gbtKey);
@@ -106,7 +140,8 @@ public:
            const string &payoutAddr, uint32_t gbtLifeTime,
            uint32_t emptyGbtLifeTime, const string &fileLastJobTime,
            uint32_t mergedMiningNotifyPolicy, uint32_t blockVersion,
-					 const string &poolCoinbaseInfo, uint8_t serverId);
+					 const string &poolCoinbaseInfo, uint8_t serverId,
+           bool isStratumJobBinary = false, bool isVerifyGbtTxids = false);
   ~JobMaker();
 
   bool init();
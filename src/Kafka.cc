@@ -208,9 +208,10 @@ rd_kafka_message_t *KafkaConsumer::consumer(int timeout_ms) {
 
 //////////////////////////// KafkaHighLevelConsumer ////////////////////////////
 KafkaHighLevelConsumer::KafkaHighLevelConsumer(const char *brokers, const char *topic,
-                                               int partition, const string &groupStr):
+                                               int partition, const string &groupStr,
+                                               bool isAutoCommit):
 brokers_(brokers), topicStr_(topic),
-groupStr_(groupStr), partition_(partition),
+groupStr_(groupStr), partition_(partition), isAutoCommit_(isAutoCommit),
 conf_(rd_kafka_conf_new()), consumer_(nullptr), topics_(nullptr)
 {
   rd_kafka_conf_set_log_cb(conf_, kafkaLogger);  // set logger
@@ -248,13 +249,17 @@ bool KafkaHighLevelConsumer::setup() {
   //
   // rdkafka options
   //
-  const vector<string> conKeys = {"message.max.bytes", "compression.codec",
+  vector<string> conKeys = {"message.max.bytes", "compression.codec",
     "queued.max.messages.kbytes","fetch.message.max.bytes","fetch.wait.max.ms",
     "group.id" /* Consumer groups require a group id */
   };
-  const vector<string> conVals = {RDKAFKA_MESSAGE_MAX_BYTES, RDKAFKA_COMPRESSION_CODEC,
+  vector<string> conVals = {RDKAFKA_MESSAGE_MAX_BYTES, RDKAFKA_COMPRESSION_CODEC,
     RDKAFKA_QUEUED_MAX_MESSAGES_KBYTES,RDKAFKA_FETCH_MESSAGE_MAX_BYTES,
     RDKAFKA_HIGH_LEVEL_CONSUMER_FETCH_WAIT_MAX_MS, groupStr_.c_str()};
+  if (!isAutoCommit_) {
+    conKeys.push_back("enable.auto.commit");
+    conVals.push_back("false");
+  }
   assert(conKeys.size() == conVals.size());
 
   for (size_t i = 0; i < conKeys.size(); i++) {
@@ -336,16 +341,38 @@ rd_kafka_message_t *KafkaHighLevelConsumer::consumer(int timeout_ms) {
   return rd_kafka_consumer_poll(consumer_, timeout_ms);
 }
 
+bool KafkaHighLevelConsumer::commitOffset(int64_t offset) {
+  rd_kafka_topic_partition_list_t *offsets = rd_kafka_topic_partition_list_new(1);
+  rd_kafka_topic_partition_list_add(offsets, topicStr_.c_str(), partition_)->offset = offset;
+
+  rd_kafka_resp_err_t err = rd_kafka_commit(consumer_, offsets, 1/* async */);
+  rd_kafka_topic_partition_list_destroy(offsets);
+
+  if (err) {
+    LOG(ERROR) << "commit offset failure: " << rd_kafka_err2str(err)
+    << ", offset: " << offset;
+    return false;
+  }
+  return true;
+}
+
 
 
 ///////////////////////////////// KafkaProducer ////////////////////////////////
 KafkaProducer::KafkaProducer(const char *brokers, const char *topic, int partition):
 brokers_(brokers), topicStr_(topic), partition_(partition), conf_(rd_kafka_conf_new()),
-producer_(nullptr), topic_(nullptr)
+producer_(nullptr), topic_(nullptr),
+queueFullPolicy_(QUEUE_FULL_DROP), spilledNum_(0),
+queued_(0), delivered_(0), failed_(0), dropped_(0), spilled_(0),
+running_(false)
 {
   rd_kafka_conf_set_log_cb(conf_, kafkaLogger);  // set logger
   LOG(INFO) << "producer librdkafka version: " << rd_kafka_version_str();
 
+  // delivery report, rd_kafka_poll() will trigger it
+  rd_kafka_conf_set_opaque(conf_, this);
+  rd_kafka_conf_set_dr_msg_cb(conf_, KafkaProducer::deliveryReportCallback);
+
   //
   // kafka conf set, default options
   // https://github.com/edenhill/librdkafka/blob/master/CONFIGURATION.md
@@ -368,6 +395,15 @@ producer_(nullptr), topic_(nullptr)
 }
 
 KafkaProducer::~KafkaProducer() {
+  running_ = false;
+  if (threadPoll_.joinable()) {
+    threadPoll_.join();
+  }
+
+  if (producer_ == nullptr) {
+    return;
+  }
+
   /* Poll to handle delivery reports */
   rd_kafka_poll(producer_, 0);
 
@@ -375,10 +411,32 @@ KafkaProducer::~KafkaProducer() {
   while (rd_kafka_outq_len(producer_) > 0) {
     rd_kafka_poll(producer_, 100);
   }
+  LOG(INFO) << "producer closed, " << getStatsString();
+
   rd_kafka_topic_destroy(topic_);  // Destroy topic
   rd_kafka_destroy(producer_);     // Destroy the handle
 }
 
+void KafkaProducer::setQueueFullPolicy(QueueFullPolicy policy,
+                                       const string &spillFile) {
+  if (policy == QUEUE_FULL_SPILL && spillFile.empty()) {
+    LOG(WARNING) << "empty spill file, use QUEUE_FULL_BLOCK instead, topic: "
+    << topicStr_;
+    policy = QUEUE_FULL_BLOCK;
+  }
+  queueFullPolicy_ = policy;
+  spillFile_       = spillFile;
+
+  // there are messages left by the last run
+  if (policy == QUEUE_FULL_SPILL &&
+      (fileExists(spillFile_.c_str()) ||
+       fileExists((spillFile_ + ".replay").c_str()))) {
+    LOG(WARNING) << "found spill file of topic " << topicStr_
+    << ", will re-produce it: " << spillFile_;
+    spilledNum_ = 1;
+  }
+}
+
 bool KafkaProducer::setup(const std::map<string, string> *options) {
   char errstr[1024];
 
@@ -426,6 +484,10 @@ bool KafkaProducer::setup(const std::map<string, string> *options) {
   topic_ = rd_kafka_topic_new(producer_, topicStr_.c_str(), topicConf);
   topicConf = NULL; /* Now owned by topic */
 
+  /* serve delivery reports */
+  running_ = true;
+  threadPoll_ = thread(&KafkaProducer::runThreadPoll, this);
+
   return true;
 }
 
@@ -449,8 +511,40 @@ bool KafkaProducer::checkAlive() {
   return true;
 }
 
+void KafkaProducer::deliveryReportCallback(rd_kafka_t *rk,
+                                           const rd_kafka_message_t *rkmessage,
+                                           void *opaque) {
+  // opaque is the one we set by rd_kafka_conf_set_opaque()
+  ((KafkaProducer *)opaque)->handleDeliveryReport(rkmessage);
+}
+
+void KafkaProducer::handleDeliveryReport(const rd_kafka_message_t *rkmessage) {
+  if (rkmessage->err) {
+    failed_++;
+    LOG(ERROR) << "delivery failure, topic: " << topicStr_
+    << ", len: " << rkmessage->len << ", err: " << rd_kafka_err2str(rkmessage->err);
+
+    // keep the undelivered message, we can't lose a solved share
+    if (queueFullPolicy_ == QUEUE_FULL_SPILL) {
+      spill(rkmessage->payload, rkmessage->len);
+    }
+    return;
+  }
+
+  delivered_++;
+  // msg opaque is the enqueue time, see _produce()
+  const uint64_t enqueueTime = (uint64_t)(uintptr_t)rkmessage->_private;
+  deliveryLatency_.add(getMonotonicTimeUs() - enqueueTime);
+}
+
+int KafkaProducer::outqLen() const {
+  if (producer_ == nullptr) {
+    return 0;
+  }
+  return rd_kafka_outq_len(producer_);
+}
 
-void KafkaProducer::produce(const void *payload, size_t len) {
+int KafkaProducer::_produce(const void *payload, size_t len) {
   // rd_kafka_produce() is non-blocking
   // Returns 0 on success or -1 on error
   int res = rd_kafka_produce(topic_, partition_, RD_KAFKA_MSG_F_COPY,
@@ -458,9 +552,167 @@ void KafkaProducer::produce(const void *payload, size_t len) {
                              NULL, 0,  /* Optional key and its length */
                              /* Message opaque, provided in delivery report
                               * callback as msg_opaque. */
-                             NULL);
-  if (res == -1) {
-    LOG(ERROR) << "produce to topic [ " << rd_kafka_topic_name(topic_)
-    << "]: " << rd_kafka_err2str(rd_kafka_errno2err(errno));
+                             (void *)(uintptr_t)getMonotonicTimeUs());
+  if (res == 0) {
+    queued_++;
+  }
+  return res;
+}
+
+void KafkaProducer::_poll(int timeoutMs) {
+  rd_kafka_poll(producer_, timeoutMs);
+}
+
+bool KafkaProducer::produce(const void *payload, size_t len) {
+  if (_produce(payload, len) == 0) {
+    return true;
+  }
+
+  rd_kafka_resp_err_t err = rd_kafka_errno2err(errno);
+  if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+    switch (queueFullPolicy_) {
+      case QUEUE_FULL_BLOCK:
+        LOG(WARNING) << "producer queue is full, blocking, topic: " << topicStr_;
+        while (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+          _poll(10);
+          if (_produce(payload, len) == 0) {
+            return true;
+          }
+          err = rd_kafka_errno2err(errno);
+        }
+        break;
+
+      case QUEUE_FULL_SPILL:
+        return spill(payload, len);
+
+      case QUEUE_FULL_DROP:
+      default:
+        dropped_++;
+        LOG(ERROR) << "producer queue is full, drop message, topic: "
+        << topicStr_ << ", len: " << len;
+        return false;
+    }
   }
+
+  failed_++;
+  LOG(ERROR) << "produce to topic [ " << rd_kafka_topic_name(topic_)
+  << "]: " << rd_kafka_err2str(err);
+
+  if (queueFullPolicy_ == QUEUE_FULL_SPILL) {
+    return spill(payload, len);
+  }
+  return false;
+}
+
+//
+// spill file format: [uint32_t len][payload][uint32_t len][payload]...
+//
+bool KafkaProducer::spill(const void *payload, size_t len) {
+  ScopeLock sl(spillLock_);
+
+  FILE *f = fopen(spillFile_.c_str(), "ab");
+  if (f == nullptr) {
+    LOG(ERROR) << "open spill file failure: " << spillFile_
+    << ", err: " << strerror(errno);
+    dropped_++;
+    return false;
+  }
+
+  const uint32_t len32 = (uint32_t)len;
+  bool res = (fwrite(&len32, sizeof(len32), 1, f) == 1 &&
+              fwrite(payload, 1, len, f) == len &&
+              fflush(f) == 0);
+  fclose(f);
+
+  if (!res) {
+    LOG(ERROR) << "write spill file failure: " << spillFile_;
+    dropped_++;
+    return false;
+  }
+
+  spilled_++;
+  spilledNum_++;
+  LOG(WARNING) << "spill message to file: " << spillFile_ << ", len: " << len;
+  return true;
+}
+
+void KafkaProducer::replaySpillFile() {
+  const string replayFile = spillFile_ + ".replay";
+
+  // a replay file may be left by the last run
+  if (!fileExists(replayFile.c_str())) {
+    ScopeLock sl(spillLock_);
+    spilledNum_ = 0;
+    if (rename(spillFile_.c_str(), replayFile.c_str()) != 0) {
+      LOG(ERROR) << "rename spill file failure: " << spillFile_
+      << ", err: " << strerror(errno);
+      return;
+    }
+  }
+
+  FILE *f = fopen(replayFile.c_str(), "rb");
+  if (f == nullptr) {
+    LOG(ERROR) << "open replay file failure: " << replayFile;
+    return;
+  }
+
+  size_t count = 0;
+  uint32_t len = 0;
+  vector<char> buf;
+  while (fread(&len, sizeof(len), 1, f) == 1) {
+    buf.resize(len);
+    if (fread(buf.data(), 1, len, f) != len) {
+      LOG(ERROR) << "truncated message in replay file: " << replayFile;
+      break;
+    }
+
+    // re-produce it, put it back to the spill file if we can't
+    while (_produce(buf.data(), buf.size()) != 0) {
+      const rd_kafka_resp_err_t err = rd_kafka_errno2err(errno);
+      if (err != RD_KAFKA_RESP_ERR__QUEUE_FULL || !running_) {
+        spill(buf.data(), buf.size());
+        break;
+      }
+      _poll(100);
+    }
+    count++;
+  }
+  fclose(f);
+  unlink(replayFile.c_str());
+
+  LOG(INFO) << "re-produce " << count << " spilled messages, topic: " << topicStr_;
+}
+
+void KafkaProducer::runThreadPoll() {
+  LOG(INFO) << "start producer poll thread, topic: " << topicStr_;
+
+  // replay the spill file only when the local queue is not busy
+  const int kReplayMaxOutqLen = 1000;
+  // log stats every minute
+  const time_t kStatsInterval = 60;
+  time_t lastStatsTime = time(nullptr);
+
+  while (running_) {
+    _poll(100);
+
+    if (spilledNum_ > 0 && outqLen() < kReplayMaxOutqLen) {
+      replaySpillFile();
+    }
+
+    if (time(nullptr) > lastStatsTime + kStatsInterval) {
+      lastStatsTime = time(nullptr);
+      LOG(INFO) << "producer stats, " << getStatsString();
+    }
+  }
+
+  LOG(INFO) << "stop producer poll thread, topic: " << topicStr_;
+}
+
+string KafkaProducer::getStatsString() const {
+  return Strings::Format("topic: %s, outq: %d, queued: %" PRIu64", "
+                         "delivered: %" PRIu64", failed: %" PRIu64", "
+                         "dropped: %" PRIu64", spilled: %" PRIu64", latency: { %s }",
+                         topicStr_.c_str(), outqLen(), queued(), delivered(),
+                         failed(), dropped(), spilled(),
+                         deliveryLatency_.toString().c_str());
 }
@@ -25,6 +25,7 @@
 #define KAFKA_H_
 
 #include "Common.h"
+#include "Utils.h"
 
 #include <librdkafka/rdkafka.h>
 
@@ -40,6 +41,8 @@
 #define KAFKA_TOPIC_RAWGW             KAFKA_TOPIC_PREFIX "RawGw"
 #define KAFKA_TOPIC_RSK_SOLVED_SHARE  KAFKA_TOPIC_PREFIX "RskSolvedShare"
 
+#define KAFKA_TOPIC_USER_UPDATES      KAFKA_TOPIC_PREFIX "UserUpdates"
+
 
 ///////////////////////////////////////////////////////////////////////
 // librdkafka options
@@ -48,7 +51,9 @@
 
 // Maximum transmit message size.
 // The RawGbt message may large than 30MB while the block size reach 8MB.
-// So allow the message to reach 60MB.
+// So allow the message to reach 60MB. A compact RawGbt (gbtmaker option
+// is_compact_rawgbt) is about the raw size of the txs, or much less when
+// it refers to the txs sent before.
 #define RDKAFKA_MESSAGE_MAX_BYTES            "60000000"
 
 // Maximum number of bytes per topic+partition to request when
@@ -117,6 +122,7 @@ class KafkaHighLevelConsumer {
   string topicStr_;
   string groupStr_;
   int    partition_;
+  bool   isAutoCommit_;  // if false, commit offsets by commitOffset()
 
   rd_kafka_conf_t  *conf_;
   rd_kafka_t       *consumer_;
@@ -124,12 +130,15 @@ class KafkaHighLevelConsumer {
 
 public:
   KafkaHighLevelConsumer(const char *brokers, const char *topic, int partition,
-                         const string &groupStr);
+                         const string &groupStr, bool isAutoCommit = true);
   ~KafkaHighLevelConsumer();
 
 //  bool checkAlive();  // I don't know which function should be used to check
   bool setup();
 
+  // commit the offset of the next message to consume, async
+  bool commitOffset(int64_t offset);
+
   //
   // don't forget to call rd_kafka_message_destroy() after consumer()
   //
@@ -139,6 +148,15 @@ public:
 
 ///////////////////////////////// KafkaProducer ////////////////////////////////
 class KafkaProducer {
+public:
+  // what to do when the local producer queue is full
+  enum QueueFullPolicy {
+    QUEUE_FULL_DROP  = 0,  // log and drop the message
+    QUEUE_FULL_BLOCK = 1,  // poll and retry until it's enqueued
+    QUEUE_FULL_SPILL = 2   // append to a spill file, re-produce it later
+  };
+
+private:
   string brokers_;
   string topicStr_;
   int    partition_;
@@ -148,13 +166,61 @@ class KafkaProducer {
   rd_kafka_t       *producer_;
   rd_kafka_topic_t *topic_;
 
+  QueueFullPolicy queueFullPolicy_;
+  string spillFile_;
+  mutex  spillLock_;
+  atomic<uint64_t> spilledNum_;  // messages in the spill file
+
+  // counters
+  atomic<uint64_t> queued_;
+  atomic<uint64_t> delivered_;
+  atomic<uint64_t> failed_;
+  atomic<uint64_t> dropped_;
+  atomic<uint64_t> spilled_;
+  // enqueue to ack latency
+  LatencyHistogram deliveryLatency_;
+
+  atomic<bool> running_;
+  thread threadPoll_;
+  void runThreadPoll();
+
+  static void deliveryReportCallback(rd_kafka_t *rk,
+                                     const rd_kafka_message_t *rkmessage,
+                                     void *opaque);
+  void handleDeliveryReport(const rd_kafka_message_t *rkmessage);
+
+protected:
+  // enqueue to the local queue, returns 0 on success or -1 with errno set,
+  // like rd_kafka_produce(). tests override it and _poll() to fake a queue.
+  virtual int  _produce(const void *payload, size_t len);
+  virtual void _poll(int timeoutMs);
+  bool spill(const void *payload, size_t len);
+  void replaySpillFile();
+  uint64_t spilledNum() const { return spilledNum_; }
+
 public:
   KafkaProducer(const char *brokers, const char *topic, int partition);
-  ~KafkaProducer();
+  virtual ~KafkaProducer();
+
+  // should be called before setup(). spillFile is required by QUEUE_FULL_SPILL,
+  // undelivered messages will be spilled too.
+  void setQueueFullPolicy(QueueFullPolicy policy, const string &spillFile = "");
 
   bool setup(const std::map<string, string> *options=nullptr);
   bool checkAlive();
-  void produce(const void *payload, size_t len);
+  // return false if the message is dropped
+  bool produce(const void *payload, size_t len);
+
+  QueueFullPolicy queueFullPolicy() const { return queueFullPolicy_; }
+  int outqLen() const;
+  uint64_t queued()    const { return queued_;    }
+  uint64_t delivered() const { return delivered_; }
+  uint64_t failed()    const { return failed_;    }
+  uint64_t dropped()   const { return dropped_;   }
+  uint64_t spilled()   const { return spilled_;   }
+  const LatencyHistogram &deliveryLatency() const { return deliveryLatency_; }
+
+  string getStatsString() const;
 };
 
 #endif
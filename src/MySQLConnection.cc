@@ -21,6 +21,9 @@
 #include <mysql/mysql.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <fstream>
+
 MySQLResult::MySQLResult() :
     result(nullptr) {
 }
@@ -204,6 +207,26 @@ uint64_t MySQLConnection::getInsertId() {
   return mysql_insert_id(conn);
 }
 
+uint32_t MySQLConnection::getErrno() {
+  return conn ? mysql_errno(conn) : 0;
+}
+
+bool MySQLConnection::isStatementError(uint32_t errorNo) {
+  switch (errorNo) {
+    case 1048:  // Column cannot be null
+    case 1054:  // Unknown column
+    case 1062:  // Duplicate entry
+    case 1064:  // You have an error in your SQL syntax
+    case 1136:  // Column count doesn't match value count
+    case 1292:  // Truncated incorrect value
+    case 1366:  // Incorrect value for column
+    case 1406:  // Data too long for column
+      return true;
+    default:
+      return false;
+  }
+}
+
 //
 // SQL: show variables like "max_allowed_packet"
 //
@@ -253,3 +276,94 @@ bool multiInsert(MySQLConnection &db, const string &table,
 
   return true;
 }
+
+DurableSqlQueue::DurableSqlQueue(const string &file): file_(file) {
+}
+
+bool DurableSqlQueue::load() {
+  std::lock_guard<std::mutex> sl(lock_);
+  std::ifstream f(file_);
+  if (!f.is_open()) {
+    return true;  // nothing left
+  }
+
+  string line;
+  while (std::getline(f, line)) {
+    if (line.length() > 0)
+      sqls_.push_back(line);
+  }
+  LOG(INFO) << "load " << sqls_.size() << " sql to retry from: " << file_;
+  return true;
+}
+
+// the whole file is rewritten and synced a push or a pop, O(n^2) to retry n
+// statements. it's fine for the few ones failed with the DB down for a while
+bool DurableSqlQueue::save() {
+  // write a new file and rename it, the old one is complete if we crash
+  const string tmpFile = file_ + ".tmp";
+  FILE *f = fopen(tmpFile.c_str(), "w");
+  if (f == nullptr) {
+    LOG(ERROR) << "open sql retry file failure: " << tmpFile << ", " << strerror(errno);
+    return false;
+  }
+  for (const auto &sql : sqls_) {
+    fwrite(sql.data(), 1, sql.length(), f);
+    fputc('\n', f);
+  }
+  fflush(f);
+  const bool res = (ferror(f) == 0 && fsync(fileno(f)) == 0);
+  fclose(f);
+
+  if (!res || rename(tmpFile.c_str(), file_.c_str()) != 0) {
+    LOG(ERROR) << "write sql retry file failure: " << file_ << ", " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool DurableSqlQueue::push(const string &sql) {
+  string line = sql;
+  std::replace(line.begin(), line.end(), '\n', ' ');
+  std::replace(line.begin(), line.end(), '\r', ' ');
+
+  std::lock_guard<std::mutex> sl(lock_);
+  sqls_.push_back(line);
+  return save();
+}
+
+size_t DurableSqlQueue::retry(MySQLConnection &db) {
+  std::lock_guard<std::mutex> rl(retryLock_);
+
+  while (true) {
+    string sql;
+    {
+      std::lock_guard<std::mutex> sl(lock_);
+      if (sqls_.empty())
+        return 0;
+      sql = sqls_.front();
+    }
+
+    if (!db.ping()) {
+      break;  // DB is down, try later
+    }
+    if (!db.execute(sql)) {
+      const uint32_t errorNo = db.getErrno();
+      if (!MySQLConnection::isStatementError(errorNo)) {
+        break;  // lock wait timeout, disk full, ...: try later
+      }
+      LOG(ERROR) << "drop the sql which is wrong, error_no: " << errorNo
+      << ", sql: " << sql;
+    }
+
+    std::lock_guard<std::mutex> sl(lock_);
+    sqls_.pop_front();
+    save();
+  }
+
+  return size();
+}
+
+size_t DurableSqlQueue::size() {
+  std::lock_guard<std::mutex> sl(lock_);
+  return sqls_.size();
+}
@@ -27,6 +27,8 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <deque>
+#include <mutex>
 
 using std::string;
 using std::vector;
@@ -126,6 +128,10 @@ public:
   }
   uint64_t affectedRows();
   uint64_t getInsertId();
+  uint32_t getErrno();  // of the last statement
+
+  // the error of the statement itself, it fails every time
+  static bool isStatementError(uint32_t errorNo);
 
   string getVariable(const char *name);
 };
@@ -133,4 +139,31 @@ public:
 bool multiInsert(MySQLConnection &db, const string &table,
                  const string &fields, const vector<string> &values);
 
+/**
+ * SQL statements which failed, kept in a local file until they are
+ * executed. One statement a line, so the file could be fed to the mysql
+ * client as well.
+ * thread-safe
+ */
+class DurableSqlQueue {
+  const string file_;
+  std::mutex lock_;
+  std::mutex retryLock_;
+  std::deque<string> sqls_;
+
+  bool save();  // lock_ is held
+
+public:
+  explicit DurableSqlQueue(const string &file);
+
+  // load the statements left by the last run
+  bool load();
+  bool push(const string &sql);
+  // execute the statements in order, stop at the first one fails and keep
+  // it for the next retry, unless the statement itself is wrong: it's
+  // dropped. return how many are left
+  size_t retry(MySQLConnection &db);
+  size_t size();
+};
+
 #endif
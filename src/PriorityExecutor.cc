@@ -0,0 +1,142 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "PriorityExecutor.h"
+
+#include <glog/logging.h>
+
+#include <cinttypes>
+
+/////////////////////////////// PriorityExecutor ///////////////////////////////
+PriorityExecutor::PriorityExecutor(size_t threadNum, size_t highOnlyThreads,
+                                   size_t maxQueueSize):
+kThreadNum_(threadNum), kHighOnlyThreads_(std::min(highOnlyThreads, threadNum)),
+kMaxQueueSize_(maxQueueSize), stopped_(true)
+{
+  for (size_t i = 0; i < PRIORITY_NUM; i++) {
+    rejectedCount_[i] = 0;
+  }
+}
+
+PriorityExecutor::~PriorityExecutor() {
+  stop();
+}
+
+void PriorityExecutor::start() {
+  ScopeLock sl(lock_);
+  if (!stopped_) {
+    return;
+  }
+  stopped_ = false;
+
+  for (size_t i = 0; i < kThreadNum_; i++) {
+    threads_.push_back(thread(&PriorityExecutor::runThread, this, i));
+  }
+}
+
+void PriorityExecutor::stop() {
+  {
+    ScopeLock sl(lock_);
+    stopped_ = true;
+  }
+  cond_.notify_all();
+
+  for (auto &t : threads_) {
+    if (t.joinable())
+      t.join();
+  }
+  threads_.clear();
+}
+
+bool PriorityExecutor::post(Priority priority, Task task) {
+  {
+    ScopeLock sl(lock_);
+    if (stopped_ || queues_[priority].size() >= kMaxQueueSize_) {
+      rejectedCount_[priority]++;
+      return false;
+    }
+    queues_[priority].push_back(QueuedTask{std::move(task), getMonotonicTimeUs()});
+  }
+  // a high-only thread can't take a low priority task
+  if (priority == PRIORITY_HIGH)
+    cond_.notify_one();
+  else
+    cond_.notify_all();
+  return true;
+}
+
+void PriorityExecutor::runThread(size_t threadIdx) {
+  const int lowest = isLowPriorityThread(threadIdx) ? PRIORITY_LOW : PRIORITY_HIGH;
+
+  while (true) {
+    QueuedTask qtask;
+    int priority = PRIORITY_HIGH;
+    {
+      UniqueLock ul(lock_);
+      for (;;) {
+        for (priority = PRIORITY_HIGH; priority <= lowest; priority++) {
+          if (!queues_[priority].empty())
+            break;
+        }
+        if (priority <= lowest || stopped_)
+          break;
+        cond_.wait(ul);
+      }
+
+      // stopped and nothing left for this thread
+      if (priority > lowest) {
+        break;
+      }
+      qtask = std::move(queues_[priority].front());
+      queues_[priority].pop_front();
+    }
+
+    waitLatency_[priority].add(getMonotonicTimeUs() - qtask.queuedTimeUs_);
+    qtask.task_(threadIdx);
+  }
+}
+
+size_t PriorityExecutor::queueSize(Priority priority) {
+  ScopeLock sl(lock_);
+  return queues_[priority].size();
+}
+
+string PriorityExecutor::toString() {
+  static const char *names[PRIORITY_NUM] = {"high", "low"};
+  string s;
+  for (size_t i = 0; i < PRIORITY_NUM; i++) {
+    s += Strings::Format("%s%s: queue: %" PRIu64", wait: %s, rejected: %" PRIu64"",
+                         i > 0 ? "; " : "", names[i],
+                         (uint64_t)queueSize((Priority)i),
+                         waitLatency_[i].toString().c_str(),
+                         rejectedCount_[i].load());
+  }
+  return s;
+}
+
+void PriorityExecutor::resetStats() {
+  for (size_t i = 0; i < PRIORITY_NUM; i++) {
+    waitLatency_[i].reset();
+    rejectedCount_[i] = 0;
+  }
+}
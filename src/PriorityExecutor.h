@@ -0,0 +1,97 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#ifndef PRIORITY_EXECUTOR_H_
+#define PRIORITY_EXECUTOR_H_
+
+#include "Common.h"
+#include "Utils.h"
+
+#include <deque>
+#include <functional>
+
+/////////////////////////////// PriorityExecutor ///////////////////////////////
+//
+// A fixed pool of threads running queued tasks, high priority tasks first.
+// The first kHighOnlyThreads_ threads only run high priority tasks, so
+// slow low priority tasks (e.g. DB writes) can't hold up the high ones
+// (e.g. submitblock).
+//
+// A task gets the index of its thread, [0, threadNum), for the per-thread
+// resources like DB connections.
+//
+class PriorityExecutor {
+public:
+  enum Priority {
+    PRIORITY_HIGH = 0,
+    PRIORITY_LOW  = 1,
+    PRIORITY_NUM  = 2
+  };
+  typedef std::function<void(size_t threadIdx)> Task;
+
+private:
+  struct QueuedTask {
+    Task task_;
+    uint64_t queuedTimeUs_;
+  };
+
+  const size_t kThreadNum_;
+  const size_t kHighOnlyThreads_;
+  const size_t kMaxQueueSize_;  // of each priority
+
+  mutex lock_;
+  Condition cond_;
+  bool stopped_;
+  std::deque<QueuedTask> queues_[PRIORITY_NUM];
+  vector<thread> threads_;
+
+  LatencyHistogram waitLatency_[PRIORITY_NUM];  // in the queue
+  atomic<uint64_t> rejectedCount_[PRIORITY_NUM];
+
+  void runThread(size_t threadIdx);
+
+public:
+  PriorityExecutor(size_t threadNum, size_t highOnlyThreads,
+                   size_t maxQueueSize);
+  ~PriorityExecutor();
+
+  void start();
+  // runs the queued tasks, then joins the threads
+  void stop();
+
+  // returns false if the queue is full or it's stopped
+  bool post(Priority priority, Task task);
+
+  size_t threadNum() const { return kThreadNum_; }
+  // if the thread runs low priority tasks
+  bool isLowPriorityThread(size_t threadIdx) const {
+    return threadIdx >= kHighOnlyThreads_;
+  }
+  size_t queueSize(Priority priority);
+
+  // "high: queue: 0, wait: count: 10, ..., rejected: 0; low: ..."
+  string toString();
+  void resetStats();
+};
+
+#endif
@@ -83,6 +83,43 @@ long long RedisResult::integer() {
   return reply_->integer;
 }
 
+static void arrayItems(const redisReply *reply, vector<string> &items) {
+  items.clear();
+  items.reserve(reply->elements);
+  for (size_t i = 0; i < reply->elements; i++) {
+    redisReply *item = reply->element[i];
+    if (item == nullptr || item->str == nullptr) {
+      items.push_back("");
+    } else {
+      items.push_back(string(item->str, item->len));
+    }
+  }
+}
+
+vector<string> RedisResult::strArray() {
+  vector<string> items;
+  if (empty() || reply_->type != REDIS_REPLY_ARRAY) {
+    return items;
+  }
+  arrayItems(reply_, items);
+  return items;
+}
+
+bool RedisResult::scanResult(string &cursor, vector<string> &items) {
+  if (empty() || reply_->type != REDIS_REPLY_ARRAY || reply_->elements != 2) {
+    return false;
+  }
+  const redisReply *cursorReply = reply_->element[0];
+  const redisReply *itemsReply  = reply_->element[1];
+  if (cursorReply == nullptr || cursorReply->type != REDIS_REPLY_STRING ||
+      itemsReply  == nullptr || itemsReply->type  != REDIS_REPLY_ARRAY) {
+    return false;
+  }
+  cursor.assign(cursorReply->str, cursorReply->len);
+  arrayItems(itemsReply, items);
+  return true;
+}
+
 /////////////////////////////// RedisConnection ///////////////////////////////
 
 RedisConnection::RedisConnection(const RedisConnectInfo &connInfo) :
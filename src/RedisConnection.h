@@ -60,6 +60,10 @@ public:
 
   string str();
   long long integer();
+  // elements of REDIS_REPLY_ARRAY as strings
+  vector<string> strArray();
+  // reply of SCAN, HSCAN...: the next cursor ("0" at the end) and the items
+  bool scanResult(string &cursor, vector<string> &items);
 };
 
 /////////////////////////////// RedisConnectInfo ///////////////////////////////
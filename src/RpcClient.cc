@@ -0,0 +1,353 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "RpcClient.h"
+
+#include <glog/logging.h>
+
+/////////////////////////////////// RpcClient //////////////////////////////////
+static size_t
+CurlWriteStringCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+  const size_t realsize = size * nmemb;
+  ((string *)userp)->append((const char *)contents, realsize);
+  return realsize;
+}
+
+RpcClient::RpcClient(const string &url, const string &userpwd):
+url_(url), userpwd_(userpwd), share_(nullptr), newConns_(0), failures_(0)
+{
+  // curl_global_init() is not thread safe, curl_easy_init() calls it if
+  // it wasn't
+  static std::once_flag curlInitFlag;
+  std::call_once(curlInitFlag, []() { curl_global_init(CURL_GLOBAL_ALL); });
+
+  share_ = curl_share_init();
+  if (share_ != nullptr) {
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC,   RpcClient::lockShare);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, RpcClient::unlockShare);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA,   (void *)this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE,      CURL_LOCK_DATA_CONNECT);
+  }
+}
+
+RpcClient::~RpcClient() {
+  for (CURL *conn : idleConns_) {
+    curl_easy_cleanup(conn);
+  }
+  // after the handles which use it
+  if (share_ != nullptr) {
+    curl_share_cleanup(share_);
+  }
+}
+
+void RpcClient::lockShare(CURL *handle, curl_lock_data data,
+                          curl_lock_access access, void *userptr) {
+  ((RpcClient *)userptr)->shareLock_.lock();
+}
+
+void RpcClient::unlockShare(CURL *handle, curl_lock_data data, void *userptr) {
+  ((RpcClient *)userptr)->shareLock_.unlock();
+}
+
+CURL *RpcClient::getConn() {
+  {
+    ScopeLock sl(lock_);
+    if (!idleConns_.empty()) {
+      CURL *conn = idleConns_.back();
+      idleConns_.pop_back();
+      return conn;
+    }
+  }
+
+  CURL *conn = curl_easy_init();
+  if (conn == nullptr) {
+    return nullptr;
+  }
+
+  // keep-alive is the default of HTTP/1.1. RSK doesn't support
+  // 'Expect: 100-Continue', it's removed from the headers, see setup().
+  curl_easy_setopt(conn, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+  curl_easy_setopt(conn, CURLOPT_NOSIGNAL,      1L);
+  curl_easy_setopt(conn, CURLOPT_TCP_NODELAY,   1L);
+  curl_easy_setopt(conn, CURLOPT_TCP_KEEPALIVE, 1L);
+  if (share_ != nullptr)
+    curl_easy_setopt(conn, CURLOPT_SHARE, share_);
+
+  if (!userpwd_.empty())
+    curl_easy_setopt(conn, CURLOPT_USERPWD, userpwd_.c_str());
+
+  curl_easy_setopt(conn, CURLOPT_USE_SSL, CURLUSESSL_TRY);
+  curl_easy_setopt(conn, CURLOPT_USERAGENT, "curl");
+
+  curl_easy_setopt(conn, CURLOPT_WRITEFUNCTION, CurlWriteStringCallback);
+  return conn;
+}
+
+void RpcClient::putConn(CURL *conn) {
+  {
+    ScopeLock sl(lock_);
+    if (idleConns_.size() < kMaxIdleConns_) {
+      idleConns_.push_back(conn);
+      return;
+    }
+  }
+  curl_easy_cleanup(conn);
+}
+
+size_t RpcClient::idleConns() {
+  ScopeLock sl(lock_);
+  return idleConns_.size();
+}
+
+bool RpcClient::setup(Transfer &t, long timeoutMs, const char *contentType) {
+  t.conn_ = getConn();
+  if (t.conn_ == nullptr) {
+    LOG(ERROR) << "curl init failure, url: " << t.url_;
+    failures_++;
+    return false;
+  }
+
+  t.headers_ = curl_slist_append(t.headers_, "Expect:");
+  if (contentType != nullptr) {
+    const string contentTypeHeader = string("Content-Type: ") + string(contentType);
+    t.headers_ = curl_slist_append(t.headers_, contentTypeHeader.c_str());
+  }
+  curl_easy_setopt(t.conn_, CURLOPT_HTTPHEADER, t.headers_);
+
+  curl_easy_setopt(t.conn_, CURLOPT_URL, t.url_);
+
+  if (t.postData_ != nullptr) {
+    curl_easy_setopt(t.conn_, CURLOPT_POSTFIELDSIZE, (long)t.postDataLen_);
+    curl_easy_setopt(t.conn_, CURLOPT_POSTFIELDS,    t.postData_);
+  } else {
+    curl_easy_setopt(t.conn_, CURLOPT_HTTPGET, 1L);
+  }
+
+  curl_easy_setopt(t.conn_, CURLOPT_TIMEOUT_MS, timeoutMs);
+  curl_easy_setopt(t.conn_, CURLOPT_WRITEDATA, (void *)&t.response_);
+  return true;
+}
+
+void RpcClient::finish(Transfer &t, CURLcode status) {
+  long code = 0;
+  long connects = 0;
+  double totalTime = 0;
+  curl_easy_getinfo(t.conn_, CURLINFO_RESPONSE_CODE, &code);
+  curl_easy_getinfo(t.conn_, CURLINFO_NUM_CONNECTS,  &connects);
+  curl_easy_getinfo(t.conn_, CURLINFO_TOTAL_TIME,    &totalTime);
+
+  newConns_ += connects;
+  latency_.add((uint64_t)(totalTime * 1000000));
+
+  curl_slist_free_all(t.headers_);
+  t.headers_ = nullptr;
+
+  if (status != CURLE_OK) {
+    LOG(ERROR) << "unable to request data from: " << t.url_ << ", error: " << curl_easy_strerror(status);
+    failures_++;
+    // the connection may be broken, don't reuse it
+    curl_easy_cleanup(t.conn_);
+    t.conn_ = nullptr;
+    t.res_ = false;
+    return;
+  }
+
+  if (code != 200) {
+    LOG(ERROR) << "server responded with code: " << code;
+    failures_++;
+  }
+  t.res_ = (code == 200);
+
+  putConn(t.conn_);
+  t.conn_ = nullptr;
+}
+
+bool RpcClient::request(const char *url, const char *postData,
+                        string &response, long timeoutMs,
+                        const char *contentType) {
+  Transfer t(this, url, postData, postData != nullptr ? strlen(postData) : 0);
+  if (!setup(t, timeoutMs, contentType)) {
+    return false;
+  }
+  finish(t, curl_easy_perform(t.conn_));
+
+  response.swap(t.response_);
+  return t.res_;
+}
+
+void RpcClient::performAll(vector<Transfer> &transfers, long timeoutMs,
+                           const char *contentType) {
+  CURLM *multi = curl_multi_init();
+  if (multi == nullptr) {
+    LOG(ERROR) << "curl multi init failure";
+    return;
+  }
+
+  for (Transfer &t : transfers) {
+    if (t.client_->setup(t, timeoutMs, contentType)) {
+      curl_multi_add_handle(multi, t.conn_);
+    }
+  }
+
+  int running = 0;
+  do {
+    CURLMcode mc = curl_multi_perform(multi, &running);
+    if (mc != CURLM_OK) {
+      LOG(ERROR) << "curl multi perform failure: " << curl_multi_strerror(mc);
+      break;
+    }
+    if (running > 0) {
+      curl_multi_wait(multi, nullptr, 0, 100/* timeout ms */, nullptr);
+    }
+  } while (running > 0);
+
+  CURLMsg *msg;
+  int msgsLeft = 0;
+  while ((msg = curl_multi_info_read(multi, &msgsLeft)) != nullptr) {
+    if (msg->msg != CURLMSG_DONE) {
+      continue;
+    }
+    for (Transfer &t : transfers) {
+      if (t.conn_ == msg->easy_handle) {
+        curl_multi_remove_handle(multi, t.conn_);
+        t.client_->finish(t, msg->data.result);
+        break;
+      }
+    }
+  }
+
+  // not finished because of the multi failure
+  for (Transfer &t : transfers) {
+    if (t.conn_ != nullptr) {
+      curl_multi_remove_handle(multi, t.conn_);
+      t.client_->finish(t, CURLE_FAILED_INIT);
+    }
+  }
+
+  curl_multi_cleanup(multi);
+}
+
+size_t RpcClient::callAll(const vector<RpcClient *> &clients,
+                          const string &request, vector<bool> &results,
+                          vector<string> &responses, long timeoutMs) {
+  vector<Transfer> transfers;
+  transfers.reserve(clients.size());
+  for (RpcClient *client : clients) {
+    transfers.push_back(Transfer(client, client->url_.c_str(),
+                                 request.c_str(), request.size()));
+  }
+  performAll(transfers, timeoutMs, "application/json");
+
+  size_t successCount = 0;
+  results.resize(transfers.size());
+  responses.resize(transfers.size());
+  for (size_t i = 0; i < transfers.size(); i++) {
+    results[i] = transfers[i].res_;
+    responses[i].swap(transfers[i].response_);
+    if (results[i])
+      successCount++;
+  }
+  return successCount;
+}
+
+size_t RpcClient::callAllRetry(const vector<RpcClient *> &clients,
+                               const string &request, size_t tries,
+                               vector<bool> &results, vector<string> &responses,
+                               long timeoutMs) {
+  results.assign(clients.size(), false);
+  responses.assign(clients.size(), "");
+
+  // indexes of the clients to call
+  vector<size_t> pending;
+  for (size_t i = 0; i < clients.size(); i++) {
+    pending.push_back(i);
+  }
+
+  for (size_t i = 0; i < tries && pending.size() > 0; i++) {
+    vector<RpcClient *> pendingClients;
+    for (size_t idx : pending) {
+      pendingClients.push_back(clients[idx]);
+    }
+
+    vector<bool> pendingResults;
+    vector<string> pendingResponses;
+    callAll(pendingClients, request, pendingResults, pendingResponses, timeoutMs);
+
+    vector<size_t> failed;
+    for (size_t j = 0; j < pending.size(); j++) {
+      results[pending[j]] = pendingResults[j];
+      responses[pending[j]].swap(pendingResponses[j]);
+      if (!pendingResults[j])
+        failed.push_back(pending[j]);
+    }
+    pending.swap(failed);
+  }
+  return clients.size() - pending.size();
+}
+
+size_t RpcClient::warmUp(size_t conns, const string &request) {
+  conns = std::min(conns, kMaxIdleConns_);
+
+  vector<Transfer> transfers(conns, Transfer(this, url_.c_str(),
+                                             request.c_str(), request.size()));
+  performAll(transfers, kTimeoutMs_, "application/json");
+
+  size_t aliveCount = 0;
+  for (const Transfer &t : transfers) {
+    if (t.res_)
+      aliveCount++;
+  }
+  return aliveCount;
+}
+
+string RpcClient::toString() const {
+  return url_ + ", latency: " + latency_.toString() +
+         ", new conns: " + std::to_string(newConns_) +
+         ", failures: " + std::to_string(failures_);
+}
+
+void RpcClient::resetStats() {
+  latency_.reset();
+  newConns_ = 0;
+  failures_ = 0;
+}
+
+string RpcClient::getEndpoint(const string &url) {
+  size_t begin = url.find("://");
+  begin = (begin == string::npos) ? 0 : begin + 3;
+  return url.substr(0, url.find_first_of("/?#", begin));
+}
+
+shared_ptr<RpcClient> RpcClient::get(const string &url, const string &userpwd) {
+  static mutex clientsLock;
+  static std::map<string, shared_ptr<RpcClient>> clients;
+
+  const string endpoint = getEndpoint(url);
+  ScopeLock sl(clientsLock);
+  shared_ptr<RpcClient> &client = clients[endpoint + "\n" + userpwd];
+  if (client == nullptr) {
+    client = std::make_shared<RpcClient>(endpoint, userpwd);
+  }
+  return client;
+}
@@ -0,0 +1,142 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#ifndef RPC_CLIENT_H_
+#define RPC_CLIENT_H_
+
+#include "Common.h"
+#include "Utils.h"
+
+#include <curl/curl.h>
+
+/////////////////////////////////// RpcClient //////////////////////////////////
+//
+// HTTP (json-rpc) client of one endpoint (scheme://host:port), keeps the
+// connections alive and reuses them, so a call doesn't pay for the TCP
+// connect again. Thread safe, a call takes an idle connection or opens a
+// new one. url_ is where call() goes, request() takes any url of the
+// same endpoint.
+//
+// httpPOST(), httpGET() and bitcoindRpcCall() use the shared client of
+// the endpoint, see RpcClient::get().
+//
+class RpcClient {
+public:
+  static const size_t kMaxIdleConns_ = 8;
+  static const long   kTimeoutMs_    = 5000;
+
+private:
+  // a request in performAll()
+  struct Transfer {
+    RpcClient *client_;
+    CURL *conn_;
+    struct curl_slist *headers_;
+    const char *url_;
+    const char *postData_;
+    size_t postDataLen_;
+    string response_;
+    bool res_;
+
+    Transfer(RpcClient *client, const char *url, const char *postData,
+             size_t postDataLen):
+    client_(client), conn_(nullptr), headers_(nullptr), url_(url),
+    postData_(postData), postDataLen_(postDataLen), res_(false) {}
+  };
+
+  const string url_;
+  const string userpwd_;
+
+  mutex lock_;
+  vector<CURL *> idleConns_;  // the last one is the most recently used
+
+  // the connection cache of all handles, a curl multi (performAll()) has its
+  // own cache which is closed with it otherwise
+  CURLSH *share_;
+  mutex shareLock_;
+  static void lockShare(CURL *handle, curl_lock_data data,
+                        curl_lock_access access, void *userptr);
+  static void unlockShare(CURL *handle, curl_lock_data data, void *userptr);
+
+  LatencyHistogram latency_;
+  atomic<uint64_t> newConns_;
+  atomic<uint64_t> failures_;
+
+  CURL *getConn();
+  void putConn(CURL *conn);
+
+  bool setup(Transfer &t, long timeoutMs, const char *contentType);
+  void finish(Transfer &t, CURLcode status);
+
+  // runs the transfers in parallel by curl multi
+  static void performAll(vector<Transfer> &transfers, long timeoutMs,
+                         const char *contentType);
+
+public:
+  RpcClient(const string &url, const string &userpwd);
+  ~RpcClient();
+
+  // postData is nullptr for GET
+  bool request(const char *url, const char *postData, string &response,
+               long timeoutMs = kTimeoutMs_,
+               const char *contentType = "application/json");
+
+  // json-rpc call to url_
+  bool call(const string &request, string &response,
+            long timeoutMs = kTimeoutMs_) {
+    return this->request(url_.c_str(), request.c_str(), response, timeoutMs);
+  }
+
+  // sends the request to all clients at the same time, results[i] and
+  // responses[i] are of clients[i]. Returns how many calls succeeded.
+  static size_t callAll(const vector<RpcClient *> &clients,
+                        const string &request, vector<bool> &results,
+                        vector<string> &responses,
+                        long timeoutMs = kTimeoutMs_);
+  // callAll() up to `tries` times, a retry goes to the clients which failed
+  // the last time only. Returns how many clients succeeded.
+  static size_t callAllRetry(const vector<RpcClient *> &clients,
+                             const string &request, size_t tries,
+                             vector<bool> &results, vector<string> &responses,
+                             long timeoutMs = kTimeoutMs_);
+
+  // makes sure there are `conns` connections open, by sending a cheap
+  // request over them at the same time. Called before the connections are
+  // needed (e.g. submitblock) and then periodically, before the server
+  // closes the idle ones. Returns how many of them are alive.
+  size_t warmUp(size_t conns, const string &request);
+
+  const string &url() const { return url_; }
+  size_t idleConns();
+
+  // "http://127.0.0.1:8332, latency: count: 10, ..., new conns: 2, failures: 0"
+  string toString() const;
+  void resetStats();
+
+  // "http://user@host:8332/path?a=1" -> "http://user@host:8332"
+  static string getEndpoint(const string &url);
+  // the shared client of the url's endpoint and the user, its url_ is the
+  // endpoint
+  static shared_ptr<RpcClient> get(const string &url, const string &userpwd);
+};
+
+#endif
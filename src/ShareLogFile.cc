@@ -0,0 +1,706 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "ShareLogFile.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+static_assert(ShareLogV2::kBloomBits_ == 2048, "bloom positions are 11 bits");
+
+namespace {
+
+inline void putVarint(string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+inline bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+  if (p < end && *p < 0x80) {
+    v = *p++;
+    return true;
+  }
+  v = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    const uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+inline void bloomBits(int32_t userId, uint32_t &b1, uint32_t &b2) {
+  const uint64_t h = (uint64_t)(uint32_t)userId * 0x9E3779B97F4A7C15ULL;
+  b1 = (uint32_t)(h >> 53);
+  b2 = (uint32_t)(h >> 42) & 2047;
+}
+
+//
+// A column starts with its mode:
+//   kColumnRuns:   runs of the same delta, varint(zigzag(delta)), varint(run - 1),
+//                  so a constant or evenly increasing column takes a few bytes
+//   kColumnDeltas: varint(zigzag(delta)) of every share, for the columns
+//                  which seldom repeat, like userId
+//
+const uint8_t kColumnRuns   = 0;
+const uint8_t kColumnDeltas = 1;
+const int     kColumnNum    = 8;
+
+template <typename T>
+void encodeColumn(const Share *shares, size_t count, T Share::*field, string &out) {
+  size_t runs = 1;
+  for (size_t i = 2; i < count; i++) {
+    const uint64_t a = static_cast<uint64_t>(shares[i - 2].*field);
+    const uint64_t b = static_cast<uint64_t>(shares[i - 1].*field);
+    const uint64_t c = static_cast<uint64_t>(shares[i].*field);
+    if (c - b != b - a)
+      runs++;
+  }
+
+  uint64_t prev = 0;
+  if (runs * 2 > count) {
+    out.push_back((char)kColumnDeltas);
+    for (size_t i = 0; i < count; i++) {
+      const uint64_t cur = static_cast<uint64_t>(shares[i].*field);
+      putVarint(out, zigzag((int64_t)(cur - prev)));
+      prev = cur;
+    }
+    return;
+  }
+
+  out.push_back((char)kColumnRuns);
+  size_t i = 0;
+  while (i < count) {
+    const uint64_t cur   = static_cast<uint64_t>(shares[i].*field);
+    const uint64_t delta = cur - prev;
+    size_t run = 1;
+    prev = cur;
+    while (i + run < count) {
+      const uint64_t next = static_cast<uint64_t>(shares[i + run].*field);
+      if (next - prev != delta)
+        break;
+      prev = next;
+      run++;
+    }
+    putVarint(out, zigzag((int64_t)delta));
+    putVarint(out, run - 1);
+    i += run;
+  }
+}
+
+// decodes a column a share at a time, so a block is decoded in tiles
+// which stay in the cache, rather than a column of the whole block at a time
+class ColumnReader {
+  const uint8_t *p_;
+  const uint8_t *end_;
+  uint8_t  mode_;
+  uint64_t prev_;
+  uint64_t delta_;
+  uint64_t runLeft_;
+
+public:
+  bool init(const uint8_t *begin, const uint8_t *end) {
+    if (begin >= end)
+      return false;
+    mode_ = *begin;
+    p_    = begin + 1;
+    end_  = end;
+    prev_ = delta_ = runLeft_ = 0;
+    return mode_ == kColumnRuns || mode_ == kColumnDeltas;
+  }
+
+  // all the values are read
+  bool isDone() const { return p_ == end_ && runLeft_ == 0; }
+
+  template <typename T>
+  bool read(Share *shares, size_t count, T Share::*field) {
+    // the state in locals, the compiler can't keep members in registers
+    const uint8_t *p = p_;
+    uint64_t prev = prev_, zz, run;
+    size_t i = 0;
+    if (mode_ == kColumnDeltas) {
+      for (; i < count; i++) {
+        if (!getVarint(p, end_, zz))
+          return false;
+        prev += (uint64_t)unzigzag(zz);
+        shares[i].*field = static_cast<T>(prev);
+      }
+    } else {
+      uint64_t delta = delta_, runLeft = runLeft_;
+      for (; i < count; i++) {
+        if (runLeft == 0) {
+          if (!getVarint(p, end_, zz) || !getVarint(p, end_, run))
+            return false;
+          delta   = (uint64_t)unzigzag(zz);
+          runLeft = run + 1;
+        }
+        prev += delta;
+        runLeft--;
+        shares[i].*field = static_cast<T>(prev);
+      }
+      delta_   = delta;
+      runLeft_ = runLeft;
+    }
+    p_    = p;
+    prev_ = prev;
+    return true;
+  }
+};
+
+bool preadFull(int fd, void *buf, size_t len, uint64_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    const ssize_t n = pread(fd, (char *)buf + done, len - done, offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+}  // namespace
+
+
+/////////////////////////////////  ShareLogV2  ////////////////////////////////
+const char ShareLogV2::kFileMagic_[8] = {'\xff', 'S', 'H', 'R', 'L', 'O', 'G', '2'};
+
+bool ShareLogV2::isV2File(const char *head, size_t len) {
+  return len >= sizeof(kFileMagic_) &&
+         memcmp(head, kFileMagic_, sizeof(kFileMagic_)) == 0;
+}
+
+uint32_t ShareLogV2::checksum(const uint8_t *data, size_t len) {
+  // 8 bytes a step, the payload is checked on every read
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 29;
+  }
+  for (; i < len; i++) {
+    h = (h ^ data[i]) * 0x100000001b3ULL;
+  }
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+bool ShareLogV2::mayHaveUser(const BlockHeader &header, int32_t userId) {
+  uint32_t b1, b2;
+  bloomBits(userId, b1, b2);
+  return (header.uidBloom_[b1 / 64] & (1ULL << (b1 % 64))) &&
+         (header.uidBloom_[b2 / 64] & (1ULL << (b2 % 64)));
+}
+
+void ShareLogV2::encodeBlock(const Share *shares, size_t count, string &out) {
+  assert(count > 0 && count <= kMaxBlockShares_);
+
+  BlockHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic_        = kDataBlockMagic_;
+  header.count_        = (uint32_t)count;
+  header.minTimestamp_ = UINT32_MAX;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t b1, b2;
+    bloomBits(shares[i].userId_, b1, b2);
+    header.uidBloom_[b1 / 64] |= (1ULL << (b1 % 64));
+    header.uidBloom_[b2 / 64] |= (1ULL << (b2 % 64));
+    header.minTimestamp_ = std::min(header.minTimestamp_, shares[i].timestamp_);
+    header.maxTimestamp_ = std::max(header.maxTimestamp_, shares[i].timestamp_);
+  }
+
+  // payload: the sizes of the columns, then the columns
+  const size_t headerPos  = out.size();
+  const size_t payloadPos = headerPos + sizeof(BlockHeader);
+  out.resize(payloadPos + sizeof(uint32_t) * kColumnNum);
+
+  uint32_t sizes[kColumnNum];
+  size_t pos = out.size();
+  for (int c = 0; c < kColumnNum; c++) {
+    switch (c) {
+      // userId first, the readers which filter by users decode it only
+      case 0: encodeColumn(shares, count, &Share::userId_,       out); break;
+      case 1: encodeColumn(shares, count, &Share::jobId_,        out); break;
+      case 2: encodeColumn(shares, count, &Share::workerHashId_, out); break;
+      case 3: encodeColumn(shares, count, &Share::ip_,           out); break;
+      case 4: encodeColumn(shares, count, &Share::share_,        out); break;
+      case 5: encodeColumn(shares, count, &Share::timestamp_,    out); break;
+      case 6: encodeColumn(shares, count, &Share::blkBits_,      out); break;
+      case 7: encodeColumn(shares, count, &Share::result_,       out); break;
+    }
+    sizes[c] = (uint32_t)(out.size() - pos);
+    pos = out.size();
+  }
+  memcpy(&out[payloadPos], sizes, sizeof(sizes));
+
+  header.size_     = (uint32_t)(out.size() - payloadPos);
+  header.checksum_ = checksum((const uint8_t *)out.data() + payloadPos, header.size_);
+  memcpy(&out[headerPos], &header, sizeof(BlockHeader));
+}
+
+bool ShareLogV2::decodeBlock(const BlockHeader &header, const uint8_t *payload,
+                             vector<Share> &shares, const std::set<int32_t> *uids) {
+  uint32_t sizes[kColumnNum];
+  if (header.magic_ != kDataBlockMagic_ || header.count_ > kMaxBlockShares_ ||
+      header.size_ < sizeof(sizes)) {
+    return false;
+  }
+  memcpy(sizes, payload, sizeof(sizes));
+
+  ColumnReader columns[kColumnNum];
+  const uint8_t *p   = payload + sizeof(sizes);
+  const uint8_t *end = payload + header.size_;
+  for (int c = 0; c < kColumnNum; c++) {
+    if (sizes[c] > (size_t)(end - p) || !columns[c].init(p, p + sizes[c]))
+      return false;
+    p += sizes[c];
+  }
+  if (p != end) {
+    return false;
+  }
+
+  const size_t base  = shares.size();
+  const size_t count = header.count_;
+  shares.resize(base + count);
+  Share *s = shares.data() + base;
+
+  if (!columns[0].read(s, count, &Share::userId_) || !columns[0].isDone()) {
+    shares.resize(base);
+    return false;
+  }
+  // no need to decode the other columns if no share is of the users
+  if (uids != nullptr) {
+    size_t i = 0;
+    while (i < count && uids->count(s[i].userId_) == 0)
+      i++;
+    if (i == count) {
+      shares.resize(base);
+      return true;
+    }
+  }
+
+  // 512 * 48 = 24 KB a tile
+  const size_t kTileShares = 512;
+  bool res = true;
+  for (size_t i = 0; res && i < count; i += kTileShares) {
+    const size_t n = std::min(kTileShares, count - i);
+    res = columns[1].read(s + i, n, &Share::jobId_) &&
+          columns[2].read(s + i, n, &Share::workerHashId_) &&
+          columns[3].read(s + i, n, &Share::ip_) &&
+          columns[4].read(s + i, n, &Share::share_) &&
+          columns[5].read(s + i, n, &Share::timestamp_) &&
+          columns[6].read(s + i, n, &Share::blkBits_) &&
+          columns[7].read(s + i, n, &Share::result_);
+  }
+  for (int c = 1; res && c < kColumnNum; c++) {
+    res = columns[c].isDone();
+  }
+  if (!res) {
+    shares.resize(base);
+    return false;
+  }
+
+  if (uids != nullptr) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (uids->count(s[i].userId_))
+        s[n++] = s[i];
+    }
+    shares.resize(base + n);
+  }
+  return true;
+}
+
+void ShareLogV2::encodeIndex(const vector<BlockIndex> &index,
+                             uint64_t indexOffset, string &out) {
+  BlockHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic_        = kIndexBlockMagic_;
+  header.count_        = (uint32_t)index.size();
+  header.size_         = (uint32_t)(index.size() * sizeof(BlockIndex));
+  header.minTimestamp_ = UINT32_MAX;
+  for (const auto &bi : index) {
+    for (size_t i = 0; i < kBloomBits_ / 64; i++) {
+      header.uidBloom_[i] |= bi.header_.uidBloom_[i];
+    }
+    header.minTimestamp_ = std::min(header.minTimestamp_, bi.header_.minTimestamp_);
+    header.maxTimestamp_ = std::max(header.maxTimestamp_, bi.header_.maxTimestamp_);
+  }
+  header.checksum_ = checksum((const uint8_t *)index.data(), header.size_);
+
+  Trailer trailer;
+  trailer.magic_       = kTrailerMagic_;
+  trailer.count_       = header.count_;
+  trailer.indexOffset_ = indexOffset;
+
+  out.append((const char *)&header, sizeof(header));
+  out.append((const char *)index.data(), header.size_);
+  out.append((const char *)&trailer, sizeof(trailer));
+}
+
+bool ShareLogV2::decodeIndex(const BlockHeader &header, const uint8_t *payload,
+                             vector<BlockIndex> &index) {
+  if (header.magic_ != kIndexBlockMagic_ ||
+      header.size_ != header.count_ * sizeof(BlockIndex)) {
+    return false;
+  }
+  index.resize(header.count_);
+  memcpy(index.data(), payload, header.size_);
+  return true;
+}
+
+
+//////////////////////////////  ShareLogReader  ///////////////////////////////
+ShareLogReader::ShareLogReader(const string &filePath)
+: filePath_(filePath), fd_(-1), version_(0), position_(0), indexPos_(0),
+skippedBlocks_(0)
+{
+}
+
+ShareLogReader::~ShareLogReader() {
+  if (fd_ != -1)
+    close(fd_);
+}
+
+bool ShareLogReader::openFile() {
+  fd_ = open(filePath_.c_str(), O_RDONLY);
+  if (fd_ == -1) {
+    LOG(ERROR) << "open file fail: " << filePath_ << ", " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool ShareLogReader::detectVersion(uint64_t fileSize) {
+  char head[sizeof(ShareLogV2::kFileMagic_)];
+  const size_t len = std::min<uint64_t>(fileSize, sizeof(head));
+  if (len == 0 || !preadFull(fd_, head, len, 0)) {
+    return false;
+  }
+  if (len < sizeof(head)) {
+    // the magic may be being written
+    if (memcmp(head, ShareLogV2::kFileMagic_, len) == 0)
+      return false;
+    version_ = 1;
+  } else {
+    version_ = ShareLogV2::isV2File(head, len) ? 2 : 1;
+  }
+  position_ = (version_ == 2 ? sizeof(head) : 0);
+  return true;
+}
+
+bool ShareLogReader::loadIndex(uint64_t fileSize) {
+  using Hdr = ShareLogV2::BlockHeader;
+  ShareLogV2::Trailer trailer;
+  if (fileSize < sizeof(ShareLogV2::kFileMagic_) + sizeof(Hdr) + sizeof(trailer) ||
+      !preadFull(fd_, &trailer, sizeof(trailer), fileSize - sizeof(trailer)) ||
+      trailer.magic_ != ShareLogV2::kTrailerMagic_) {
+    return false;  // not closed by the writer
+  }
+
+  Hdr header;
+  const uint64_t indexEnd = fileSize - sizeof(trailer);
+  if (trailer.indexOffset_ + sizeof(Hdr) > indexEnd ||
+      !preadFull(fd_, &header, sizeof(Hdr), trailer.indexOffset_) ||
+      trailer.indexOffset_ + sizeof(Hdr) + header.size_ != indexEnd) {
+    LOG(WARNING) << "invalid index, scan the blocks: " << filePath_;
+    return false;
+  }
+
+  buf_.resize(header.size_);
+  if (!preadFull(fd_, (char *)buf_.data(), header.size_, trailer.indexOffset_ + sizeof(Hdr)) ||
+      ShareLogV2::checksum((const uint8_t *)buf_.data(), header.size_) != header.checksum_ ||
+      !ShareLogV2::decodeIndex(header, (const uint8_t *)buf_.data(), index_)) {
+    LOG(WARNING) << "invalid index, scan the blocks: " << filePath_;
+    index_.clear();
+    return false;
+  }
+  indexPos_ = 0;
+  return true;
+}
+
+int ShareLogReader::nextBlock(uint64_t fileSize, ShareLogV2::BlockHeader &header) {
+  while (position_ < fileSize) {
+    const size_t len = std::min<uint64_t>(fileSize - position_, sizeof(header));
+    if (len < sizeof(uint32_t) || !preadFull(fd_, &header, len, position_)) {
+      return 0;
+    }
+    if (header.magic_ == ShareLogV2::kTrailerMagic_) {
+      if (len < sizeof(ShareLogV2::Trailer))
+        return 0;
+      position_ += sizeof(ShareLogV2::Trailer);
+      continue;
+    }
+    if (header.magic_ != ShareLogV2::kDataBlockMagic_ &&
+        header.magic_ != ShareLogV2::kIndexBlockMagic_) {
+      LOG(ERROR) << "invalid block at " << position_ << ": " << filePath_;
+      return -1;
+    }
+    if (len < sizeof(header) ||
+        position_ + sizeof(header) + header.size_ > fileSize) {
+      return 0;  // being written
+    }
+    return 1;
+  }
+  return 0;
+}
+
+bool ShareLogReader::readBlock(uint64_t offset, const ShareLogV2::BlockHeader &header,
+                               vector<Share> &shares, const std::set<int32_t> *uids) {
+  buf_.resize(header.size_);
+  if (!preadFull(fd_, (char *)buf_.data(), header.size_, offset + sizeof(header))) {
+    LOG(ERROR) << "read block fail at " << offset << ": " << filePath_;
+    return false;
+  }
+  const uint8_t *payload = (const uint8_t *)buf_.data();
+  if (ShareLogV2::checksum(payload, header.size_) != header.checksum_ ||
+      !ShareLogV2::decodeBlock(header, payload, shares, uids)) {
+    LOG(ERROR) << "invalid block at " << offset << ": " << filePath_;
+    return false;
+  }
+  return true;
+}
+
+static bool mayHaveUsers(const ShareLogV2::BlockHeader &header,
+                         const std::set<int32_t> &uids) {
+  for (const int32_t uid : uids) {
+    if (ShareLogV2::mayHaveUser(header, uid))
+      return true;
+  }
+  return false;
+}
+
+int64_t ShareLogReader::readV1(uint64_t fileSize, vector<Share> &shares,
+                               size_t maxShares, const std::set<int32_t> *uids) {
+  // with uids, until some shares of the users are read
+  while (shares.empty()) {
+    const size_t num = std::min<uint64_t>((fileSize - position_) / sizeof(Share), maxShares);
+    if (num == 0) {
+      return 0;
+    }
+    shares.resize(num);
+    if (!preadFull(fd_, shares.data(), num * sizeof(Share), position_)) {
+      LOG(ERROR) << "read file fail: " << filePath_ << ", " << strerror(errno);
+      shares.clear();
+      return -1;
+    }
+    position_ += num * sizeof(Share);
+
+    if (uids != nullptr) {
+      size_t n = 0;
+      for (size_t i = 0; i < num; i++) {
+        if (uids->count(shares[i].userId_))
+          shares[n++] = shares[i];
+      }
+      shares.resize(n);
+    }
+  }
+  return shares.size();
+}
+
+int64_t ShareLogReader::readV2(uint64_t fileSize, vector<Share> &shares,
+                               size_t maxShares, const std::set<int32_t> *uids) {
+  // the blocks in the index of a closed file, no need to read their headers
+  while (indexPos_ < index_.size() && shares.size() < maxShares) {
+    const ShareLogV2::BlockIndex &bi = index_[indexPos_++];
+    if (uids != nullptr && !mayHaveUsers(bi.header_, *uids)) {
+      skippedBlocks_++;
+    } else if (!readBlock(bi.offset_, bi.header_, shares, uids)) {
+      return -1;
+    }
+    position_ = bi.offset_ + sizeof(bi.header_) + bi.header_.size_;
+  }
+  if (indexPos_ == index_.size()) {
+    index_.clear();
+    indexPos_ = 0;
+  }
+
+  // the rest (the index and the trailer, or blocks appended later) is scanned
+  ShareLogV2::BlockHeader header;
+  while (index_.empty() && shares.size() < maxShares) {
+    const int res = nextBlock(fileSize, header);
+    if (res <= 0) {
+      if (res < 0)
+        return -1;
+      break;
+    }
+    if (header.magic_ == ShareLogV2::kDataBlockMagic_) {
+      if (uids != nullptr && !mayHaveUsers(header, *uids)) {
+        skippedBlocks_++;
+      } else if (!readBlock(position_, header, shares, uids)) {
+        return -1;
+      }
+    }
+    position_ += sizeof(header) + header.size_;
+  }
+  return shares.size();
+}
+
+int64_t ShareLogReader::read(vector<Share> &shares, size_t maxShares,
+                             const std::set<int32_t> *uids) {
+  shares.clear();
+  if (fd_ == -1 && !openFile()) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    LOG(ERROR) << "fstat fail: " << filePath_ << ", " << strerror(errno);
+    return -1;
+  }
+  const uint64_t fileSize = st.st_size;
+
+  if (version_ == 0) {
+    if (!detectVersion(fileSize))
+      return 0;
+    if (version_ == 2)
+      loadIndex(fileSize);
+  }
+
+  if (version_ == 1)
+    return readV1(fileSize, shares, maxShares, uids);
+  return readV2(fileSize, shares, maxShares, uids);
+}
+
+bool ShareLogReader::scanBlocks(vector<ShareLogV2::BlockIndex> &index,
+                                uint64_t &endOffset) {
+  index.clear();
+  struct stat st;
+  if ((fd_ == -1 && !openFile()) || fstat(fd_, &st) != 0) {
+    return false;
+  }
+  const uint64_t fileSize = st.st_size;
+  if ((version_ == 0 && !detectVersion(fileSize)) || version_ != 2) {
+    return false;
+  }
+
+  ShareLogV2::BlockIndex bi;
+  int res;
+  while ((res = nextBlock(fileSize, bi.header_)) > 0) {
+    if (bi.header_.magic_ == ShareLogV2::kDataBlockMagic_) {
+      bi.offset_ = position_;
+      index.push_back(bi);
+    }
+    position_ += sizeof(bi.header_) + bi.header_.size_;
+  }
+  endOffset = position_;
+  return res == 0;
+}
+
+bool ShareLogReader::isReachEOF() {
+  struct stat st;
+  const int res = (fd_ != -1) ? fstat(fd_, &st) : stat(filePath_.c_str(), &st);
+  if (res != 0) {
+    LOG(ERROR) << "stat fail: " << filePath_;
+    return true;  // if error we consider as EOF
+  }
+  if (version_ == 0) {
+    return st.st_size == 0;
+  }
+  return position_ == (uint64_t)st.st_size;
+}
+
+
+/////////////////////////////  ShareLogWatcher  ///////////////////////////////
+const int ShareLogWatcher::kFileModified_;
+const int ShareLogWatcher::kFileCreated_;
+
+ShareLogWatcher::ShareLogWatcher(const string &dataDir)
+: dataDir_(dataDir), fd_(-1), wd_(-1)
+{
+}
+
+ShareLogWatcher::~ShareLogWatcher() {
+  if (fd_ != -1)
+    close(fd_);  // the watch is removed with it
+}
+
+bool ShareLogWatcher::init() {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ == -1) {
+    LOG(ERROR) << "inotify_init1 fail: " << strerror(errno);
+    return false;
+  }
+  // the directory rather than the file: the next day's file is created in it
+  wd_ = inotify_add_watch(fd_, dataDir_.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO);
+  if (wd_ == -1) {
+    LOG(ERROR) << "inotify_add_watch fail: " << dataDir_ << ", " << strerror(errno);
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+int ShareLogWatcher::wait(int timeoutMs) {
+  if (fd_ == -1) {
+    usleep(timeoutMs * 1000);
+    return 0;
+  }
+
+  struct pollfd pfd;
+  pfd.fd      = fd_;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, timeoutMs) <= 0)
+    return 0;  // timeout or interrupted
+
+  // drain all the events, a write of the writer may be many of them
+  int changes = 0;
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  while (true) {
+    const ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+    for (const char *p = buf; p < buf + len; ) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      if (event->mask & IN_MODIFY)
+        changes |= kFileModified_;
+      if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        changes |= kFileCreated_;
+      if (event->mask & IN_Q_OVERFLOW)
+        changes |= kFileModified_ | kFileCreated_;
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return changes;
+}
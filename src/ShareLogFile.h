@@ -0,0 +1,179 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#ifndef SHARE_LOG_FILE_H_
+#define SHARE_LOG_FILE_H_
+
+#include "Common.h"
+#include "Stratum.h"
+
+#include <set>
+
+//
+// Sharelog file formats.
+//
+// v1: Share structs, one after another.
+//
+// v2: kFileMagic_, then blocks. A data block has the shares committed
+// together (at most kMaxBlockShares_), stored column by column, every
+// column as zigzag-varint deltas, or runs of them. The block header has the
+// min/max timestamp and a bloom filter of the userIds, so readers skip
+// the blocks they don't need without reading their payload. userId is the
+// first column, the other columns of a block without the users aren't
+// decoded either.
+//
+// When the writer closes a file, an index block (offsets and headers of all
+// the data blocks) and a trailer pointing to it are appended. If the file
+// is appended again later, the old index block and trailer are skipped.
+//
+class ShareLogV2 {
+public:
+  static const char     kFileMagic_[8];
+  static const uint32_t kDataBlockMagic_  = 0x32424c53u;  // "SLB2"
+  static const uint32_t kIndexBlockMagic_ = 0x32494c53u;  // "SLI2"
+  static const uint32_t kTrailerMagic_    = 0x32544c53u;  // "SLT2"
+  static const size_t   kMaxBlockShares_  = 65536;
+  static const size_t   kBloomBits_       = 2048;
+
+  struct BlockHeader {
+    uint32_t magic_;
+    uint32_t size_;      // of the payload after the header
+    uint32_t count_;     // shares, or index entries
+    uint32_t checksum_;  // of the payload
+    uint32_t minTimestamp_;
+    uint32_t maxTimestamp_;
+    uint64_t uidBloom_[kBloomBits_ / 64];
+  };
+
+  struct BlockIndex {
+    uint64_t offset_;
+    BlockHeader header_;
+  };
+
+  struct Trailer {
+    uint32_t magic_;
+    uint32_t count_;        // index entries
+    uint64_t indexOffset_;  // of the index block
+  };
+
+  static bool isV2File(const char *head, size_t len);
+
+  // append a data block of the shares to out
+  static void encodeBlock(const Share *shares, size_t count, string &out);
+  // append an index block and the trailer to out
+  static void encodeIndex(const vector<BlockIndex> &index, uint64_t indexOffset,
+                          string &out);
+  // append the shares of a data block to shares, only the shares of
+  // the users if uids isn't null
+  static bool decodeBlock(const BlockHeader &header, const uint8_t *payload,
+                          vector<Share> &shares,
+                          const std::set<int32_t> *uids = nullptr);
+  static bool decodeIndex(const BlockHeader &header, const uint8_t *payload,
+                          vector<BlockIndex> &index);
+
+  static uint32_t checksum(const uint8_t *data, size_t len);
+  // false if no share of the block is of the user
+  static bool mayHaveUser(const BlockHeader &header, int32_t userId);
+};
+
+
+//////////////////////////////  ShareLogReader  ///////////////////////////////
+//
+// Reads the shares of a sharelog file of either format, also while the
+// file is still being written: an incomplete share or block at the end is
+// read next time.
+//
+class ShareLogReader {
+  string filePath_;
+  int fd_;
+  int version_;        // 1 or 2, 0 if unknown yet (empty file)
+  uint64_t position_;  // where to read next
+
+  // v2 only
+  vector<ShareLogV2::BlockIndex> index_;  // from the trailer, if any
+  size_t indexPos_;
+  string buf_;
+  uint64_t skippedBlocks_;
+
+  bool openFile();
+  bool detectVersion(uint64_t fileSize);
+  bool loadIndex(uint64_t fileSize);
+  // 1 if a complete block is at position_ (trailers are skipped),
+  // 0 if not yet, -1 if the file is corrupted
+  int nextBlock(uint64_t fileSize, ShareLogV2::BlockHeader &header);
+  int64_t readV1(uint64_t fileSize, vector<Share> &shares, size_t maxShares,
+                 const std::set<int32_t> *uids);
+  int64_t readV2(uint64_t fileSize, vector<Share> &shares, size_t maxShares,
+                 const std::set<int32_t> *uids);
+  bool readBlock(uint64_t offset, const ShareLogV2::BlockHeader &header,
+                 vector<Share> &shares, const std::set<int32_t> *uids);
+
+public:
+  explicit ShareLogReader(const string &filePath);
+  ~ShareLogReader();
+
+  // Replaces shares with the next ones, at most maxShares of a v1 file, or
+  // the whole blocks of a v2 file until there are at least maxShares.
+  // With uids, only the shares of the users are returned.
+  // Returns the number of shares, 0 if nothing new, -1 on error.
+  int64_t read(vector<Share> &shares, size_t maxShares,
+               const std::set<int32_t> *uids = nullptr);
+
+  // The data blocks of a v2 file and where the last complete one ends,
+  // for the writer to append after it.
+  bool scanBlocks(vector<ShareLogV2::BlockIndex> &index, uint64_t &endOffset);
+
+  bool isReachEOF();
+  int version() const { return version_; }
+  uint64_t position() const { return position_; }
+  uint64_t skippedBlocks() const { return skippedBlocks_; }
+};
+
+
+/////////////////////////////  ShareLogWatcher  ///////////////////////////////
+//
+// Waits, by inotify, for the sharelog files of a directory to be appended
+// or created, so a reader tails them as soon as the data is written rather
+// than by polling. If inotify isn't available (or on NFS, where it doesn't
+// see remote writes) wait() just times out, like sleeping.
+//
+class ShareLogWatcher {
+  string dataDir_;
+  int fd_;
+  int wd_;
+
+public:
+  static const int kFileModified_ = 0x01;
+  static const int kFileCreated_  = 0x02;
+
+  explicit ShareLogWatcher(const string &dataDir);
+  ~ShareLogWatcher();
+
+  bool init();
+  bool isWatching() const { return fd_ != -1; }
+  // Waits at most timeoutMs for the files to be changed. Returns the
+  // changes seen (kFileModified_ | kFileCreated_), 0 if timeout.
+  int wait(int timeoutMs);
+};
+
+#endif
@@ -0,0 +1,415 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "ShmRing.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <glog/logging.h>
+
+static int futexWait(atomic<uint32_t> *addr, uint32_t val, int timeoutMs) {
+  struct timespec ts;
+  ts.tv_sec  = timeoutMs / 1000;
+  ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+  // not FUTEX_PRIVATE_FLAG, it's shared between processes
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, &ts, nullptr, 0);
+}
+
+static int futexWakeAll(atomic<uint32_t> *addr) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+/////////////////////////////////// ShmRing ////////////////////////////////////
+ShmRing::ShmRing(): isWriter_(false), lockFd_(-1), control_(nullptr),
+generation_(0), mem_(nullptr), memSize_(0), header_(nullptr), readSeq_(0)
+{
+}
+
+ShmRing::~ShmRing() {
+  close();
+}
+
+void ShmRing::closeRing() {
+  if (mem_ != nullptr) {
+    munmap(mem_, memSize_);
+  }
+  mem_        = nullptr;
+  header_     = nullptr;
+  memSize_    = 0;
+  generation_ = 0;
+}
+
+void ShmRing::close() {
+  closeRing();
+  if (control_ != nullptr) {
+    munmap(control_, sizeof(Control));
+  }
+  control_ = nullptr;
+  // releases the flock
+  if (lockFd_ != -1) {
+    ::close(lockFd_);
+  }
+  lockFd_ = -1;
+}
+
+void ShmRing::unlink(const string &name) {
+  ShmRing ring;
+  ring.name_ = name;
+  if (ring.openControl(false) && ring.control_->generation_ > 0) {
+    shm_unlink(ring.ringName(ring.control_->generation_).c_str());
+  }
+  shm_unlink(name.c_str());
+}
+
+ShmRing::Slot *ShmRing::getSlot(uint64_t seq) const {
+  const size_t slotBytes = sizeof(Slot) + header_->slotSize_;
+  return (Slot *)((char *)mem_ + sizeof(Header) +
+                  (seq % header_->slotNum_) * slotBytes);
+}
+
+string ShmRing::ringName(uint32_t generation) const {
+  return name_ + "." + std::to_string(generation);
+}
+
+void *ShmRing::mapSegment(const string &name, int fd, size_t size, bool writable) {
+  void *mem = mmap(nullptr, size, writable ? PROT_READ|PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+    LOG(ERROR) << "mmap shm failure: " << name << ", err: " << strerror(errno);
+    return nullptr;
+  }
+  return mem;
+}
+
+bool ShmRing::openControl(bool isWriter) {
+  int fd = shm_open(name_.c_str(), isWriter ? O_CREAT|O_RDWR : O_RDONLY, 0644);
+  if (fd == -1) {
+    LOG(ERROR) << "shm_open failure: " << name_ << ", err: " << strerror(errno);
+    return false;
+  }
+
+  if (isWriter && flock(fd, LOCK_EX|LOCK_NB) == -1) {
+    LOG(ERROR) << "shm ring is locked by another writer: " << name_
+    << ", err: " << strerror(errno);
+    ::close(fd);
+    return false;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  if (isWriter && (size_t)st.st_size != sizeof(Control)) {
+    // not a control object, e.g. a ring of version 1. replace it, the readers
+    // which have mapped it are not affected.
+    if (st.st_size != 0) {
+      LOG(WARNING) << "replace invalid shm ring: " << name_;
+      ::close(fd);
+      shm_unlink(name_.c_str());
+      fd = shm_open(name_.c_str(), O_CREAT|O_EXCL|O_RDWR, 0644);
+      if (fd == -1 || flock(fd, LOCK_EX|LOCK_NB) == -1) {
+        LOG(ERROR) << "create shm ring failure: " << name_ << ", err: " << strerror(errno);
+        if (fd != -1) {
+          ::close(fd);
+        }
+        return false;
+      }
+    }
+    // a new object is zero filled, readers don't map it while it's empty
+    if (ftruncate(fd, sizeof(Control)) == -1) {
+      LOG(ERROR) << "ftruncate shm failure: " << name_ << ", err: " << strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    st.st_size = sizeof(Control);
+  }
+  if ((size_t)st.st_size != sizeof(Control)) {
+    LOG(ERROR) << "invalid shm ring: " << name_;
+    ::close(fd);
+    return false;
+  }
+
+  control_ = (Control *)mapSegment(name_, fd, sizeof(Control), isWriter);
+  if (control_ == nullptr) {
+    ::close(fd);
+    return false;
+  }
+
+  if (isWriter) {
+    lockFd_ = fd;  // hold the flock until close()
+    if (control_->magic_ != kControlMagic_ || control_->version_ != kVersion_) {
+      control_->version_    = kVersion_;
+      control_->generation_ = 0;
+      std::atomic_thread_fence(std::memory_order_release);
+      control_->magic_      = kControlMagic_;
+    }
+    return true;
+  }
+
+  ::close(fd);
+  if (control_->magic_ != kControlMagic_ || control_->version_ != kVersion_) {
+    LOG(ERROR) << "invalid shm ring: " << name_;
+    return false;
+  }
+  return true;
+}
+
+bool ShmRing::attachRing() {
+  const uint32_t generation = control_->generation_.load(std::memory_order_acquire);
+  if (generation == 0) {
+    LOG(ERROR) << "shm ring is not initialized: " << name_;
+    return false;
+  }
+  const string name = ringName(generation);
+
+  // the futex word lives in the segment, so map it writable
+  int fd = shm_open(name.c_str(), O_RDWR, 0644);
+  if (fd == -1) {
+    LOG(ERROR) << "shm_open failure: " << name << ", err: " << strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+  if ((size_t)st.st_size < sizeof(Header)) {
+    LOG(ERROR) << "invalid shm ring: " << name;
+    ::close(fd);
+    return false;
+  }
+  void *mem = mapSegment(name, fd, st.st_size, true);
+  ::close(fd);
+  if (mem == nullptr) {
+    return false;
+  }
+
+  Header *header = (Header *)mem;
+  if (header->magic_ != kMagic_ || header->version_ != kVersion_ ||
+      (size_t)st.st_size < sizeof(Header) + (size_t)header->slotNum_ *
+                           (sizeof(Slot) + header->slotSize_)) {
+    LOG(ERROR) << "invalid shm ring: " << name;
+    munmap(mem, st.st_size);
+    return false;
+  }
+
+  closeRing();
+  mem_        = mem;
+  memSize_    = st.st_size;
+  header_     = header;
+  generation_ = generation;
+  return true;
+}
+
+bool ShmRing::createRing(uint32_t slotNum, uint32_t slotSize) {
+  const uint32_t oldGeneration = control_->generation_;
+  const uint32_t generation = oldGeneration + 1;
+  const string name = ringName(generation);
+  const size_t size = sizeof(Header) + (size_t)slotNum * (sizeof(Slot) + slotSize);
+
+  // may be left by a writer which died before switching to it
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT|O_EXCL|O_RDWR, 0644);
+  if (fd == -1) {
+    LOG(ERROR) << "shm_open failure: " << name << ", err: " << strerror(errno);
+    return false;
+  }
+  if (ftruncate(fd, size) == -1) {
+    LOG(ERROR) << "ftruncate shm failure: " << name << ", err: " << strerror(errno);
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void *mem = mapSegment(name, fd, size, true);
+  ::close(fd);
+  if (mem == nullptr) {
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // a new object is zero filled
+  Header *header = (Header *)mem;
+  header->version_  = kVersion_;
+  header->slotNum_  = slotNum;
+  header->slotSize_ = slotSize;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic_    = kMagic_;
+
+  // switch the readers to it, wake up the ones waiting on the old ring
+  control_->generation_.store(generation, std::memory_order_release);
+  if (header_ != nullptr) {
+    header_->futex_++;
+    futexWakeAll(&header_->futex_);
+  }
+  closeRing();
+  // the readers keep their mapping until they switch
+  if (oldGeneration > 0) {
+    shm_unlink(ringName(oldGeneration).c_str());
+  }
+
+  mem_        = mem;
+  memSize_    = size;
+  header_     = header;
+  generation_ = generation;
+
+  LOG(INFO) << "create shm ring: " << name << ", slots: " << slotNum
+  << ", slot size: " << slotSize;
+  return true;
+}
+
+bool ShmRing::openWriter(const string &name, uint32_t slotNum, uint32_t slotSize) {
+  assert(slotNum > 0 && slotSize > 0);
+  close();
+  slotSize = (slotSize + 7) & ~7u;  // keep slots 8 bytes aligned
+  name_     = name;
+  isWriter_ = true;
+
+  if (!openControl(true)) {
+    close();
+    return false;
+  }
+
+  // continue the sequence of the last writer, readers may still map it
+  if (control_->generation_ > 0 && attachRing() &&
+      header_->slotNum_ == slotNum && header_->slotSize_ == slotSize) {
+    LOG(INFO) << "reuse shm ring: " << ringName(generation_)
+    << ", seq: " << header_->writeSeq_;
+    return true;
+  }
+
+  if (!createRing(slotNum, slotSize)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool ShmRing::openReader(const string &name) {
+  close();
+  name_     = name;
+  isWriter_ = false;
+
+  if (!openControl(false) || !attachRing()) {
+    close();
+    return false;
+  }
+
+  // start from the latest message
+  const uint64_t writeSeq = header_->writeSeq_;
+  readSeq_ = writeSeq > 0 ? writeSeq - 1 : 0;
+
+  LOG(INFO) << "open shm ring: " << ringName(generation_) << ", seq: " << readSeq_;
+  return true;
+}
+
+bool ShmRing::write(const void *data, size_t len) {
+  assert(isWriter_);
+  if (len > header_->slotSize_) {
+    LOG(ERROR) << "message is too large for shm ring: " << len
+    << " > " << header_->slotSize_;
+    return false;
+  }
+
+  const uint64_t seq = header_->writeSeq_;
+  Slot *slot = getSlot(seq);
+
+  slot->seq_.store(0, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(slot->data_, data, len);
+  slot->len_ = (uint32_t)len;
+  slot->seq_.store(seq + 1, std::memory_order_release);
+
+  header_->writeSeq_.store(seq + 1, std::memory_order_release);
+  header_->futex_++;
+  futexWakeAll(&header_->futex_);
+  return true;
+}
+
+bool ShmRing::read(string &data, int timeoutMs) {
+  assert(!isWriter_);
+
+  while (true) {
+    // the writer switched to a new ring, read it from the beginning
+    if (control_->generation_.load(std::memory_order_acquire) != generation_) {
+      if (!attachRing()) {
+        return false;
+      }
+      readSeq_ = 0;
+      LOG(INFO) << "switch to shm ring: " << ringName(generation_);
+    }
+
+    const uint32_t futexVal = header_->futex_.load(std::memory_order_acquire);
+    const uint64_t writeSeq = header_->writeSeq_.load(std::memory_order_acquire);
+
+    if (readSeq_ >= writeSeq) {
+      // a broken ring, catch up with the writer
+      if (readSeq_ > writeSeq) {
+        readSeq_ = writeSeq;
+      }
+      if (timeoutMs <= 0) {
+        return false;
+      }
+      // wait for the writer, return immediately if futex_ has been changed
+      if (futexWait(&header_->futex_, futexVal, timeoutMs) == -1 &&
+          errno == ETIMEDOUT) {
+        return false;
+      }
+      // woken up by a switch to a new ring, wait on that one
+      if (control_->generation_.load(std::memory_order_acquire) != generation_) {
+        continue;
+      }
+      timeoutMs = 0;  // don't wait again
+      continue;
+    }
+
+    // too slow, skip to the oldest one
+    if (writeSeq - readSeq_ > header_->slotNum_) {
+      LOG(WARNING) << "shm ring reader is too slow, skip "
+      << (writeSeq - header_->slotNum_ - readSeq_) << " messages";
+      readSeq_ = writeSeq - header_->slotNum_;
+    }
+
+    Slot *slot = getSlot(readSeq_);
+    const uint64_t seq1 = slot->seq_.load(std::memory_order_acquire);
+    if (seq1 != readSeq_ + 1) {
+      readSeq_++;  // overwritten, skip it
+      continue;
+    }
+    const uint32_t len = slot->len_;
+    if (len > header_->slotSize_) {
+      readSeq_++;
+      continue;
+    }
+    data.assign(slot->data_, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t seq2 = slot->seq_.load(std::memory_order_relaxed);
+    readSeq_++;
+
+    if (seq2 == seq1) {
+      return true;
+    }
+    // the slot was overwritten while we were copying it
+  }
+}
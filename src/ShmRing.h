@@ -0,0 +1,113 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+#include "Common.h"
+
+//
+// A single writer, multi reader broadcast ring in POSIX shared memory.
+//
+// Used to relay messages between processes on the same host, e.g. one sserver
+// consumes 'StratumJob' from kafka and publishes the pre-built jobs to the
+// other co-located sservers. Readers are woken up by a futex in the shared
+// header, so a new message is picked up within microseconds.
+//
+// Every slot is protected by a sequence number (seqlock), readers never block
+// the writer. A reader which falls behind more than slotNum messages skips to
+// the oldest one still in the ring.
+//
+// The shm object 'name' only holds the generation of the ring, the ring itself
+// is the object 'name.<generation>'. A writer which needs a different ring
+// creates the next generation and switches to it, a segment which readers have
+// mapped is never resized. The writer holds a flock on 'name', so there is only
+// one writer.
+//
+class ShmRing {
+  struct Control {
+    uint32_t magic_;
+    uint32_t version_;
+    atomic<uint32_t> generation_;  // 0: no ring yet
+  };
+
+  struct Header {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t slotNum_;
+    uint32_t slotSize_;          // max payload size of a slot
+    atomic<uint64_t> writeSeq_;  // how many messages are written
+    atomic<uint32_t> futex_;     // increased after every write
+  };
+
+  struct Slot {
+    // seq + 1 of the message in this slot, 0 while it's being written
+    atomic<uint64_t> seq_;
+    uint32_t len_;
+    char data_[0];
+  };
+
+  static const uint32_t kControlMagic_ = 0x434e5242u;  // "BRNC"
+  static const uint32_t kMagic_        = 0x474e5242u;  // "BRNG"
+  static const uint32_t kVersion_      = 2;
+
+  string name_;
+  bool   isWriter_;
+  int    lockFd_;       // the flock of the writer
+  Control *control_;
+  uint32_t generation_;  // of the mapped ring
+  void  *mem_;
+  size_t memSize_;
+  Header *header_;
+
+  uint64_t readSeq_;  // next message to read, reader only
+
+  Slot *getSlot(uint64_t seq) const;
+  string ringName(uint32_t generation) const;
+  void *mapSegment(const string &name, int fd, size_t size, bool writable);
+  bool openControl(bool isWriter);
+  bool createRing(uint32_t slotNum, uint32_t slotSize);
+  bool attachRing();
+  void closeRing();
+
+public:
+  ShmRing();
+  ~ShmRing();
+
+  // name: shm object name, like "/btcpool_sjob"
+  bool openWriter(const string &name, uint32_t slotNum, uint32_t slotSize);
+  // the reader starts from the latest message in the ring
+  bool openReader(const string &name);
+  void close();
+  // remove the shm objects of the ring
+  static void unlink(const string &name);
+
+  bool isOpen() const { return header_ != nullptr; }
+
+  // writer only
+  bool write(const void *data, size_t len);
+  // reader only. return false if timeout.
+  bool read(string &data, int timeoutMs);
+};
+
+#endif
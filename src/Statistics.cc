@@ -38,6 +38,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -1202,43 +1203,82 @@ void StatsServer::consumeCommonEvents(rd_kafka_message_t *rkmessage) {
   const char *message = (const char*)rkmessage->payload;
   DLOG(INFO) << "A New Common Event: " << string(message, rkmessage->len);
 
+  vector<WorkerUpdate> updates;
+  if (!parseWorkerUpdates(message, rkmessage->len, updates)) {
+    return;
+  }
+  for (const auto &update : updates) {
+    handleWorkerUpdate(update);
+  }
+}
+
+// check the fields and add it to updates
+static bool parseWorkerUpdate(JsonNode content,
+                              vector<StatsServer::WorkerUpdate> &updates) {
+  if (content["user_id"].type()     != Utilities::JS::type::Int ||
+      content["worker_id"].type()   != Utilities::JS::type::Int ||
+      content["worker_name"].type() != Utilities::JS::type::Str ||
+      content["miner_agent"].type() != Utilities::JS::type::Str) {
+    LOG(ERROR) << "common event `worker_update` missing some fields";
+    return false;
+  }
+
+  StatsServer::WorkerUpdate update;
+  update.userId_     = content["user_id"].int32();
+  update.workerId_   = content["worker_id"].int64();
+  update.workerName_ = filterWorkerName(content["worker_name"].str());
+  update.minerAgent_ = filterWorkerName(content["miner_agent"].str());
+  updates.push_back(update);
+  return true;
+}
+
+bool StatsServer::parseWorkerUpdates(const char *message, size_t len,
+                                     vector<WorkerUpdate> &updates) {
+  updates.clear();
+
   JsonNode r;
-  if (!JsonNode::parse(message, message + rkmessage->len, r)) {
+  if (!JsonNode::parse(message, message + len, r)) {
     LOG(ERROR) << "decode common event failure";
-    return;
+    return false;
   }
 
   // check fields
-  if (r["type"].type()    != Utilities::JS::type::Str ||
-      r["content"].type() != Utilities::JS::type::Obj) {
+  if (r["type"].type() != Utilities::JS::type::Str) {
     LOG(ERROR) << "common event missing some fields";
-    return;
+    return false;
   }
 
   // update worker status
   if (r["type"].str() == "worker_update") {
-    // check fields
-    if (r["content"]["user_id"].type()     != Utilities::JS::type::Int ||
-        r["content"]["worker_id"].type()   != Utilities::JS::type::Int ||
-        r["content"]["worker_name"].type() != Utilities::JS::type::Str ||
-        r["content"]["miner_agent"].type() != Utilities::JS::type::Str) {
-      LOG(ERROR) << "common event `worker_update` missing some fields";
-      return;
+    if (r["content"].type() != Utilities::JS::type::Obj) {
+      LOG(ERROR) << "common event missing some fields";
+      return false;
     }
-
-    int32_t userId    = r["content"]["user_id"].int32();
-    int64_t workerId  = r["content"]["worker_id"].int64();
-    string workerName = filterWorkerName(r["content"]["worker_name"].str());
-    string minerAgent = filterWorkerName(r["content"]["miner_agent"].str());
-
-    if (poolDBCommonEvents_ != nullptr) {
-      updateWorkerStatusToDB(userId, workerId, workerName.c_str(), minerAgent.c_str());
+    return parseWorkerUpdate(r["content"], updates);
+  }
+  // a batch of worker_update, content is an array of them. the broken ones
+  // are skipped
+  else if (r["type"].str() == "worker_update_batch") {
+    if (r["content"].type() != Utilities::JS::type::Array) {
+      LOG(ERROR) << "common event missing some fields";
+      return false;
     }
-    if (redisCommonEvents_ != nullptr) {
-      updateWorkerStatusToRedis(userId, workerId, workerName.c_str(), minerAgent.c_str());
+    for (JsonNode &content : *r["content"].children()) {
+      parseWorkerUpdate(content, updates);
     }
   }
+  return true;
+}
 
+void StatsServer::handleWorkerUpdate(const WorkerUpdate &update) {
+  if (poolDBCommonEvents_ != nullptr) {
+    updateWorkerStatusToDB(update.userId_, update.workerId_,
+                           update.workerName_.c_str(), update.minerAgent_.c_str());
+  }
+  if (redisCommonEvents_ != nullptr) {
+    updateWorkerStatusToRedis(update.userId_, update.workerId_,
+                              update.workerName_.c_str(), update.minerAgent_.c_str());
+  }
 }
 
 bool StatsServer::updateWorkerStatusToRedis(const int32_t userId, const int64_t workerId,
@@ -1637,47 +1677,316 @@ void StatsServer::run() {
 
 
 
-//////////////////////////////  ShareLogWriter  ///////////////////////////////
-ShareLogWriter::ShareLogWriter(const char *kafkaBrokers,
-                               const string &dataDir,
-                               const string &kafkaGroupID)
-:running_(true), dataDir_(dataDir),
-hlConsumer_(kafkaBrokers, KAFKA_TOPIC_SHARE_LOG, 0/* patition */, kafkaGroupID)
+////////////////////////////  ShareLogFileWriter  /////////////////////////////
+const uint64_t ShareLogFileWriter::kPreallocSize_;
+
+ShareLogFileWriter::ShareLogFileWriter(const string &dataDir, bool isFsync,
+                                       int fileVersion):
+dataDir_(dataDir), isFsync_(isFsync), fileVersion_(fileVersion), lastDay_(0),
+lastFile_(nullptr), pendingBytes_(0), committedShares_(0)
 {
+  if (fileVersion_ != 1 && fileVersion_ != 2) {
+    LOG(ERROR) << "invalid sharelog file version: " << fileVersion_ << ", use 1";
+    fileVersion_ = 1;
+  }
 }
 
-ShareLogWriter::~ShareLogWriter() {
-  // close file handlers
-  for (auto & itr : fileHandlers_) {
-    LOG(INFO) << "fclose file handler, date: " << date("%F", itr.first);
-    fclose(itr.second);
+ShareLogFileWriter::~ShareLogFileWriter() {
+  commit();
+  for (auto &itr : files_) {
+    closeFile(itr.first, itr.second);
   }
-  fileHandlers_.clear();
+  files_.clear();
 }
 
-void ShareLogWriter::stop() {
-  if (!running_)
+ShareLogFileWriter::DailyFile *ShareLogFileWriter::openFile(uint32_t day) {
+  auto itr = files_.find(day);
+  if (itr != files_.end()) {
+    return &itr->second;
+  }
+
+  const string filePath = getStatsFilePath(dataDir_, day);
+  LOG(INFO) << "open: " << filePath;
+
+  // not O_APPEND, we write at the end by pwrite()
+  const int fd = open(filePath.c_str(), O_WRONLY | O_CREAT, 0644);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    LOG(FATAL) << "open file fail: " << filePath << ", " << strerror(errno);
+    if (fd != -1)
+      close(fd);
+    return nullptr;
+  }
+
+  DailyFile &f = files_[day];
+  f.fd_        = fd;
+  f.size_      = st.st_size;
+  f.allocated_ = st.st_size;
+  f.buf_.reserve(kBufferSize_);
+  f.hasNewBlocks_ = false;
+  if (!initFile(filePath, st.st_size, f)) {
+    LOG(ERROR) << "invalid sharelog file: " << filePath;
+    close(fd);
+    files_.erase(day);
+    return nullptr;
+  }
+  return &f;
+}
+
+// copy [offset, end of file) to tailPath
+static bool copyFileTail(const string &filePath, uint64_t offset,
+                         const string &tailPath) {
+  FILE *in = fopen(filePath.c_str(), "rb");
+  if (in == nullptr || fseeko(in, (off_t)offset, SEEK_SET) != 0) {
+    LOG(ERROR) << "open file fail: " << filePath << ", " << strerror(errno);
+    if (in != nullptr)
+      fclose(in);
+    return false;
+  }
+  FILE *out = fopen(tailPath.c_str(), "wb");
+  if (out == nullptr) {
+    LOG(ERROR) << "open file fail: " << tailPath << ", " << strerror(errno);
+    fclose(in);
+    return false;
+  }
+
+  bool res = true;
+  char buf[64 * 1024];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    if (fwrite(buf, 1, n, out) != n) {
+      res = false;
+      break;
+    }
+  }
+  if (ferror(in) || fflush(out) != 0 || fsync(fileno(out)) != 0) {
+    res = false;
+  }
+  if (!res) {
+    LOG(ERROR) << "copy file fail: " << tailPath << ", " << strerror(errno);
+  }
+  fclose(out);
+  fclose(in);
+  return res;
+}
+
+bool ShareLogFileWriter::initFile(const string &filePath, uint64_t fileSize,
+                                  DailyFile &f) {
+  ShareLogReader reader(filePath);
+  uint64_t endOffset = 0;
+  const bool isScanned = (fileSize > 0 && reader.scanBlocks(f.index_, endOffset));
+
+  if (reader.version() == 0) {
+    // new file, or only a part of the v2 magic was written
+    f.version_ = fileVersion_;
+    f.size_    = 0;
+    if (f.version_ == 2) {
+      f.buf_.assign(ShareLogV2::kFileMagic_, sizeof(ShareLogV2::kFileMagic_));
+    }
+  } else {
+    f.version_ = reader.version();
+    if (f.version_ != fileVersion_) {
+      LOG(WARNING) << "append the existing file in v" << f.version_ << ": " << filePath;
+    }
+    if (f.version_ == 2) {
+      if (!isScanned) {
+        if (endOffset < sizeof(ShareLogV2::kFileMagic_)) {
+          return false;  // not scanned at all
+        }
+        // a broken block: the file goes on from the last good block, the
+        // rest is kept aside for a look
+        const string tailPath = Strings::Format("%s.tail.%ld", filePath.c_str(),
+                                                (long)time(nullptr));
+        LOG(ERROR) << "broken block at " << endOffset << " of " << filePath
+                   << ", copy the rest to " << tailPath;
+        if (!copyFileTail(filePath, endOffset, tailPath)) {
+          return false;
+        }
+      }
+      // drop the incomplete or broken block and what's after it
+      f.size_ = endOffset;
+    } else {
+      // drop the incomplete share of a crashed writer, or every share
+      // appended would be misaligned
+      f.size_ = fileSize - fileSize % sizeof(Share);
+    }
+  }
+
+  if (f.size_ < fileSize) {
+    LOG(WARNING) << "truncate " << filePath << " from " << fileSize << " to " << f.size_;
+    if (ftruncate(f.fd_, f.size_) != 0) {
+      LOG(ERROR) << "ftruncate fail: " << strerror(errno);
+      return false;
+    }
+    f.allocated_ = f.size_;
+  }
+  return true;
+}
+
+void ShareLogFileWriter::closeFile(uint32_t day, DailyFile &f) {
+  LOG(INFO) << "close file, date: " << date("%F", day);
+  // the index of the blocks for the readers
+  if (f.version_ == 2 && f.hasNewBlocks_ && f.buf_.empty() && f.shares_.empty()) {
+    ShareLogV2::encodeIndex(f.index_, f.size_, f.buf_);
+    if (!writeFile(f)) {
+      LOG(ERROR) << "write index fail, date: " << date("%F", day);
+    }
+  }
+  // release the preallocated space after the data
+  if (f.allocated_ > f.size_ && ftruncate(f.fd_, f.size_) != 0) {
+    LOG(ERROR) << "ftruncate fail, date: " << date("%F", day) << ", " << strerror(errno);
+  }
+  close(f.fd_);
+}
+
+void ShareLogFileWriter::closeOldFiles() {
+  while (files_.size() > kMaxOpenFiles_) {
+    // Maps (and sets) are sorted, so the first element is the smallest,
+    // and the last element is the largest.
+    auto itr = files_.begin();
+    if (itr->second.buf_.size() > 0 || itr->second.shares_.size() > 0) {
+      break;  // not written yet
+    }
+    if (lastFile_ == &itr->second) {
+      lastFile_ = nullptr;
+    }
+    closeFile(itr->first, itr->second);
+    files_.erase(itr);
+  }
+}
+
+bool ShareLogFileWriter::addShare(const Share &share) {
+  const uint32_t day = share.timestamp_ - (share.timestamp_ % 86400);
+  if (lastFile_ == nullptr || day != lastDay_) {
+    lastFile_ = openFile(day);
+    lastDay_  = day;
+    if (lastFile_ == nullptr)
+      return false;
+  }
+  if (lastFile_->version_ == 2) {
+    lastFile_->shares_.push_back(share);
+    if (lastFile_->shares_.size() == ShareLogV2::kMaxBlockShares_) {
+      encodeShares(*lastFile_);
+    }
+  } else {
+    lastFile_->buf_.append((const char *)&share, sizeof(Share));
+  }
+  pendingBytes_ += sizeof(Share);
+  return true;
+}
+
+void ShareLogFileWriter::encodeShares(DailyFile &f) {
+  if (f.shares_.empty()) {
     return;
+  }
+  ShareLogV2::BlockIndex bi;
+  bi.offset_ = f.size_ + f.buf_.size();
+  ShareLogV2::encodeBlock(f.shares_.data(), f.shares_.size(), f.buf_);
+  memcpy(&bi.header_, f.buf_.data() + (bi.offset_ - f.size_), sizeof(bi.header_));
+  f.index_.push_back(bi);
+  f.hasNewBlocks_ = true;
+  f.shares_.clear();
+}
 
-  running_ = false;
+bool ShareLogFileWriter::writeFile(DailyFile &f) {
+  const uint64_t newSize = f.size_ + f.buf_.size();
+
+  // preallocate, so the file isn't extended by every write
+  if (newSize > f.allocated_) {
+    const uint64_t allocSize = std::max<uint64_t>(kPreallocSize_, newSize - f.allocated_);
+    if (fallocate(f.fd_, FALLOC_FL_KEEP_SIZE, f.allocated_, allocSize) == 0) {
+      f.allocated_ += allocSize;
+    } else {
+      // e.g. not supported by the file system, just write
+      LOG(WARNING) << "fallocate fail: " << strerror(errno);
+      f.allocated_ = newSize;
+    }
+  }
+
+  size_t written = 0;
+  while (written < f.buf_.size()) {
+    const ssize_t n = pwrite(f.fd_, f.buf_.data() + written,
+                             f.buf_.size() - written, f.size_ + written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG(ERROR) << "pwrite fail: " << strerror(errno);
+      break;
+    }
+    written += n;
+  }
+
+  // the rest is written again next time
+  f.size_ += written;
+  f.buf_.erase(0, written);
+
+  if (f.buf_.size() > 0) {
+    return false;
+  }
+  if (isFsync_ && fdatasync(f.fd_) != 0) {
+    LOG(ERROR) << "fdatasync fail: " << strerror(errno);
+    return false;
+  }
+  return true;
 }
 
-FILE* ShareLogWriter::getFileHandler(uint32_t ts) {
-  if (fileHandlers_.find(ts) != fileHandlers_.end()) {
-    return fileHandlers_[ts];
+bool ShareLogFileWriter::commit() {
+  if (pendingBytes_ == 0) {
+    return true;
   }
 
-  const string filePath = getStatsFilePath(dataDir_, ts);
-  LOG(INFO) << "fopen: " << filePath;
+  const uint64_t startUs = getMonotonicTimeUs();
+  bool res = true;
+  for (auto &itr : files_) {
+    encodeShares(itr.second);
+    if (itr.second.buf_.size() > 0 && !writeFile(itr.second)) {
+      res = false;
+    }
+  }
+  commitLatency_.add(getMonotonicTimeUs() - startUs);
 
-  FILE *f = fopen(filePath.c_str(), "ab");  // append mode, bin file
-  if (f == nullptr) {
-    LOG(FATAL) << "fopen file fail: " << filePath;
-    return nullptr;
+  if (res) {
+    committedShares_ += pendingBytes_ / sizeof(Share);
+    pendingBytes_ = 0;
   }
 
-  fileHandlers_[ts] = f;
-  return f;
+  // should call this after write data
+  closeOldFiles();
+  return res;
+}
+
+string ShareLogFileWriter::toString() const {
+  return Strings::Format("shares: %" PRIu64", commit: %s",
+                         committedShares_, commitLatency_.toString().c_str());
+}
+
+void ShareLogFileWriter::resetStats() {
+  commitLatency_.reset();
+  committedShares_ = 0;
+}
+
+
+//////////////////////////////  ShareLogWriter  ///////////////////////////////
+ShareLogWriter::ShareLogWriter(const char *kafkaBrokers,
+                               const string &dataDir,
+                               const string &kafkaGroupID,
+                               int32_t commitIntervalMs, bool isFsync,
+                               int fileVersion)
+:running_(true), dataDir_(dataDir), kCommitIntervalMs_(commitIntervalMs),
+fileWriter_(dataDir, isFsync, fileVersion), lastOffset_(-1),
+hlConsumer_(kafkaBrokers, KAFKA_TOPIC_SHARE_LOG, 0/* patition */, kafkaGroupID,
+            false/* commit offsets after shares are on disk */)
+{
+}
+
+ShareLogWriter::~ShareLogWriter() {
+}
+
+void ShareLogWriter::stop() {
+  if (!running_)
+    return;
+
+  running_ = false;
 }
 
 void ShareLogWriter::consumeShareLog(rd_kafka_message_t *rkmessage) {
@@ -1704,65 +2013,41 @@ void ShareLogWriter::consumeShareLog(rd_kafka_message_t *rkmessage) {
     return;
   }
 
+  // the offset is done even the message is dropped
+  lastOffset_ = rkmessage->offset;
+
   if (rkmessage->len != sizeof(Share)) {
     LOG(ERROR) << "sharelog message size(" << rkmessage->len << ") is not: " << sizeof(Share);
     return;
   }
 
-  shares_.push_back(Share());
-  Share *share = &(*shares_.rbegin());
-
-  memcpy((uint8_t *)share, (const uint8_t *)rkmessage->payload, rkmessage->len);
+  Share share;
+  memcpy((uint8_t *)&share, (const uint8_t *)rkmessage->payload, rkmessage->len);
 
-  if (!share->isValid()) {
-    LOG(ERROR) << "invalid share: " << share->toString();
-    shares_.pop_back();
+  if (!share.isValid()) {
+    LOG(ERROR) << "invalid share: " << share.toString();
     return;
   }
-}
-
-void ShareLogWriter::tryCloseOldHanders() {
-  while (fileHandlers_.size() > 3) {
-    // Maps (and sets) are sorted, so the first element is the smallest,
-    // and the last element is the largest.
-    auto itr = fileHandlers_.begin();
-
-    LOG(INFO) << "fclose file handler, date: " << date("%F", itr->first);
-    fclose(itr->second);
-
-    fileHandlers_.erase(itr);
-  }
+  fileWriter_.addShare(share);
 }
 
 bool ShareLogWriter::flushToDisk() {
-  std::set<FILE*> usedHandlers;
-
-  for (const auto& share : shares_) {
-    const uint32_t ts = share.timestamp_ - (share.timestamp_ % 86400);
-    FILE *f = getFileHandler(ts);
-    if (f == nullptr)
-      return false;
-
-    usedHandlers.insert(f);
-    fwrite((uint8_t *)&share, sizeof(Share), 1, f);
+  if (!fileWriter_.commit()) {
+    return false;  // try again next time, the offset isn't committed
   }
 
-  shares_.clear();
-
-  for (auto & f : usedHandlers) {
-    fflush(f);
+  if (lastOffset_ >= 0) {
+    hlConsumer_.commitOffset(lastOffset_ + 1);
+    lastOffset_ = -1;
   }
-
-  // should call this after write data
-  tryCloseOldHanders();
-
   return true;
 }
 
 void ShareLogWriter::run() {
-  time_t lastFlushTime = time(nullptr);
-  const int32_t kFlushDiskInterval = 2;
-  const int32_t kTimeoutMs = 1000;
+  uint64_t lastFlushTimeUs = getMonotonicTimeUs();
+  time_t lastStatsTime = time(nullptr);
+  const time_t kStatsInterval = 3600;
+  const int32_t kTimeoutMs = 100;
 
   if (!hlConsumer_.setup()) {
     LOG(ERROR) << "setup sharelog consumer fail";
@@ -1771,12 +2056,19 @@ void ShareLogWriter::run() {
 
   while (running_) {
     //
-    // flush data to disk
+    // flush data to disk, group commit
     //
-    if (shares_.size() > 0 &&
-        time(nullptr) > kFlushDiskInterval + lastFlushTime) {
+    if (lastOffset_ >= 0 &&
+        (getMonotonicTimeUs() >= lastFlushTimeUs + kCommitIntervalMs_ * 1000 ||
+         fileWriter_.pendingBytes() >= ShareLogFileWriter::kBufferSize_)) {
       flushToDisk();
-      lastFlushTime = time(nullptr);
+      lastFlushTimeUs = getMonotonicTimeUs();
+    }
+
+    if (time(nullptr) >= lastStatsTime + kStatsInterval) {
+      LOG(INFO) << "sharelog writer, " << fileWriter_.toString();
+      fileWriter_.resetStats();
+      lastStatsTime = time(nullptr);
     }
 
     //
@@ -1797,8 +2089,7 @@ void ShareLogWriter::run() {
   }
 
   // flush left shares
-  if (shares_.size() > 0)
-    flushToDisk();
+  flushToDisk();
 }
 
 
@@ -1830,6 +2121,21 @@ void ShareStatsDay::processShare(uint32_t hourIdx, const Share &share) {
   modifyHoursFlag_ |= (0x01u << hourIdx);
 }
 
+void ShareStatsDay::merge(uint32_t hoursFlag, const HourShares *hours) {
+  ScopeLock sl(lock_);
+  for (uint32_t i = 0; i < 24; i++) {
+    if ((hoursFlag & (0x01u << i)) == 0)
+      continue;
+    shareAccept1h_[i] += hours[i].accept_;
+    shareReject1h_[i] += hours[i].reject_;
+    score1h_[i]       += hours[i].score_;
+    shareAccept1d_    += hours[i].accept_;
+    shareReject1d_    += hours[i].reject_;
+    score1d_          += hours[i].score_;
+  }
+  modifyHoursFlag_ |= hoursFlag;
+}
+
 void ShareStatsDay::getShareStatsHour(uint32_t hourIdx, ShareStats *stats) {
   ScopeLock sl(lock_);
   if (hourIdx > 23)
@@ -1871,45 +2177,26 @@ ShareLogDumper::~ShareLogDumper() {
 }
 
 void ShareLogDumper::dump2stdout() {
-  FILE *f = nullptr;
-
-  // open file
   LOG(INFO) << "open file: " << filePath_;
-  if ((f = fopen(filePath_.c_str(), "rb")) == nullptr) {
-    LOG(ERROR) << "open file fail: " << filePath_;
-    return;
-  }
+  ShareLogReader reader(filePath_);
 
   // 2000000 * 48 = 96,000,000 Bytes
-  const uint32_t kElements = 2000000;
-  size_t readNum;
-  string buf;
-  buf.resize(kElements * sizeof(Share));
-
-  while (1) {
-    readNum = fread((uint8_t *)buf.data(), sizeof(Share), kElements, f);
+  const size_t kElements = 2000000;
+  vector<Share> shares;
+  int64_t readNum;
 
-    if (readNum == 0) {
-      if (feof(f)) {
-        LOG(INFO) << "End-of-File reached: " << filePath_;
-        break;
-      }
-      LOG(INFO) << "read 0 bytes: " << filePath_;
-      continue;
+  // only the shares of the uids are read, the v2 blocks without them are
+  // skipped
+  while ((readNum = reader.read(shares, kElements,
+                                isDumpAll_ ? nullptr : &uids_)) > 0) {
+    for (const auto &share : shares) {
+      parseShare(&share);
     }
+  }
 
-    parseShareLog((uint8_t *)buf.data(), readNum * sizeof(Share));
-  };
-
-  fclose(f);
-}
-
-void ShareLogDumper::parseShareLog(const uint8_t *buf, size_t len) {
-  assert(len % sizeof(Share) == 0);
-  const size_t size = len / sizeof(Share);
-
-  for (size_t i = 0; i < size; i++) {
-    parseShare((Share *)(buf + sizeof(Share)*i));
+  if (readNum == 0) {
+    LOG(INFO) << "End-of-File reached: " << filePath_
+    << ", v" << reader.version() << ", skipped blocks: " << reader.skippedBlocks();
   }
 }
 
@@ -1928,7 +2215,9 @@ void ShareLogDumper::parseShare(const Share *share) {
 ///////////////////////////////  ShareLogParser  ///////////////////////////////
 ShareLogParser::ShareLogParser(const string &dataDir, time_t timestamp,
                                const MysqlConnectInfo &poolDBInfo)
-: date_(timestamp), f_(nullptr), buf_(nullptr), lastPosition_(0), poolDB_(poolDBInfo)
+: date_(timestamp), filePath_(getStatsFilePath(dataDir, timestamp)),
+reader_(filePath_), poolDB_(poolDBInfo), removeExpiredData_(true),
+lastRemoveTime_(0), batchShares_(0), lastMergeTimeUs_(0)
 {
   pthread_rwlock_init(&rwlock_, nullptr);
 
@@ -1937,18 +2226,12 @@ ShareLogParser::ShareLogParser(const string &dataDir, time_t timestamp,
     WorkerKey pkey(0, 0);
     workersStats_[pkey] = std::make_shared<ShareStatsDay>();
   }
-  filePath_ = getStatsFilePath(dataDir, timestamp);
 
   // prealloc memory
-  buf_ = (uint8_t *)malloc(kMaxElementsNum_ * sizeof(Share));
+  shares_.reserve(kMaxElementsNum_ + ShareLogV2::kMaxBlockShares_);
 }
 
 ShareLogParser::~ShareLogParser() {
-  if (f_)
-    fclose(f_);
-
-  if (buf_)
-    free(buf_);
 }
 
 bool ShareLogParser::init() {
@@ -1983,125 +2266,249 @@ bool ShareLogParser::init() {
   return true;
 }
 
-void ShareLogParser::parseShareLog(const uint8_t *buf, size_t len) {
-  assert(len % sizeof(Share) == 0);
-  const size_t size = len / sizeof(Share);
+void ShareLogParser::parseShare(const Share &share, SharesBatch &batch) {
+  if (!share.isValid()) {
+    LOG(ERROR) << "invalid share: " << share.toString();
+    return;
+  }
 
-  for (size_t i = 0; i < size; i++) {
-    parseShare((Share *)(buf + sizeof(Share)*i));
+  const WorkerKey wkey(share.userId_, share.workerHashId_);
+  auto itr = batch.workers_.find(wkey);
+  if (itr == batch.workers_.end()) {
+    itr = batch.workers_.emplace(wkey, WorkerShares()).first;
+  }
+  WorkerShares &worker = itr->second;
+  if (worker.hoursFlag_ == 0) {
+    batch.touched_.push_back(&(*itr));
   }
-}
 
-void ShareLogParser::parseShare(const Share *share) {
-  if (!share->isValid()) {
-    LOG(ERROR) << "invalid share: " << share->toString();
-    return;
+  const uint32_t hourIdx = getHourIdx(share.timestamp_);
+  ShareStatsDay::HourShares &hour = worker.hours_[hourIdx];
+  worker.hoursFlag_ |= (0x01u << hourIdx);
+
+  if (share.result_ == Share::Result::ACCEPT) {
+    if (share.blkBits_ != batch.blkBits_) {
+      BitsToDifficulty(share.blkBits_, &batch.networkDiff_);
+      batch.blkBits_ = share.blkBits_;
+    }
+    hour.accept_ += share.share_;
+    hour.score_  += share.score(batch.networkDiff_);
+  } else {
+    hour.reject_ += share.share_;
   }
+}
 
-  WorkerKey wkey(share->userId_, share->workerHashId_);
-  WorkerKey ukey(share->userId_, 0);
-  WorkerKey pkey(0, 0);
+bool ShareLogParser::parseBlocks(const uint8_t *data,
+                                 const vector<ShareLogV2::BlockIndex> &blocks,
+                                 size_t begin, size_t end, SharesBatch &batch,
+                                 size_t maxWorkers) {
+  vector<Share> shares;
+  shares.reserve(ShareLogV2::kMaxBlockShares_);
 
-  pthread_rwlock_wrlock(&rwlock_);
-  if (workersStats_.find(wkey) == workersStats_.end()) {
-    workersStats_[wkey] = std::make_shared<ShareStatsDay>();
+  for (size_t i = begin; i < end; i++) {
+    const ShareLogV2::BlockHeader &header = blocks[i].header_;
+    const uint8_t *payload = data + blocks[i].offset_ + sizeof(header);
+    shares.clear();
+    if (ShareLogV2::checksum(payload, header.size_) != header.checksum_ ||
+        !ShareLogV2::decodeBlock(header, payload, shares)) {
+      LOG(ERROR) << "invalid block at " << blocks[i].offset_ << ": " << filePath_;
+      return false;
+    }
+    for (const auto &share : shares) {
+      parseShare(share, batch);
+    }
+    releaseSharesBatch(batch, maxWorkers);
   }
-  if (workersStats_.find(ukey) == workersStats_.end()) {
-    workersStats_[ukey] = std::make_shared<ShareStatsDay>();
+  return true;
+}
+
+void ShareLogParser::mergeSharesBatch(SharesBatch &batch) {
+  // the stats of the new workers and users
+  pthread_rwlock_wrlock(&rwlock_);
+  for (auto *itr : batch.touched_) {
+    WorkerShares &worker = itr->second;
+    if (worker.worker_ != nullptr)
+      continue;
+    const WorkerKey ukey(itr->first.userId_, 0);
+    for (const WorkerKey &key : {itr->first, ukey}) {
+      if (workersStats_.find(key) == workersStats_.end()) {
+        workersStats_[key] = std::make_shared<ShareStatsDay>();
+      }
+    }
+    worker.worker_ = workersStats_[itr->first];
+    worker.user_   = workersStats_[ukey];
   }
+  shared_ptr<ShareStatsDay> pool = workersStats_[WorkerKey(0, 0)];
   pthread_rwlock_unlock(&rwlock_);
 
-  const uint32_t hourIdx = getHourIdx(share->timestamp_);
-  workersStats_[wkey]->processShare(hourIdx, *share);
-  workersStats_[ukey]->processShare(hourIdx, *share);
-  workersStats_[pkey]->processShare(hourIdx, *share);
+  uint32_t poolHoursFlag = 0;
+  ShareStatsDay::HourShares poolHours[24];
+  memset(poolHours, 0, sizeof(poolHours));
+
+  for (auto *itr : batch.touched_) {
+    WorkerShares &worker = itr->second;
+    worker.worker_->merge(worker.hoursFlag_, worker.hours_);
+    worker.user_->merge(worker.hoursFlag_, worker.hours_);
+
+    for (uint32_t i = 0; i < 24; i++) {
+      if ((worker.hoursFlag_ & (0x01u << i)) == 0)
+        continue;
+      poolHours[i].accept_ += worker.hours_[i].accept_;
+      poolHours[i].reject_ += worker.hours_[i].reject_;
+      poolHours[i].score_  += worker.hours_[i].score_;
+      memset(&worker.hours_[i], 0, sizeof(worker.hours_[i]));
+    }
+    poolHoursFlag |= worker.hoursFlag_;
+    worker.hoursFlag_ = 0;
+  }
+  pool->merge(poolHoursFlag, poolHours);
+
+  batch.touched_.clear();
+}
+
+void ShareLogParser::releaseSharesBatch(SharesBatch &batch, size_t maxWorkers) {
+  if (batch.workers_.size() <= maxWorkers)
+    return;
+  mergeSharesBatch(batch);
+  std::unordered_map<WorkerKey, WorkerShares>().swap(batch.workers_);
 }
 
-bool ShareLogParser::processUnchangedShareLog() {
-  FILE *f = nullptr;
+bool ShareLogParser::processUnchangedShareLog(uint32_t threadNum,
+                                              size_t maxBatchesWorkers) {
+  if (threadNum == 0) {
+    threadNum = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const uint64_t startUs = getMonotonicTimeUs();
 
-  // open file
   LOG(INFO) << "open file: " << filePath_;
-  if ((f = fopen(filePath_.c_str(), "rb")) == nullptr) {
-    LOG(ERROR) << "open file fail: " << filePath_;
+  const int fd = open(filePath_.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    LOG(ERROR) << "open file fail: " << filePath_ << ", " << strerror(errno);
+    if (fd != -1)
+      close(fd);
     return false;
   }
+  if (st.st_size == 0) {
+    close(fd);
+    LOG(INFO) << "empty file: " << filePath_;
+    return true;
+  }
 
-  // 2000000 * 48 = 96,000,000 Bytes
-  const uint32_t kElements = 2000000;
-  size_t readNum;
-  string buf;
-  buf.resize(kElements * sizeof(Share));
-
-  while (1) {
-    readNum = fread((uint8_t *)buf.data(), sizeof(Share), kElements, f);
+  // the blocks of a v2 file, scanned from their headers
+  ShareLogReader reader(filePath_);
+  vector<ShareLogV2::BlockIndex> blocks;
+  uint64_t endOffset = 0;
+  const bool isV2 = reader.scanBlocks(blocks, endOffset);
+  if (!isV2 && reader.version() != 1) {
+    close(fd);
+    LOG(ERROR) << "invalid file: " << filePath_;
+    return false;
+  }
 
-    if (readNum == 0) {
-      if (feof(f)) {
-        LOG(INFO) << "End-of-File reached: " << filePath_;
-        break;
-      }
-      LOG(INFO) << "read 0 bytes: " << filePath_;
-      continue;
+  void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    LOG(ERROR) << "mmap fail: " << filePath_ << ", " << strerror(errno);
+    return false;
+  }
+  // every thread reads its range from the beginning to the end
+  madvise(mem, st.st_size, MADV_SEQUENTIAL);
+  const uint8_t *data = (const uint8_t *)mem;
+
+  // split into ranges of about the same number of shares,
+  // v1: [begin, end) of shares, v2: [begin, end) of blocks
+  vector<size_t> bounds(threadNum + 1, 0);
+  uint64_t totalShares = 0;
+  if (isV2) {
+    for (const auto &block : blocks) {
+      totalShares += block.header_.count_;
+    }
+    uint64_t shares = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      const size_t t = std::min<uint64_t>(shares * threadNum / std::max<uint64_t>(totalShares, 1),
+                                          threadNum - 1);
+      bounds[t + 1] = i + 1;
+      shares += blocks[i].header_.count_;
     }
+  } else {
+    totalShares = st.st_size / sizeof(Share);
+    for (size_t t = 1; t <= threadNum; t++) {
+      bounds[t] = totalShares * t / threadNum;
+    }
+  }
+  // the threads without a block start and end after the last one
+  for (size_t t = 1; t <= threadNum; t++) {
+    bounds[t] = std::max(bounds[t], bounds[t - 1]);
+  }
+
+  // the memory of the batches is bounded, not threads * workers. a batch is
+  // merged in stages if its thread sees more workers
+  const size_t maxWorkers = std::max<size_t>(maxBatchesWorkers / threadNum, 4096);
+  vector<SharesBatch> batches(threadNum);
+  atomic<bool> res(true);
+  vector<thread> threads;
+  for (size_t t = 0; t < threadNum; t++) {
+    threads.push_back(thread([&, t]() {
+      if (isV2) {
+        if (!parseBlocks(data, blocks, bounds[t], bounds[t + 1], batches[t], maxWorkers))
+          res = false;
+        return;
+      }
+      const Share *shares = (const Share *)data;
+      for (size_t i = bounds[t]; i < bounds[t + 1]; i++) {
+        parseShare(shares[i], batches[t]);
+        if ((i - bounds[t]) % ShareLogV2::kMaxBlockShares_ == 0) {
+          releaseSharesBatch(batches[t], maxWorkers);
+        }
+      }
+    }));
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  munmap(mem, st.st_size);
 
-    parseShareLog((uint8_t *)buf.data(), readNum * sizeof(Share));
-  };
+  for (auto &batch : batches) {
+    mergeSharesBatch(batch);
+  }
 
-  fclose(f);
-  return true;
+  LOG(INFO) << "End-of-File reached: " << filePath_ << ", v" << reader.version()
+  << ", shares: " << totalShares << ", threads: " << threadNum
+  << ", used: " << (getMonotonicTimeUs() - startUs) / 1000 << " ms";
+  return res;
 }
 
 int64_t ShareLogParser::processGrowingShareLog() {
-  size_t readNum = 0;
+  // the reader keeps the position, an incomplete share or block at the end
+  // of the file is read next time
+  const int64_t readNum = reader_.read(shares_, kMaxElementsNum_);
 
-  if (f_ == nullptr) {
-    if ((f_ = fopen(filePath_.c_str(), "rb")) == nullptr) {
-      LOG(ERROR) << "open file fail: " << filePath_;
-      return -1;
+  // parse shares, grouped by workers
+  if (readNum > 0) {
+    for (const auto &share : shares_) {
+      parseShare(share, batch_);
     }
+    batchShares_ += readNum;
   }
-  assert(f_ != nullptr);
-
-  // seek to last position. we manager the file indicator by our own.
-  fseek(f_, lastPosition_, SEEK_SET);
-
-  //
-  // no need to set buffer memory to zero before fread
-  // return: the total number of elements successfully read is returned.
-  //
-  // fread():
-  // C11 at 7.21.8.1.2 and 7.21.8.2.2 says: If an error occurs, the resulting
-  // value of the file position indicator for the stream is indeterminate.
-  //
-  readNum = fread(buf_, sizeof(Share), kMaxElementsNum_, f_);
-  if (readNum == 0)
-    return 0;
-
-  const size_t bufSize = readNum * sizeof(Share);
-  lastPosition_ += bufSize;
-  assert(lastPosition_ % sizeof(Share) == 0);
-
-  // parse shares
-  parseShareLog(buf_, bufSize);
 
+  if (batchShares_ >= kMaxElementsNum_ ||
+      (batchShares_ > 0 && getMonotonicTimeUs() >= lastMergeTimeUs_ + kMergeIntervalUs_)) {
+    mergeGrowingShares();
+  }
   return readNum;
 }
 
-bool ShareLogParser::isReachEOF() {
-  struct stat sb;
-  int fd = open(filePath_.c_str(), O_RDONLY);
-  if (fd == -1) {
-    LOG(ERROR) << "open file fail: " << filePath_;
-    return true;  // if error we consider as EOF
-  }
-  if (fstat(fd, &sb) == -1) {
-    LOG(ERROR) << "fstat fail: " << filePath_;
-    return true;
-  }
-  close(fd);
+void ShareLogParser::mergeGrowingShares() {
+  mergeSharesBatch(batch_);
+  // the workers of the day are kept in workersStats_ too
+  releaseSharesBatch(batch_, kMaxBatchesWorkers_);
+  batchShares_     = 0;
+  lastMergeTimeUs_ = getMonotonicTimeUs();
+}
 
-  return lastPosition_ == sb.st_size;
+bool ShareLogParser::isReachEOF() {
+  return reader_.isReachEOF();
 }
 
 void ShareLogParser::generateHoursData(shared_ptr<ShareStatsDay> stats,
@@ -2310,17 +2717,129 @@ shared_ptr<ShareStatsDay> ShareLogParser::getShareStatsDayHandler(const WorkerKe
   return nullptr;
 }
 
+void makePartitionsPlan(const vector<std::pair<string, string>> &rows,
+                        bool isHourField, time_t now, const string &expiredValue,
+                        int32_t daysAhead, PartitionsPlan *plan) {
+  int64_t maxBound = 0;
+  size_t partitionsNum = 0;
+  const int64_t expiredBound = strtoll(expiredValue.c_str(), nullptr, 10);
+  for (const auto &row : rows) {
+    if (row.second == "MAXVALUE") {
+      plan->maxPartition_ = row.first;
+      continue;
+    }
+    const int64_t bound = strtoll(row.second.c_str(), nullptr, 10);
+    maxBound = std::max(maxBound, bound);
+    partitionsNum++;
+    // all its rows are less than bound
+    if (bound <= expiredBound) {
+      plan->dropPartitions_.push_back(row.first);
+    }
+  }
+
+  // the partitions of today and the next days, before they are written
+  const time_t today = now - (now % 86400);
+  for (int32_t i = 0; i <= daysAhead; i++) {
+    const time_t day = today + 86400 * i;
+    int64_t bound = strtoll(date("%Y%m%d", day + 86400).c_str(), nullptr, 10);
+    if (isHourField) {
+      bound *= 100;  // YYYYMMDD00
+    }
+    if (bound <= maxBound) {
+      continue;  // exists
+    }
+    plan->createPartitions_ += Strings::Format("%sPARTITION `p%s` VALUES LESS THAN (%" PRId64")",
+                                               plan->createPartitions_.length() ? "," : "",
+                                               date("%Y%m%d", day).c_str(), bound);
+  }
+
+  // a table must have one partition at least
+  if (plan->maxPartition_.empty() && plan->createPartitions_.empty() &&
+      plan->dropPartitions_.size() == partitionsNum && partitionsNum > 0) {
+    plan->dropPartitions_.pop_back();
+  }
+}
+
+mutex ShareLogParser::partitionsLock_;
+
+bool ShareLogParser::maintainPartitions(const string &tableName,
+                                        const string &field,
+                                        const string &expiredValue) {
+  const int32_t kPartitionDaysAhead = 3;
+
+  string sql = Strings::Format("SELECT `PARTITION_NAME`,`PARTITION_DESCRIPTION` "
+                               " FROM `information_schema`.`PARTITIONS` "
+                               " WHERE `TABLE_SCHEMA` = DATABASE() "
+                               "   AND `TABLE_NAME` = '%s' "
+                               "   AND `PARTITION_NAME` IS NOT NULL ",
+                               tableName.c_str());
+  ScopeLock sl(partitionsLock_);
+  MySQLResult res;
+  if (!poolDB_.query(sql, res)) {
+    LOG(ERROR) << "get partitions of table." << tableName << " failure";
+    return true;  // try it next time
+  }
+  if (res.numRows() == 0) {
+    return false;
+  }
+
+  vector<std::pair<string, string>> rows;
+  char **row = nullptr;
+  while ((row = res.nextRow()) != nullptr) {
+    rows.push_back(std::make_pair(string(row[0]), string(row[1])));
+  }
+  PartitionsPlan plan;
+  makePartitionsPlan(rows, field == "hour", time(nullptr), expiredValue,
+                     kPartitionDaysAhead, &plan);
+
+  if (plan.createPartitions_.length()) {
+    if (plan.maxPartition_.length()) {
+      // the max partition has no rows if the partitions are created in time
+      sql = Strings::Format("ALTER TABLE `%s` REORGANIZE PARTITION `%s` INTO "
+                            "(%s,PARTITION `%s` VALUES LESS THAN MAXVALUE)",
+                            tableName.c_str(), plan.maxPartition_.c_str(),
+                            plan.createPartitions_.c_str(), plan.maxPartition_.c_str());
+    } else {
+      sql = Strings::Format("ALTER TABLE `%s` ADD PARTITION (%s)",
+                            tableName.c_str(), plan.createPartitions_.c_str());
+    }
+    if (poolDB_.execute(sql)) {
+      LOG(INFO) << "create partitions of table." << tableName << ": "
+      << plan.createPartitions_;
+    } else {
+      LOG(ERROR) << "create partitions of table." << tableName << " failure";
+    }
+  }
+
+  if (plan.dropPartitions_.size()) {
+    const string names = "`" + boost::algorithm::join(plan.dropPartitions_, "`,`") + "`";
+    sql = Strings::Format("ALTER TABLE `%s` DROP PARTITION %s",
+                          tableName.c_str(), names.c_str());
+    if (poolDB_.execute(sql)) {
+      LOG(INFO) << "drop expired partitions of table." << tableName
+      << " before '" << expiredValue << "': " << names;
+    } else {
+      LOG(ERROR) << "drop partitions of table." << tableName << " failure";
+    }
+  }
+  return true;
+}
+
 void ShareLogParser::removeExpiredDataFromDB() {
-  static time_t lastRemoveTime = 0u;
   string sql;
 
   // check if we need to remove, 3600 = 1 hour
-  if (lastRemoveTime + 3600 > time(nullptr)) {
+  if (!removeExpiredData_ || lastRemoveTime_ + 3600 > time(nullptr)) {
     return;
   }
 
   // set the last remove timestamp
-  lastRemoveTime = time(nullptr);
+  lastRemoveTime_ = time(nullptr);
+
+  //
+  // the tables partitioned by day (install/bpool_local_stats_db_partitions.sql)
+  // drop the expired partitions rather than DELETE the rows
+  //
 
   //
   // table.stats_workers_day
@@ -2331,7 +2850,8 @@ void ShareLogParser::removeExpiredDataFromDB() {
                                time(nullptr) - 86400 * kDailyDataKeepDays_workers);
     sql = Strings::Format("DELETE FROM `stats_workers_day` WHERE `day` < '%s'",
                           dayStr.c_str());
-    if (poolDB_.execute(sql)) {
+    if (!maintainPartitions("stats_workers_day", "day", dayStr) &&
+        poolDB_.execute(sql)) {
       LOG(INFO) << "delete expired workers daily data before '"<< dayStr
       << "', count: " << poolDB_.affectedRows();
     }
@@ -2346,7 +2866,8 @@ void ShareLogParser::removeExpiredDataFromDB() {
                                time(nullptr) - 3600 * kHourDataKeepDays_workers);
     sql = Strings::Format("DELETE FROM `stats_workers_hour` WHERE `hour` < '%s'",
                           hourStr.c_str());
-    if (poolDB_.execute(sql)) {
+    if (!maintainPartitions("stats_workers_hour", "hour", hourStr) &&
+        poolDB_.execute(sql)) {
       LOG(INFO) << "delete expired workers hour data before '"<< hourStr
       << "', count: " << poolDB_.affectedRows();
     }
@@ -2361,7 +2882,8 @@ void ShareLogParser::removeExpiredDataFromDB() {
                                 time(nullptr) - 3600 * kHourDataKeepDays_users);
     sql = Strings::Format("DELETE FROM `stats_users_hour` WHERE `hour` < '%s'",
                           hourStr.c_str());
-    if (poolDB_.execute(sql)) {
+    if (!maintainPartitions("stats_users_hour", "hour", hourStr) &&
+        poolDB_.execute(sql)) {
       LOG(INFO) << "delete expired users hour data before '"<< hourStr
       << "', count: " << poolDB_.affectedRows();
     }
@@ -2370,6 +2892,7 @@ void ShareLogParser::removeExpiredDataFromDB() {
 
 bool ShareLogParser::flushToDB() {
   const time_t beginningTime = time(nullptr);
+  mergeGrowingShares();
 
   if (!poolDB_.ping()) {
     LOG(ERROR) << "connect db fail";
@@ -2445,6 +2968,113 @@ bool ShareLogParser::flushToDB() {
 
 
 
+/////////////////////////////  ShareLogBatchParser  /////////////////////////////
+ShareLogBatchParser::ShareLogBatchParser(const string &dataDir,
+                                         const MysqlConnectInfo &poolDBInfo,
+                                         uint32_t parallelDays,
+                                         uint32_t parseThreads)
+: dataDir_(dataDir), poolDBInfo_(poolDBInfo),
+parallelDays_(std::max(parallelDays, 1u)), parseThreads_(parseThreads)
+{
+}
+
+bool ShareLogBatchParser::processDay(time_t day, uint32_t threadNum,
+                                     bool removeExpiredData) {
+  // ShareLogParser::init() creates a missing file, which would be parsed as
+  // a day without shares
+  struct stat st;
+  const string filePath = getStatsFilePath(dataDir_, day);
+  if (stat(filePath.c_str(), &st) != 0) {
+    LOG(ERROR) << "sharelog file not found: " << filePath;
+    return false;
+  }
+
+  ShareLogParser slparser(dataDir_, day, poolDBInfo_);
+  if (!slparser.processUnchangedShareLog(threadNum)) {
+    LOG(ERROR) << "processUnchangedShareLog fail, date: " << date("%F", day);
+    return false;
+  }
+  if (!flushDay(slparser, day, removeExpiredData)) {
+    LOG(ERROR) << "flushToDB fail, date: " << date("%F", day);
+    return false;
+  }
+  return true;
+}
+
+bool ShareLogBatchParser::flushDay(ShareLogParser &slparser, time_t day,
+                                   bool removeExpiredData) {
+  slparser.setRemoveExpiredData(removeExpiredData);
+  return slparser.flushToDB();  // it checks the db
+}
+
+bool ShareLogBatchParser::run(time_t beginTs, time_t endTs) {
+  const time_t beginDay = beginTs - (beginTs % 86400);
+  const time_t endDay   = endTs   - (endTs   % 86400);
+  if (endDay < beginDay) {
+    LOG(ERROR) << "invalid date range: " << date("%F", beginDay)
+    << " ~ " << date("%F", endDay);
+    return false;
+  }
+
+  const size_t days = (endDay - beginDay) / 86400 + 1;
+  const uint32_t threadNum = (uint32_t)std::min<size_t>(parallelDays_, days);
+  uint32_t parseThreads = parseThreads_;
+  if (parseThreads == 0) {
+    const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    parseThreads = std::max(1u, cores / threadNum);
+  }
+  LOG(INFO) << "re-run sharelog: " << date("%F", beginDay) << " ~ "
+  << date("%F", endDay) << ", days: " << days << ", parallel days: "
+  << threadNum << ", parse threads a day: " << parseThreads;
+
+  const uint64_t startUs = getMonotonicTimeUs();
+  atomic<size_t> nextDay(0);
+
+  // progress
+  mutex lock;
+  size_t doneDays = 0;
+  uint64_t doneBytes = 0;
+  vector<time_t> failedDays;
+
+  vector<thread> threads;
+  for (uint32_t t = 0; t < threadNum; t++) {
+    threads.push_back(thread([&]() {
+      size_t i;
+      while ((i = nextDay++) < days) {
+        const time_t day = beginDay + i * 86400;
+        struct stat st;
+        const string filePath = getStatsFilePath(dataDir_, day);
+        const uint64_t bytes = (stat(filePath.c_str(), &st) == 0) ? st.st_size : 0;
+
+        // the days run in parallel, the last one removes the expired data
+        const bool res = processDay(day, parseThreads, i == days - 1);
+
+        ScopeLock sl(lock);
+        doneDays++;
+        doneBytes += bytes;
+        if (!res)
+          failedDays.push_back(day);
+
+        const double elapsed = (getMonotonicTimeUs() - startUs) / 1000000.0;
+        LOG(INFO) << "re-run " << date("%F", day) << (res ? " done" : " fail")
+        << ", days: " << doneDays << "/" << days
+        << Strings::Format(", %.1lf MB/s, elapsed: %.0lfs, eta: %.0lfs",
+                           doneBytes / 1048576.0 / std::max(elapsed, 0.001),
+                           elapsed, elapsed / doneDays * (days - doneDays));
+      }
+    }));
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  for (const auto day : failedDays) {
+    LOG(ERROR) << "re-run fail, date: " << date("%F", day);
+  }
+  return failedDays.size() == 0;
+}
+
+
 
 ////////////////////////////  ShareLogParserServer  ////////////////////////////
 ShareLogParserServer::ShareLogParserServer(const string dataDir,
@@ -2454,6 +3084,7 @@ ShareLogParserServer::ShareLogParserServer(const string dataDir,
                                            const uint32_t kFlushDBInterval):
 running_(true), dataDir_(dataDir),
 poolDBInfo_(poolDBInfo), kFlushDBInterval_(kFlushDBInterval),
+watcher_(dataDir), newFileCreated_(true),
 base_(nullptr), httpdHost_(httpdHost), httpdPort_(httpdPort),
 requestCount_(0), responseBytes_(0)
 {
@@ -2753,6 +3384,9 @@ bool ShareLogParserServer::setupThreadShareLogParser() {
 void ShareLogParserServer::runThreadShareLogParser() {
   LOG(INFO) << "thread sharelog parser start";
 
+  if (!watcher_.init()) {
+    LOG(WARNING) << "can't watch sharelog dir, check it every second: " << dataDir_;
+  }
   time_t lastFlushDBTime = 0;
 
   while (running_) {
@@ -2778,7 +3412,6 @@ void ShareLogParserServer::runThreadShareLogParser() {
       }
       DLOG(INFO) << "process share: " << res;
     }
-    sleep(1);
 
     // flush data to db
     if (time(nullptr) > lastFlushDBTime + kFlushDBInterval_) {
@@ -2789,6 +3422,11 @@ void ShareLogParserServer::runThreadShareLogParser() {
     // check if need to switch bin file
     trySwithBinFile(shareLogParser);
 
+    // wait for the sharelog to be appended, or the next day's one to be
+    // created. at most a second, to flush and switch the file in time
+    if (watcher_.wait(1000) & ShareLogWatcher::kFileCreated_) {
+      newFileCreated_ = true;
+    }
   } /* while */
 
   LOG(INFO) << "thread sharelog parser stop";
@@ -2809,10 +3447,12 @@ void ShareLogParserServer::trySwithBinFile(shared_ptr<ShareLogParser> shareLogPa
   // switch file when:
   //   1. today has been pasted at least 5 seconds
   //   2. last bin file has reached EOF
-  //   3. new file exists
+  //   3. new file exists, checked only when a file has been created if
+  //      the dir is watched
   //
   const string filePath = getStatsFilePath(dataDir_, now);
   if (now > beginTs + 5 &&
+      newFileCreated_ &&
       shareLogParser->isReachEOF() &&
       fileExists(filePath.c_str()))
   {
@@ -2821,6 +3461,8 @@ void ShareLogParserServer::trySwithBinFile(shared_ptr<ShareLogParser> shareLogPa
     bool res = initShareLogParser(now);
     if (!res) {
       LOG(ERROR) << "trySwithBinFile fail";
+    } else if (watcher_.isWatching()) {
+      newFileCreated_ = false;
     }
   }
 }
@@ -28,6 +28,7 @@
 #include "Kafka.h"
 #include "MySQLConnection.h"
 #include "RedisConnection.h"
+#include "ShareLogFile.h"
 #include "Stratum.h"
 
 #include <event2/event.h>
@@ -402,34 +403,120 @@ public:
 
   void getWorkerStatus(struct evbuffer *evb, const char *pUserId,
                        const char *pWorkerId, const char *pIsMerge);
+
+  struct WorkerUpdate {
+    int32_t userId_;
+    int64_t workerId_;
+    string  workerName_;
+    string  minerAgent_;
+  };
+  // the workers of a common event, 'worker_update' or 'worker_update_batch'.
+  // none for the other events, returns false if it's broken
+  static bool parseWorkerUpdates(const char *message, size_t len,
+                                 vector<WorkerUpdate> &updates);
+
+private:
+  void handleWorkerUpdate(const WorkerUpdate &update);
 };
 
 
 
+// filename: sharelog-2016-07-12.bin
+string getStatsFilePath(const string &dataDir, time_t ts);
+
+////////////////////////////  ShareLogFileWriter  /////////////////////////////
+//
+// Appends shares to the daily sharelog files. Shares are grouped per file
+// in memory and written by commit(): one pwrite() a file, then fdatasync()
+// if isFsync. Files are preallocated by fallocate(FALLOC_FL_KEEP_SIZE), so
+// the file size seen by the readers is still the size of the data.
+// New files are written in fileVersion (see ShareLogFile.h), existing files
+// are appended in their own format. With v2, the shares of a commit are
+// encoded as a block, and the index is written when the file is closed.
+// An existing file is truncated at its last whole share or block; with a
+// broken v2 block, what's cut off is copied to "<file>.tail.<ts>" first.
+// Not thread safe.
+//
+class ShareLogFileWriter {
+public:
+  static const uint64_t kPreallocSize_ = 64 * 1024 * 1024;
+  static const size_t   kBufferSize_   = 4 * 1024 * 1024;
+  static const size_t   kMaxOpenFiles_ = 3;
+
+private:
+  struct DailyFile {
+    int fd_;
+    uint64_t size_;       // written
+    uint64_t allocated_;  // preallocated
+    string buf_;          // not written yet
+
+    int version_;
+    vector<Share> shares_;  // v2: not encoded yet
+    vector<ShareLogV2::BlockIndex> index_;  // v2: data blocks
+    bool hasNewBlocks_;     // v2: index_ isn't written yet
+  };
+
+  string dataDir_;
+  bool isFsync_;
+  int fileVersion_;
+
+  // key: timestamp - (timestamp % 86400)
+  std::map<uint32_t, DailyFile> files_;
+  // most shares are of the same day
+  uint32_t lastDay_;
+  DailyFile *lastFile_;
+  size_t pendingBytes_;  // sizeof(Share) * shares
+
+  LatencyHistogram commitLatency_;
+  uint64_t committedShares_;
+
+  DailyFile *openFile(uint32_t day);
+  bool initFile(const string &filePath, uint64_t fileSize, DailyFile &f);
+  void encodeShares(DailyFile &f);
+  bool writeFile(DailyFile &f);
+  void closeFile(uint32_t day, DailyFile &f);
+  void closeOldFiles();
+
+public:
+  ShareLogFileWriter(const string &dataDir, bool isFsync, int fileVersion = 1);
+  ~ShareLogFileWriter();
+
+  // returns false if the file can't be opened
+  bool addShare(const Share &share);
+  // bytes of shares not committed
+  size_t pendingBytes() const { return pendingBytes_; }
+  // returns true if all shares are written (and synced if isFsync)
+  bool commit();
+
+  // "shares: 1000, commit: count: 10, avg: ..."
+  string toString() const;
+  void resetStats();
+};
+
+
 //////////////////////////////  ShareLogWriter  ///////////////////////////////
 //
 // 1. consume topic 'ShareLog'
-// 2. write sharelog to Disk
+// 2. write sharelog to Disk, group commit every commitIntervalMs
+// 3. commit the kafka offset after the shares are on disk
 //
 class ShareLogWriter {
   atomic<bool> running_;
   string dataDir_;  // where to put sharelog data files
+  const int32_t kCommitIntervalMs_;
 
-  // key:   timestamp - (timestamp % 86400)
-  // value: FILE *
-  std::map<uint32_t, FILE *> fileHandlers_;
-  std::vector<Share> shares_;
+  ShareLogFileWriter fileWriter_;
+  int64_t lastOffset_;  // of the last share added to fileWriter_, -1 if none
 
   KafkaHighLevelConsumer hlConsumer_;  // consume topic: 'ShareLog'
 
-  FILE* getFileHandler(uint32_t ts);
   void consumeShareLog(rd_kafka_message_t *rkmessage);
   bool flushToDisk();
-  void tryCloseOldHanders();
 
 public:
   ShareLogWriter(const char *kafkaBrokers, const string &dataDir,
-                 const string &kafkaGroupID);
+                 const string &kafkaGroupID, int32_t commitIntervalMs,
+                 bool isFsync, int fileVersion);
   ~ShareLogWriter();
 
   void stop();
@@ -455,6 +542,13 @@ public:
 // thread-safe
 class ShareStatsDay {
 public:
+  // the shares of an hour, parsed by ShareLogParser in a batch
+  struct HourShares {
+    uint64_t accept_;
+    uint64_t reject_;
+    double   score_;  // only accept share
+  };
+
   // hours
   uint64_t shareAccept1h_[24];
   uint64_t shareReject1h_[24];
@@ -472,6 +566,8 @@ public:
   ShareStatsDay();
 
   void processShare(uint32_t hourIdx, const Share &share);
+  // add the shares of the hours in hoursFlag
+  void merge(uint32_t hoursFlag, const HourShares *hours);
   void getShareStatsHour(uint32_t hourIdx, ShareStats *stats);
   void getShareStatsDay(ShareStats *stats);
 };
@@ -483,7 +579,6 @@ class ShareLogDumper {
   std::set<int32_t> uids_;  // if empty dump all user's shares
   bool isDumpAll_;
 
-  void parseShareLog(const uint8_t *buf, size_t len);
   void parseShare(const Share *share);
 
 public:
@@ -494,6 +589,22 @@ public:
 };
 
 ///////////////////////////////  ShareLogParser  ///////////////////////////////
+// the partitions to create and to drop of a stats table partitioned by `day`
+// (YYYYMMDD) or `hour` (YYYYMMDD00), see install/bpool_local_stats_db_partitions.sql
+struct PartitionsPlan {
+  string maxPartition_;      // VALUES LESS THAN MAXVALUE, empty if none
+  string createPartitions_;  // "PARTITION `pYYYYMMDD` VALUES LESS THAN (...),..."
+  vector<string> dropPartitions_;
+};
+
+// rows: `PARTITION_NAME`, `PARTITION_DESCRIPTION` of the table in
+// information_schema.PARTITIONS. plans the partitions of the day of now and
+// the next daysAhead days, and drops the ones whose rows are all less than
+// expiredValue
+void makePartitionsPlan(const vector<std::pair<string, string>> &rows,
+                        bool isHourField, time_t now, const string &expiredValue,
+                        int32_t daysAhead, PartitionsPlan *plan);
+
 //
 // 1. read sharelog data files
 // 2. calculate share & score
@@ -510,21 +621,67 @@ class ShareLogParser {
   //
   // for processGrowingShareLog()
   //
-  FILE *f_;        // file handler
-  uint8_t *buf_;   // fread buffer
+  ShareLogReader reader_;
+  vector<Share> shares_;  // read buffer
   // 48 * 1000000 = 48,000,000 ~ 48 MB
   static const size_t kMaxElementsNum_ = 1000000;  // num of Share
-  off_t lastPosition_;
+  // workers in the batches of the threads of processUnchangedShareLog() or
+  // in batch_, ~ 650 bytes a worker. a batch is merged and released when it
+  // has more
+  static const size_t kMaxBatchesWorkers_ = 1000000;
 
   MySQLConnection  poolDB_;  // save stats data
+  bool removeExpiredData_;   // by flushToDB(), at most once an hour
+  time_t lastRemoveTime_;
+  // the parsers of the parallel days alter the same tables
+  static mutex partitionsLock_;
+
+  // the shares of a worker in a batch. a share touches a HourShares, one
+  // cache line rather than the ones of the hour and the day in ShareStatsDay
+  struct WorkerShares {
+    uint32_t hoursFlag_;  // hours with shares
+    ShareStatsDay::HourShares hours_[24];
+    // of the worker and the user in workersStats_, set by the first merge
+    shared_ptr<ShareStatsDay> worker_;
+    shared_ptr<ShareStatsDay> user_;
+
+    WorkerShares(): hoursFlag_(0) { memset(hours_, 0, sizeof(hours_)); }
+  };
+
+  // A batch of shares parsed by a thread, grouped by workers without any
+  // lock, then merged into workersStats_: every worker, user and the pool
+  // is locked once a batch rather than once a share. The workers are kept
+  // for the next batch.
+  struct SharesBatch {
+    // key: worker, the users and the pool are summed up when it's merged
+    std::unordered_map<WorkerKey, WorkerShares> workers_;
+    vector<std::pair<const WorkerKey, WorkerShares> *> touched_;  // with shares
+    // network difficulty of blkBits_, which changes every 2016 blocks
+    uint32_t blkBits_;
+    double   networkDiff_;
+
+    SharesBatch(): blkBits_(0), networkDiff_(0.0) {}
+  };
+  // for processGrowingShareLog(). a small read touches about as many workers
+  // as shares, the batch is merged every kMergeIntervalUs_ or kMaxElementsNum_
+  // shares so the grouping pays for the merging
+  SharesBatch batch_;
+  size_t batchShares_;  // not merged yet
+  uint64_t lastMergeTimeUs_;
+  static const uint64_t kMergeIntervalUs_ = 1000000;
 
   inline int32_t getHourIdx(uint32_t ts) {
-    // %H	Hour in 24h format (00-23)
-    return atoi(date("%H", ts).c_str());
+    // same as date("%H", ts), hour in 24h format (00-23) of UTC
+    return (ts % 86400) / 3600;
   }
 
-  void parseShareLog(const uint8_t *buf, size_t len);
-  void parseShare(const Share *share);
+  inline void parseShare(const Share &share, SharesBatch &batch);
+  bool parseBlocks(const uint8_t *data, const vector<ShareLogV2::BlockIndex> &blocks,
+                   size_t begin, size_t end, SharesBatch &batch, size_t maxWorkers);
+  // merge the shares of the batch into workersStats_
+  void mergeSharesBatch(SharesBatch &batch);
+  // merge the batch and release its workers if it has more than maxWorkers
+  void releaseSharesBatch(SharesBatch &batch, size_t maxWorkers);
 
   void generateDailyData(shared_ptr<ShareStatsDay> stats,
                          const int32_t userId, const int64_t workerId,
@@ -540,6 +697,11 @@ class ShareLogParser {
                             const string &tableName,
                             const string &extraFields);
   void removeExpiredDataFromDB();
+  // drop the partitions of the table before expiredValue of field (`day` or
+  // `hour`), and create the ones of the next days. return false if the table
+  // isn't partitioned
+  bool maintainPartitions(const string &tableName, const string &field,
+                          const string &expiredValue);
 
 public:
   ShareLogParser(const string &dataDir, time_t timestamp,
@@ -550,22 +712,65 @@ public:
 
   // flush data to DB
   bool flushToDB();
+  // flushToDB() removes the expired data from DB, unless it's disabled
+  void setRemoveExpiredData(bool enable) { removeExpiredData_ = enable; }
 
   // get share stats day handler
   shared_ptr<ShareStatsDay> getShareStatsDayHandler(const WorkerKey &key);
 
   // read unchanged share data bin file, for example yestoday's file. it will
-  // use mmap() to get high performance. call only once will process
-  // the whole bin file
-  bool processUnchangedShareLog();
-
-  // today's file is still growing, return processed shares number.
+  // mmap() the file and parse it by threadNum threads (0: one a core), which
+  // hold the shares of about maxBatchesWorkers workers before merging them.
+  // call only once will process the whole bin file
+  bool processUnchangedShareLog(uint32_t threadNum = 0,
+                                size_t maxBatchesWorkers = kMaxBatchesWorkers_);
+
+  // today's file is still growing, return processed shares number. the
+  // stats are updated every second, or by mergeGrowingShares()
   int64_t processGrowingShareLog();
+  // merge the shares parsed by processGrowingShareLog(), flushToDB() does it.
+  // in the thread of processGrowingShareLog()
+  void mergeGrowingShares();
   bool isReachEOF();  // only for growing file
 };
 
 
 
+/////////////////////////////  ShareLogBatchParser  /////////////////////////////
+//
+// re-run the share bin logs of a date range, for example after a bug fix.
+// every day is parsed by ShareLogParser::processUnchangedShareLog() and
+// flushed to DB like `slparser -d`, so the stats are the same. days are
+// re-run in parallel, at most parallelDays at a time: a day holds all its
+// workers' stats in memory until it's flushed.
+//
+class ShareLogBatchParser {
+  string dataDir_;
+  MysqlConnectInfo poolDBInfo_;
+  uint32_t parallelDays_;
+  uint32_t parseThreads_;  // of a day, 0: share the cores by the days
+
+  // parse the file of the day and flush it by flushDay(). a missing file
+  // fails the day
+  bool processDay(time_t day, uint32_t threadNum, bool removeExpiredData);
+
+protected:
+  // flush the stats of a parsed day to DB. the expired data is removed by
+  // one day of a run only
+  virtual bool flushDay(ShareLogParser &slparser, time_t day, bool removeExpiredData);
+
+public:
+  ShareLogBatchParser(const string &dataDir, const MysqlConnectInfo &poolDBInfo,
+                      uint32_t parallelDays, uint32_t parseThreads = 0);
+  virtual ~ShareLogBatchParser() {}
+
+  // from the day of beginTs to the day of endTs, both included.
+  // return false if any day fails
+  bool run(time_t beginTs, time_t endTs);
+};
+
+
+
 ////////////////////////////  ShareLogParserServer  ////////////////////////////
 //
 // read share binlog, parse shares, calc stats data than save them to database
@@ -593,6 +798,10 @@ class ShareLogParserServer {
   MysqlConnectInfo poolDBInfo_;  // save stats data
   time_t kFlushDBInterval_;
 
+  // wakes the parser thread up when the sharelog is appended or created
+  ShareLogWatcher watcher_;
+  bool newFileCreated_;  // since the last switch, or unknown
+
   // httpd
   struct event_base *base_;
   string httpdHost_;
@@ -160,30 +160,73 @@ int64_t StratumWorker::calcWorkerId(const string &workerName) {
   return workerHashId;
 }
 
+// merkle levels with at least this many pairs are hashed by several threads
+static const size_t kMerkleParallelMinPairs = 256;
+static const unsigned kMerkleMaxThreads     = 4;
+
+// rehashes the merkle levels from firstChanged (index in levels[0]), the
+// caller sets levels[0], the levels above it are kept up to that point
 static
-void makeMerkleBranch(const vector<uint256> &vtxhashs, vector<uint256> &steps) {
-  if (vtxhashs.size() == 0) {
+void updateMerkleLevels(vector<vector<uint256> > &levels, size_t firstChanged) {
+  if (levels.empty() || levels[0].empty()) {
+    levels.resize(levels.empty() ? 0 : 1);
     return;
   }
-  vector<uint256> hashs(vtxhashs.begin(), vtxhashs.end());
-  while (hashs.size() > 1) {
-    // put first element
-    steps.push_back(*hashs.begin());
-    if (hashs.size() % 2 == 0) {
-      // if even, push_back the end one, size should be an odd number.
-      // because we ignore the coinbase tx when make merkle branch.
-      hashs.push_back(*hashs.rbegin());
-    }
-    // ignore the first one than merge two
-    for (size_t i = 0; i < (hashs.size() - 1) / 2; i++) {
-      // Hash = Double SHA256
-      hashs[i] = Hash(BEGIN(hashs[i*2 + 1]), END(hashs[i*2 + 1]),
-                      BEGIN(hashs[i*2 + 2]), END(hashs[i*2 + 2]));
-    }
-    hashs.resize((hashs.size() - 1) / 2);
-  }
-  assert(hashs.size() == 1);
-  steps.push_back(*hashs.begin());  // put the last one
+  const unsigned threadNum = std::max(1u, std::min(thread::hardware_concurrency(),
+                                                   kMerkleMaxThreads));
+  size_t k = 0;
+  while (levels[k].size() > 1) {
+    if (levels.size() < k + 2) {
+      levels.resize(k + 2);
+    }
+    const vector<uint256> &hashs = levels[k];
+    vector<uint256> &next = levels[k + 1];
+    // if even, the end one is paired with itself, because we ignore the
+    // coinbase tx (the first one) when make merkle branch
+    const size_t pairs = hashs.size() / 2;
+    const size_t begin = std::min(firstChanged == 0 ? 0 : (firstChanged - 1) / 2, pairs);
+    next.resize(pairs);
+
+    auto hashPairs = [&hashs, &next](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        const uint256 &right = (i*2 + 2 < hashs.size()) ? hashs[i*2 + 2] : hashs[i*2 + 1];
+        // Hash = Double SHA256
+        next[i] = Hash(BEGIN(hashs[i*2 + 1]), END(hashs[i*2 + 1]),
+                       BEGIN(right), END(right));
+      }
+    };
+
+    if (threadNum == 1 || pairs - begin < kMerkleParallelMinPairs) {
+      hashPairs(begin, pairs);
+    } else {
+      const size_t chunk = (pairs - begin + threadNum - 1) / threadNum;
+      vector<thread> workers;
+      for (size_t b = begin + chunk; b < pairs; b += chunk) {
+        workers.push_back(thread(hashPairs, b, std::min(b + chunk, pairs)));
+      }
+      hashPairs(begin, begin + chunk);
+      for (auto &worker : workers) {
+        worker.join();
+      }
+    }
+    firstChanged = begin;
+    k++;
+  }
+  levels.resize(k + 1);
+}
+
+// txid of a tx in gbt: "txid" since segwit ("hash" is the wtxid then),
+// older nodes only have "hash" which is the txid
+static
+JsonNode getGbtTxid(JsonNode &jtx) {
+  JsonNode jtxid = jtx["txid"];
+  if (jtxid.type() != Utilities::JS::type::Str) {
+    jtxid = jtx["hash"];
+  }
+  if (jtxid.type() != Utilities::JS::type::Str || jtxid.size() != 64) {
+    return JsonNode();
+  }
+  return jtxid;
 }
 
 static
@@ -360,42 +403,251 @@ bool StratumJob::unserializeFromJson(const char *s, size_t len) {
   return true;
 }
 
-bool StratumJob::initFromGbt(const char *gbt, const string &poolCoinbaseInfo,
-                             const CTxDestination &poolPayoutAddr,
-                             const uint32_t blockVersion,
-                             const string &nmcAuxBlockJson,
-                             const RskWork &latestRskBlockJson,
-                             const uint8_t serverId,
-                             const bool isMergedMiningUpdate) {
-  uint256 gbtHash = Hash(gbt, gbt + strlen(gbt));
+//
+// binary format helpers, integers are in host byte order (little-endian on
+// all of our servers), the same as Share and FoundBlock in kafka.
+//
+template <typename T>
+static inline void _binWrite(string &buf, const T v) {
+  buf.append((const char *)&v, sizeof(T));
+}
+
+static inline void _binWriteStr(string &buf, const string &str) {
+  _binWrite(buf, (uint32_t)str.size());
+  buf.append(str);
+}
+
+static inline void _binWriteHash(string &buf, const uint256 &hash) {
+  buf.append((const char *)hash.begin(), 32);
+}
+
+// hex string -> raw bytes
+static inline void _binWriteHexStr(string &buf, const string &hex) {
+  vector<char> bin;
+  Hex2Bin(hex.c_str(), hex.size(), bin);
+  _binWrite(buf, (uint32_t)bin.size());
+  buf.append(bin.data(), bin.size());
+}
+
+namespace {
+
+class BinaryReader {
+  const char *p_;
+  const char *end_;
+
+public:
+  BinaryReader(const char *s, size_t len): p_(s), end_(s + len) {}
+
+  template <typename T>
+  bool read(T *v) {
+    if (p_ + sizeof(T) > end_) {
+      return false;
+    }
+    memcpy(v, p_, sizeof(T));
+    p_ += sizeof(T);
+    return true;
+  }
+
+  bool readStr(string *str) {
+    uint32_t len;
+    if (!read(&len) || p_ + len > end_) {
+      return false;
+    }
+    str->assign(p_, len);
+    p_ += len;
+    return true;
+  }
+
+  bool readHash(uint256 *hash) {
+    if (p_ + 32 > end_) {
+      return false;
+    }
+    memcpy(hash->begin(), p_, 32);
+    p_ += 32;
+    return true;
+  }
+
+  // raw bytes -> hex string
+  bool readHexStr(string *hex) {
+    uint32_t len;
+    if (!read(&len) || p_ + len > end_) {
+      return false;
+    }
+    hex->clear();
+    Bin2Hex((const uint8 *)p_, len, *hex);
+    p_ += len;
+    return true;
+  }
+};
+
+}  // namespace
+
+bool StratumJob::isBinaryFormat(const char *s, size_t len) {
+  return len >= STRATUM_JOB_BINARY_MAGIC_LEN &&
+         memcmp(s, STRATUM_JOB_BINARY_MAGIC, STRATUM_JOB_BINARY_MAGIC_LEN) == 0;
+}
+
+bool StratumJob::unserialize(const char *s, size_t len) {
+  if (isBinaryFormat(s, len)) {
+    return unserializeFromBinary(s, len);
+  }
+  return unserializeFromJson(s, len);
+}
+
+string StratumJob::serializeToBinary() const {
+  string buf;
+  buf.reserve(512 + coinbase1_.size() + coinbase2_.size() +
+              merkleBranch_.size() * 32);
+
+  buf.append(STRATUM_JOB_BINARY_MAGIC, STRATUM_JOB_BINARY_MAGIC_LEN);
+  _binWrite(buf, (uint16_t)STRATUM_JOB_BINARY_VERSION);
+
+  _binWrite(buf, jobId_);
+  _binWriteHash(buf, uint256S(gbtHash_));
+  _binWriteHash(buf, prevHash_);
+  _binWriteHexStr(buf, prevHashBeStr_);
+  _binWrite(buf, height_);
+  _binWriteHexStr(buf, coinbase1_);
+  _binWriteHexStr(buf, coinbase2_);
+
+  _binWrite(buf, (uint16_t)merkleBranch_.size());
+  for (const auto &hash : merkleBranch_) {
+    _binWriteHash(buf, hash);
+  }
+
+  _binWrite(buf, nVersion_);
+  _binWrite(buf, nBits_);
+  _binWrite(buf, nTime_);
+  _binWrite(buf, minTime_);
+  _binWrite(buf, coinbaseValue_);
+  _binWriteStr(buf, witnessCommitment_);
+#ifdef CHAIN_TYPE_UBTC
+  _binWriteStr(buf, rootStateHash_);
+#else
+  _binWriteStr(buf, "");
+#endif
+
+  // namecoin
+  _binWriteHash(buf, nmcAuxBlockHash_);
+  _binWrite(buf, nmcAuxBits_);
+  _binWrite(buf, nmcHeight_);
+  _binWriteStr(buf, nmcRpcAddr_);
+  _binWriteStr(buf, nmcRpcUserpass_);
+
+  // rsk
+  _binWriteStr(buf, blockHashForMergedMining_);
+  _binWriteHash(buf, rskNetworkTarget_);
+  _binWriteStr(buf, feesForMiner_);
+  _binWriteStr(buf, rskdRpcAddress_);
+  _binWriteStr(buf, rskdRpcUserPwd_);
+
+  // namecoin and RSK
+  _binWrite(buf, (uint8_t)(isMergedMiningCleanJob_ ? 1 : 0));
+
+  return buf;
+}
+
+bool StratumJob::unserializeFromBinary(const char *s, size_t len) {
+  if (!isBinaryFormat(s, len)) {
+    LOG(ERROR) << "invalid binary stratum job magic";
+    return false;
+  }
+  BinaryReader r(s + STRATUM_JOB_BINARY_MAGIC_LEN,
+                 len - STRATUM_JOB_BINARY_MAGIC_LEN);
+
+  uint16_t version = 0;
+  if (!r.read(&version) || version != STRATUM_JOB_BINARY_VERSION) {
+    LOG(ERROR) << "unsupported binary stratum job version: " << version;
+    return false;
+  }
+
+  uint256 gbtHash;
+  uint16_t merkleBranchCount = 0;
+  string rootStateHash;
+  uint8_t isMergedMiningClean = 0;
+
+  bool res = r.read(&jobId_) &&
+             r.readHash(&gbtHash) &&
+             r.readHash(&prevHash_) &&
+             r.readHexStr(&prevHashBeStr_) &&
+             r.read(&height_) &&
+             r.readHexStr(&coinbase1_) &&
+             r.readHexStr(&coinbase2_) &&
+             r.read(&merkleBranchCount);
+  if (res) {
+    merkleBranch_.resize(merkleBranchCount);
+    for (size_t i = 0; res && i < merkleBranchCount; i++) {
+      res = r.readHash(&merkleBranch_[i]);
+    }
+  }
+  res = res &&
+        r.read(&nVersion_) &&
+        r.read(&nBits_) &&
+        r.read(&nTime_) &&
+        r.read(&minTime_) &&
+        r.read(&coinbaseValue_) &&
+        r.readStr(&witnessCommitment_) &&
+        r.readStr(&rootStateHash) &&
+        // namecoin
+        r.readHash(&nmcAuxBlockHash_) &&
+        r.read(&nmcAuxBits_) &&
+        r.read(&nmcHeight_) &&
+        r.readStr(&nmcRpcAddr_) &&
+        r.readStr(&nmcRpcUserpass_) &&
+        // rsk
+        r.readStr(&blockHashForMergedMining_) &&
+        r.readHash(&rskNetworkTarget_) &&
+        r.readStr(&feesForMiner_) &&
+        r.readStr(&rskdRpcAddress_) &&
+        r.readStr(&rskdRpcUserPwd_) &&
+        r.read(&isMergedMiningClean);
+
+  if (!res) {
+    LOG(ERROR) << "parse binary stratum job failure, len: " << len;
+    return false;
+  }
+
+  gbtHash_ = gbtHash.ToString();
+#ifdef CHAIN_TYPE_UBTC
+  rootStateHash_ = rootStateHash;
+#endif
+  isMergedMiningCleanJob_ = (isMergedMiningClean != 0);
+
+  BitsToTarget(nmcAuxBits_, nmcNetworkTarget_);
+  BitsToTarget(nBits_, networkTarget_);
+
+  return true;
+}
+
+///////////////////////////////// GbtTemplate //////////////////////////////////
+GbtTemplate::GbtTemplate(): height_(0), nVersion_(0), nBits_(0), curTime_(0),
+minTime_(0), coinbaseValue_(0), isTxsDecoded_(false), reusedTxCount_(0) {
+}
+
+bool GbtTemplate::initFromGbt(const char *gbt, const bool isDecodeGbtTxs,
+                              const GbtTemplate *previous) {
+  const size_t len = strlen(gbt);
   JsonNode r;
-  if (!JsonNode::parse(gbt, gbt + strlen(gbt), r)) {
+  if (!JsonNode::parse(gbt, gbt + len, r)) {
     LOG(ERROR) << "decode gbt json fail: >" << gbt << "<";
     return false;
   }
   JsonNode jgbt = r["result"];
 
-  // jobId: timestamp + gbtHash, we need to make sure jobId is unique in a some time
-  // jobId can convert to uint64_t
-  const string jobIdStr = Strings::Format("%08x%s%02x", (uint32_t)time(nullptr),
-                                                        gbtHash.ToString().substr(0, 6).c_str(),
-                                                        serverId);
-  assert(jobIdStr.length() == 16);
-  jobId_ = strtoull(jobIdStr.c_str(), nullptr, 16/* hex */);
-
-  gbtHash_ = gbtHash.ToString();
+  // a gbt rebuilt from a compact rawgbt keeps the hash of the original one
+  if (r["gbthash"].type() == Utilities::JS::type::Str && r["gbthash"].size() == 64) {
+    gbtHash_ = uint256S(r["gbthash"].str());
+  } else {
+    gbtHash_ = Hash(gbt, gbt + len);
+  }
 
   // height etc.
   // fields in gbt json has already checked by GbtMaker
-  prevHash_ = uint256S(jgbt["previousblockhash"].str());
-  height_   = jgbt["height"].int32();
-  if (blockVersion != 0) {
-    nVersion_ = blockVersion;
-  } else {
-    nVersion_ = jgbt["version"].uint32();
-  }
+  prevHash_      = uint256S(jgbt["previousblockhash"].str());
+  height_        = jgbt["height"].int32();
+  nVersion_      = jgbt["version"].uint32();
   nBits_         = jgbt["bits"].uint32_hex();
-  nTime_         = jgbt["curtime"].uint32();
+  curTime_       = jgbt["curtime"].uint32();
   minTime_       = jgbt["mintime"].uint32();
   coinbaseValue_ = jgbt["coinbasevalue"].int64();
 
@@ -414,12 +666,307 @@ bool StratumJob::initFromGbt(const char *gbt, const string &poolCoinbaseInfo,
   }
 #endif
 
+  // read txs hash, use the txid given by gbt, decode the tx only when
+  // there is none or we are asked to
+  JsonNode jtxs = jgbt["transactions"];
+  vector<uint256> vtxhashs;  // txs without coinbase
+  vtxhashs.reserve(jtxs.array().size());
+  for (JsonNode & node : jtxs.array()) {
+    JsonNode jtxid = getGbtTxid(node);
+    if (!isDecodeGbtTxs && jtxid.type() == Utilities::JS::type::Str) {
+      vtxhashs.push_back(uint256S(jtxid.str()));
+      continue;
+    }
+    CMutableTransaction tx;
+    DecodeHexTx(tx, node["data"].str());
+    vtxhashs.push_back(MakeTransactionRef(std::move(tx))->GetHash());
+  }
+  isTxsDecoded_ = isDecodeGbtTxs;
+
+  // keep the merkle tree of the previous template as far as the txs are
+  // the same, a txid we did not decode is not trusted by a decoding one
+  reusedTxCount_ = 0;
+  if (previous != nullptr && previous->txCount() > 0 &&
+      (previous->isTxsDecoded_ || !isDecodeGbtTxs)) {
+    const vector<uint256> &prevTxids = previous->merkleLevels_[0];
+    const size_t n = std::min(prevTxids.size(), vtxhashs.size());
+    while (reusedTxCount_ < n && prevTxids[reusedTxCount_] == vtxhashs[reusedTxCount_]) {
+      reusedTxCount_++;
+    }
+  }
+  if (reusedTxCount_ > 0) {
+    merkleLevels_ = previous->merkleLevels_;
+  } else {
+    merkleLevels_.resize(1);
+  }
+  merkleLevels_[0].swap(vtxhashs);
+  updateMerkleLevels(merkleLevels_, reusedTxCount_);
+
+  // merkle branch, merkleBranch_ could be empty
+  merkleBranch_.clear();
+  if (txCount() > 0) {
+    for (const auto &level : merkleLevels_) {
+      merkleBranch_.push_back(level[0]);
+    }
+  }
+  return true;
+}
+
+////////////////////////////////// CompactGbt //////////////////////////////////
+bool CompactGbt::isCompactFormat(const char *s, size_t len) {
+  return len >= RAWGBT_COMPACT_MAGIC_LEN &&
+         memcmp(s, RAWGBT_COMPACT_MAGIC, RAWGBT_COMPACT_MAGIC_LEN) == 0;
+}
+
+string CompactGbt::toGbt() const {
+  size_t dataSize = 0;
+  for (const auto &tx : txs_) {
+    if (tx != nullptr) {
+      dataSize += tx->size() * 2;
+    }
+  }
+  string gbt;
+  gbt.reserve(header_.size() + txids_.size() * 96 + dataSize + 96);
+
+  gbt.append("{\"gbthash\":\"");
+  gbt.append(gbtHash_.ToString());
+  gbt.append("\",");
+  gbt.append(header_, 1, txsPos_ - 1);
+
+  string hex;
+  for (size_t i = 0; i < txids_.size(); i++) {
+    gbt.append(i == 0 ? "{" : ",{");
+    if (txs_[i] != nullptr) {
+      Bin2Hex((const uint8 *)txs_[i]->data(), txs_[i]->size(), hex);
+      gbt.append("\"data\":\"");
+      gbt.append(hex);
+      gbt.append("\",");
+    }
+    gbt.append("\"txid\":\"");
+    gbt.append(txids_[i].ToString());
+    gbt.append("\"}");
+  }
+  gbt.append(header_, txsPos_, string::npos);
+  return gbt;
+}
+
+///////////////////////////////// RawGbtEncoder ////////////////////////////////
+bool RawGbtEncoder::encode(const string &gbt, JsonNode &jgbt, const uint256 &gbtHash,
+                           uint32_t createdAt, string &msg) {
+  JsonNode jtxs = jgbt["transactions"];
+  if (jtxs.type() != Utilities::JS::type::Array ||
+      jtxs.start() <= gbt.data() || jtxs.end() > gbt.data() + gbt.size()) {
+    LOG(ERROR) << "gbt without transactions";
+    return false;
+  }
+  const size_t txsBegin = jtxs.start() + 1 - gbt.data();  // after '['
+  const size_t txsEnd   = jtxs.end() - 1 - gbt.data();    // the ']'
+
+  const time_t now = time(nullptr);
+  const bool isFull = (msgCount_ == 0 || msgCount_ >= kFullInterval_ ||
+                       lastFullTime_ + kFullMaxAge_ <= now);
+
+  msg.clear();
+  msg.reserve(txsBegin + (gbt.size() - txsEnd) + jtxs.size() / 2 + 64);
+  msg.append(RAWGBT_COMPACT_MAGIC, RAWGBT_COMPACT_MAGIC_LEN);
+  _binWrite(msg, (uint16_t)RAWGBT_COMPACT_VERSION);
+  _binWrite(msg, createdAt);
+  _binWriteHash(msg, gbtHash);
+  _binWrite(msg, (uint8_t)(isFull ? 1 : 0));
+  _binWriteStr(msg, gbt.substr(0, txsBegin) + gbt.substr(txsEnd));
+  _binWrite(msg, (uint32_t)txsBegin);
+
+  vector<JsonNode> &txs = jtxs.array();
+  _binWrite(msg, (uint32_t)txs.size());
+
+  // the txs are remembered only when the message is made
+  vector<uint256> sentTxs;
+  size_t refCount = 0;
+  for (JsonNode &node : txs) {
+    JsonNode jtxid = getGbtTxid(node);
+    if (jtxid.type() != Utilities::JS::type::Str ||
+        node["data"].type() != Utilities::JS::type::Str) {
+      LOG(ERROR) << "invalid tx in gbt, missing txid or data";
+      return false;
+    }
+    const uint256 txid = uint256S(jtxid.str());
+    _binWriteHash(msg, txid);
+
+    if (!isFull && sentTxs_.count(txid) != 0) {
+      _binWrite(msg, (uint8_t)0);
+      refCount++;
+      continue;
+    }
+    _binWrite(msg, (uint8_t)1);
+    _binWriteHexStr(msg, node["data"].str());
+    sentTxs.push_back(txid);
+  }
+
+  if (isFull) {
+    sentTxs_.clear();
+    msgCount_     = 0;
+    lastFullTime_ = now;
+  }
+  sentTxs_.insert(sentTxs.begin(), sentTxs.end());
+  msgCount_++;
+
+  LOG(INFO) << "compact rawgbt, full: " << isFull << ", txs: " << txs.size()
+  << ", with body: " << sentTxs.size() << ", referenced: " << refCount
+  << ", msg len: " << msg.size() << ", gbt len: " << gbt.size();
+  return true;
+}
+
+///////////////////////////////// RawGbtDecoder ////////////////////////////////
+void RawGbtDecoder::removeExpiredTxs(time_t now) {
+  // a tx is referenced only during RawGbtEncoder::kFullMaxAge_ after its
+  // body was sent, keep it twice as long for the delay of the messages
+  const time_t expiredTime = now - 2 * RawGbtEncoder::kFullMaxAge_;
+  for (auto it = txs_.begin(); it != txs_.end(); ) {
+    if (it->second.lastSeen_ < expiredTime) {
+      it = txs_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool RawGbtDecoder::decode(const char *s, size_t len, CompactGbt &cgbt) {
+  if (!CompactGbt::isCompactFormat(s, len)) {
+    LOG(ERROR) << "invalid compact rawgbt magic";
+    return false;
+  }
+  BinaryReader r(s + RAWGBT_COMPACT_MAGIC_LEN, len - RAWGBT_COMPACT_MAGIC_LEN);
+
+  uint16_t version = 0;
+  if (!r.read(&version) || version != RAWGBT_COMPACT_VERSION) {
+    LOG(ERROR) << "unsupported compact rawgbt version: " << version;
+    return false;
+  }
+
+  uint8_t isFull = 0;
+  uint32_t txCount = 0;
+  bool res = r.read(&cgbt.createdAt_) &&
+             r.readHash(&cgbt.gbtHash_) &&
+             r.read(&isFull) &&
+             r.readStr(&cgbt.header_) &&
+             r.read(&cgbt.txsPos_) &&
+             r.read(&txCount);
+  // each tx takes 33 bytes at least
+  if (!res || cgbt.header_.empty() || cgbt.header_[0] != '{' ||
+      cgbt.txsPos_ == 0 || cgbt.txsPos_ >= cgbt.header_.size() ||
+      cgbt.header_[cgbt.txsPos_] != ']' || txCount > len / 33) {
+    LOG(ERROR) << "parse compact rawgbt header failure, len: " << len;
+    return false;
+  }
+  cgbt.isFull_ = (isFull != 0);
+  cgbt.txids_.resize(txCount);
+  cgbt.txs_.assign(txCount, nullptr);
+
+  const time_t now = time(nullptr);
+  size_t missingCount = 0;
+  string body;
+  for (size_t i = 0; res && i < txCount; i++) {
+    const uint256 &txid = cgbt.txids_[i];
+    uint8_t hasBody = 0;
+    res = r.readHash(&cgbt.txids_[i]) && r.read(&hasBody);
+    if (!res) {
+      break;
+    }
+
+    if (hasBody != 0) {
+      res = r.readStr(&body);
+      if (res && isKeepTxs_) {
+        auto tx = std::make_shared<const string>(std::move(body));
+        txs_[txid] = TxEntry{tx, now};
+        cgbt.txs_[i] = tx;
+      }
+      continue;
+    }
+    if (!isKeepTxs_) {
+      continue;
+    }
+    auto itr = txs_.find(txid);
+    if (itr == txs_.end()) {
+      missingCount++;
+      continue;
+    }
+    itr->second.lastSeen_ = now;
+    cgbt.txs_[i] = itr->second.tx_;
+  }
+  if (!res) {
+    LOG(ERROR) << "parse compact rawgbt txs failure, len: " << len;
+    return false;
+  }
+  removeExpiredTxs(now);
+
+  if (missingCount > 0) {
+    LOG(WARNING) << "compact rawgbt " << cgbt.gbtHash_.ToString() << ", "
+    << missingCount << " of " << txCount << " txs never received, "
+    << "wait for a full message";
+    return false;
+  }
+  return true;
+}
+
+bool StratumJob::initFromGbt(const char *gbt, const string &poolCoinbaseInfo,
+                             const CTxDestination &poolPayoutAddr,
+                             const uint32_t blockVersion,
+                             const string &nmcAuxBlockJson,
+                             const RskWork &latestRskBlockJson,
+                             const uint8_t serverId,
+                             const bool isMergedMiningUpdate,
+                             const bool isDecodeGbtTxs) {
+  GbtTemplate gbtTpl;
+  if (!gbtTpl.initFromGbt(gbt, isDecodeGbtTxs, nullptr)) {
+    return false;
+  }
+  return initFromGbtTemplate(gbtTpl, poolCoinbaseInfo, poolPayoutAddr, blockVersion,
+                             nmcAuxBlockJson, latestRskBlockJson, serverId,
+                             isMergedMiningUpdate);
+}
+
+bool StratumJob::initFromGbtTemplate(const GbtTemplate &gbtTpl,
+                                     const string &poolCoinbaseInfo,
+                                     const CTxDestination &poolPayoutAddr,
+                                     const uint32_t blockVersion,
+                                     const string &nmcAuxBlockJson,
+                                     const RskWork &latestRskBlockJson,
+                                     const uint8_t serverId,
+                                     const bool isMergedMiningUpdate) {
+  // jobId: timestamp + gbtHash, we need to make sure jobId is unique in a some time
+  // jobId can convert to uint64_t
+  const string jobIdStr = Strings::Format("%08x%s%02x", (uint32_t)time(nullptr),
+                                                        gbtTpl.gbtHash_.ToString().substr(0, 6).c_str(),
+                                                        serverId);
+  assert(jobIdStr.length() == 16);
+  jobId_ = strtoull(jobIdStr.c_str(), nullptr, 16/* hex */);
+
+  gbtHash_ = gbtTpl.gbtHash_.ToString();
+
+  // height etc.
+  prevHash_ = gbtTpl.prevHash_;
+  height_   = gbtTpl.height_;
+  if (blockVersion != 0) {
+    nVersion_ = blockVersion;
+  } else {
+    nVersion_ = gbtTpl.nVersion_;
+  }
+  nBits_             = gbtTpl.nBits_;
+  nTime_             = gbtTpl.curTime_;
+  minTime_           = gbtTpl.minTime_;
+  coinbaseValue_     = gbtTpl.coinbaseValue_;
+  witnessCommitment_ = gbtTpl.witnessCommitment_;
+#ifdef CHAIN_TYPE_UBTC
+  rootStateHash_     = gbtTpl.rootStateHash_;
+#endif
+
   BitsToTarget(nBits_, networkTarget_);
 
   // previous block hash
   // we need to convert to little-endian
   // 00000000000000000328e9fea9914ad83b7404a838aa66aefb970e5689c2f63d
   // 89c2f63dfb970e5638aa66ae3b7404a8a9914ad80328e9fe0000000000000000
+  prevHashBeStr_.clear();
   for (int i = 0; i < 8; i++) {
     uint32 a = *(uint32 *)(BEGIN(prevHash_) + i * 4);
     a = HToBe(a);
@@ -427,17 +974,7 @@ bool StratumJob::initFromGbt(const char *gbt, const string &poolCoinbaseInfo,
   }
 
   // merkle branch, merkleBranch_ could be empty
-  {
-    // read txs hash/data
-    vector<uint256> vtxhashs;  // txs without coinbase
-    for (JsonNode & node : jgbt["transactions"].array()) {
-      CMutableTransaction tx;
-      DecodeHexTx(tx, node["data"].str());
-      vtxhashs.push_back(MakeTransactionRef(std::move(tx))->GetHash());
-    }
-    // make merkleSteps and merkle branch
-    makeMerkleBranch(vtxhashs, merkleBranch_);
-  }
+  merkleBranch_ = gbtTpl.merkleBranch_;
 
   // for Namecoin and RSK merged mining
   isMergedMiningCleanJob_ = isMergedMiningUpdate;
@@ -681,6 +1218,37 @@ bool StratumJob::initFromGbt(const char *gbt, const string &poolCoinbaseInfo,
   return true;
 }
 
+bool StratumJob::verifyGbtTxids(const char *gbt, size_t len) {
+  JsonNode r;
+  if (!JsonNode::parse(gbt, gbt + len, r)) {
+    LOG(ERROR) << "decode gbt json fail";
+    return false;
+  }
+  JsonNode jtxs = r["result"]["transactions"];
+
+  size_t index = 0;
+  for (JsonNode & node : jtxs.array()) {
+    JsonNode jtxid = getGbtTxid(node);
+    if (jtxid.type() != Utilities::JS::type::Str) {
+      index++;
+      continue;  // initFromGbt() decodes this one itself
+    }
+    CMutableTransaction tx;
+    if (!DecodeHexTx(tx, node["data"].str())) {
+      LOG(ERROR) << "decode gbt tx fail, index: " << index;
+      return false;
+    }
+    const uint256 txid = MakeTransactionRef(std::move(tx))->GetHash();
+    if (txid != uint256S(jtxid.str())) {
+      LOG(ERROR) << "gbt txid mismatch, index: " << index << ", gbt: " << jtxid.str()
+                 << ", decoded: " << txid.ToString();
+      return false;
+    }
+    index++;
+  }
+  return true;
+}
+
 bool StratumJob::isEmptyBlock() {
   return merkleBranch_.size() == 0 ? true : false;
 }
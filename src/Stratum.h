@@ -135,6 +135,12 @@ public:
     if (share_ == 0 || blkBits_ == 0) { return 0.0; }
     double networkDifficulty = 0.0;
     BitsToDifficulty(blkBits_, &networkDifficulty);
+    return score(networkDifficulty);
+  }
+
+  // networkDifficulty: of blkBits_, for the callers which cache it
+  double score(double networkDifficulty) const {
+    if (share_ == 0 || blkBits_ == 0) { return 0.0; }
 
     // Network diff may less than share diff on testnet or regression test network.
     // On regression test network, the network diff may be zero.
@@ -219,6 +225,119 @@ public:
 
 
 
+///////////////////////////////// GbtTemplate //////////////////////////////////
+// the parts of a getblocktemplate that a StratumJob is made of, parsed and
+// hashed once. JobMaker keeps the latest one: refreshing a job of the same
+// gbt only builds a new coinbase, and a gbt that keeps the leading txs of
+// the previous one rehashes only the changed part of the merkle tree.
+class GbtTemplate {
+public:
+  uint256  gbtHash_;
+  uint256  prevHash_;
+  int32_t  height_;
+  uint32_t nVersion_;
+  uint32_t nBits_;
+  uint32_t curTime_;
+  uint32_t minTime_;
+  int64_t  coinbaseValue_;
+  string   witnessCommitment_;
+#ifdef CHAIN_TYPE_UBTC
+  string   rootStateHash_;
+#endif
+
+  // merkleLevels_[0] is the txids without coinbase, merkleLevels_[k + 1] is
+  // hashed from merkleLevels_[k] with the coinbase side left out, so the
+  // first element of each level is a step of the merkle branch
+  vector<vector<uint256> > merkleLevels_;
+  vector<uint256> merkleBranch_;
+  // txs decoded instead of trusting the txids in gbt
+  bool   isTxsDecoded_;
+  // leading txids shared with the previous template
+  size_t reusedTxCount_;
+
+public:
+  GbtTemplate();
+
+  // previous: the template made before this one, its merkle tree is reused
+  // for the leading txids both have, could be nullptr
+  bool initFromGbt(const char *gbt, const bool isDecodeGbtTxs,
+                   const GbtTemplate *previous);
+  size_t txCount() const {
+    return merkleLevels_.empty() ? 0 : merkleLevels_[0].size();
+  }
+};
+
+////////////////////////////////// CompactGbt //////////////////////////////////
+// compact RawGbt message, instead of the base64 of the whole gbt json:
+// the gbt json without txs, the txids and the raw bytes of the txs. A tx
+// already sent since the last full message is referenced by its txid only.
+//
+// the decoder keeps the txs it has seen to resolve the references, so a
+// consumer starting in the middle could make templates after the next full
+// message, which is made every RawGbtEncoder::kFullInterval_ messages.
+#define RAWGBT_COMPACT_MAGIC      "\xffRGB"
+#define RAWGBT_COMPACT_MAGIC_LEN  4
+#define RAWGBT_COMPACT_VERSION    1
+
+class CompactGbt {
+public:
+  uint32_t createdAt_;
+  uint256  gbtHash_;  // hash of the original gbt json
+  bool     isFull_;   // all txs with their bodies
+  string   header_;   // gbt json, "transactions" is empty
+  uint32_t txsPos_;   // offset of the ']' of "transactions" in header_
+  vector<uint256> txids_;
+  // raw tx bytes, nullptr if the decoder does not keep txs
+  vector<shared_ptr<const string> > txs_;
+
+public:
+  CompactGbt(): createdAt_(0), isFull_(false), txsPos_(0) {}
+
+  static bool isCompactFormat(const char *s, size_t len);
+
+  // gbt json with the txs put back, without the fields of txs other than
+  // "data" and "txid", and with "gbthash" of the original gbt json
+  string toGbt() const;
+};
+
+class RawGbtEncoder {
+  uint32_t msgCount_;      // since the last full message
+  time_t   lastFullTime_;
+  set<uint256> sentTxs_;  // txs with body since the last full message
+
+public:
+  // a full message every kFullInterval_ messages, and at least once during
+  // kFullMaxAge_ seconds, so a referenced tx was sent in the recent time
+  static const uint32_t kFullInterval_ = 10;
+  static const time_t   kFullMaxAge_   = 300;
+
+  RawGbtEncoder(): msgCount_(0), lastFullTime_(0) {}
+
+  bool encode(const string &gbt, JsonNode &jgbt, const uint256 &gbtHash,
+              uint32_t createdAt, string &msg);
+  // the last message was not sent, the next one is full
+  void forceFull() { msgCount_ = 0; }
+};
+
+class RawGbtDecoder {
+  struct TxEntry {
+    shared_ptr<const string> tx_;
+    time_t lastSeen_;
+  };
+  bool isKeepTxs_;
+  map<uint256, TxEntry> txs_;  // txid -> raw tx
+
+  void removeExpiredTxs(time_t now);
+
+public:
+  // isKeepTxs: keep the txs to resolve the references, if false only the
+  // txids are read and CompactGbt::txs_ are nullptr
+  explicit RawGbtDecoder(bool isKeepTxs): isKeepTxs_(isKeepTxs) {}
+
+  bool decode(const char *s, size_t len, CompactGbt &cgbt);
+  size_t txCount() const { return txs_.size(); }
+};
+
 ////////////////////////////////// StratumJob //////////////////////////////////
 //
 // Stratum Job
@@ -244,6 +363,12 @@ public:
 //              so job_ids can be eventually rotated.
 //
 //
+// binary StratumJob message: [magic][uint16_t version][fields...]
+// the first byte of the magic could never be the first byte of a json
+#define STRATUM_JOB_BINARY_MAGIC      "\xffSJB"
+#define STRATUM_JOB_BINARY_MAGIC_LEN  4
+#define STRATUM_JOB_BINARY_VERSION    1
+
 class StratumJob {
 public:
   // jobId: timestamp + gbtHash, hex string, we need to make sure jobId is
@@ -296,14 +421,37 @@ public:
   string serializeToJson() const;
   bool unserializeFromJson(const char *s, size_t len);
 
+  // compact binary format, hashes are raw 32 bytes, see serializeToBinary()
+  string serializeToBinary() const;
+  bool unserializeFromBinary(const char *s, size_t len);
+
+  // detect json or binary by the magic prefix, so consumers could accept both
+  // of them while rolling out the binary format
+  bool unserialize(const char *s, size_t len);
+  static bool isBinaryFormat(const char *s, size_t len);
+
   bool initFromGbt(const char *gbt, const string &poolCoinbaseInfo,
                    const CTxDestination &poolPayoutAddr,
                    const uint32_t blockVersion,
                    const string &nmcAuxBlockJson,
                    const RskWork &latestRskBlockJson,
                    const uint8_t serverId,
-                   const bool isMergedMiningUpdate);
+                   const bool isMergedMiningUpdate,
+                   const bool isDecodeGbtTxs = false);
+  // the same as initFromGbt(), with the gbt already parsed
+  bool initFromGbtTemplate(const GbtTemplate &gbtTpl,
+                           const string &poolCoinbaseInfo,
+                           const CTxDestination &poolPayoutAddr,
+                           const uint32_t blockVersion,
+                           const string &nmcAuxBlockJson,
+                           const RskWork &latestRskBlockJson,
+                           const uint8_t serverId,
+                           const bool isMergedMiningUpdate);
   bool isEmptyBlock();
+
+  // decodes every tx of the gbt and checks it against the txid given by
+  // the gbt, which initFromGbt() trusts
+  static bool verifyGbtTxids(const char *gbt, size_t len);
 };
 
 #endif
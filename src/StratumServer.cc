@@ -95,12 +95,17 @@ void SessionIDManager::freeSessionId(uint32_t sessionId) {
 ////////////////////////////////// JobRepository ///////////////////////////////
 JobRepository::JobRepository(const char *kafkaBrokers,
                              const string &fileLastNotifyTime,
-                             Server *server):
+                             Server *server,
+                             JobRelayMode jobRelayMode,
+                             const string &jobRelayShmName):
 running_(true),
 kafkaConsumer_(kafkaBrokers, KAFKA_TOPIC_STRATUM_JOB, 0/*patition*/),
-server_(server), fileLastNotifyTime_(fileLastNotifyTime),
+server_(server),
+jobRelayMode_(jobRelayMode), jobRelayShmName_(jobRelayShmName),
+fileLastNotifyTime_(fileLastNotifyTime),
 kMaxJobsLifeTime_(300),
 kMiningNotifyInterval_(30),  // TODO: make as config arg
+kJobRelayStallTime_(60),
 lastJobSendTime_(0)
 {
   assert(kMiningNotifyInterval_ < kMaxJobsLifeTime_);
@@ -140,6 +145,20 @@ void JobRepository::stop() {
 bool JobRepository::setupThreadConsume() {
   const int32_t kConsumeLatestN = 1;
 
+  // read jobs from the relay publisher, no kafka
+  if (jobRelayMode_ == JOB_RELAY_SUBSCRIBER) {
+    threadConsume_ = thread(&JobRepository::runThreadConsumeRelay, this);
+    return true;
+  }
+
+  if (jobRelayMode_ == JOB_RELAY_PUBLISHER) {
+    // 32 * 128KB, a stratum job is only a few KB
+    if (!jobRelay_.openWriter(jobRelayShmName_, 32, 128 * 1024)) {
+      LOG(ERROR) << "open job relay failure: " << jobRelayShmName_;
+      return false;
+    }
+  }
+
   // we need to consume the latest one
   map<string, string> consumerOptions;
   consumerOptions["fetch.wait.max.ms"] = "10";
@@ -208,9 +227,14 @@ void JobRepository::consumeStratumJob(rd_kafka_message_t *rkmessage) {
     return;
   }
 
+  addStratumJob((const char *)rkmessage->payload, rkmessage->len);
+}
+
+void JobRepository::addStratumJob(const char *payload, size_t len,
+                                  const string *miningNotify2,
+                                  const string *miningNotify3Clean) {
   StratumJob *sjob = new StratumJob();
-  bool res = sjob->unserializeFromJson((const char *)rkmessage->payload,
-                                       rkmessage->len);
+  bool res = sjob->unserialize(payload, len);
   if (res == false) {
     LOG(ERROR) << "unserialize stratum job fail";
     delete sjob;
@@ -251,7 +275,13 @@ void JobRepository::consumeStratumJob(rd_kafka_message_t *rkmessage) {
   // don't have a sense and such shares will be rejected. When this flag is set,
   // miner should also drop all previous jobs.
   // 
-  shared_ptr<StratumJobEx> exJob = std::make_shared<StratumJobEx>(sjob, isClean);
+  shared_ptr<StratumJobEx> exJob;
+  if (miningNotify2 != nullptr && miningNotify3Clean != nullptr) {
+    exJob = std::make_shared<StratumJobEx>(sjob, isClean,
+                                           *miningNotify2, *miningNotify3Clean);
+  } else {
+    exJob = std::make_shared<StratumJobEx>(sjob, isClean);
+  }
   {
     ScopeLock sl(lock_);
 
@@ -266,6 +296,10 @@ void JobRepository::consumeStratumJob(rd_kafka_message_t *rkmessage) {
     exJobs_[sjob->jobId_] = exJob;
   }
 
+  if (jobRelayMode_ == JOB_RELAY_PUBLISHER) {
+    publishStratumJob(payload, len, exJob);
+  }
+
   // if job has clean flag, call server to send job
   if (isClean || isMergedMiningClean) {
     sendMiningNotify(exJob);
@@ -288,6 +322,143 @@ void JobRepository::consumeStratumJob(rd_kafka_message_t *rkmessage) {
   }
 }
 
+//
+// job relay message:
+//   [uint32_t len][stratum job json]
+//   [uint32_t len][miningNotify2_]
+//   [uint32_t len][miningNotify3Clean_]
+//
+static void _appendRelayField(string &buf, const char *data, size_t len) {
+  const uint32_t len32 = (uint32_t)len;
+  buf.append((const char *)&len32, sizeof(len32));
+  buf.append(data, len);
+}
+
+static bool _readRelayField(const string &buf, size_t &pos,
+                            const char **data, size_t *len) {
+  uint32_t len32;
+  if (pos + sizeof(len32) > buf.size()) {
+    return false;
+  }
+  memcpy(&len32, buf.data() + pos, sizeof(len32));
+  pos += sizeof(len32);
+  if (pos + len32 > buf.size()) {
+    return false;
+  }
+  *data = buf.data() + pos;
+  *len  = len32;
+  pos += len32;
+  return true;
+}
+
+void JobRepository::publishStratumJob(const char *payload, size_t len,
+                                      shared_ptr<StratumJobEx> exJob) {
+  string buf;
+  buf.reserve(len + exJob->miningNotify2_.size() +
+              exJob->miningNotify3Clean_.size() + 12);
+  _appendRelayField(buf, payload, len);
+  _appendRelayField(buf, exJob->miningNotify2_.data(),
+                    exJob->miningNotify2_.size());
+  _appendRelayField(buf, exJob->miningNotify3Clean_.data(),
+                    exJob->miningNotify3Clean_.size());
+
+  if (!jobRelay_.write(buf.data(), buf.size())) {
+    LOG(ERROR) << "publish stratum job to relay failure, jobId: "
+    << exJob->sjob_->jobId_;
+  }
+}
+
+bool JobRepository::readRelayJob(string &buf, int32_t timeoutMs) {
+  if (!jobRelay_.read(buf, timeoutMs)) {
+    return false;
+  }
+
+  size_t pos = 0;
+  const char *json, *notify2, *notify3Clean;
+  size_t jsonLen, notify2Len, notify3CleanLen;
+  if (!_readRelayField(buf, pos, &json, &jsonLen) ||
+      !_readRelayField(buf, pos, &notify2, &notify2Len) ||
+      !_readRelayField(buf, pos, &notify3Clean, &notify3CleanLen)) {
+    LOG(ERROR) << "invalid job relay message, len: " << buf.size();
+    return false;
+  }
+  const string miningNotify2(notify2, notify2Len);
+  const string miningNotify3Clean(notify3Clean, notify3CleanLen);
+  addStratumJob(json, jsonLen, &miningNotify2, &miningNotify3Clean);
+  return true;
+}
+
+void JobRepository::runThreadConsumeRelay() {
+  LOG(INFO) << "start job repository relay consume thread";
+
+  const int32_t kTimeoutMs = 1000;
+  // poll the relay between kafka messages while falling back
+  const int32_t kFallbackTimeoutMs = 100;
+
+  string buf;
+  time_t lastRelayTime = time(nullptr);
+  time_t lastOpenTime  = 0;
+  bool isKafkaSetup = false;  // the kafka consumer is set up on the first stall
+  bool isFallback   = false;
+
+  while (running_) {
+    // the publisher may not be started yet, retry every second
+    if (!jobRelay_.isOpen() && lastOpenTime != time(nullptr)) {
+      lastOpenTime = time(nullptr);
+      jobRelay_.openReader(jobRelayShmName_);
+    }
+
+    if (!jobRelay_.isOpen()) {
+      if (!isFallback) {
+        sleep(1);
+      }
+    } else if (readRelayJob(buf, isFallback ? 0 : kTimeoutMs)) {
+      lastRelayTime = time(nullptr);
+      if (isFallback) {
+        LOG(INFO) << "job relay is resumed, stop consuming 'StratumJob' from kafka";
+        isFallback = false;
+      }
+    }
+
+    // the publisher is gone or stuck, the ring's writeSeq_ doesn't move
+    if (!isFallback && lastRelayTime + kJobRelayStallTime_ < time(nullptr)) {
+      LOG(WARNING) << "no job from the relay in " << kJobRelayStallTime_
+      << " seconds, consume 'StratumJob' from kafka";
+
+      if (!isKafkaSetup) {
+        map<string, string> consumerOptions;
+        consumerOptions["fetch.wait.max.ms"] = "10";
+        if (!kafkaConsumer_.setup(RD_KAFKA_OFFSET_TAIL(1), &consumerOptions)) {
+          LOG(FATAL) << "setup consumer for the job relay fallback fail";
+          return;
+        }
+        isKafkaSetup = true;
+      }
+      isFallback = true;
+    }
+
+    rd_kafka_message_t *rkmessage;
+    if (isFallback) {
+      rkmessage = kafkaConsumer_.consumer(kFallbackTimeoutMs);
+      if (rkmessage != nullptr) {
+        consumeStratumJob(rkmessage);
+        rd_kafka_message_destroy(rkmessage);  /* Return message to rdkafka */
+      }
+    } else if (isKafkaSetup) {
+      // the relay is back, drop what kafka has fetched, they are in the relay too
+      while ((rkmessage = kafkaConsumer_.consumer(0)) != nullptr) {
+        rd_kafka_message_destroy(rkmessage);
+      }
+    }
+
+    // check if we need to send mining notify
+    checkAndSendMiningNotify();
+
+    tryCleanExpiredJobs();
+  }
+  LOG(INFO) << "stop job repository relay consume thread";
+}
+
 void JobRepository::markAllJobsAsStale() {
   ScopeLock sl(lock_);
   for (auto it : exJobs_) {
@@ -346,11 +517,32 @@ void JobRepository::tryCleanExpiredJobs() {
 
 
 //////////////////////////////////// UserInfo /////////////////////////////////
-UserInfo::UserInfo(const string &apiUrl, Server *server):
-running_(true), apiUrl_(apiUrl), lastMaxUserId_(0),
-server_(server)
+UserInfo::UserInfo(const string &apiUrl, Server *server,
+                   const char *kafkaBrokers):
+running_(true), apiUrl_(apiUrl),
+lastMaxUserId_(0),
+#ifdef USER_DEFINED_COINBASE
+lastTime_(0),
+#endif
+httpGetter_([](const string &url, string &response, long timeoutMs) {
+  return httpGET(url.c_str(), response, timeoutMs);
+}),
+hasUnknownUsers_(false), lastSyncFetchUs_(0),
+syncFetches_(0), negativeHits_(0),
+server_(server), lastCleanRecentWorkersTime_(0),
+workerUpdatesSent_(0), workerUpdatesDeduped_(0),
+eventSender_([this](const string &eventJson) {
+  server_->sendCommonEvents2Kafka(eventJson);
+}),
+kafkaConsumerUpdates_(nullptr)
 {
-  pthread_rwlock_init(&rwlock_, nullptr);
+  for (auto &shard : directory_) {
+    shard = std::make_shared<const DirectoryShard>();
+  }
+  if (kafkaBrokers != nullptr) {
+    kafkaConsumerUpdates_ = new KafkaConsumer(kafkaBrokers, KAFKA_TOPIC_USER_UPDATES,
+                                              0/* partition */);
+  }
 }
 
 UserInfo::~UserInfo() {
@@ -359,10 +551,14 @@ UserInfo::~UserInfo() {
   if (threadUpdate_.joinable())
     threadUpdate_.join();
 
+  if (threadConsumeUpdates_.joinable())
+    threadConsumeUpdates_.join();
+
   if (threadInsertWorkerName_.joinable())
     threadInsertWorkerName_.join();
 
-  pthread_rwlock_destroy(&rwlock_);
+  if (kafkaConsumerUpdates_ != nullptr)
+    delete kafkaConsumerUpdates_;
 }
 
 void UserInfo::stop() {
@@ -370,42 +566,194 @@ void UserInfo::stop() {
     return;
 
   running_ = false;
-}
 
-int32_t UserInfo::getUserId(const string userName) {
-  pthread_rwlock_rdlock(&rwlock_);
-  auto itr = nameIds_.find(userName);
-  pthread_rwlock_unlock(&rwlock_);
+  // wake up the update thread
+  ScopeLock sl(negativeLock_);
+  unknownUsersCond_.notify_all();
+}
 
-  if (itr != nameIds_.end()) {
+int32_t UserInfo::lookupUserId(const string &userName) {
+  shared_ptr<const DirectoryShard> dir = std::atomic_load(&directory_[shardOf(userName)]);
+  auto itr = dir->nameIds_.find(userName);
+  if (itr != dir->nameIds_.end()) {
     return itr->second;
   }
   return 0;  // not found
 }
 
+size_t UserInfo::userCount() {
+  size_t count = 0;
+  for (auto &shard : directory_) {
+    count += std::atomic_load(&shard)->nameIds_.size();
+  }
+  return count;
+}
+
+int32_t UserInfo::getUserId(const string userName) {
+  const uint64_t startUs = getMonotonicTimeUs();
+  const int32_t userId = lookupUserId(userName);
+  lookupLatency_.add(getMonotonicTimeUs() - startUs);
+  return userId;
+}
+
+bool UserInfo::fetchUnknownUser(const string &userName) {
+  if (apiUrl_.empty()) {
+    return false;
+  }
+
+  const time_t now = time(nullptr);
+  ScopeLock sl(negativeLock_);
+  auto itr = negativeNames_.find(userName);
+  if (itr != negativeNames_.end()) {
+    if (itr->second > now) {
+      negativeHits_++;
+      return false;
+    }
+    negativeNames_.erase(itr);  // expired
+  }
+
+  fetchingNames_.insert(userName);
+  hasUnknownUsers_ = true;
+  unknownUsersCond_.notify_all();
+  return true;
+}
+
+bool UserInfo::isFetchingUser(const string &userName) {
+  ScopeLock sl(negativeLock_);
+  return fetchingNames_.find(userName) != fetchingNames_.end();
+}
+
+void UserInfo::setUnknownUsersFetchedCallback(std::function<void()> callback) {
+  ScopeLock sl(negativeLock_);
+  unknownUsersFetchedCallback_ = callback;
+}
+
+void UserInfo::fetchUnknownUsers() {
+  std::unordered_set<string> names;
+  {
+    ScopeLock sl(negativeLock_);
+    hasUnknownUsers_ = false;
+    if (fetchingNames_.size() == 0) {
+      return;
+    }
+    // they're still fetching until the negative cache is updated
+    names = fetchingNames_;
+  }
+
+  // don't flood the api
+  const uint64_t nowUs = getMonotonicTimeUs();
+  if (lastSyncFetchUs_ + kMinSyncFetchIntervalUs_ > nowUs) {
+    usleep(lastSyncFetchUs_ + kMinSyncFetchIntervalUs_ - nowUs);
+  }
+  lastSyncFetchUs_ = getMonotonicTimeUs();
+
+  syncFetches_++;
+  {
+    ScopeLock sl(fetchLock_);
+    incrementalUpdateUsers(kSyncFetchTimeoutMs_);
+  }
+
+  {
+    const time_t now = time(nullptr);
+    ScopeLock sl(negativeLock_);
+    for (const auto &name : names) {
+      fetchingNames_.erase(name);
+      // applyUpdates() clears the negative cache after publishing, so a user
+      // pushed by kafka now is not kept as unknown
+      if (lookupUserId(name) == 0) {
+        if (negativeNames_.size() >= kMaxNegativeCacheSize_) {
+          negativeNames_.clear();
+        }
+        negativeNames_[name] = now + kNegativeCacheSeconds_;
+      }
+    }
+
+    // in the lock, so it's not called after it's cleared
+    if (unknownUsersFetchedCallback_) {
+      unknownUsersFetchedCallback_();
+    }
+  }
+}
+
+void UserInfo::applyUpdates(const vector<UserUpdate> &updates) {
+  if (updates.size() == 0) {
+    return;
+  }
+
+  {
+    ScopeLock sl(publishLock_);
+    // copy the shards of the updates, update and publish them
+    std::unordered_map<size_t, shared_ptr<DirectoryShard>> shards;
+    auto copyShard = [&](const size_t idx) -> DirectoryShard & {
+      shared_ptr<DirectoryShard> &shard = shards[idx];
+      if (shard == nullptr) {
+        shard = std::make_shared<DirectoryShard>(*std::atomic_load(&directory_[idx]));
+      }
+      return *shard;
+    };
+
+    for (const auto &update : updates) {
+      DirectoryShard &nameShard = copyShard(shardOf(update.userName_));
+      auto res = nameShard.nameIds_.insert(std::make_pair(update.userName_, update.userId_));
+      if (!res.second && res.first->second != update.userId_) {
+        LOG(WARNING) << "user " << update.userName_ << " is " << res.first->second
+        << " already, ignore the new id " << update.userId_;
+        continue;
+      }
+#ifdef USER_DEFINED_COINBASE
+      if (update.hasCoinbaseInfo_) {
+        DirectoryShard &idShard = copyShard(shardOf(update.userId_));
+        idShard.idCoinbaseInfos_[update.userId_] = update.coinbaseInfo_;
+      }
+#endif
+    }
+    for (const auto &itr : shards) {
+      std::atomic_store(&directory_[itr.first], shared_ptr<const DirectoryShard>(itr.second));
+    }
+  }
+
+  // they're not unknown any more
+  ScopeLock sl(negativeLock_);
+  if (negativeNames_.size() > 0) {
+    for (const auto &update : updates) {
+      negativeNames_.erase(update.userName_);
+    }
+  }
+}
+
 #ifdef USER_DEFINED_COINBASE
 ////////////////////// User defined coinbase enabled //////////////////////
 
+// resize coinbaseInfo to USER_DEFINED_COINBASE_SIZE bytes
+static void _formatCoinbaseInfo(string &coinbaseInfo) {
+  if (coinbaseInfo.size() > USER_DEFINED_COINBASE_SIZE) {
+    coinbaseInfo.resize(USER_DEFINED_COINBASE_SIZE);
+  } else {
+    // padding '\x20' at both beginning and ending of coinbaseInfo
+    int beginPaddingLen = (USER_DEFINED_COINBASE_SIZE - coinbaseInfo.size()) / 2;
+    coinbaseInfo.insert(0, beginPaddingLen, '\x20');
+    coinbaseInfo.resize(USER_DEFINED_COINBASE_SIZE, '\x20');
+  }
+}
+
 // getCoinbaseInfo
 string UserInfo::getCoinbaseInfo(int32_t userId) {
-  pthread_rwlock_rdlock(&rwlock_);
-  auto itr = idCoinbaseInfos_.find(userId);
-  pthread_rwlock_unlock(&rwlock_);
-
-  if (itr != idCoinbaseInfos_.end()) {
+  shared_ptr<const DirectoryShard> dir = std::atomic_load(&directory_[shardOf(userId)]);
+  auto itr = dir->idCoinbaseInfos_.find(userId);
+  if (itr != dir->idCoinbaseInfos_.end()) {
     return itr->second;
   }
   return "";  // not found
 }
 
-int32_t UserInfo::incrementalUpdateUsers() {
+int32_t UserInfo::incrementalUpdateUsers(const int32_t timeoutMs) {
   //
   // WARNING: The API is incremental update, we use `?last_id=` to make sure
   //          always get the new data. Make sure you have use `last_id` in API.
   //
   const string url = Strings::Format("%s?last_id=%d&last_time=%" PRId64, apiUrl_.c_str(), lastMaxUserId_, lastTime_);
   string resp;
-  if (!httpGET(url.c_str(), resp, 10000/* timeout ms */)) {
+  if (!httpGetter_(url, resp, timeoutMs)) {
     LOG(ERROR) << "http get request user list fail, url: " << url;
     return -1;
   }
@@ -427,7 +775,8 @@ int32_t UserInfo::incrementalUpdateUsers() {
   }
   lastTime_ = data["time"].int64();
 
-  pthread_rwlock_wrlock(&rwlock_);
+  vector<UserUpdate> updates;
+  updates.reserve(vUser->size());
   for (JsonNode &itr : *vUser) {
 
     const string  userName(itr.key_start(), itr.key_end() - itr.key_start());
@@ -438,29 +787,19 @@ int32_t UserInfo::incrementalUpdateUsers() {
     }
 
     int32 userId = itr["puid"].int32();
+    const bool hasCoinbaseInfo = (itr["coinbase"].type() == Utilities::JS::type::Str);
     string coinbaseInfo = itr["coinbase"].str();
-
-    // resize coinbaseInfo to USER_DEFINED_COINBASE_SIZE bytes
-    if (coinbaseInfo.size() > USER_DEFINED_COINBASE_SIZE) {
-      coinbaseInfo.resize(USER_DEFINED_COINBASE_SIZE);
-    } else {
-      // padding '\x20' at both beginning and ending of coinbaseInfo
-      int beginPaddingLen = (USER_DEFINED_COINBASE_SIZE - coinbaseInfo.size()) / 2;
-      coinbaseInfo.insert(0, beginPaddingLen, '\x20');
-      coinbaseInfo.resize(USER_DEFINED_COINBASE_SIZE, '\x20');
-    }
+    _formatCoinbaseInfo(coinbaseInfo);
 
     if (userId > lastMaxUserId_) {
       lastMaxUserId_ = userId;
     }
-    nameIds_[userName] = userId;
 
     // get user's coinbase info
     LOG(INFO) << "user id: " << userId << ", coinbase info: " << coinbaseInfo;
-    idCoinbaseInfos_[userId] = coinbaseInfo;
-
+    updates.push_back(UserUpdate{userName, userId, hasCoinbaseInfo, coinbaseInfo});
   }
-  pthread_rwlock_unlock(&rwlock_);
+  applyUpdates(updates);
 
   return vUser->size();
 }
@@ -469,14 +808,14 @@ int32_t UserInfo::incrementalUpdateUsers() {
 #else
 ////////////////////// User defined coinbase disabled //////////////////////
 
-int32_t UserInfo::incrementalUpdateUsers() {
+int32_t UserInfo::incrementalUpdateUsers(const int32_t timeoutMs) {
   //
   // WARNING: The API is incremental update, we use `?last_id=` to make sure
   //          always get the new data. Make sure you have use `last_id` in API.
   //
   const string url = Strings::Format("%s?last_id=%d", apiUrl_.c_str(), lastMaxUserId_);
   string resp;
-  if (!httpGET(url.c_str(), resp, 10000/* timeout ms */)) {
+  if (!httpGetter_(url, resp, timeoutMs)) {
     LOG(ERROR) << "http get request user list fail, url: " << url;
     return -1;
   }
@@ -495,16 +834,17 @@ int32_t UserInfo::incrementalUpdateUsers() {
     return 0;
   }
 
-  pthread_rwlock_wrlock(&rwlock_);
+  vector<UserUpdate> updates;
+  updates.reserve(vUser->size());
   for (const auto &itr : *vUser) {
     const string  userName(itr.key_start(), itr.key_end() - itr.key_start());
     const int32_t userId   = itr.int32();
     if (userId > lastMaxUserId_) {
       lastMaxUserId_ = userId;
     }
-    nameIds_.insert(std::make_pair(userName, userId));
+    updates.push_back(UserUpdate{userName, userId});
   }
-  pthread_rwlock_unlock(&rwlock_);
+  applyUpdates(updates);
 
   return vUser->size();
 }
@@ -512,17 +852,121 @@ int32_t UserInfo::incrementalUpdateUsers() {
 /////////////////// End of user defined coinbase disabled ///////////////////
 #endif
 
+//
+// message of topic 'UserUpdates':
+//   {"user_name":"jack","user_id":1}
+//   {"user_name":"jack","user_id":1,"coinbase":"/jack/"}  (USER_DEFINED_COINBASE)
+//
+bool UserInfo::parseUserUpdate(const char *s, size_t len, UserUpdate &update) {
+  JsonNode r;
+  if (!JsonNode::parse(s, s + len, r)) {
+    LOG(ERROR) << "decode user update fail, json: " << string(s, len);
+    return false;
+  }
+  if (r["user_name"].type() != Utilities::JS::type::Str ||
+      r["user_id"].type()   != Utilities::JS::type::Int) {
+    LOG(ERROR) << "invalid user update: " << string(s, len);
+    return false;
+  }
+  update.userName_ = r["user_name"].str();
+  update.userId_   = r["user_id"].int32();
+  if (update.userName_.empty() || update.userId_ <= 0) {
+    LOG(ERROR) << "invalid user update: " << string(s, len);
+    return false;
+  }
+#ifdef USER_DEFINED_COINBASE
+  // without "coinbase" the user keeps the coinbase info it has
+  update.hasCoinbaseInfo_ = (r["coinbase"].type() == Utilities::JS::type::Str);
+  update.coinbaseInfo_.clear();
+  if (update.hasCoinbaseInfo_) {
+    update.coinbaseInfo_ = r["coinbase"].str();
+    _formatCoinbaseInfo(update.coinbaseInfo_);
+  }
+#endif
+  return true;
+}
+
+void UserInfo::runThreadConsumeUpdates() {
+  LOG(INFO) << "start user updates consume thread";
+
+  const int32_t kTimeoutMs = 1000;
+  const size_t  kMaxBatchSize = 1000;
+  vector<UserUpdate> updates;
+
+  while (running_) {
+    rd_kafka_message_t *rkmessage;
+    rkmessage = kafkaConsumerUpdates_->consumer(updates.size() > 0 ? 0 : kTimeoutMs);
+    bool isIdle = (rkmessage == nullptr);  // no more messages for now
+
+    if (rkmessage != nullptr) {
+      isIdle = (rkmessage->err != RD_KAFKA_RESP_ERR_NO_ERROR);
+      if (rkmessage->err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+        UserUpdate update;
+        if (parseUserUpdate((const char *)rkmessage->payload, rkmessage->len, update)) {
+          updates.push_back(update);
+        }
+      } else if (rkmessage->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+        LOG(ERROR) << "consume user updates error: " << rd_kafka_message_errstr(rkmessage);
+      }
+      rd_kafka_message_destroy(rkmessage);  /* Return message to rdkafka */
+    }
+
+    // publish a batch when there are no more messages for now
+    if (updates.size() >= kMaxBatchSize || (updates.size() > 0 && isIdle)) {
+      applyUpdates(updates);
+      LOG(INFO) << "update users from kafka, count: " << updates.size();
+      updates.clear();
+    }
+  }
+  LOG(INFO) << "stop user updates consume thread";
+}
+
 void UserInfo::runThreadUpdate() {
   const time_t updateInterval = 10;  // seconds
+  const time_t statsInterval  = 60;
   time_t lastUpdateTime = time(nullptr);
+  time_t lastStatsTime  = time(nullptr);
 
   while (running_) {
-    if (lastUpdateTime + updateInterval > time(nullptr)) {
-      usleep(500000);  // 500ms
+    if (lastStatsTime + statsInterval <= time(nullptr)) {
+      lastStatsTime = time(nullptr);
+      LOG(INFO) << "users: " << userCount()
+      << ", sync fetches: " << syncFetches_.exchange(0)
+      << ", negative hits: " << negativeHits_.exchange(0)
+      << ", lookup latency: " << lookupLatency_.toString();
+      lookupLatency_.reset();
+
+      size_t workerNameQSize;
+      {
+        ScopeLock sl(workerNameLock_);
+        workerNameQSize = workerNameQ_.size();
+      }
+      LOG(INFO) << "worker name queue: " << workerNameQSize
+      << ", sent: " << workerUpdatesSent_.exchange(0)
+      << ", deduped: " << workerUpdatesDeduped_.exchange(0);
+    }
+
+    // wait 500ms at most, wake up at once for the unknown users
+    bool hasUnknownUsers;
+    {
+      UniqueLock ul(negativeLock_);
+      unknownUsersCond_.wait_for(ul, std::chrono::milliseconds(500),
+                                 [&] { return hasUnknownUsers_ || !running_; });
+      hasUnknownUsers = hasUnknownUsers_;
+    }
+    if (hasUnknownUsers) {
+      fetchUnknownUsers();
+    }
+
+    if (!running_ || lastUpdateTime + updateInterval > time(nullptr)) {
       continue;
     }
 
-    int32_t res = incrementalUpdateUsers();
+    int32_t res;
+    {
+      ScopeLock sl(fetchLock_);
+      res = incrementalUpdateUsers();
+    }
     lastUpdateTime = time(nullptr);
 
     if (res > 0)
@@ -531,6 +975,21 @@ void UserInfo::runThreadUpdate() {
 }
 
 bool UserInfo::setupThreads() {
+  //
+  // start consuming before the http api, so we'll not miss any update
+  // between them.
+  //
+  if (kafkaConsumerUpdates_ != nullptr) {
+    if (!kafkaConsumerUpdates_->setup(RD_KAFKA_OFFSET_END)) {
+      LOG(ERROR) << "setup user updates consumer fail";
+      return false;
+    }
+    if (!kafkaConsumerUpdates_->checkAlive()) {
+      LOG(ERROR) << "kafka brokers is not alive";
+      return false;
+    }
+  }
+
   //
   // get all user list, incremental update model.
   //
@@ -539,7 +998,11 @@ bool UserInfo::setupThreads() {
   // data in one request.
   //
   while (1) {
-    int32_t res = incrementalUpdateUsers();
+    int32_t res;
+    {
+      ScopeLock sl(fetchLock_);
+      res = incrementalUpdateUsers();
+    }
     if (res == 0)
       break;
 
@@ -553,6 +1016,9 @@ bool UserInfo::setupThreads() {
 
   threadUpdate_ = thread(&UserInfo::runThreadUpdate, this);
   threadInsertWorkerName_ = thread(&UserInfo::runThreadInsertWorkerName, this);
+  if (kafkaConsumerUpdates_ != nullptr) {
+    threadConsumeUpdates_ = thread(&UserInfo::runThreadConsumeUpdates, this);
+  }
   return true;
 }
 
@@ -577,51 +1043,83 @@ void UserInfo::addWorker(const int32_t userId, const int64_t workerId,
 
 void UserInfo::runThreadInsertWorkerName() {
   while (running_) {
-    if (insertWorkerName() > 0) {
-      continue;
-    }
+    // drain the queue every second, so the events are batched
+    insertWorkerName(time(nullptr));
     sleep(1);
   }
 }
 
-int32_t UserInfo::insertWorkerName() {
-  std::deque<WorkerName>::iterator itr = workerNameQ_.end();
+void UserInfo::sendWorkerUpdates(const string &content, const size_t count) {
+  // sent events to kafka: worker_update_batch
+  const string eventJson = Strings::Format("{\"created_at\":\"%s\","
+                                           "\"type\":\"worker_update_batch\","
+                                           "\"content\":[%s]}",
+                                           date("%F %T").c_str(),
+                                           content.c_str());
+  eventSender_(eventJson);
+  workerUpdatesSent_ += count;
+}
+
+int32_t UserInfo::insertWorkerName(const time_t now) {
+  // take all of them at once
+  std::deque<WorkerName> workerNames;
   {
     ScopeLock sl(workerNameLock_);
     if (workerNameQ_.size() == 0)
       return 0;
-    itr = workerNameQ_.begin();
+    workerNames.swap(workerNameQ_);
   }
 
-  if (itr == workerNameQ_.end())
-    return 0;
+  string content;
+  size_t count = 0;
 
+  for (const auto &itr : workerNames) {
+    // skip the same registration in the window
+    RecentWorker &recent = recentWorkers_[std::make_pair(itr.userId_, itr.workerId_)];
+    if (recent.sentTime_ + kWorkerUpdateDedupSeconds_ > now &&
+        recent.minerAgent_ == itr.minerAgent_) {
+      workerUpdatesDeduped_++;
+      continue;
+    }
+    recent.sentTime_   = now;
+    recent.minerAgent_ = itr.minerAgent_;
 
-  // sent events to kafka: worker_update
-  {
-    string eventJson;
-    eventJson = Strings::Format("{\"created_at\":\"%s\","
-                                 "\"type\":\"worker_update\","
-                                 "\"content\":{"
-                                     "\"user_id\":%d,"
-                                     "\"worker_id\":%ld,"
-                                     "\"worker_name\":\"%s\","
-                                     "\"miner_agent\":\"%s\""
-                                "}}",
-                                date("%F %T").c_str(),
-                                itr->userId_,
-                                itr->workerId_,
-                                itr->workerName_,
-                                itr->minerAgent_);
-    server_->sendCommonEvents2Kafka(eventJson);
+    if (count > 0) {
+      content.append(",");
+    }
+    content.append(Strings::Format("{\"user_id\":%d,"
+                                   "\"worker_id\":%" PRId64 ","
+                                   "\"worker_name\":\"%s\","
+                                   "\"miner_agent\":\"%s\"}",
+                                   itr.userId_,
+                                   itr.workerId_,
+                                   itr.workerName_,
+                                   itr.minerAgent_));
+    count++;
+
+    if (count >= kMaxWorkerUpdatesPerEvent_) {
+      sendWorkerUpdates(content, count);
+      content.clear();
+      count = 0;
+    }
+  }
+  if (count > 0) {
+    sendWorkerUpdates(content, count);
   }
 
-
-  {
-    ScopeLock sl(workerNameLock_);
-    workerNameQ_.pop_front();
+  // remove the expired ones
+  if (lastCleanRecentWorkersTime_ + kWorkerUpdateDedupSeconds_ < now) {
+    lastCleanRecentWorkersTime_ = now;
+    for (auto itr = recentWorkers_.begin(); itr != recentWorkers_.end(); ) {
+      if (itr->second.sentTime_ + kWorkerUpdateDedupSeconds_ <= now) {
+        itr = recentWorkers_.erase(itr);
+      } else {
+        itr++;
+      }
+    }
   }
-  return 1;
+
+  return workerNames.size();
 }
 
 
@@ -634,6 +1132,26 @@ state_(0), isClean_(isClean), sjob_(sjob)
   makeMiningNotifyStr();
 }
 
+StratumJobEx::StratumJobEx(StratumJob *sjob, bool isClean,
+                           const string &miningNotify2,
+                           const string &miningNotify3Clean):
+state_(0), isClean_(isClean), sjob_(sjob)
+{
+  assert(sjob != nullptr);
+  miningNotify1_      = "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"";
+  miningNotify2_      = miningNotify2;
+  coinbase1_          = sjob_->coinbase1_.c_str();
+  miningNotify3Clean_ = miningNotify3Clean;
+
+  // miningNotify3_ only differs in the clean_jobs field, see makeMiningNotifyStr()
+  const string kCleanTail = "true]}\n";
+  miningNotify3_ = miningNotify3Clean_;
+  if (!isClean_ && miningNotify3_.size() >= kCleanTail.size()) {
+    miningNotify3_.resize(miningNotify3_.size() - kCleanTail.size());
+    miningNotify3_.append("false]}\n");
+  }
+}
+
 StratumJobEx::~StratumJobEx() {
   if (sjob_) {
     delete sjob_;
@@ -701,21 +1219,20 @@ bool StratumJobEx::isStale() {
 void StratumJobEx::generateCoinbaseTx(std::vector<char> *coinbaseBin,
                                       const uint32_t extraNonce1,
                                       const string &extraNonce2Hex,
-                                      string *userCoinbaseInfo) {
+                                      const string *userCoinbase1) {
   string coinbaseHex;
   const string extraNonceStr = Strings::Format("%08x%s", extraNonce1, extraNonce2Hex.c_str());
-  string coinbase1 = sjob_->coinbase1_;
 
 #ifdef USER_DEFINED_COINBASE
-  if (userCoinbaseInfo != nullptr) {
-    string userCoinbaseHex;
-    Bin2Hex((uint8*)(*userCoinbaseInfo).c_str(), (*userCoinbaseInfo).size(), userCoinbaseHex);
-    // replace the last `userCoinbaseHex.size()` bytes to `userCoinbaseHex`
-    coinbase1.replace(coinbase1.size()-userCoinbaseHex.size(), userCoinbaseHex.size(), userCoinbaseHex);
+  // the same coinbase1 sent to the miner, see getUserCoinbase1()
+  if (userCoinbase1 != nullptr) {
+    coinbaseHex.append(*userCoinbase1);
+  } else {
+    coinbaseHex.append(sjob_->coinbase1_);
   }
+#else
+  coinbaseHex.append(sjob_->coinbase1_);
 #endif
-
-  coinbaseHex.append(coinbase1);
   coinbaseHex.append(extraNonceStr);
   coinbaseHex.append(sjob_->coinbase2_);
   Hex2Bin((const char *)coinbaseHex.c_str(), *coinbaseBin);
@@ -730,8 +1247,8 @@ void StratumJobEx::generateBlockHeader(CBlockHeader *header,
                                        const uint32_t nBits, const int32_t nVersion,
                                        const uint32_t nTime, const uint32_t nonce,
                                        const uint32_t versionMask,
-                                       string *userCoinbaseInfo) {
-  generateCoinbaseTx(coinbaseBin, extraNonce1, extraNonce2Hex, userCoinbaseInfo);
+                                       const string *userCoinbase1) {
+  generateCoinbaseTx(coinbaseBin, extraNonce1, extraNonce2Hex, userCoinbase1);
 
   header->hashPrevBlock = hashPrevBlock;
   header->nVersion      = (nVersion ^ versionMask);
@@ -750,6 +1267,34 @@ void StratumJobEx::generateBlockHeader(CBlockHeader *header,
   }
 }
 
+#ifdef USER_DEFINED_COINBASE
+shared_ptr<const string> StratumJobEx::getUserCoinbase1(const int32_t userId,
+                                                        UserInfo *userInfo) {
+  {
+    ScopeLock sl(userCoinbase1sLock_);
+    auto itr = userCoinbase1s_.find(userId);
+    if (itr != userCoinbase1s_.end()) {
+      return itr->second;
+    }
+  }
+
+  // build it without the lock, it's ok if two threads build the same one
+  const string userCoinbaseInfo = userInfo->getCoinbaseInfo(userId);
+  string userCoinbaseHex;
+  Bin2Hex((const uint8_t *)userCoinbaseInfo.c_str(), userCoinbaseInfo.size(), userCoinbaseHex);
+
+  string coinbase1 = coinbase1_;
+  if (userCoinbaseHex.size() <= coinbase1.size()) {
+    // replace the last `userCoinbaseHex.size()` bytes to `userCoinbaseHex`
+    coinbase1.replace(coinbase1.size()-userCoinbaseHex.size(), userCoinbaseHex.size(), userCoinbaseHex);
+  }
+  shared_ptr<const string> ptr = std::make_shared<const string>(std::move(coinbase1));
+
+  ScopeLock sl(userCoinbase1sLock_);
+  return userCoinbase1s_.insert(std::make_pair(userId, ptr)).first->second;
+}
+#endif
+
 ////////////////////////////////// StratumServer ///////////////////////////////
 StratumServer::StratumServer(const char *ip, const unsigned short port,
                              const char *kafkaBrokers, const string &userAPIUrl,
@@ -758,13 +1303,27 @@ StratumServer::StratumServer(const char *ip, const unsigned short port,
                              const string &fileLastNotifyTime,
                              bool isEnableSimulator, bool isSubmitInvalidBlock,
                              bool isDevModeEnable, float minerDifficulty,
-                             const int32_t shareAvgSeconds)
+                             const int32_t shareAvgSeconds,
+                             const string &solvedShareSpillDir,
+                             JobRelayMode jobRelayMode,
+                             const string &jobRelayShmName,
+                             const string &diffCacheFile,
+                             RedisConnectInfo *diffCacheRedisInfo,
+                             const string &diffCacheRedisKey,
+                             const AdmissionConfig &admissionConfig,
+                             bool isUserUpdatesFromKafka)
 :running_(true), server_(shareAvgSeconds, versionMask),
 ip_(ip), port_(port), serverId_(serverId),
 fileLastNotifyTime_(fileLastNotifyTime),
 kafkaBrokers_(kafkaBrokers), userAPIUrl_(userAPIUrl),
 isEnableSimulator_(isEnableSimulator), isSubmitInvalidBlock_(isSubmitInvalidBlock),
-isDevModeEnable_(isDevModeEnable), minerDifficulty_(minerDifficulty)
+isDevModeEnable_(isDevModeEnable), minerDifficulty_(minerDifficulty),
+solvedShareSpillDir_(solvedShareSpillDir),
+jobRelayMode_(jobRelayMode), jobRelayShmName_(jobRelayShmName),
+diffCacheFile_(diffCacheFile), diffCacheRedisInfo_(diffCacheRedisInfo),
+diffCacheRedisKey_(diffCacheRedisKey),
+admissionConfig_(admissionConfig),
+isUserUpdatesFromKafka_(isUserUpdatesFromKafka)
 {
 }
 
@@ -775,7 +1334,11 @@ bool StratumServer::init() {
   if (!server_.setup(ip_.c_str(), port_, kafkaBrokers_.c_str(),
                      userAPIUrl_, serverId_, fileLastNotifyTime_,
                      isEnableSimulator_, isSubmitInvalidBlock_,
-                     isDevModeEnable_, minerDifficulty_)) {
+                     isDevModeEnable_, minerDifficulty_,
+                     solvedShareSpillDir_,
+                     jobRelayMode_, jobRelayShmName_,
+                     diffCacheFile_, diffCacheRedisInfo_, diffCacheRedisKey_,
+                     admissionConfig_, isUserUpdatesFromKafka_)) {
     LOG(ERROR) << "fail to setup server";
     return false;
   }
@@ -805,6 +1368,11 @@ kafkaProducerCommonEvents_(nullptr),
 kafkaProducerRskSolvedShare_(nullptr),
 versionMask_(versionMask),
 isEnableSimulator_(false), isSubmitInvalidBlock_(false),
+shareCount_(0), lastShareCount_(0), warmupMinute_(0), shareRateEvent_(nullptr),
+acceptLimiter_(nullptr), firstJobCredit_(0),
+admissionEvent_(nullptr), admissionStatsEvent_(nullptr),
+authorizeEvent_(nullptr),
+pendingHandshakes_(0), acceptedCount_(0), deferredCount_(0), rejectedCount_(0),
 
 #ifndef WORK_WITH_STRATUM_SWITCHER
 sessionIDManager_(nullptr),
@@ -812,7 +1380,8 @@ sessionIDManager_(nullptr),
 
 isDevModeEnable_(false), minerDifficulty_(1.0),
 kShareAvgSeconds_(shareAvgSeconds),
-jobRepository_(nullptr), userInfo_(nullptr)
+jobRepository_(nullptr), userInfo_(nullptr), workerDiffCache_(nullptr),
+backpressureSessions_(0), coalescedNotifies_(0), slowConsumerClosed_(0)
 {
 }
 
@@ -820,6 +1389,28 @@ Server::~Server() {
   if (signal_event_ != nullptr) {
     event_free(signal_event_);
   }
+  if (shareRateEvent_ != nullptr) {
+    event_free(shareRateEvent_);
+  }
+  if (admissionEvent_ != nullptr) {
+    event_free(admissionEvent_);
+  }
+  if (admissionStatsEvent_ != nullptr) {
+    event_free(admissionStatsEvent_);
+  }
+  if (authorizeEvent_ != nullptr) {
+    // the update thread of userInfo_ activates it
+    if (userInfo_ != nullptr) {
+      userInfo_->setUnknownUsersFetchedCallback(nullptr);
+    }
+    event_free(authorizeEvent_);
+  }
+  for (const auto &pending : pendingAccepts_) {
+    close(pending.fd_);
+  }
+  if (acceptLimiter_ != nullptr) {
+    delete acceptLimiter_;
+  }
   if (listener_ != nullptr) {
     evconnlistener_free(listener_);
   }
@@ -847,6 +1438,9 @@ Server::~Server() {
   if (userInfo_ != nullptr) {
     delete userInfo_;
   }
+  if (workerDiffCache_ != nullptr) {
+    delete workerDiffCache_;
+  }
 
 #ifndef WORK_WITH_STRATUM_SWITCHER
   if (sessionIDManager_ != nullptr) {
@@ -860,7 +1454,15 @@ bool Server::setup(const char *ip, const unsigned short port,
                    const string &userAPIUrl,
                    const uint8_t serverId, const string &fileLastNotifyTime,
                    bool isEnableSimulator, bool isSubmitInvalidBlock,
-                   bool isDevModeEnable, float minerDifficulty) {
+                   bool isDevModeEnable, float minerDifficulty,
+                   const string &solvedShareSpillDir,
+                   JobRelayMode jobRelayMode,
+                   const string &jobRelayShmName,
+                   const string &diffCacheFile,
+                   RedisConnectInfo *diffCacheRedisInfo,
+                   const string &diffCacheRedisKey,
+                   const AdmissionConfig &admissionConfig,
+                   bool isUserUpdatesFromKafka) {
   if (isEnableSimulator) {
     isEnableSimulator_ = true;
     LOG(WARNING) << "Simulator is enabled, all share will be accepted";
@@ -893,18 +1495,48 @@ bool Server::setup(const char *ip, const unsigned short port,
                                                  KAFKA_TOPIC_COMMON_EVENTS,
                                                  RD_KAFKA_PARTITION_UA);
 
+  //
+  // we can't lose any solved share. spill them to disk if the producer queue
+  // is full or the delivery failed, otherwise block until it's enqueued.
+  //
+  if (solvedShareSpillDir.empty()) {
+    kafkaProducerSolvedShare_->setQueueFullPolicy(KafkaProducer::QUEUE_FULL_BLOCK);
+    kafkaProducerNamecoinSolvedShare_->setQueueFullPolicy(KafkaProducer::QUEUE_FULL_BLOCK);
+    kafkaProducerRskSolvedShare_->setQueueFullPolicy(KafkaProducer::QUEUE_FULL_BLOCK);
+  } else {
+    const string prefix = Strings::Format("%s/sserver_%u_", solvedShareSpillDir.c_str(),
+                                          (uint32_t)serverId);
+    kafkaProducerSolvedShare_->setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL,
+                                                  prefix + KAFKA_TOPIC_SOLVED_SHARE ".spill");
+    kafkaProducerNamecoinSolvedShare_->setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL,
+                                                          prefix + KAFKA_TOPIC_NMC_SOLVED_SHARE ".spill");
+    kafkaProducerRskSolvedShare_->setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL,
+                                                     prefix + KAFKA_TOPIC_RSK_SOLVED_SHARE ".spill");
+  }
+
   // job repository
-  jobRepository_ = new JobRepository(kafkaBrokers, fileLastNotifyTime, this);
+  jobRepository_ = new JobRepository(kafkaBrokers, fileLastNotifyTime, this,
+                                     jobRelayMode, jobRelayShmName);
   if (!jobRepository_->setupThreadConsume()) {
     return false;
   }
 
   // user info
-  userInfo_ = new UserInfo(userAPIUrl, this);
+  userInfo_ = new UserInfo(userAPIUrl, this,
+                           isUserUpdatesFromKafka ? kafkaBrokers : nullptr);
   if (!userInfo_->setupThreads()) {
     return false;
   }
 
+  // worker diff cache
+  if (!diffCacheFile.empty() || diffCacheRedisInfo != nullptr) {
+    workerDiffCache_ = new WorkerDiffCache(diffCacheFile, diffCacheRedisInfo,
+                                           diffCacheRedisKey);
+    if (!workerDiffCache_->setup()) {
+      return false;
+    }
+  }
+
 #ifndef WORK_WITH_STRATUM_SWITCHER
   sessionIDManager_ = new SessionIDManager(serverId);
 #endif
@@ -1016,6 +1648,37 @@ bool Server::setup(const char *ip, const unsigned short port,
     LOG(ERROR) << "cannot create listener: " << ip << ":" << port;
     return false;
   }
+
+  // log share rate every minute in the warm-up period
+  shareRateEvent_ = event_new(base_, -1, EV_PERSIST, Server::shareRateCallback, this);
+  struct timeval oneMinute = {60, 0};
+  event_add(shareRateEvent_, &oneMinute);
+
+  // admission control
+  admissionConfig_ = admissionConfig;
+  acceptLimiter_ = new AcceptLimiter(admissionConfig.acceptRatePerSubnet_,
+                                     admissionConfig.acceptBurstPerSubnet_);
+  if (admissionConfig_.isAcceptLimited() || admissionConfig_.firstJobsPerSecond_ > 0) {
+    LOG(INFO) << "admission control, accept rate per subnet: "
+    << admissionConfig_.acceptRatePerSubnet_ << "/s, burst: "
+    << admissionConfig_.acceptBurstPerSubnet_
+    << ", max pending handshakes: " << admissionConfig_.maxPendingHandshakes_
+    << ", max pending accepts: " << admissionConfig_.maxPendingAccepts_
+    << ", first jobs: " << admissionConfig_.firstJobsPerSecond_ << "/s";
+
+    admissionEvent_ = event_new(base_, -1, EV_PERSIST, Server::admissionCallback, this);
+    struct timeval tenMs = {0, 10000};
+    event_add(admissionEvent_, &tenMs);
+  }
+  admissionStatsEvent_ = event_new(base_, -1, EV_PERSIST, Server::admissionStatsCallback, this);
+  event_add(admissionStatsEvent_, &oneMinute);
+
+  // resume the authorizes of unknown users when the update thread fetched them
+  authorizeEvent_ = event_new(base_, -1, 0, Server::authorizeCallback, this);
+  userInfo_->setUnknownUsersFetchedCallback([this]() {
+    event_active(authorizeEvent_, EV_TIMEOUT, 0);
+  });
+
   return true;
 }
 
@@ -1036,6 +1699,27 @@ void Server::stop() {
 
   jobRepository_->stop();
   userInfo_->stop();
+  if (workerDiffCache_ != nullptr) {
+    workerDiffCache_->stop();
+  }
+}
+
+void Server::shareRateCallback(evutil_socket_t, short, void *ptr) {
+  Server *server = static_cast<Server *>(ptr);
+  const uint64_t shareCount = server->shareCount_;
+
+  server->warmupMinute_++;
+  LOG(INFO) << "share rate, minute " << server->warmupMinute_ << " after start: "
+  << (shareCount - server->lastShareCount_) / 60.0 << " shares/s"
+  << ", workers in diff cache: "
+  << (server->workerDiffCache_ != nullptr ? server->workerDiffCache_->size() : 0);
+  server->lastShareCount_ = shareCount;
+
+  if (server->warmupMinute_ >= kWarmupMinutes_) {
+    LOG(INFO) << "share rate, first " << kWarmupMinutes_ << " minutes: "
+    << shareCount / (kWarmupMinutes_ * 60.0) << " shares/s";
+    event_del(server->shareRateEvent_);
+  }
 }
 
 void Server::sendMiningNotifyToAll(shared_ptr<StratumJobEx> exJobPtr) {
@@ -1094,29 +1778,41 @@ void Server::listenerCallback(struct evconnlistener* listener,
                               int socklen, void* data)
 {
   Server *server = static_cast<Server *>(data);
-  struct event_base  *base = (struct event_base*)server->base_;
+
+  if (server->admissionConfig_.isAcceptLimited() &&
+      !server->tryAdmit(saddr)) {
+    server->deferAccept(fd, saddr, socklen);
+    return;
+  }
+  server->acceptConnection(fd, saddr);
+}
+
+void Server::acceptConnection(evutil_socket_t fd, struct sockaddr *saddr) {
   struct bufferevent *bev;
   uint32_t sessionID = 0u;
 
 #ifndef WORK_WITH_STRATUM_SWITCHER
   // can't alloc session Id
-  if (server->sessionIDManager_->allocSessionId(&sessionID) == false) {
+  if (sessionIDManager_->allocSessionId(&sessionID) == false) {
     close(fd);
     return;
   }
 #endif
 
-  bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE|BEV_OPT_THREADSAFE);
+  bev = bufferevent_socket_new(base_, fd, BEV_OPT_CLOSE_ON_FREE|BEV_OPT_THREADSAFE);
   if(bev == nullptr) {
     LOG(ERROR) << "error constructing bufferevent!";
-    server->stop();
+    stop();
     return;
   }
 
   // create stratum session
-  StratumSession* conn = new StratumSession(fd, bev, server, saddr,
-                                            server->kShareAvgSeconds_,
+  StratumSession* conn = new StratumSession(fd, bev, this, saddr,
+                                            kShareAvgSeconds_,
                                             sessionID);
+  acceptedCount_++;
+  pendingHandshakes_++;
+
   // set callback functions
   bufferevent_setcb(bev,
                     Server::readCallback, nullptr,
@@ -1124,7 +1820,168 @@ void Server::listenerCallback(struct evconnlistener* listener,
   // By default, a newly created bufferevent has writing enabled.
   bufferevent_enable(bev, EV_READ|EV_WRITE);
 
-  server->addConnection(fd, conn);
+  addConnection(fd, conn);
+}
+
+bool Server::tryAdmit(const struct sockaddr *saddr) {
+  if (admissionConfig_.maxPendingHandshakes_ > 0 &&
+      pendingHandshakes_ >= admissionConfig_.maxPendingHandshakes_) {
+    return false;
+  }
+  return acceptLimiter_->tryAccept(saddr, getMonotonicTimeUs());
+}
+
+void Server::deferAccept(evutil_socket_t fd, struct sockaddr *saddr, int socklen) {
+  // the miner will reconnect later
+  if ((int32_t)pendingAccepts_.size() >= admissionConfig_.maxPendingAccepts_ ||
+      socklen < 0 || (size_t)socklen > sizeof(PendingAccept::saddr_)) {
+    close(fd);
+    rejectedCount_++;
+    return;
+  }
+
+  PendingAccept pending;
+  pending.fd_ = fd;
+  memset(&pending.saddr_, 0, sizeof(pending.saddr_));
+  memcpy(&pending.saddr_, saddr, socklen);
+  pending.enqueueTimeUs_ = getMonotonicTimeUs();
+  pendingAccepts_.push_back(pending);
+  deferredCount_++;
+}
+
+void Server::drainPendingAccepts() {
+  const uint64_t now = getMonotonicTimeUs();
+  const size_t num = pendingAccepts_.size();
+
+  // keep the order of the ones still waiting
+  for (size_t i = 0; i < num; i++) {
+    PendingAccept pending = pendingAccepts_.front();
+    pendingAccepts_.pop_front();
+
+    if (pending.enqueueTimeUs_ + kMaxPendingAcceptSeconds_ * 1000000ull < now) {
+      close(pending.fd_);
+      rejectedCount_++;
+      continue;
+    }
+    if (!tryAdmit((struct sockaddr *)&pending.saddr_)) {
+      pendingAccepts_.push_back(pending);
+      continue;
+    }
+    acceptDelay_.add(now - pending.enqueueTimeUs_);
+    acceptConnection(pending.fd_, (struct sockaddr *)&pending.saddr_);
+  }
+}
+
+void Server::finishHandshake(const uint64_t acceptTimeUs, bool isAuthorized) {
+  pendingHandshakes_--;
+  if (isAuthorized) {
+    handshakeLatency_.add(getMonotonicTimeUs() - acceptTimeUs);
+  }
+}
+
+void Server::finishFirstJob(const uint64_t authorizeTimeUs) {
+  firstJobLatency_.add(getMonotonicTimeUs() - authorizeTimeUs);
+}
+
+void Server::sendFirstMiningNotify(StratumSession *session) {
+  if (admissionConfig_.firstJobsPerSecond_ <= 0) {
+    session->sendMiningNotify(jobRepository_->getLatestStratumJobEx(), true/* is first job */);
+    return;
+  }
+  // the session is always in the event loop, same as the queue
+  session->markWaitingFirstJob();
+  firstJobQueue_.push_back(session->fd_);
+}
+
+void Server::drainFirstJobQueue() {
+  if (firstJobQueue_.empty()) {
+    firstJobCredit_ = 0;  // not saved up for a burst
+    return;
+  }
+  // 10ms per tick, so 150/s is 1 or 2 a tick, 50/s is 1 every 2 ticks
+  firstJobCredit_ += admissionConfig_.firstJobsPerSecond_;
+  int32_t num = firstJobCredit_ / 100;
+  firstJobCredit_ %= 100;
+  if (num == 0) {
+    return;
+  }
+
+  shared_ptr<StratumJobEx> exJobPtr = jobRepository_->getLatestStratumJobEx();
+  ScopeLock sl(connsLock_);
+  while (num > 0 && !firstJobQueue_.empty()) {
+    const evutil_socket_t fd = firstJobQueue_.front();
+    firstJobQueue_.pop_front();
+
+    // the fd may be closed or reused by another session
+    auto itr = connections_.find(fd);
+    if (itr == connections_.end() || itr->second->isDead() ||
+        !itr->second->isWaitingFirstJob()) {
+      continue;
+    }
+    itr->second->sendMiningNotify(exJobPtr, true/* is first job */);
+    num--;
+  }
+}
+
+void Server::addPendingAuthorize(StratumSession *session) {
+  // the session is always in the event loop, same as the queue
+  pendingAuthorizes_.push_back(session->fd_);
+}
+
+void Server::drainPendingAuthorizes() {
+  std::deque<evutil_socket_t> fds;
+  fds.swap(pendingAuthorizes_);
+
+  ScopeLock sl(connsLock_);
+  for (const auto fd : fds) {
+    // the fd may be closed or reused by another session
+    auto itr = connections_.find(fd);
+    if (itr == connections_.end() || itr->second->isDead() ||
+        !itr->second->isAuthorizing()) {
+      continue;
+    }
+    if (!itr->second->resumeAuthorize()) {
+      pendingAuthorizes_.push_back(fd);  // still fetching
+    }
+  }
+}
+
+void Server::authorizeCallback(evutil_socket_t, short, void *ptr) {
+  Server *server = static_cast<Server *>(ptr);
+  server->drainPendingAuthorizes();
+}
+
+void Server::admissionCallback(evutil_socket_t, short, void *ptr) {
+  Server *server = static_cast<Server *>(ptr);
+  if (!server->pendingAccepts_.empty()) {
+    server->drainPendingAccepts();
+  }
+  server->drainFirstJobQueue();
+}
+
+void Server::admissionStatsCallback(evutil_socket_t, short, void *ptr) {
+  Server *server = static_cast<Server *>(ptr);
+
+  const uint64_t accepted = server->acceptedCount_.exchange(0);
+  const uint64_t deferred = server->deferredCount_.exchange(0);
+  const uint64_t rejected = server->rejectedCount_.exchange(0);
+  LOG(INFO) << "admission, accept rate: " << accepted / 60.0 << "/s"
+  << ", deferred: " << deferred << ", rejected: " << rejected
+  << ", pending accepts: " << server->pendingAccepts_.size()
+  << ", pending handshakes: " << server->pendingHandshakes_
+  << ", first job queue: " << server->firstJobQueue_.size()
+  << ", pending authorizes: " << server->pendingAuthorizes_.size();
+  LOG(INFO) << "admission, accept delay: " << server->acceptDelay_.toString();
+  LOG(INFO) << "admission, handshake latency: " << server->handshakeLatency_.toString();
+  LOG(INFO) << "admission, first job latency: " << server->firstJobLatency_.toString();
+  LOG(INFO) << "output, backpressure sessions: " << server->backpressureSessions_
+  << ", coalesced notifies: " << server->coalescedNotifies_.exchange(0)
+  << ", slow consumers closed: " << server->slowConsumerClosed_.exchange(0);
+  server->acceptDelay_.reset();
+  server->handshakeLatency_.reset();
+  server->firstJobLatency_.reset();
+
+  server->acceptLimiter_->cleanup(getMonotonicTimeUs());
 }
 
 void Server::readCallback(struct bufferevent* bev, void *connection) {
@@ -1132,6 +1989,11 @@ void Server::readCallback(struct bufferevent* bev, void *connection) {
   conn->readBuf(bufferevent_get_input(bev));
 }
 
+void Server::writeCallback(struct bufferevent* bev, void *connection) {
+  StratumSession *conn = static_cast<StratumSession *>(connection);
+  conn->onOutputDrained();
+}
+
 void Server::eventCallback(struct bufferevent* bev, short events,
                               void *connection) {
   StratumSession *conn = static_cast<StratumSession *>(connection);
@@ -1161,7 +2023,7 @@ int Server::checkShare(const Share &share,
                        const uint32_t nTime, const uint32_t nonce,
                        const uint32_t versionMask,
                        const uint256 &jobTarget, const string &workFullName,
-                       string *userCoinbaseInfo) {
+                       const string *userCoinbase1) {
   shared_ptr<StratumJobEx> exJobPtr = jobRepository_->getStratumJobEx(share.jobId_);
   if (exJobPtr == nullptr) {
     return StratumError::JOB_NOT_FOUND;
@@ -1190,7 +2052,7 @@ int Server::checkShare(const Share &share,
                                 extraNonce1, extraNonce2Hex,
                                 sjob->merkleBranch_, sjob->prevHash_,
                                 sjob->nBits_, sjob->nVersion_, nTime, nonce,
-                                versionMask, userCoinbaseInfo);
+                                versionMask, userCoinbase1);
   uint256 blkHash = header.GetHash();
 
   arith_uint256 bnBlockHash     = UintToArith256(blkHash);
@@ -1326,6 +2188,7 @@ int Server::checkShare(const Share &share,
 }
 
 void Server::sendShare2Kafka(const uint8_t *data, size_t len) {
+  shareCount_++;
   kafkaProducerShareLog_->produce(data, len);
 }
 
@@ -44,10 +44,13 @@
 
 #include <primitives/block.h>
 
+#include "AdmissionControl.h"
 #include "Kafka.h"
 #include "MySQLConnection.h"
+#include "ShmRing.h"
 #include "Stratum.h"
 #include "StratumSession.h"
+#include "WorkerDiffCache.h"
 
 class Server;
 class StratumJobEx;
@@ -90,6 +93,18 @@ public:
 
 
 ////////////////////////////////// JobRepository ///////////////////////////////
+//
+// Local job relay: on a host running several sservers, the PUBLISHER consumes
+// 'StratumJob' from kafka and writes the job with its pre-built mining notify
+// segments into a shared-memory ring, SUBSCRIBERs read jobs from the ring
+// instead of kafka. A subscriber consumes kafka only while the ring stalls.
+//
+enum JobRelayMode {
+  JOB_RELAY_NONE       = 0,
+  JOB_RELAY_PUBLISHER  = 1,
+  JOB_RELAY_SUBSCRIBER = 2
+};
+
 class JobRepository {
   atomic<bool> running_;
   mutex lock_;
@@ -98,25 +113,42 @@ class JobRepository {
   KafkaConsumer kafkaConsumer_;  // consume topic: 'StratumJob'
   Server *server_;               // call server to send new job
 
+  // relay stratum jobs to co-located sservers by shared memory
+  JobRelayMode jobRelayMode_;
+  string jobRelayShmName_;
+  ShmRing jobRelay_;
+
   string fileLastNotifyTime_;
 
   const time_t kMaxJobsLifeTime_;
   const time_t kMiningNotifyInterval_;
+  // a subscriber falls back to kafka if the relay has no new job for so long
+  const time_t kJobRelayStallTime_;
 
   time_t lastJobSendTime_;
   uint256 latestPrevBlockHash_;
 
   thread threadConsume_;
   void runThreadConsume();
+  void runThreadConsumeRelay();
+  bool readRelayJob(string &buf, int32_t timeoutMs);
 
   void consumeStratumJob(rd_kafka_message_t *rkmessage);
+  // miningNotify2 & miningNotify3Clean are pre-built by the relay publisher
+  void addStratumJob(const char *payload, size_t len,
+                     const string *miningNotify2 = nullptr,
+                     const string *miningNotify3Clean = nullptr);
+  void publishStratumJob(const char *payload, size_t len,
+                         shared_ptr<StratumJobEx> exJob);
   void sendMiningNotify(shared_ptr<StratumJobEx> exJob);
   void tryCleanExpiredJobs();
   void checkAndSendMiningNotify();
 
 public:
   JobRepository(const char *kafkaBrokers, const string &fileLastNotifyTime,
-                Server *server);
+                Server *server,
+                JobRelayMode jobRelayMode = JOB_RELAY_NONE,
+                const string &jobRelayShmName = "");
   ~JobRepository();
 
   void stop();
@@ -129,7 +161,7 @@ public:
 
 
 ///////////////////////////////////// UserInfo /////////////////////////////////
-// 1. update userName->userId by interval
+// 1. update userName->userId by interval, or by the kafka topic 'UserUpdates'
 // 2. insert worker name to db
 class UserInfo {
   struct WorkerName {
@@ -144,49 +176,160 @@ class UserInfo {
     }
   };
 
+  //
+  // Read-only snapshots of the users, in kDirectoryShards_ shards. Writers
+  // copy the shards of their updates, apply the updates and publish the new
+  // shards with std::atomic_store(), so readers never wait for the writers
+  // and an update doesn't copy all users.
+  //
+  static const size_t kDirectoryShards_ = 256;
+  struct DirectoryShard {
+    // username -> userId, of the names in the shard
+    std::unordered_map<string, int32_t> nameIds_;
+#ifdef USER_DEFINED_COINBASE
+    // userId -> userCoinbaseInfo, of the ids in the shard
+    std::unordered_map<int32_t, string> idCoinbaseInfos_;
+#endif
+  };
+  static size_t shardOf(const string &userName) {
+    return std::hash<string>()(userName) % kDirectoryShards_;
+  }
+  static size_t shardOf(const int32_t userId) {
+    return (uint32_t)userId % kDirectoryShards_;
+  }
+
   //--------------------
-  pthread_rwlock_t rwlock_;
   atomic<bool> running_;
   string apiUrl_;
 
-  // username -> userId
-  std::unordered_map<string, int32_t> nameIds_;
+  shared_ptr<const DirectoryShard> directory_[kDirectoryShards_];
+  mutex publishLock_;  // only one writer at a time
+  size_t userCount();
+
+  // the http poll, lastMaxUserId_ & lastTime_ are guarded by fetchLock_
+  mutex fetchLock_;
   int32_t lastMaxUserId_;
-  
 #ifdef USER_DEFINED_COINBASE
-  // userId -> userCoinbaseInfo
-  std::unordered_map<int32_t, string> idCoinbaseInfos_;
   int64_t lastTime_;
 #endif
+  // GETs the user list api, httpGET() by default
+  typedef std::function<bool(const string &url, string &response,
+                             long timeoutMs)> HttpGetter;
+  HttpGetter httpGetter_;
+
+  //
+  // unknown user names: the update thread fetches new users from the api for
+  // them, at most once per kMinSyncFetchIntervalUs_, and remembers the names
+  // still unknown. the event loop never waits for the api.
+  //
+  static const int32_t  kSyncFetchTimeoutMs_     = 1000;
+  static const uint64_t kMinSyncFetchIntervalUs_ = 1000000;
+  static const time_t   kNegativeCacheSeconds_   = 60;
+  static const size_t   kMaxNegativeCacheSize_   = 100000;
+  mutex negativeLock_;
+  std::unordered_map<string, time_t> negativeNames_;  // name -> expire time
+  std::unordered_set<string> fetchingNames_;  // names the update thread will fetch
+  bool hasUnknownUsers_;
+  Condition unknownUsersCond_;
+  uint64_t lastSyncFetchUs_;
+  std::function<void()> unknownUsersFetchedCallback_;
+
+  // stats
+  LatencyHistogram lookupLatency_;
+  atomic<uint64_t> syncFetches_;
+  atomic<uint64_t> negativeHits_;
 
   // workerName
   mutex workerNameLock_;
   std::deque<WorkerName> workerNameQ_;
   Server *server_;
 
+  //
+  // worker names are sent as batched 'worker_update_batch' events, a worker
+  // registered again with the same agent in the window is skipped.
+  // only used in threadInsertWorkerName_.
+  //
+  static const size_t kMaxWorkerUpdatesPerEvent_ = 500;
+  static const time_t kWorkerUpdateDedupSeconds_ = 600;
+  struct RecentWorker {
+    time_t sentTime_;
+    string minerAgent_;
+
+    RecentWorker(): sentTime_(0) {}
+  };
+  std::map<std::pair<int32_t, int64_t>, RecentWorker> recentWorkers_;
+  time_t lastCleanRecentWorkersTime_;
+  atomic<uint64_t> workerUpdatesSent_;
+  atomic<uint64_t> workerUpdatesDeduped_;
+  // sends the events to kafka, by the server by default
+  typedef std::function<void(const string &eventJson)> EventSender;
+  EventSender eventSender_;
+  void sendWorkerUpdates(const string &content, const size_t count);
+
+  // user updates pushed by kafka, nullptr if disabled
+  KafkaConsumer *kafkaConsumerUpdates_;
+  thread threadConsumeUpdates_;
+  void runThreadConsumeUpdates();
+
   thread threadInsertWorkerName_;
   void runThreadInsertWorkerName();
-  int32_t insertWorkerName();
 
   thread threadUpdate_;
   void runThreadUpdate();
-  int32_t incrementalUpdateUsers();
+  int32_t incrementalUpdateUsers(const int32_t timeoutMs = 10000);
+
+  int32_t lookupUserId(const string &userName);
 
 public:
-  UserInfo(const string &apiUrl, Server *server);
+  struct UserUpdate {
+    string  userName_;
+    int32_t userId_;
+#ifdef USER_DEFINED_COINBASE
+    bool    hasCoinbaseInfo_;  // false: keep the user's coinbase info
+    string  coinbaseInfo_;
+#endif
+  };
+
+  UserInfo(const string &apiUrl, Server *server,
+           const char *kafkaBrokers = nullptr);
   ~UserInfo();
 
+  // replace httpGET(), before setupThreads()
+  void setHttpGetter(HttpGetter httpGetter) { httpGetter_ = httpGetter; }
+
   void stop();
   bool setupThreads();
 
+  // never blocks, return 0 if the user is unknown now
   int32_t getUserId(const string userName);
 
+  //
+  // ask the update thread to fetch an unknown user. return false if the name
+  // is known as not existing, the caller should reject it now. otherwise the
+  // callback is called in the update thread once it's fetched, check
+  // isFetchingUser() and getUserId() again then. the callback is called with
+  // a lock held, it must not call UserInfo.
+  //
+  bool fetchUnknownUser(const string &userName);
+  bool isFetchingUser(const string &userName);
+  void setUnknownUsersFetchedCallback(std::function<void()> callback);
+  // called by the update thread
+  void fetchUnknownUsers();
+
+  // name -> id is never changed, a known name keeps its id
+  void applyUpdates(const vector<UserUpdate> &updates);
+  bool parseUserUpdate(const char *s, size_t len, UserUpdate &update);
+
 #ifdef USER_DEFINED_COINBASE
   string  getCoinbaseInfo(int32_t userId);
 #endif
 
   void addWorker(const int32_t userId, const int64_t workerId,
                  const string &workerName, const string &minerAgent);
+  // called by threadInsertWorkerName_, returns the workers taken from the queue
+  int32_t insertWorkerName(const time_t now);
+  // replace the server's kafka producer, before setupThreads()
+  void setEventSender(EventSender eventSender) { eventSender_ = eventSender; }
 };
 
 
@@ -203,7 +346,14 @@ class StratumJobEx {
   void generateCoinbaseTx(std::vector<char> *coinbaseBin,
                           const uint32_t extraNonce1,
                           const string &extraNonce2Hex,
-                          string *userCoinbaseInfo = nullptr);
+                          const string *userCoinbase1 = nullptr);
+
+#ifdef USER_DEFINED_COINBASE
+  // userId -> coinbase1 with the user's coinbase info.
+  // all sessions of a user share it, it's built only once in this job.
+  mutex userCoinbase1sLock_;
+  std::unordered_map<int32_t, shared_ptr<const string>> userCoinbase1s_;
+#endif
 
 public:
   bool isClean_;
@@ -216,6 +366,9 @@ public:
 
 public:
   StratumJobEx(StratumJob *sjob, bool isClean);
+  // use the mining notify segments pre-built by the job relay publisher
+  StratumJobEx(StratumJob *sjob, bool isClean,
+               const string &miningNotify2, const string &miningNotify3Clean);
   ~StratumJobEx();
 
   void markStale();
@@ -230,7 +383,11 @@ public:
                            const uint32_t nBits, const int32_t nVersion,
                            const uint32_t nTime, const uint32_t nonce,
                            const uint32_t versionMask,
-                           string *userCoinbaseInfo = nullptr);
+                           const string *userCoinbase1 = nullptr);
+
+#ifdef USER_DEFINED_COINBASE
+  shared_ptr<const string> getUserCoinbase1(const int32_t userId, UserInfo *userInfo);
+#endif
 };
 
 
@@ -264,6 +421,58 @@ class Server {
   //
   bool isSubmitInvalidBlock_;
 
+  // share rate in the first minutes after start, it shows how long
+  // the miners take to reach their difficulty again
+  static const int32_t kWarmupMinutes_ = 15;
+  atomic<uint64_t> shareCount_;
+  uint64_t lastShareCount_;
+  int32_t warmupMinute_;
+  struct event *shareRateEvent_;
+  static void shareRateCallback(evutil_socket_t, short, void *server);
+
+  //
+  // admission control: pace accepts and first jobs when a lot of miners
+  // reconnect at the same time. all of these are used in the event loop.
+  //
+  struct PendingAccept {
+    evutil_socket_t fd_;
+    struct sockaddr_storage saddr_;  // IPv4 or IPv6
+    uint64_t enqueueTimeUs_;
+  };
+  static const int32_t kMaxPendingAcceptSeconds_ = 30;
+  AdmissionConfig admissionConfig_;
+  AcceptLimiter *acceptLimiter_;
+  std::deque<PendingAccept> pendingAccepts_;
+  std::deque<evutil_socket_t> firstJobQueue_;
+  int32_t firstJobCredit_;  // in 1/100 job, what a tick can't send is carried
+  struct event *admissionEvent_;       // every 10ms
+  struct event *admissionStatsEvent_;  // every minute
+
+  atomic<int32_t>  pendingHandshakes_;
+  atomic<uint64_t> acceptedCount_;
+  atomic<uint64_t> deferredCount_;
+  atomic<uint64_t> rejectedCount_;
+  LatencyHistogram acceptDelay_;       // time in pendingAccepts_
+  LatencyHistogram handshakeLatency_;  // accepted -> authorized
+  LatencyHistogram firstJobLatency_;   // authorized -> first job sent
+
+  bool tryAdmit(const struct sockaddr *saddr);
+  void acceptConnection(evutil_socket_t fd, struct sockaddr *saddr);
+  void deferAccept(evutil_socket_t fd, struct sockaddr *saddr, int socklen);
+  void drainPendingAccepts();
+  void drainFirstJobQueue();
+  static void admissionCallback(evutil_socket_t, short, void *server);
+  static void admissionStatsCallback(evutil_socket_t, short, void *server);
+
+  //
+  // authorizes waiting for the unknown users, userInfo_ fetches them in its
+  // update thread and activates authorizeEvent_. used in the event loop.
+  //
+  std::deque<evutil_socket_t> pendingAuthorizes_;
+  struct event *authorizeEvent_;
+  void drainPendingAuthorizes();
+  static void authorizeCallback(evutil_socket_t, short, void *server);
+
 public:
 #ifndef WORK_WITH_STRATUM_SWITCHER
   SessionIDManager *sessionIDManager_;
@@ -281,6 +490,12 @@ public:
   const int32_t kShareAvgSeconds_;
   JobRepository *jobRepository_;
   UserInfo *userInfo_;
+  WorkerDiffCache *workerDiffCache_;  // nullptr if disabled
+
+  // slow clients
+  atomic<int32_t>  backpressureSessions_;  // sessions coalescing notifies now
+  atomic<uint64_t> coalescedNotifies_;     // dropped stale notifies
+  atomic<uint64_t> slowConsumerClosed_;    // closed for the full output buffer
 
 public:
   Server(const int32_t shareAvgSeconds, const uint32_t versionMask);
@@ -292,7 +507,15 @@ public:
              bool isEnableSimulator,
              bool isSubmitInvalidBlock,
              bool isDevModeEnable,
-             float minerDifficulty);
+             float minerDifficulty,
+             const string &solvedShareSpillDir,
+             JobRelayMode jobRelayMode,
+             const string &jobRelayShmName,
+             const string &diffCacheFile,
+             RedisConnectInfo *diffCacheRedisInfo,
+             const string &diffCacheRedisKey,
+             const AdmissionConfig &admissionConfig,
+             bool isUserUpdatesFromKafka);
   void run();
   void stop();
 
@@ -303,11 +526,20 @@ public:
   void addConnection   (evutil_socket_t fd, StratumSession *connection);
   void removeConnection(evutil_socket_t fd);
 
+  // the session is authorized or closed before that
+  void finishHandshake(const uint64_t acceptTimeUs, bool isAuthorized);
+  void finishFirstJob(const uint64_t authorizeTimeUs);
+  // send the latest job to a new session, maybe paced by admission control
+  void sendFirstMiningNotify(StratumSession *session);
+  // the session's user is fetching, resume the authorize when it's done
+  void addPendingAuthorize(StratumSession *session);
+
   static void listenerCallback(struct evconnlistener* listener,
                                evutil_socket_t socket,
                                struct sockaddr* saddr,
                                int socklen, void* server);
   static void readCallback (struct bufferevent *, void *connection);
+  static void writeCallback(struct bufferevent *, void *connection);
   static void eventCallback(struct bufferevent *, short, void *connection);
 
   int checkShare(const Share &share,
@@ -315,7 +547,7 @@ public:
                  const uint32_t nTime, const uint32_t nonce,
                  const uint32_t versionMask,
                  const uint256 &jobTarget, const string &workFullName,
-                 string *userCoinbaseInfo = nullptr);
+                 const string *userCoinbase1 = nullptr);
   void sendShare2Kafka      (const uint8_t *data, size_t len);
   void sendSolvedShare2Kafka(const FoundBlock *foundBlock,
                              const std::vector<char> &coinbaseBin);
@@ -349,6 +581,23 @@ class StratumServer {
   // difficulty to send to miners. for development
   float minerDifficulty_;
 
+  // solved shares will be spilled to this dir if kafka is not available
+  string solvedShareSpillDir_;
+
+  // local job relay by shared memory
+  JobRelayMode jobRelayMode_;
+  string jobRelayShmName_;
+
+  // worker's last difficulty
+  string diffCacheFile_;
+  RedisConnectInfo *diffCacheRedisInfo_;
+  string diffCacheRedisKey_;
+
+  AdmissionConfig admissionConfig_;
+
+  // consume user updates from kafka, the user list api is still polled
+  bool isUserUpdatesFromKafka_;
+
 public:
   StratumServer(const char *ip, const unsigned short port,
                 const char *kafkaBrokers,
@@ -359,7 +608,15 @@ public:
                 bool isSubmitInvalidBlock,
                 bool isDevModeEnable,
                 float minerDifficulty,
-                const int32_t shareAvgSeconds);
+                const int32_t shareAvgSeconds,
+                const string &solvedShareSpillDir,
+                JobRelayMode jobRelayMode,
+                const string &jobRelayShmName,
+                const string &diffCacheFile,
+                RedisConnectInfo *diffCacheRedisInfo,
+                const string &diffCacheRedisKey,
+                const AdmissionConfig &admissionConfig,
+                bool isUserUpdatesFromKafka);
   ~StratumServer();
 
   bool init();
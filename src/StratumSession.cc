@@ -222,6 +222,15 @@ bev_(bev), fd_(fd), server_(server)
 {
   state_ = CONNECTED;
   currDiff_    = 0U;
+  isCustomDiff_ = false;
+  lastDiffCacheTime_ = 0;
+  acceptTimeUs_    = getMonotonicTimeUs();
+  authorizeTimeUs_ = 0;
+  isHandshakePending_ = true;
+  isWaitingFirstJob_  = false;
+  isAuthorizing_      = false;
+  isOutputBackpressure_ = false;
+  pendingNotifyDiff_    = 0;
   extraNonce1_ = extraNonce1;
 
   // usually stratum job interval is 30~60 seconds, 10 is enough for miners
@@ -265,6 +274,18 @@ void StratumSession::markAsDead() {
   // mark as dead
   isDead_ = true;
 
+  if (isHandshakePending_) {
+    isHandshakePending_ = false;
+    server_->finishHandshake(acceptTimeUs_, false);
+  }
+
+  bufferevent_lock(bev_);
+  if (isOutputBackpressure_) {
+    isOutputBackpressure_ = false;
+    server_->backpressureSessions_--;
+  }
+  bufferevent_unlock(bev_);
+
   // sent event to kafka: miner_dead
   if (worker_.userId_ > 0) {
     string eventJson;
@@ -595,6 +616,7 @@ void StratumSession::_handleRequest_AuthorizePassword(const string &password) {
   // than set current diff
   if (d >= DiffController::kMinDiff_) {
     diffController_.resetCurDiff(d);
+    isCustomDiff_ = true;
   }
 }
 
@@ -604,6 +626,10 @@ void StratumSession::handleRequest_Authorize(const string &idStr,
     responseError(idStr, StratumError::NOT_SUBSCRIBED);
     return;
   }
+  if (isAuthorizing_) {
+    responseError(idStr, StratumError::UNAUTHORIZED);  // wait for the last one
+    return;
+  }
 
   //
   //  params[0] = user[.worker]
@@ -628,14 +654,51 @@ void StratumSession::handleRequest_Authorize(const string &idStr,
   const string userName = worker_.getUserName(fullName);
 
   const int32_t userId = server_->userInfo_->getUserId(userName);
-  if (userId <= 0) {
+  if (userId > 0) {
+    _handleRequest_AuthorizeUser(idStr, fullName, userId);
+    return;
+  }
+
+  // a new user maybe, don't wait for the api in the event loop
+  if (!server_->userInfo_->fetchUnknownUser(userName)) {
     responseError(idStr, StratumError::INVALID_USERNAME);
     return;
   }
+  isAuthorizing_     = true;
+  authorizeIdStr_    = idStr;
+  authorizeFullName_ = fullName;
+  server_->addPendingAuthorize(this);
+}
+
+bool StratumSession::resumeAuthorize() {
+  const string userName = worker_.getUserName(authorizeFullName_);
+  const int32_t userId = server_->userInfo_->getUserId(userName);
+  if (userId <= 0 && server_->userInfo_->isFetchingUser(userName)) {
+    return false;
+  }
 
+  isAuthorizing_ = false;
+  if (userId <= 0) {
+    responseError(authorizeIdStr_, StratumError::INVALID_USERNAME);
+  } else {
+    _handleRequest_AuthorizeUser(authorizeIdStr_, authorizeFullName_, userId);
+  }
+  authorizeIdStr_.clear();
+  authorizeFullName_.clear();
+  return true;
+}
+
+void StratumSession::_handleRequest_AuthorizeUser(const string &idStr,
+                                                  const string &fullName,
+                                                  const int32_t userId) {
   // auth success
   responseTrue(idStr);
   state_ = AUTHENTICATED;
+  authorizeTimeUs_ = getMonotonicTimeUs();
+  if (isHandshakePending_) {
+    isHandshakePending_ = false;
+    server_->finishHandshake(acceptTimeUs_, true);
+  }
 
   // set id & names, will filter workername in this func
   worker_.setUserIDAndNames(userId, fullName);
@@ -644,12 +707,24 @@ void StratumSession::handleRequest_Authorize(const string &idStr,
   DLOG(INFO) << "userId: " << worker_.userId_
   << ", wokerHashId: " << worker_.workerHashId_ << ", workerName:" << worker_.workerName_;
 
+  // start at the worker's last difficulty, vardiff doesn't need to
+  // converge again after a reconnection
+  if (!isCustomDiff_ && server_->workerDiffCache_ != nullptr) {
+    const uint64_t cachedDiff = server_->workerDiffCache_->get(worker_.userId_,
+                                                                worker_.workerHashId_);
+    if (cachedDiff >= DiffController::kMinDiff_) {
+      diffController_.resetCurDiff(cachedDiff);
+      lastDiffCacheTime_ = time(nullptr);
+      DLOG(INFO) << "use cached diff: " << cachedDiff << ", worker: " << worker_.fullName_;
+    }
+  }
+
   // set read timeout to 10 mins, it's enought for most miners even usb miner.
   // if it's a pool watcher, set timeout to a week
   setReadTimeout(isLongTimeout_ ? 86400*7 : 60*10);
   
-  // send latest stratum job
-  sendMiningNotify(server_->jobRepository_->getLatestStratumJobEx(), true/* is first job */);
+  // send latest stratum job, maybe paced by the server
+  server_->sendFirstMiningNotify(this);
 
   // sent events to kafka: miner_connect
   {
@@ -671,6 +746,14 @@ void StratumSession::handleRequest_Authorize(const string &idStr,
   }
 }
 
+void StratumSession::updateWorkerDiffCache(const uint64_t diff) {
+  if (isCustomDiff_ || server_->workerDiffCache_ == nullptr) {
+    return;
+  }
+  server_->workerDiffCache_->set(worker_.userId_, worker_.workerHashId_, diff);
+  lastDiffCacheTime_ = time(nullptr);
+}
+
 void StratumSession::handleExMessage_AuthorizeAgentWorker(const int64_t workerId,
                                                           const string &clientAgent,
                                                           const string &workerName) {
@@ -684,6 +767,7 @@ void StratumSession::handleExMessage_AuthorizeAgentWorker(const int64_t workerId
 
 void StratumSession::_handleRequest_SetDifficulty(uint64_t suggestDiff) {
   diffController_.resetCurDiff(formatDifficulty(suggestDiff));
+  isCustomDiff_ = true;
 }
 
 void StratumSession::handleRequest_SuggestTarget(const string &idStr,
@@ -849,7 +933,7 @@ void StratumSession::handleRequest_Submit(const string &idStr,
   submitResult = server_->checkShare(share, extraNonce1_, extraNonce2Hex,
                                      nTime, nonce, versionMask, jobTarget,
                                      worker_.fullName_,
-                                     &localJob->userCoinbaseInfo_);
+                                     localJob->userCoinbase1_.get());
 #else
   // check block header
   submitResult = server_->checkShare(share, extraNonce1_, extraNonce2Hex,
@@ -947,6 +1031,20 @@ void StratumSession::sendMiningNotify(shared_ptr<StratumJobEx> exJobPtr, bool is
   }
   StratumJob *sjob = exJobPtr->sjob_;
 
+  // a new job arrives before the paced first job, send it as the first one
+  if (isWaitingFirstJob_) {
+    isWaitingFirstJob_ = false;
+    isFirstJob = true;
+    server_->finishFirstJob(authorizeTimeUs_);
+  }
+
+  // the client doesn't read fast enough, only keep the latest job for it.
+  // agent sessions are not coalesced, their ex-messages can't be dropped.
+  const bool isCoalesced = (agentSessions_ == nullptr && checkOutputBackpressure());
+  if (isCoalesced) {
+    isFirstJob = true;  // jobs between may be clean jobs, so always clean
+  }
+
   localJobs_.push_back(LocalJob());
   LocalJob &ljob = *(localJobs_.rbegin());
   ljob.blkBits_       = sjob->nBits_;
@@ -955,9 +1053,8 @@ void StratumSession::sendMiningNotify(shared_ptr<StratumJobEx> exJobPtr, bool is
   ljob.jobDifficulty_ = diffController_.calcCurDiff();
 
 #ifdef USER_DEFINED_COINBASE
-  // add the User's coinbaseInfo to the coinbase1's tail
-  string userCoinbaseInfo = server_->userInfo_->getCoinbaseInfo(worker_.userId_);
-  ljob.userCoinbaseInfo_ = userCoinbaseInfo;
+  // coinbase1 with the user's coinbaseInfo at the tail, cached in the job
+  ljob.userCoinbase1_ = exJobPtr->getUserCoinbase1(worker_.userId_, server_->userInfo_);
 #endif
 
   if (agentSessions_ != nullptr)
@@ -974,9 +1071,20 @@ void StratumSession::sendMiningNotify(shared_ptr<StratumJobEx> exJobPtr, bool is
 
   // set difficulty
   if (currDiff_ != ljob.jobDifficulty_) {
-    sendSetDifficulty(ljob.jobDifficulty_);
+    // not the first job, the diff is adjusted by vardiff
+    if (currDiff_ != 0) {
+      updateWorkerDiffCache(ljob.jobDifficulty_);
+    }
+    if (!isCoalesced) {
+      sendSetDifficulty(ljob.jobDifficulty_);
+    }
     currDiff_ = ljob.jobDifficulty_;
   }
+  else if (lastDiffCacheTime_ != 0 &&
+           lastDiffCacheTime_ + kWorkerDiffCacheRefreshSeconds_ < time(nullptr)) {
+    // keep the entry of a long-running stable worker alive
+    updateWorkerDiffCache(ljob.jobDifficulty_);
+  }
 
   string notifyStr;
   notifyStr.reserve(2048);
@@ -999,25 +1107,24 @@ void StratumSession::sendMiningNotify(shared_ptr<StratumJobEx> exJobPtr, bool is
   // notify2
   notifyStr.append(exJobPtr->miningNotify2_);
 
-  string coinbase1 = exJobPtr->coinbase1_;
-
+  // coinbase1
 #ifdef USER_DEFINED_COINBASE
-  string userCoinbaseHex;
-  Bin2Hex((const uint8_t *)ljob.userCoinbaseInfo_.c_str(), ljob.userCoinbaseInfo_.size(), userCoinbaseHex);
-  // replace the last `userCoinbaseHex.size()` bytes to `userCoinbaseHex`
-  coinbase1.replace(coinbase1.size()-userCoinbaseHex.size(), userCoinbaseHex.size(), userCoinbaseHex);
+  notifyStr.append(*ljob.userCoinbase1_);
+#else
+  notifyStr.append(exJobPtr->coinbase1_);
 #endif
 
-  // coinbase1
-  notifyStr.append(coinbase1);
-
   // notify3
   if (isFirstJob)
   	notifyStr.append(exJobPtr->miningNotify3Clean_);
   else
     notifyStr.append(exJobPtr->miningNotify3_);
 
-  sendData(notifyStr);  // send notify string
+  if (isCoalesced) {
+    coalesceMiningNotify(notifyStr, ljob.jobDifficulty_);
+  } else {
+    sendData(notifyStr);  // send notify string
+  }
 
   // clear localJobs_
   while (localJobs_.size() >= kMaxNumLocalJobs_) {
@@ -1026,12 +1133,78 @@ void StratumSession::sendMiningNotify(shared_ptr<StratumJobEx> exJobPtr, bool is
 }
 
 void StratumSession::sendData(const char *data, size_t len) {
+  if (isDead()) {
+    return;
+  }
+
+  // the client doesn't read at all, don't let it eat our memory
+  const size_t outputLen = evbuffer_get_length(bufferevent_get_output(bev_));
+  if (outputLen + len > kOutputMaxBytes_) {
+    LOG(WARNING) << "output buffer is full (" << outputLen << " bytes), close session"
+    << ", ip: " << clientIp_ << ", name: \"" << worker_.fullName_ << "\"";
+    server_->slowConsumerClosed_++;
+    bufferevent_disable(bev_, EV_READ|EV_WRITE);
+    markAsDead();
+    return;
+  }
+
   // add data to a bufferevent’s output buffer
   // it is automatically locked so we don't need to lock
   bufferevent_write(bev_, data, len);
   DLOG(INFO) << "send(" << len << "): " << data;
 }
 
+bool StratumSession::checkOutputBackpressure() {
+  bufferevent_lock(bev_);
+  if (!isOutputBackpressure_ &&
+      evbuffer_get_length(bufferevent_get_output(bev_)) > kOutputHighWatermark_) {
+    isOutputBackpressure_ = true;
+    server_->backpressureSessions_++;
+
+    // get a callback when the output drains below the low watermark
+    bufferevent_setwatermark(bev_, EV_WRITE, kOutputLowWatermark_, 0);
+    bufferevent_setcb(bev_, Server::readCallback, Server::writeCallback,
+                      Server::eventCallback, (void*)this);
+  }
+  const bool res = isOutputBackpressure_;
+  bufferevent_unlock(bev_);
+  return res;
+}
+
+void StratumSession::coalesceMiningNotify(const string &notifyStr,
+                                          const uint64_t difficulty) {
+  bufferevent_lock(bev_);
+  if (isOutputBackpressure_) {
+    if (!pendingNotify_.empty()) {
+      server_->coalescedNotifies_++;  // replace the stale one
+    }
+    pendingNotify_ = notifyStr;
+    pendingNotifyDiff_ = difficulty;
+  } else {
+    // drained just now
+    sendSetDifficulty(difficulty);
+    sendData(notifyStr);
+  }
+  bufferevent_unlock(bev_);
+}
+
+void StratumSession::onOutputDrained() {
+  // called by libevent with the bufferevent locked
+  if (!isOutputBackpressure_) {
+    return;
+  }
+  isOutputBackpressure_ = false;
+  server_->backpressureSessions_--;
+  bufferevent_setcb(bev_, Server::readCallback, nullptr,
+                    Server::eventCallback, (void*)this);
+
+  if (!pendingNotify_.empty()) {
+    sendSetDifficulty(pendingNotifyDiff_);
+    sendData(pendingNotify_);
+    pendingNotify_.clear();
+  }
+}
+
 // if read a message (ex-message or stratum) success should return true,
 // otherwise return false.
 bool StratumSession::handleMessage() {
@@ -190,7 +190,7 @@ public:
     uint32_t blkBits_;
     uint8_t  shortJobId_;
 #ifdef USER_DEFINED_COINBASE
-    string   userCoinbaseInfo_;
+    shared_ptr<const string> userCoinbase1_;  // coinbase1 sent to the miner
 #endif
     std::set<LocalShare> submitShares_;
     std::vector<uint8_t> agentSessionsDiff2Exp_;
@@ -219,8 +219,37 @@ private:
 
   uint32_t extraNonce1_;   // MUST be unique across all servers
   static const int kExtraNonce2Size_ = 8;  // extraNonce2 size is always 8 bytes
+  static const time_t kWorkerDiffCacheRefreshSeconds_ = 3600;
+
+  // output buffer of slow clients. a mining notify is several KB.
+  static const size_t kOutputHighWatermark_ = 64 * 1024;   // start coalescing
+  static const size_t kOutputLowWatermark_  = 16 * 1024;   // stop coalescing
+  static const size_t kOutputMaxBytes_      = 512 * 1024;  // close the session
 
   uint64_t currDiff_;
+  // difficulty is set by the miner (password "d=", suggest_difficulty),
+  // don't override it with the cached one
+  bool isCustomDiff_;
+  time_t lastDiffCacheTime_;
+
+  // for admission control
+  uint64_t acceptTimeUs_;
+  uint64_t authorizeTimeUs_;
+  bool isHandshakePending_;
+  bool isWaitingFirstJob_;
+
+  // the user is unknown, the authorize waits for the update thread to fetch it
+  bool isAuthorizing_;
+  string authorizeIdStr_;
+  string authorizeFullName_;
+
+  // output backpressure, guarded by the bufferevent's lock
+  bool isOutputBackpressure_;
+  string pendingNotify_;  // only the latest job is kept
+  uint64_t pendingNotifyDiff_;
+
+  bool checkOutputBackpressure();
+  void coalesceMiningNotify(const string &notifyStr, const uint64_t difficulty);
   std::deque<LocalJob> localJobs_;
   size_t kMaxNumLocalJobs_;
 
@@ -261,6 +290,9 @@ private:
   void handleRequest_MiningConfigure  (const string &idStr, const JsonNode &jparams);
   void _handleRequest_SetDifficulty(uint64_t suggestDiff);
   void _handleRequest_AuthorizePassword(const string &password);
+  void _handleRequest_AuthorizeUser(const string &idStr, const string &fullName,
+                                    const int32_t userId);
+  void updateWorkerDiffCache(const uint64_t diff);
 
   // request from BTCAgent
   void handleRequest_AgentGetCapabilities(const string &idStr, const JsonNode &jparams);
@@ -287,6 +319,15 @@ public:
   void markAsDead();
   bool isDead();
 
+  // the first job will be sent later, by Server's admission control
+  void markWaitingFirstJob() { isWaitingFirstJob_ = true; }
+  bool isWaitingFirstJob() const { return isWaitingFirstJob_; }
+
+  // called by Server when the unknown users are fetched. return false if
+  // the user is still fetching.
+  bool isAuthorizing() const { return isAuthorizing_; }
+  bool resumeAuthorize();
+
   void sendSetDifficulty(const uint64_t difficulty);
   void sendMiningNotify(shared_ptr<StratumJobEx> exJobPtr, bool isFirstJob=false);
   void sendData(const char *data, size_t len);
@@ -294,6 +335,7 @@ public:
     sendData(str.data(), str.size());
   }
   void readBuf(struct evbuffer *buf);
+  void onOutputDrained();
 
   void handleExMessage_AuthorizeAgentWorker(const int64_t workerId,
                                             const string &clientAgent,
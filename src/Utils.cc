@@ -22,6 +22,7 @@
  THE SOFTWARE.
 */
 #include "Utils.h"
+#include "RpcClient.h"
 #include "utilities_js.hpp"
 
 #include <util.h>
@@ -30,7 +31,6 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 
-#include <curl/curl.h>
 #include <glog/logging.h>
 
 static const char _hexchars[] = "0123456789abcdef";
@@ -140,31 +140,6 @@ bool s_sendmore (zmq::socket_t & socket, const std::string & string) {
 
 
 
-struct CurlChunk {
-  char *memory;
-  size_t size;
-};
-
-static size_t
-CurlWriteChunkCallback(void *contents, size_t size, size_t nmemb, void *userp)
-{
-  size_t realsize = size * nmemb;
-  struct CurlChunk *mem = (struct CurlChunk *)userp;
-
-  mem->memory = (char *)realloc(mem->memory, mem->size + realsize + 1);
-  if(mem->memory == NULL) {
-    /* out of memory! */
-    printf("not enough memory (realloc returned NULL)\n");
-    return 0;
-  }
-
-  memcpy(&(mem->memory[mem->size]), contents, realsize);
-  mem->size += realsize;
-  mem->memory[mem->size] = 0;
-
-  return realsize;
-}
-
 bool httpGET(const char *url, string &response, long timeoutMs) {
   return httpPOST(url, nullptr, nullptr, response, timeoutMs, nullptr);
 }
@@ -176,74 +151,9 @@ bool httpGET(const char *url, const char *userpwd,
 
 bool httpPOST(const char *url, const char *userpwd, const char *postData,
               string &response, long timeoutMs, const char *mineType) {
-  struct curl_slist *headers = NULL;
-  CURLcode status;
-  long code;
-  CURL *curl = curl_easy_init();
-  struct CurlChunk chunk;
-  if (!curl) {
-    return false;
-  }
-
-  chunk.memory = (char *)malloc(1);  /* will be grown as needed by the realloc above */
-  chunk.size   = 0;          /* no data at this point */
-
-  // RSK doesn't support 'Expect: 100-Continue' in 'HTTP/1.1'.
-  // So switch to 'HTTP/1.0'.
-  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_0);
-
-  if (mineType != nullptr) {
-    string mineHeader = string("Content-Type: ") + string(mineType);
-    headers = curl_slist_append(headers, mineHeader.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  }
-
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-
-  if (postData != nullptr) {
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(postData));
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS,    postData);
-  }
-
-  if (userpwd != nullptr)
-    curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd);
-
-  curl_easy_setopt(curl, CURLOPT_USE_SSL, CURLUSESSL_TRY);
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, "curl");
-
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeoutMs);
-
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteChunkCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA,     (void *)&chunk);
-
-  status = curl_easy_perform(curl);
-  if (status != 0) {
-    LOG(ERROR) << "unable to request data from: " << url << ", error: " << curl_easy_strerror(status);
-    goto error;
-  }
-
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-  if (code != 200) {
-    LOG(ERROR) << "server responded with code: " << code;
-    goto error;
-  }
-
-  response.assign(chunk.memory, chunk.size);
-
-  curl_easy_cleanup(curl);
-  curl_slist_free_all(headers);
-  free(chunk.memory);
-  return true;
-
-
-error:
-  if (curl)
-    curl_easy_cleanup(curl);
-  if (headers)
-    curl_slist_free_all(headers);
-
-  free(chunk.memory);
-  return false;
+  // keep-alive connections of the endpoint
+  return RpcClient::get(url, userpwd != nullptr ? userpwd : "")->request(
+      url, postData, response, timeoutMs, mineType);
 }
 
 bool bitcoindRpcCall(const char *url, const char *userpwd, const char *reqData,
@@ -508,3 +418,72 @@ uint64_t getAlphaNumRank(const string &str, size_t significand) {
 
   return r;
 }
+
+uint64_t getMonotonicTimeUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/////////////////////////////// LatencyHistogram ///////////////////////////////
+const uint64_t LatencyHistogram::kBucketBounds_[LatencyHistogram::kBucketNum_] = {
+  100, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 500000, 1000000,
+  UINT64_MAX
+};
+
+LatencyHistogram::LatencyHistogram() {
+  reset();
+}
+
+void LatencyHistogram::reset() {
+  for (size_t i = 0; i < kBucketNum_; i++) {
+    buckets_[i] = 0;
+  }
+  count_ = 0;
+  sumUs_ = 0;
+  maxUs_ = 0;
+}
+
+void LatencyHistogram::add(uint64_t us) {
+  size_t i = 0;
+  while (us > kBucketBounds_[i]) {
+    i++;
+  }
+  buckets_[i]++;
+  count_++;
+  sumUs_ += us;
+
+  uint64_t m = maxUs_;
+  while (us > m && !maxUs_.compare_exchange_weak(m, us)) {
+    // m is reloaded by compare_exchange_weak()
+  }
+}
+
+uint64_t LatencyHistogram::avgUs() const {
+  const uint64_t c = count_;
+  return c == 0 ? 0 : sumUs_ / c;
+}
+
+uint64_t LatencyHistogram::percentileUs(double p) const {
+  const uint64_t c = count_;
+  if (c == 0) {
+    return 0;
+  }
+  const uint64_t rank = (uint64_t)ceil(c * p / 100.0);
+  uint64_t n = 0;
+  for (size_t i = 0; i < kBucketNum_ - 1; i++) {
+    n += buckets_[i];
+    if (n >= rank) {
+      return kBucketBounds_[i];
+    }
+  }
+  // the last bucket is unbounded
+  return maxUs_;
+}
+
+string LatencyHistogram::toString() const {
+  return Strings::Format("count: %" PRIu64", avg: %" PRIu64"us, "
+                         "p50: %" PRIu64"us, p99: %" PRIu64"us, max: %" PRIu64"us",
+                         count(), avgUs(), percentileUs(50), percentileUs(99),
+                         maxUs());
+}
@@ -101,4 +101,41 @@ bool checkBitcoinRPC(const string &rpcAddr, const string &rpcUserpass);
 // so max significand is 9 if you convert the rank as double.
 uint64_t getAlphaNumRank(const string &str, size_t significand = 9);
 
+// monotonic clock, microseconds
+uint64_t getMonotonicTimeUs();
+
+//
+// A lock-free latency histogram with fixed buckets, used to export delivery,
+// rpc and queue-wait latencies. Values are in microseconds.
+//
+class LatencyHistogram {
+public:
+  static const size_t kBucketNum_ = 12;
+
+private:
+  // upper bound of each bucket, the last one is +inf
+  static const uint64_t kBucketBounds_[kBucketNum_];
+
+  atomic<uint64_t> buckets_[kBucketNum_];
+  atomic<uint64_t> count_;
+  atomic<uint64_t> sumUs_;
+  atomic<uint64_t> maxUs_;
+
+public:
+  LatencyHistogram();
+
+  void add(uint64_t us);
+  void reset();
+
+  uint64_t count() const { return count_; }
+  uint64_t avgUs() const;
+  uint64_t maxUs() const { return maxUs_; }
+  // returns the upper bound of the bucket which contains the percentile,
+  // p is in [0, 100]
+  uint64_t percentileUs(double p) const;
+
+  // "count: 10, avg: 120us, p50: 100us, p99: 500us, max: 433us"
+  string toString() const;
+};
+
 #endif
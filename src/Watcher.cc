@@ -197,8 +197,8 @@ void ClientContainer::consumeStratumJob(rd_kafka_message_t *rkmessage) {
     }
   
     StratumJob *sjob = new StratumJob();
-    bool res = sjob->unserializeFromJson((const char *)rkmessage->payload,
-                                         rkmessage->len);
+    bool res = sjob->unserialize((const char *)rkmessage->payload,
+                                 rkmessage->len);
     if (res == false) {
       LOG(ERROR) << "unserialize stratum job fail";
       delete sjob;
@@ -0,0 +1,312 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "WorkerDiffCache.h"
+
+#include "RedisConnection.h"
+#include "Utils.h"
+
+#include <inttypes.h>
+
+#include <glog/logging.h>
+
+/////////////////////////////// WorkerDiffCache ////////////////////////////////
+WorkerDiffCache::WorkerDiffCache(const string &file, RedisConnectInfo *redisInfo,
+                                 const string &redisKey):
+running_(true), isChanged_(false), file_(file),
+redisInfo_(redisInfo), redis_(nullptr), redisKey_(redisKey), redisCursor_("0")
+{
+}
+
+WorkerDiffCache::~WorkerDiffCache() {
+  stop();
+  if (threadSync_.joinable()) {
+    threadSync_.join();
+  }
+  if (redis_ != nullptr) {
+    redis_->close();
+    delete redis_;
+  }
+  if (redisInfo_ != nullptr) {
+    delete redisInfo_;
+  }
+}
+
+bool WorkerDiffCache::setup() {
+  if (!file_.empty()) {
+    loadFromFile();
+  }
+
+  if (redisInfo_ != nullptr) {
+    redis_ = new RedisConnection(*redisInfo_);
+    // it's only a cache, keep going and retry in the sync thread
+    if (redis_->ping()) {
+      pullFromRedis(SIZE_MAX);
+    } else {
+      LOG(ERROR) << "worker diff cache: can't connect to redis";
+    }
+  }
+
+  LOG(INFO) << "worker diff cache: " << size() << " entries";
+  threadSync_ = thread(&WorkerDiffCache::runThreadSync, this);
+  return true;
+}
+
+void WorkerDiffCache::stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  LOG(INFO) << "stop worker diff cache";
+}
+
+uint64_t WorkerDiffCache::get(const int32_t userId, const int64_t workerId) {
+  ScopeLock sl(lock_);
+  auto itr = entries_.find(Key{userId, workerId});
+  if (itr == entries_.end()) {
+    return 0;
+  }
+  if (itr->second.updateTime_ + kEntryExpireSeconds_ < (uint32_t)time(nullptr)) {
+    return 0;
+  }
+  return itr->second.diff_;
+}
+
+void WorkerDiffCache::set(const int32_t userId, const int64_t workerId,
+                          const uint64_t diff) {
+  ScopeLock sl(lock_);
+  Entry &entry = entries_[Key{userId, workerId}];
+  entry.diff_       = diff;
+  entry.updateTime_ = (uint32_t)time(nullptr);
+  entry.isDirty_    = true;
+  isChanged_ = true;
+}
+
+void WorkerDiffCache::merge(const int32_t userId, const int64_t workerId,
+                            const uint64_t diff, const uint32_t updateTime) {
+  if (updateTime + kEntryExpireSeconds_ < (uint32_t)time(nullptr)) {
+    return;
+  }
+  ScopeLock sl(lock_);
+  auto itr = entries_.find(Key{userId, workerId});
+  if (itr != entries_.end() && itr->second.updateTime_ >= updateTime) {
+    return;
+  }
+  entries_[Key{userId, workerId}] = Entry{diff, updateTime, false};
+  isChanged_ = true;
+}
+
+size_t WorkerDiffCache::size() {
+  ScopeLock sl(lock_);
+  return entries_.size();
+}
+
+bool WorkerDiffCache::loadFromFile() {
+  FILE *f = fopen(file_.c_str(), "r");
+  if (f == nullptr) {
+    LOG(WARNING) << "worker diff cache: can't open file: " << file_;
+    return false;
+  }
+
+  // line: userId workerId diff updateTime
+  int32_t  userId;
+  int64_t  workerId;
+  uint64_t diff;
+  uint32_t updateTime;
+  size_t   count = 0;
+  while (fscanf(f, "%d %" SCNd64 " %" SCNu64 " %u",
+                &userId, &workerId, &diff, &updateTime) == 4) {
+    merge(userId, workerId, diff, updateTime);
+    count++;
+  }
+  fclose(f);
+
+  LOG(INFO) << "worker diff cache: load " << count << " entries from " << file_;
+  return true;
+}
+
+bool WorkerDiffCache::saveToFile() {
+  // copied out, formatted and written without the lock
+  vector<std::pair<Key, Entry>> entries;
+  {
+    ScopeLock sl(lock_);
+    const uint32_t now = (uint32_t)time(nullptr);
+    entries.reserve(entries_.size());
+    for (auto itr = entries_.begin(); itr != entries_.end(); ) {
+      if (itr->second.updateTime_ + kEntryExpireSeconds_ < now) {
+        itr = entries_.erase(itr);
+        continue;
+      }
+      entries.push_back(*itr);
+      itr++;
+    }
+    isChanged_ = false;
+  }
+
+  // write to a temp file and rename, so we never leave a half written file
+  const string tmpFile = file_ + ".tmp";
+  FILE *f = fopen(tmpFile.c_str(), "w");
+  if (f == nullptr) {
+    LOG(ERROR) << "worker diff cache: can't open file: " << tmpFile;
+    return false;
+  }
+  for (const auto &itr : entries) {
+    fprintf(f, "%d %" PRId64 " %" PRIu64 " %u\n",
+            itr.first.userId_, itr.first.workerId_,
+            itr.second.diff_, itr.second.updateTime_);
+  }
+  if (fclose(f) != 0 || rename(tmpFile.c_str(), file_.c_str()) != 0) {
+    LOG(ERROR) << "worker diff cache: write file failure: " << file_;
+    return false;
+  }
+  return true;
+}
+
+string WorkerDiffCache::formatField(const Key &key) {
+  return Strings::Format("%d:%" PRId64, key.userId_, key.workerId_);
+}
+
+bool WorkerDiffCache::parseField(const string &field, Key *key) {
+  return sscanf(field.c_str(), "%d:%" SCNd64, &key->userId_, &key->workerId_) == 2;
+}
+
+bool WorkerDiffCache::pushToRedis() {
+  // field: "userId:workerId", value: "diff:updateTime"
+  vector<std::pair<Key, Entry>> pushed;
+  {
+    ScopeLock sl(lock_);
+    for (const auto &itr : entries_) {
+      if (itr.second.isDirty_) {
+        pushed.push_back(itr);
+      }
+    }
+  }
+  for (const auto &itr : pushed) {
+    redis_->prepare({"HSET", redisKey_, formatField(itr.first),
+                     Strings::Format("%" PRIu64 ":%u", itr.second.diff_,
+                                     itr.second.updateTime_)});
+  }
+
+  vector<bool> written(pushed.size(), false);
+  bool res = true;
+  for (size_t i = 0; i < pushed.size(); i++) {
+    RedisResult r = redis_->execute();
+    written[i] = (r.type() == REDIS_REPLY_INTEGER);
+    if (!written[i]) {
+      res = false;
+    }
+  }
+
+  // the failed ones are pushed again next time, also the ones which have
+  // been changed since
+  {
+    ScopeLock sl(lock_);
+    for (size_t i = 0; i < pushed.size(); i++) {
+      if (!written[i]) {
+        continue;
+      }
+      auto itr = entries_.find(pushed[i].first);
+      if (itr != entries_.end() &&
+          itr->second.diff_ == pushed[i].second.diff_ &&
+          itr->second.updateTime_ == pushed[i].second.updateTime_) {
+        itr->second.isDirty_ = false;
+      }
+    }
+  }
+
+  if (!res) {
+    LOG(ERROR) << "worker diff cache: redis HSET failure";
+  }
+  return res;
+}
+
+bool WorkerDiffCache::pullFromRedis(size_t maxPages) {
+  const uint32_t now = (uint32_t)time(nullptr);
+  const string count = std::to_string(kRedisScanCount_);
+
+  for (size_t page = 0; page < maxPages; page++) {
+    RedisResult r = redis_->execute({"HSCAN", redisKey_, redisCursor_, "COUNT", count});
+    string cursor;
+    vector<string> items;
+    if (!r.scanResult(cursor, items)) {
+      LOG(ERROR) << "worker diff cache: redis HSCAN failure, reply type: " << r.type();
+      redisCursor_ = "0";
+      return false;
+    }
+
+    vector<string> expiredFields;
+    for (size_t i = 0; i + 1 < items.size(); i += 2) {
+      Key key;
+      uint64_t diff;
+      uint32_t updateTime;
+      if (!parseField(items[i], &key) ||
+          sscanf(items[i + 1].c_str(), "%" SCNu64 ":%u", &diff, &updateTime) != 2) {
+        continue;
+      }
+      if (updateTime + kEntryExpireSeconds_ < now) {
+        expiredFields.push_back(items[i]);
+        continue;
+      }
+      merge(key.userId_, key.workerId_, diff, updateTime);
+    }
+
+    // redis can't expire hash fields, remove them by ourselves
+    if (expiredFields.size() > 0) {
+      vector<string> args = {"HDEL", redisKey_};
+      args.insert(args.end(), expiredFields.begin(), expiredFields.end());
+      redis_->execute(args);
+    }
+
+    redisCursor_ = cursor;
+    if (redisCursor_ == "0") {
+      break;  // the whole hash is read, start over next time
+    }
+  }
+  return true;
+}
+
+void WorkerDiffCache::runThreadSync() {
+  time_t lastSyncTime = time(nullptr);
+
+  while (running_) {
+    sleep(1);
+    if (running_ && lastSyncTime + kSyncIntervalSeconds_ > time(nullptr)) {
+      continue;
+    }
+    lastSyncTime = time(nullptr);
+
+    if (redis_ != nullptr && redis_->ping()) {
+      pushToRedis();
+      pullFromRedis(kRedisScanPages_);
+    }
+
+    bool isChanged;
+    {
+      ScopeLock sl(lock_);
+      isChanged = isChanged_;
+    }
+    if (!file_.empty() && isChanged) {
+      saveToFile();
+    }
+  }
+}
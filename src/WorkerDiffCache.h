@@ -0,0 +1,122 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#ifndef WORKER_DIFF_CACHE_H_
+#define WORKER_DIFF_CACHE_H_
+
+#include "Common.h"
+
+#include <unordered_map>
+
+class RedisConnectInfo;
+class RedisConnection;
+
+//
+// Remember the last difficulty of every worker, so a reconnecting miner
+// (sserver restart, network flap) starts at its previous diff instead of
+// kDefaultDiff_ and doesn't flood the pool with low difficulty shares.
+//
+// The cache lives in memory and is written to a local file periodically.
+// With redis enabled, the changed entries are also pushed to a redis hash,
+// and the hash is read back by HSCAN a part a time, so the sservers behind
+// the same LB share their knowledge.
+//
+// All public methods are thread safe.
+//
+/////////////////////////////// WorkerDiffCache ////////////////////////////////
+class WorkerDiffCache {
+public:
+  static const time_t kEntryExpireSeconds_ = 86400 * 3;
+  static const time_t kSyncIntervalSeconds_ = 60;
+  // fields read by a HSCAN call, and HSCAN calls of a sync
+  static const size_t kRedisScanCount_ = 1000;
+  static const size_t kRedisScanPages_ = 100;
+
+  struct Key {
+    int32_t userId_;
+    int64_t workerId_;
+
+    bool operator==(const Key &r) const {
+      return userId_ == r.userId_ && workerId_ == r.workerId_;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      return std::hash<int64_t>()(k.workerId_) ^ ((size_t)k.userId_ << 1);
+    }
+  };
+
+  struct Entry {
+    uint64_t diff_;
+    uint32_t updateTime_;
+    bool     isDirty_;  // not pushed to redis yet
+  };
+
+private:
+  atomic<bool> running_;
+
+  mutex lock_;
+  std::unordered_map<Key, Entry, KeyHash> entries_;
+  bool isChanged_;  // not written to file yet
+
+  string file_;
+
+  RedisConnectInfo *redisInfo_;
+  RedisConnection  *redis_;
+  string redisKey_;
+  string redisCursor_;  // where the next HSCAN goes on, "0" to start over
+
+  thread threadSync_;
+  void runThreadSync();
+
+  bool pushToRedis();
+  // at most maxPages HSCAN calls from redisCursor_
+  bool pullFromRedis(size_t maxPages);
+
+  static string formatField(const Key &key);
+  static bool parseField(const string &field, Key *key);
+
+public:
+  // file: empty to disable the local file.
+  // redisInfo: nullptr to disable redis, will be owned by the cache.
+  WorkerDiffCache(const string &file, RedisConnectInfo *redisInfo,
+                  const string &redisKey);
+  ~WorkerDiffCache();
+
+  bool setup();
+  void stop();
+
+  // return 0 if not found or expired
+  uint64_t get(const int32_t userId, const int64_t workerId);
+  void set(const int32_t userId, const int64_t workerId, const uint64_t diff);
+  // only keep the newer one
+  void merge(const int32_t userId, const int64_t workerId,
+             const uint64_t diff, const uint32_t updateTime);
+  size_t size();
+
+  bool loadFromFile();
+  bool saveToFile();
+};
+
+#endif
@@ -128,7 +128,12 @@ int main(int argc, char **argv) {
                                       cfg.lookup("pooldb.dbname"));
   }
 
-  gBlockMaker = new BlockMaker(cfg.lookup("kafka.brokers").c_str(), *poolDBInfo);
+  // failed inserts are kept in it and retried
+  string sqlRetryFile = "./blkmaker_pooldb_retry.sql";
+  cfg.lookupValue("pooldb.sql_retry_file", sqlRetryFile);
+
+  gBlockMaker = new BlockMaker(cfg.lookup("kafka.brokers").c_str(), *poolDBInfo,
+                               sqlRetryFile);
 
   // add bitcoinds
   {
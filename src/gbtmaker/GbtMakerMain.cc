@@ -38,6 +38,8 @@
 
 #include "Utils.h"
 #include "GbtMaker.h"
+
+#include <chainparams.h>
 #include "config/bpool-version.h"
 
 using namespace std;
@@ -120,15 +122,30 @@ int main(int argc, char **argv) {
   signal(SIGTERM, handler);
   signal(SIGINT,  handler);
 
+  // check if we are using testnet3
+  bool isTestnet3 = true;
+  cfg.lookupValue("testnet", isTestnet3);
+  if (isTestnet3) {
+    SelectParams(CBaseChainParams::TESTNET);
+    LOG(WARNING) << "using bitcoin testnet3";
+  } else {
+    SelectParams(CBaseChainParams::MAIN);
+  }
+
   bool isCheckZmq = true;
   cfg.lookupValue("gbtmaker.is_check_zmq", isCheckZmq);
   int32_t rpcCallInterval = 5;
   cfg.lookupValue("gbtmaker.rpcinterval", rpcCallInterval);
+  bool isCompactRawGbt = false;
+  cfg.lookupValue("gbtmaker.is_compact_rawgbt", isCompactRawGbt);
+  bool isEmptyGbtFastPath = false;
+  cfg.lookupValue("gbtmaker.is_empty_gbt_fast_path", isEmptyGbtFastPath);
   gGbtMaker = new GbtMaker(cfg.lookup("bitcoind.zmq_addr"),
                            cfg.lookup("bitcoind.rpc_addr"),
                            cfg.lookup("bitcoind.rpc_userpwd"),
                            cfg.lookup("kafka.brokers"),
-                           rpcCallInterval, isCheckZmq);
+                           rpcCallInterval, isCheckZmq, isCompactRawGbt,
+                           isEmptyGbtFastPath);
 
   try {
     if (!gGbtMaker->init()) {
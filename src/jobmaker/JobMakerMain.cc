@@ -175,6 +175,18 @@ int main(int argc, char **argv) {
     cfg.lookupValue("jobmaker.merged_mining_notify", mergedMiningNotify);
     cfg.lookupValue("jobmaker.id", serverId);
 
+    // "json" or "binary"
+    string stratumJobFormat = "json";
+    cfg.lookupValue("jobmaker.stratum_job_format", stratumJobFormat);
+    if (stratumJobFormat != "json" && stratumJobFormat != "binary") {
+      LOG(FATAL) << "invalid jobmaker.stratum_job_format: " << stratumJobFormat;
+      return(EXIT_FAILURE);
+    }
+
+    // check txids of gbt in the background, see JobMaker::runThreadVerifyGbtTxids()
+    bool isVerifyGbtTxids = false;
+    cfg.lookupValue("jobmaker.verify_gbt_txids", isVerifyGbtTxids);
+
     if (serverId > 0xFFu || serverId == 0) {
       LOG(FATAL) << "invalid server id, range: [1, 255]";
       return(EXIT_FAILURE);
@@ -184,7 +196,8 @@ int main(int argc, char **argv) {
                              cfg.lookup("pool.payout_address"), gbtLifeTime,
                              emptyGbtLifeTime, fileLastJobTime, 
                              mergedMiningNotify, blockVersion,
-                             poolCoinbaseInfo, serverId);
+                             poolCoinbaseInfo, serverId,
+                             stratumJobFormat == "binary", isVerifyGbtTxids);
 
     if (!gJobMaker->init()) {
       LOG(FATAL) << "init failure";
@@ -121,9 +121,17 @@ int main(int argc, char **argv) {
   signal(SIGINT,  handler);
 
   try {
+    int32_t commitIntervalMs = 2000;
+    bool isFsync = true;
+    int32_t fileVersion = 1;
+    cfg.lookupValue("sharelog_writer.commit_interval_ms", commitIntervalMs);
+    cfg.lookupValue("sharelog_writer.is_fsync", isFsync);
+    cfg.lookupValue("sharelog_writer.file_version", fileVersion);
+
     gShareLogWriter = new ShareLogWriter(cfg.lookup("kafka.brokers").c_str(),
                                          cfg.lookup("sharelog_writer.data_dir").c_str(),
-                                         cfg.lookup("sharelog_writer.kafka_group_id").c_str());
+                                         cfg.lookup("sharelog_writer.kafka_group_id").c_str(),
+                                         commitIntervalMs, isFsync, fileVersion);
     gShareLogWriter->run();
     delete gShareLogWriter;
   }
@@ -55,6 +55,7 @@ void usage() {
   fprintf(stderr, BIN_VERSION_STRING("slparser"));
   fprintf(stderr, "Usage:\tslparser -c \"slparser.cfg\" [-l <log_dir|stderr>]\n");
   fprintf(stderr, "\tslparser -c \"slparser.cfg\" [-l <log_dir|stderr>] -d \"20160830\"\n");
+  fprintf(stderr, "\tslparser -c \"slparser.cfg\" [-l <log_dir|stderr>] -d \"20160830\" -e \"20160905\"\n");
   fprintf(stderr, "\tslparser -c \"slparser.cfg\" [-l <log_dir|stderr>] -d \"20160830\" -u \"puid(0: dump all, >0: someone's)\"\n");
 }
 
@@ -62,6 +63,7 @@ int main(int argc, char **argv) {
   char *optLogDir = NULL;
   char *optConf   = NULL;
   int32_t optDate = 0;
+  int32_t optEndDate = 0;  // re-run days from optDate to it
   int32_t optPUID = -1;  // pool user id
   int c;
 
@@ -69,7 +71,7 @@ int main(int argc, char **argv) {
     usage();
     return 1;
   }
-  while ((c = getopt(argc, argv, "c:l:d:u:h")) != -1) {
+  while ((c = getopt(argc, argv, "c:l:d:e:u:h")) != -1) {
     switch (c) {
       case 'c':
         optConf = optarg;
@@ -80,6 +82,9 @@ int main(int argc, char **argv) {
       case 'd':
         optDate = atoi(optarg);
         break;
+      case 'e':
+        optEndDate = atoi(optarg);
+        break;
       case 'u':
         optPUID = atoi(optarg);
         break;
@@ -88,6 +93,11 @@ int main(int argc, char **argv) {
         exit(0);
     }
   }
+  if (optEndDate != 0 && optDate == 0) {
+    fprintf(stderr, "-e \"end date\" must be given with -d \"begin date\"\n");
+    usage();
+    return 1;
+  }
 
   // Initialize Google's logging library.
   google::InitGoogleLogging(argv[0]);
@@ -149,6 +159,31 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  //////////////////////////////////////////////////////////////////////////////
+  //  re-run the share bin logs of some days
+  //////////////////////////////////////////////////////////////////////////////
+  if (optDate != 0 && optEndDate != 0) {
+    const string beginStr = Strings::Format("%04d-%02d-%02d 00:00:00",
+                                            optDate/10000,
+                                            optDate/100 % 100, optDate % 100);
+    const string endStr = Strings::Format("%04d-%02d-%02d 00:00:00",
+                                          optEndDate/10000,
+                                          optEndDate/100 % 100, optEndDate % 100);
+    int32_t parallelDays = 2;
+    int32_t parseThreads = 0;
+    cfg.lookupValue("sharelog.parallel_days", parallelDays);
+    cfg.lookupValue("sharelog.parse_threads", parseThreads);
+
+    ShareLogBatchParser batchParser(cfg.lookup("sharelog.data_dir"), *poolDBInfo,
+                                    std::max(parallelDays, 1),
+                                    std::max(parseThreads, 0));
+    const bool res = batchParser.run(str2time(beginStr.c_str(), "%F %T"),
+                                     str2time(endStr.c_str(), "%F %T"));
+
+    google::ShutdownGoogleLogging();
+    return res ? 0 : 1;
+  }
+
   //////////////////////////////////////////////////////////////////////////////
   //  re-run someday's share bin log
   //////////////////////////////////////////////////////////////////////////////
@@ -160,12 +195,14 @@ int main(int argc, char **argv) {
 
     ShareLogParser slparser(cfg.lookup("sharelog.data_dir"),
                             ts, *poolDBInfo);
+    int32_t parseThreads = 0;
+    cfg.lookupValue("sharelog.parse_threads", parseThreads);
     do {
       if (slparser.init() == false) {
         LOG(ERROR) << "init failure";
         break;
       }
-      if (!slparser.processUnchangedShareLog()) {
+      if (!slparser.processUnchangedShareLog(std::max(parseThreads, 0))) {
         LOG(ERROR) << "processUnchangedShareLog fail";
         break;
       }
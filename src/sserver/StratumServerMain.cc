@@ -38,6 +38,7 @@
 #include "zmq.hpp"
 
 #include "Utils.h"
+#include "RedisConnection.h"
 #include "StratumServer.h"
 #include "config/bpool-version.h"
 
@@ -165,6 +166,52 @@ int main(int argc, char **argv) {
     string fileLastMiningNotifyTime;
     cfg.lookupValue("sserver.file_last_notify_time", fileLastMiningNotifyTime);
 
+    string solvedShareSpillDir;
+    cfg.lookupValue("sserver.solved_share_spill_dir", solvedShareSpillDir);
+
+    // local job relay
+    JobRelayMode jobRelayMode = JOB_RELAY_NONE;
+    string jobRelayModeStr;
+    string jobRelayShmName = "/btcpool_sjob";
+    cfg.lookupValue("sserver.job_relay.mode", jobRelayModeStr);
+    cfg.lookupValue("sserver.job_relay.shm_name", jobRelayShmName);
+    if (jobRelayModeStr == "publisher") {
+      jobRelayMode = JOB_RELAY_PUBLISHER;
+    } else if (jobRelayModeStr == "subscriber") {
+      jobRelayMode = JOB_RELAY_SUBSCRIBER;
+    } else if (!jobRelayModeStr.empty() && jobRelayModeStr != "none") {
+      LOG(FATAL) << "invalid sserver.job_relay.mode: " << jobRelayModeStr;
+      return(EXIT_FAILURE);
+    }
+
+    // worker's last difficulty, local file and/or redis
+    string diffCacheFile;
+    cfg.lookupValue("sserver.diff_cache.file", diffCacheFile);
+    RedisConnectInfo *diffCacheRedisInfo = nullptr;
+    string diffCacheRedisKey = "btcpool_worker_diff";
+    bool diffCacheUseRedis = false;
+    cfg.lookupValue("sserver.diff_cache.use_redis", diffCacheUseRedis);
+    if (diffCacheUseRedis) {
+      int32_t redisPort = 6379;
+      string redisPasswd;
+      cfg.lookupValue("redis.port", redisPort);
+      cfg.lookupValue("redis.password", redisPasswd);
+      cfg.lookupValue("sserver.diff_cache.redis_key", diffCacheRedisKey);
+      diffCacheRedisInfo = new RedisConnectInfo(cfg.lookup("redis.host"),
+                                                redisPort, redisPasswd);
+    }
+
+    // admission control
+    AdmissionConfig admissionConfig;
+    cfg.lookupValue("sserver.admission.accept_rate_per_subnet",  admissionConfig.acceptRatePerSubnet_);
+    cfg.lookupValue("sserver.admission.accept_burst_per_subnet", admissionConfig.acceptBurstPerSubnet_);
+    cfg.lookupValue("sserver.admission.max_pending_handshakes",  admissionConfig.maxPendingHandshakes_);
+    cfg.lookupValue("sserver.admission.max_pending_accepts",     admissionConfig.maxPendingAccepts_);
+    cfg.lookupValue("sserver.admission.first_jobs_per_second",   admissionConfig.firstJobsPerSecond_);
+
+    bool isUserUpdatesFromKafka = false;
+    cfg.lookupValue("users.updates_from_kafka", isUserUpdatesFromKafka);
+
     evthread_use_pthreads();
 
     // new StratumServer
@@ -178,7 +225,15 @@ int main(int argc, char **argv) {
                                        isSubmitInvalidBlock,
                                        isDevModeEnabled,
                                        minerDifficulty,
-                                       shareAvgSeconds);
+                                       shareAvgSeconds,
+                                       solvedShareSpillDir,
+                                       jobRelayMode,
+                                       jobRelayShmName,
+                                       diffCacheFile,
+                                       diffCacheRedisInfo,
+                                       diffCacheRedisKey,
+                                       admissionConfig,
+                                       isUserUpdatesFromKafka);
 
     if (!gStratumServer->init()) {
       LOG(FATAL) << "init failure";
@@ -10,17 +10,324 @@
 #include <memory>
 #include <cstdlib>
 #include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <algorithm>
 #include <cstring>
 #include <array>
 #include <stdexcept>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//
+// Parsing runs in two stages, in the spirit of simdjson:
+//
+//  1. structural index: one pass over the input, 64 bytes at a time, that
+//     records the offset of every {}[]:, outside of strings, every opening
+//     quote and the first byte of every scalar. Escapes and "inside a
+//     string" are computed with bit tricks on 64-bit masks, the masks
+//     themselves come from SSE2 compares (plain loop on other targets).
+//  2. link: walk the tokens once, check the grammar, and store for each
+//     container the index of its closing token and for each string or
+//     scalar the offset where its text ends.
+//
+// No node is built while parsing. A container lists its direct children
+// the first time they are asked for (operator[], children(), array(),
+// obj()), so the parts of a multi-MB block template that nobody reads are
+// never materialized. Only the first value of the input is parsed, bytes
+// after it are ignored.
+//
 namespace Utilities {
 namespace JS {
 
 enum class type { Null, Obj, Array, Str, Int, Real, Bool, Undefined };
 
+struct Token {
+  uint32_t pos_;  // offset of the token in the input
+  uint32_t end_;  // container: index of the closing token,
+                  // string: offset of the closing quote,
+                  // other scalars: offset just past the text
+};
+
+struct Document {
+  const char *buf_;
+  size_t len_;
+  std::vector<Token> tokens_;
+};
+
+namespace detail {
+
+inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// per-byte masks of one 64-byte block, bit i is byte i
+struct BlockMasks {
+  uint64_t backslash_;
+  uint64_t quote_;
+  uint64_t op_;     // {}[]:,
+  uint64_t space_;  // any byte <= 0x20, the link stage checks the gaps
+                    // it relies on
+};
+
+inline void classify_block(const char *p, BlockMasks &m) {
+#if defined(__SSE2__)
+  m.backslash_ = m.quote_ = m.op_ = m.space_ = 0;
+  for (int k = 0; k < 4; k++) {
+    const __m128i v  = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+    // '[' | 0x20 == '{' and ']' | 0x20 == '}', nothing else maps there
+    const __m128i lv = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(lv, _mm_set1_epi8('{')),
+                     _mm_cmpeq_epi8(lv, _mm_set1_epi8('}'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    const __m128i sp = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x20)), v);
+    const int shift = 16 * k;
+    m.backslash_ |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+    m.quote_ |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << shift;
+    m.op_    |= (uint64_t)(uint32_t)_mm_movemask_epi8(op) << shift;
+    m.space_ |= (uint64_t)(uint32_t)_mm_movemask_epi8(sp) << shift;
+  }
+#else
+  m.backslash_ = m.quote_ = m.op_ = m.space_ = 0;
+  for (int i = 0; i < 64; i++) {
+    const uint64_t bit = 1ULL << i;
+    switch (p[i]) {
+      case '\\': m.backslash_ |= bit; break;
+      case '"':  m.quote_     |= bit; break;
+      case '{': case '}': case '[': case ']': case ':': case ',':
+        m.op_ |= bit; break;
+      default:
+        if ((unsigned char)p[i] <= 0x20) { m.space_ |= bit; }
+        break;
+    }
+  }
+#endif
+}
+
+// bits of the characters escaped by a backslash, carrying odd-length
+// backslash runs over to the next block
+inline uint64_t find_escaped(uint64_t backslash, uint64_t &prev_escaped) {
+  backslash &= ~prev_escaped;
+  const uint64_t follows_escape = backslash << 1 | prev_escaped;
+  const uint64_t even_bits = 0x5555555555555555ULL;
+  const uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+  const uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+  prev_escaped = (sequences_starting_on_even_bits < backslash) ? 1 : 0;
+  const uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+  return (even_bits ^ invert_mask) & follows_escape;
+}
+
+// bit i is the xor of bits 0..i
+inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+inline bool build_index(const char *begin, const char *end,
+                        std::vector<Token> &tokens) {
+  const size_t len = end - begin;
+  if (len >= UINT32_MAX) {
+    return false;
+  }
+  tokens.clear();
+  tokens.reserve(len / 32 + 16);
+
+  uint64_t prev_escaped   = 0;
+  uint64_t prev_in_string = 0;
+  uint64_t prev_scalar    = 0;
+  char tail[64];
+
+  for (size_t base = 0; base < len; base += 64) {
+    const char *p = begin + base;
+    if (len - base < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, len - base);
+      p = tail;
+    }
+    BlockMasks m;
+    classify_block(p, m);
+
+    const uint64_t quote = m.quote_ & ~find_escaped(m.backslash_, prev_escaped);
+    // opening quotes are inside, closing quotes are not
+    const uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+    prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+    // first byte of each run of scalar text (numbers, true, false, null,
+    // and garbage that the link stage will reject)
+    const uint64_t scalar = ~(m.op_ | m.space_ | quote | in_string);
+    const uint64_t scalar_start = scalar & ~(scalar << 1 | prev_scalar);
+    prev_scalar = scalar >> 63;
+
+    uint64_t bits = (m.op_ & ~in_string) | (quote & in_string) | scalar_start;
+    while (bits != 0) {
+      Token t;
+      t.pos_ = (uint32_t)(base + __builtin_ctzll(bits));
+      t.end_ = 0;
+      tokens.push_back(t);
+      bits &= bits - 1;
+    }
+  }
+
+  // unterminated string
+  return prev_in_string == 0;
+}
+
+inline uint32_t next_pos(const Document &doc, size_t i) {
+  return (i + 1 < doc.tokens_.size()) ? doc.tokens_[i + 1].pos_ : (uint32_t)doc.len_;
+}
+
+// only whitespace may sit between the end of a value and the next token
+inline bool only_space(const char *buf, uint32_t from, uint32_t to) {
+  for (; from < to; from++) {
+    if (!is_space(buf[from])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool link_string(Document &doc, size_t i) {
+  const char *buf = doc.buf_;
+  const uint32_t pos = doc.tokens_[i].pos_;
+  uint32_t e = next_pos(doc, i);
+  while (e > pos + 1 && is_space(buf[e - 1])) {
+    e--;
+  }
+  if (e <= pos + 1 || buf[e - 1] != '"') {
+    return false;
+  }
+  doc.tokens_[i].end_ = e - 1;
+  return true;
+}
+
+inline bool link_scalar(Document &doc, size_t i) {
+  const char *buf = doc.buf_;
+  const uint32_t pos = doc.tokens_[i].pos_;
+  const uint32_t len = (uint32_t)doc.len_;
+  uint32_t e = pos;
+
+  switch (buf[pos]) {
+    case '"':
+      return link_string(doc, i);
+
+    case 't':
+    case 'f':
+    case 'n': {
+      const char *lit = (buf[pos] == 't') ? "true" : (buf[pos] == 'f') ? "false" : "null";
+      const uint32_t litLen = (uint32_t)strlen(lit);
+      if (len - pos < litLen || memcmp(buf + pos, lit, litLen) != 0) {
+        return false;
+      }
+      e = pos + litLen;
+      break;
+    }
+
+    default: {
+      if (e < len && buf[e] == '-') { e++; }
+      if (e >= len || !isdigit((unsigned char)buf[e])) { return false; }
+      while (e < len && isdigit((unsigned char)buf[e])) { e++; }
+      if (e < len && buf[e] == '.') {
+        e++;
+        if (e >= len || !isdigit((unsigned char)buf[e])) { return false; }
+        while (e < len && isdigit((unsigned char)buf[e])) { e++; }
+      }
+      if (e < len && (buf[e] == 'e' || buf[e] == 'E')) {
+        e++;
+        if (e < len && (buf[e] == '+' || buf[e] == '-')) { e++; }
+        if (e >= len || !isdigit((unsigned char)buf[e])) { return false; }
+        while (e < len && isdigit((unsigned char)buf[e])) { e++; }
+      }
+      break;
+    }
+  }
+
+  if (!only_space(buf, e, next_pos(doc, i))) {
+    return false;
+  }
+  doc.tokens_[i].end_ = e;
+  return true;
+}
+
+// checks the grammar of the first value and links containers and scalars
+inline bool link_index(Document &doc) {
+  enum class state { Value, Key, Next };
+  const uint32_t kNone = UINT32_MAX;
+
+  std::vector<Token> &tk = doc.tokens_;
+  const char *buf = doc.buf_;
+  const size_t n = tk.size();
+  // innermost open container, each open container keeps the index of the
+  // one around it in end_ until it is closed
+  uint32_t top = kNone;
+  state s = state::Value;
+  size_t i = 0;
+
+  while (true) {
+    if (s == state::Next && top == kNone) {
+      return true;
+    }
+    if (i >= n) {
+      return false;
+    }
+    const char c = buf[tk[i].pos_];
+
+    if (s == state::Value) {
+      if (c == '{' || c == '[') {
+        tk[i].end_ = top;
+        top = (uint32_t)i++;
+        if (i < n && buf[tk[i].pos_] == ((c == '{') ? '}' : ']')) {
+          const uint32_t open = top;
+          top = tk[open].end_;
+          tk[open].end_ = (uint32_t)i++;
+          s = state::Next;
+        } else {
+          s = (c == '{') ? state::Key : state::Value;
+        }
+        continue;
+      }
+      if (!link_scalar(doc, i)) {
+        return false;
+      }
+      i++;
+      s = state::Next;
+    }
+    else if (s == state::Key) {
+      if (c != '"' || i + 1 >= n || !link_string(doc, i) ||
+          buf[tk[i + 1].pos_] != ':') {
+        return false;
+      }
+      i += 2;
+      s = state::Value;
+    }
+    else {
+      const char open = buf[tk[top].pos_];
+      if (c == ',') {
+        i++;
+        s = (open == '{') ? state::Key : state::Value;
+      } else if (c == ((open == '{') ? '}' : ']')) {
+        const uint32_t outer = tk[top].end_;
+        tk[top].end_ = (uint32_t)i++;
+        top = outer;
+      } else {
+        return false;
+      }
+    }
+  }
+}
+
+}  // namespace detail
+
 class Node{
   public:
 
@@ -33,7 +340,7 @@ class Node{
       while( (i = std::find_first_of(i,end,string_stop.begin(),string_stop.end())) != end) {
         if(*i == '\\') {
           ++i;
-          if(i == end){ return end;} 
+          if(i == end){ return end;}
           ++i;
         } else {
           return i;
@@ -41,148 +348,29 @@ class Node{
       }
       return end;
     }
-    
-    //parses a number, including floats
-    static const char* parse_float(const char* begin, const char* end) {
-      const char* i = begin;
-      if(*i == '-') { ++i; }
-      if(i == end) return end;
-      while(isdigit(*i)) { ++i; if(i == end) return end;}
-
-      if(*i == '.') { 
-        ++i;
-        while(isdigit(*i)) { ++i; if(i == end) return end;  }
-      }
-
-      if(*i == 'e' || *i == 'E') {
-        ++i;
-        if(*i == '+' || *i == '-') { ++i; }
-        while(isdigit(*i)) { ++i; if(i == end) return end; }
-      }
-      return i;
-    }
 
     static bool parse(const char* begin, const char* end, Node &root) {
-      //stop on [n]ull,[t]rue,[f]alse,["]string,number,array, or object
-      static std::array<char,19> stop = {'n','"','0','1','2','3','4','5','6','7','8','9','-','t','f','[',']','{','}'};
-      Node* parent = nullptr;
-      Node node;
-
-      const char* i = begin;
-      while( (i = std::find_first_of(i,end,stop.begin(),stop.end())) != end) {
-       
+      auto doc = std::make_shared<Document>();
+      doc->buf_ = begin;
+      doc->len_ = end - begin;
 
-        if ( *i == '}' || *i == ']' ) {
-          if( parent == nullptr || ( parent->type_ != ( (*i == '}') ? JS::type::Obj : JS::type::Array ) )) {
-            root.reset_soft();
-            return false;
-          } else {
-            if(parent->parent_ == nullptr) {
-              return true;
-            }
-            parent = parent->parent_;
-          }
-          ++i;
-          continue;
-        }
-
-        node.reset();
-        
-        if (parent != nullptr && parent->type_ == JS::type::Obj) {
-          //parse the key and continue
-          node.key_start_ = ++i;
-          if( (i = Node::parse_string(i,end)) == end) {
-            root.reset_soft();
-            return false;
-          }
-
-          node.key_end_ = i;
-          ++i;
-          if( (i = std::find_first_of(i,end,stop.begin(),stop.end())) == end ) {
-            root.reset_soft();
-            return false;
-          }
-        }
-
-
-        if ( *i == '{' || *i == '[' ) {
-          node.children_ = std::make_shared<std::vector<Node> >();
-          node.sorted_ = true;
-          node.type_ = (*i == '{') ? JS::type::Obj : JS::type::Array;
-          ++i;
-        } else if ( *i == 'n' ) {
-          node.type_ = JS::type::Null;
-          ++i;
-        } else if ( *i == 't' || *i == 'f') {
-          node.type_ = JS::type::Bool;
-          node.start_ = i;
-          ++i;
-        } else if ( *i == '"') {
-          node.start_ = ++i;
-          if( (i = Node::parse_string(i,end)) == end) {
-            root.reset_soft();
-            return false;
-          }
-          node.end_ = i;
-          node.type_ = JS::type::Str;
-          ++i;
-        } else {
-          node.start_ = i;
-          if(*i == '-') { ++i;}
-          if(i == end) {
-            root.reset_soft();
-            return false;
-
-          }
-          while(isdigit(*i)) { ++i; }
-          auto j = Node::parse_float(i,end);
-          if( j == end) {
-            root.reset_soft();
-            return false;
-          } 
-
-          if( i != j) {
-            node.type_ = JS::type::Real;
-            node.end_ = j;
-            i = j;
-          } else {
-            node.type_ = JS::type::Int;
-            node.end_ = i;
-          }
-        }
-        
-        if( parent == nullptr) {
-          root.set_soft(node);
-          if(node.type_ == JS::type::Obj || node.type_ ==JS::type::Array) {
-            parent = &root;
-          } else {
-            return true;
-          }
-        } else {
-          node.parent_ = parent; 
-          if(node.has_key() && parent->children_->size() > 0 &&
-                 ( node < parent->children_->back() )) {
-            parent->sorted_ = false;
-          }
-          parent->children_->push_back(node);
-          if(node.type_ == JS::type::Obj || node.type_ ==JS::type::Array) {
-            parent = &parent->children_->back();
-          }
-        }
-      }
-
-      //this code should never be reached in a valid json object
       root.reset_soft();
-      return false;
+      if (!detail::build_index(begin, end, doc->tokens_) ||
+          !detail::link_index(*doc)) {
+        return false;
+      }
+      root.set_value(doc, 0);
+      return true;
     }
 
     void sort_objects() {
       if(type_ == JS::type::Obj || type_ == JS::type::Array) {
+        materialize();
         if(type_ == JS::type::Obj && sorted_ == false) {
           std::sort(children_->begin(), children_->end());
           sorted_ = true;
         }
-        for(auto child:*children_) {
+        for(auto &child:*children_) {
             child.sort_objects();
         }
       }
@@ -191,7 +379,7 @@ class Node{
     std::ostream& print(std::ostream &out) const{
       return Node::print(out,*this);
     }
-  
+
     static std::ostream& print(std::ostream &out,const Node &node) {
       if(node.has_key()) {
         out << '"' << std::string(node.key_start_,node.key_end_) << '"' << ":";
@@ -199,11 +387,12 @@ class Node{
 
       if(node.type_ == JS::type::Array || node.type_ == JS::type::Obj) {
         out << ((node.type_ == JS::type::Obj) ? "{" : "[");
-        auto n = node.children_->cbegin();
-        while(n != node.children_->cend()){
+        auto children = node.children();
+        auto n = children->cbegin();
+        while(n != children->cend()){
             Node::print(out,*n);
             ++n;
-          while(n != node.children_->cend()) {
+          while(n != children->cend()) {
             out << ",";
             Node::print(out,*n);
             ++n;
@@ -227,33 +416,43 @@ class Node{
 
     void detach() {
       parent_ = nullptr;
+      keyed_ = false;
     }
 
     void reset_soft() {
       //don't change the parent
       children_.reset();
+      doc_.reset();
       type_ = JS::type::Undefined;
    }
 
     void reset() {
       parent_ = nullptr;
+      keyed_ = false;
       children_.reset();
+      doc_.reset();
       type_ = JS::type::Undefined;
    }
 
     void set_soft(const Node &node) {
       //don't change the parent
       type_ = node.type_;
+      keyed_ = node.keyed_;
       key_start_ = node.key_start_;
       key_end_ = node.key_end_;
       start_ = node.start_;
       end_ = node.end_;
+      sorted_ = node.sorted_;
       children_ = node.children_;
+      doc_ = node.doc_;
+      token_ = node.token_;
     }
 
-    Node():type_(JS::type::Undefined),parent_(nullptr) {
+    Node():type_(JS::type::Undefined),keyed_(false),key_start_(nullptr),
+           key_end_(nullptr),start_(nullptr),end_(nullptr),sorted_(false),
+           parent_(nullptr),token_(0) {
     }
-    
+
     JS::type type() const { return type_; }
 
     const char* start() const { return start_; }
@@ -263,11 +462,14 @@ class Node{
     const char* key_start() const { return key_start_; }
     const char* key_end() const { return key_end_; }
     size_t key_size() const{ return std::distance(key_start_,key_end_); }
-    
+
     Node* parent() const{ return parent_; }
 
-    std::shared_ptr<std::vector<Node> > children() const{ return children_; }
-  
+    std::shared_ptr<std::vector<Node> > children() const{
+      materialize();
+      return children_;
+    }
+
     Node node() {
       return *this;
     }
@@ -279,13 +481,35 @@ class Node{
     }
 
     Node operator[](const char *val) {
+      if(type_ != JS::type::Obj) {
+        return Node();
+      }
       auto val_end = val + strlen(val);
-      if(type_ == JS::type::Obj) {
+
+      // small objects are searched on the tokens, without listing them,
+      // as long as the value found is not a container
+      if(!children_ && doc_ && doc_->tokens_[token_].end_ - token_ <= kScanLookupMaxTokens) {
+        Node ret;
+        if(scan_lookup(val, val_end, ret)) {
+          return ret;
+        }
+      }
+      materialize();
+
+      Node *found = nullptr;
+      if(children_->size() <= kLinearLookupMax) {
+        for(auto &child:*children_) {
+          if(child.keys_equal(val,val_end)) {
+            found = &child;
+            break;
+          }
+        }
+      } else {
         if(!sorted_) {
           std::sort(children_->begin(), children_->end());
           sorted_ = true;
         }
-        const auto comp = [this,val_end](const Node& node, const char* val) {
+        const auto comp = [val_end](const Node& node, const char* val) {
               return std::lexicographical_compare(
                               node.key_start_,node.key_end_
                              ,val,val_end);
@@ -293,18 +517,25 @@ class Node{
         auto it = std::lower_bound(children_->begin(),children_->end()
             ,val,comp);
         if(it != children_->end() && it->keys_equal(val,val_end)) {
-          Node ret = *it;
-          ret.detach();
-          return ret;
+          found = &(*it);
         }
       }
-      return Node();
+      if(found == nullptr) {
+        return Node();
+      }
+
+      // list the children in place, so every copy handed out shares them
+      // and they live as long as this node
+      if(found->type_ == JS::type::Obj || found->type_ == JS::type::Array) {
+        found->materialize();
+      }
+      Node ret = *found;
+      ret.detach();
+      return ret;
     }
 
     bool keys_equal(const Node &rhs) const {
-      return std::lexicographical_compare(
-                      key_start_,key_end_
-                     ,rhs.key_start(),rhs.key_end());
+      return keys_equal(rhs.key_start(), rhs.key_end());
     }
 
     bool keys_equal(const char * begin, const char *end) const{
@@ -316,7 +547,7 @@ class Node{
     }
 
 
-    bool has_key() const { return parent_ != nullptr && parent_->type_ == JS::type::Obj; }
+    bool has_key() const { return keyed_; }
     bool sorted() const { return sorted_;}
     int8_t int8() const{ return *start_; }
     uint8_t uint8() const { return *start_; }
@@ -332,18 +563,136 @@ class Node{
     std::string str() const { return std::string(start_,end_); }
     bool boolean() const { return (*start_ == 't' ) ? true : false; }
 
-    std::vector<Node>& obj() { return *children_; }
-    std::vector<Node>& array() { return *children_; }
+    std::vector<Node>& obj() { materialize(); return *children_; }
+    std::vector<Node>& array() { materialize(); return *children_; }
 
   private:
+    // objects up to this size are searched in place instead of sorted
+    static const size_t kLinearLookupMax = 16;
+    // unlisted objects up to this many tokens are searched on the tokens
+    static const uint32_t kScanLookupMaxTokens = 64;
+
+    // index of the token after the value at i and its trailing comma
+    static uint32_t next_sibling(const Token *tk, const char *buf, uint32_t i) {
+      i = (buf[tk[i].pos_] == '{' || buf[tk[i].pos_] == '[') ? tk[i].end_ + 1 : i + 1;
+      return (buf[tk[i].pos_] == ',') ? i + 1 : i;
+    }
+
+    // looks a key up on the tokens, false when it has to be listed first
+    bool scan_lookup(const char *val, const char *val_end, Node &ret) const {
+      const Token *tk = doc_->tokens_.data();
+      const char *buf = doc_->buf_;
+      const uint32_t close = tk[token_].end_;
+      const size_t val_len = val_end - val;
+
+      for(uint32_t i = token_ + 1; i < close; i = next_sibling(tk, buf, i + 2)) {
+        if(tk[i].end_ - tk[i].pos_ - 1 == val_len &&
+           memcmp(buf + tk[i].pos_ + 1, val, val_len) == 0) {
+          const char c = buf[tk[i + 2].pos_];
+          if(c == '{' || c == '[') {
+            return false;
+          }
+          ret.set_value(doc_, i + 2);
+          return true;
+        }
+      }
+      return true;  // not found
+    }
+
+    // makes this node a view on the value starting at token i
+    void set_value(const std::shared_ptr<const Document> &doc, uint32_t i) {
+      const Token &t = doc->tokens_[i];
+      const char *buf = doc->buf_;
+
+      doc_ = doc;
+      token_ = i;
+      children_.reset();
+      sorted_ = false;
+
+      switch (buf[t.pos_]) {
+        case '{':
+        case '[':
+          type_ = (buf[t.pos_] == '{') ? JS::type::Obj : JS::type::Array;
+          start_ = buf + t.pos_;
+          end_ = buf + doc->tokens_[t.end_].pos_ + 1;
+          break;
+        case '"':
+          type_ = JS::type::Str;
+          start_ = buf + t.pos_ + 1;
+          end_ = buf + t.end_;
+          break;
+        case 't':
+        case 'f':
+          type_ = JS::type::Bool;
+          start_ = buf + t.pos_;
+          end_ = buf + t.end_;
+          break;
+        case 'n':
+          type_ = JS::type::Null;
+          start_ = buf + t.pos_;
+          end_ = buf + t.end_;
+          break;
+        default:
+          start_ = buf + t.pos_;
+          end_ = buf + t.end_;
+          type_ = (std::find_if(start_, end_, [](char c) {
+                     return c == '.' || c == 'e' || c == 'E';
+                   }) == end_) ? JS::type::Int : JS::type::Real;
+          break;
+      }
+    }
+
+    // lists the direct children of a container, once
+    void materialize() const {
+      if(children_) {
+        return;
+      }
+      children_ = std::make_shared<std::vector<Node> >();
+      if((type_ != JS::type::Obj && type_ != JS::type::Array) || !doc_) {
+        return;
+      }
+
+      const Token *tk = doc_->tokens_.data();
+      const char *buf = doc_->buf_;
+      const uint32_t close = tk[token_].end_;
+      const bool isObj = (type_ == JS::type::Obj);
+
+      size_t count = 0;
+      for(uint32_t i = token_ + 1; i < close; i = next_sibling(tk, buf, isObj ? i + 2 : i)) {
+        count++;
+      }
+      children_->reserve(count);
+
+      sorted_ = true;
+      for(uint32_t i = token_ + 1; i < close; ) {
+        Node child;
+        if(isObj) {
+          child.keyed_ = true;
+          child.key_start_ = buf + tk[i].pos_ + 1;
+          child.key_end_ = buf + tk[i].end_;
+          i += 2;
+        }
+        child.set_value(doc_, i);
+        child.parent_ = const_cast<Node *>(this);
+        if(isObj && !children_->empty() && child < children_->back()) {
+          sorted_ = false;
+        }
+        children_->push_back(std::move(child));
+        i = next_sibling(tk, buf, i);
+      }
+    }
+
     JS::type type_;
+    bool keyed_;
     const char* key_start_;
     const char* key_end_;
     const char* start_;
     const char* end_;
-    bool sorted_;
+    mutable bool sorted_;
     Node* parent_;
-    std::shared_ptr<std::vector<Node> > children_;
+    mutable std::shared_ptr<std::vector<Node> > children_;
+    std::shared_ptr<const Document> doc_;
+    uint32_t token_;
 
 };
 
@@ -0,0 +1,126 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "AdmissionControl.h"
+
+#include <arpa/inet.h>
+
+TEST(AdmissionControl, TokenBucket) {
+  // 10 tokens per second, burst 5
+  TokenBucket bucket(10, 5, 1000000);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(bucket.tryConsume(1000000), true);
+  }
+  ASSERT_EQ(bucket.tryConsume(1000000), false);
+
+  // 100ms later, one more token
+  ASSERT_EQ(bucket.tryConsume(1100000), true);
+  ASSERT_EQ(bucket.tryConsume(1100000), false);
+
+  // never exceed the burst
+  ASSERT_EQ(bucket.isFull(100000000), true);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(bucket.tryConsume(100000000), true);
+  }
+  ASSERT_EQ(bucket.tryConsume(100000000), false);
+}
+
+static struct sockaddr_storage makeAddr(const char *ip) {
+  struct sockaddr_storage saddr;
+  memset(&saddr, 0, sizeof(saddr));
+  if (strchr(ip, ':') == nullptr) {
+    struct sockaddr_in *sin = (struct sockaddr_in *)&saddr;
+    sin->sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &sin->sin_addr);
+  } else {
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&saddr;
+    sin6->sin6_family = AF_INET6;
+    inet_pton(AF_INET6, ip, &sin6->sin6_addr);
+  }
+  return saddr;
+}
+
+static bool tryAccept(AcceptLimiter &limiter, const char *ip, uint64_t nowUs) {
+  struct sockaddr_storage saddr = makeAddr(ip);
+  return limiter.tryAccept((struct sockaddr *)&saddr, nowUs);
+}
+
+TEST(AdmissionControl, AcceptLimiter) {
+  // disabled
+  {
+    AcceptLimiter limiter(0, 0);
+    for (int i = 0; i < 1000; i++) {
+      ASSERT_EQ(tryAccept(limiter, "10.0.0.1", 0), true);
+    }
+    ASSERT_EQ(limiter.size(), 0u);
+  }
+
+  AcceptLimiter limiter(1, 2);
+  // 10.0.0.1 and 10.0.0.2 are in the same subnet
+  ASSERT_EQ(tryAccept(limiter, "10.0.0.1", 0), true);
+  ASSERT_EQ(tryAccept(limiter, "10.0.0.2", 0), true);
+  ASSERT_EQ(tryAccept(limiter, "10.0.0.3", 0), false);
+  // 10.0.1.1 is not
+  ASSERT_EQ(tryAccept(limiter, "10.0.1.1", 0), true);
+  ASSERT_EQ(limiter.size(), 2u);
+
+  ASSERT_EQ(tryAccept(limiter, "10.0.0.3", 1000000), true);
+  ASSERT_EQ(tryAccept(limiter, "10.0.0.3", 1000000), false);
+
+  // full buckets are removed
+  limiter.cleanup(1200000);
+  ASSERT_EQ(limiter.size(), 1u);
+  limiter.cleanup(10000000);
+  ASSERT_EQ(limiter.size(), 0u);
+}
+
+TEST(AdmissionControl, AcceptLimiterIPv6) {
+  uint64_t subnet1, subnet2;
+  struct sockaddr_storage saddr1 = makeAddr("10.0.0.1");
+  struct sockaddr_storage saddr2 = makeAddr("::ffff:10.0.0.2");
+  ASSERT_EQ(AcceptLimiter::subnetOf((struct sockaddr *)&saddr1, subnet1), true);
+  ASSERT_EQ(AcceptLimiter::subnetOf((struct sockaddr *)&saddr2, subnet2), true);
+  ASSERT_EQ(subnet1, subnet2);
+
+  saddr1 = makeAddr("2001:db8:1:2::1");
+  ASSERT_EQ(AcceptLimiter::subnetOf((struct sockaddr *)&saddr1, subnet1), true);
+  ASSERT_EQ(subnet1, 0x20010db800010002ull);
+
+  struct sockaddr unknown;
+  memset(&unknown, 0, sizeof(unknown));
+  unknown.sa_family = AF_UNIX;
+  ASSERT_EQ(AcceptLimiter::subnetOf(&unknown, subnet1), false);
+
+  AcceptLimiter limiter(1, 2);
+  // the same /64
+  ASSERT_EQ(tryAccept(limiter, "2001:db8:1:2::1", 0), true);
+  ASSERT_EQ(tryAccept(limiter, "2001:db8:1:2:ffff::1", 0), true);
+  ASSERT_EQ(tryAccept(limiter, "2001:db8:1:2::3", 0), false);
+  // not the same one
+  ASSERT_EQ(tryAccept(limiter, "2001:db8:1:3::1", 0), true);
+  // not limited
+  ASSERT_EQ(limiter.tryAccept(&unknown, 0), true);
+  ASSERT_EQ(limiter.size(), 2u);
+}
@@ -24,8 +24,15 @@
 
 #include "gtest/gtest.h"
 #include "Common.h"
+#include "Utils.h"
 #include "BitcoinUtils.h"
 
+#include <glog/logging.h>
+
+#include <hash.h>
+#include <primitives/block.h>
+#include <script/script.h>
+
 
 ////////////////////////////////  Block Rewards  /////////////////////////////////
 TEST(BitcoinUtils, GetBlockSubsidy) {
@@ -93,3 +100,55 @@ TEST(BitcoinUtils, GetBlockSubsidy) {
   reward = GetBlockSubsidy(70000000, consensus);
   ASSERT_EQ(reward, 0);         // 0 satoshi
 }
+
+////////////////////////////////  Block Hex  /////////////////////////////////
+TEST(BitcoinUtils, EncodeHexBlock) {
+  // blocks of about 2 MB and 4 MB
+  for (const size_t blockSize : {2000000, 4000000}) {
+    CBlock block;
+    block.nVersion = 0x20000000;
+    block.nTime    = 1527811800;
+    block.nBits    = 0x17376f56;
+    block.nNonce   = 42;
+
+    // the first one is the coinbase tx
+    string txsHex;
+    size_t size = 0;
+    for (uint32_t i = 0; size < blockSize; i++) {
+      CMutableTransaction tx;
+      tx.vin.resize(1);
+      tx.vin[0].prevout = COutPoint(Hash(BEGIN(i), END(i)), i % 3);
+      tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(100 + i % 100, i & 0xff);
+      tx.vout.resize(1 + i % 2);
+      for (auto &out : tx.vout) {
+        out.scriptPubKey = CScript() << std::vector<unsigned char>(200 + i % 300, i >> 8);
+      }
+      block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+
+      const string txHex = EncodeHexTx(*block.vtx.back());
+      if (i > 0) {
+        txsHex += txHex;
+      }
+      size += txHex.size() / 2;
+    }
+    CDataStream ssCoinbase(SER_NETWORK, PROTOCOL_VERSION);
+    ssCoinbase << *block.vtx[0];
+    const vector<char> coinbaseTx(ssCoinbase.begin(), ssCoinbase.end());
+
+    const uint64_t t0 = getMonotonicTimeUs();
+    const string blockHex1 = EncodeHexBlock(block);
+    const uint64_t t1 = getMonotonicTimeUs();
+    const string blockHex2 = EncodeHexBlock(block, coinbaseTx,
+                                            block.vtx.size() - 1, txsHex);
+    const uint64_t t2 = getMonotonicTimeUs();
+    ASSERT_EQ(blockHex1, blockHex2);
+
+    CBlock block2;
+    ASSERT_EQ(DecodeHexBlk(block2, blockHex2), true);
+    ASSERT_EQ(block2.GetHash(), block.GetHash());
+    ASSERT_EQ(block2.vtx.size(), block.vtx.size());
+
+    LOG(INFO) << "block size: " << blockHex1.size() / 2 << ", txs: " << block.vtx.size()
+    << ", serialize block: " << (t1 - t0) << "us, from serialized txs: " << (t2 - t1) << "us";
+  }
+}
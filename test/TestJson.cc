@@ -0,0 +1,234 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include <glog/logging.h>
+
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "Utils.h"
+#include "utilities_js.hpp"
+
+#include <random>
+
+using Utilities::JS::type;
+
+TEST(JsonNode, StratumLine) {
+  const string line = "{\"id\": 4, \"method\": \"mining.submit\", \"params\": "
+  "[\"slush.miner1\", \"bf\", \"00000001\", \"504e86ed\", \"b2957c02\"]}\n";
+
+  JsonNode jnode;
+  ASSERT_TRUE(JsonNode::parse(line.data(), line.data() + line.size(), jnode));
+  ASSERT_EQ(jnode.type(), type::Obj);
+  ASSERT_EQ(jnode["id"].type(), type::Int);
+  ASSERT_EQ(jnode["id"].int32(), 4);
+  ASSERT_EQ(jnode["method"].str(), "mining.submit");
+  ASSERT_EQ(jnode["nonexist"].type(), type::Undefined);
+
+  JsonNode jparams = jnode["params"];
+  ASSERT_EQ(jparams.type(), type::Array);
+  ASSERT_EQ(jparams.children()->size(), 5u);
+  ASSERT_EQ(jparams.children()->at(0).str(), "slush.miner1");
+  ASSERT_EQ(jparams.children()->at(1).uint32(), 0u);
+  ASSERT_EQ(jparams.children()->at(3).uint32_hex(), 0x504e86edu);
+  ASSERT_EQ(jparams.children()->at(4).uint64_hex(), 0xb2957c02u);
+}
+
+TEST(JsonNode, Values) {
+  const string s = "{\"a\":null,\"b\":true,\"c\":false,\"d\":-12,\"e\":1.5e3,"
+  "\"f\":\"x\\\"y\",\"g\":{},\"h\":[],\"i\":[{\"j\":[1,[2,3]]}],\"k\":\"{[,:]}\"}";
+
+  JsonNode r;
+  ASSERT_TRUE(JsonNode::parse(s.data(), s.data() + s.size(), r));
+  ASSERT_EQ(r["a"].type(), type::Null);
+  ASSERT_EQ(r["b"].type(), type::Bool);
+  ASSERT_EQ(r["b"].boolean(), true);
+  ASSERT_EQ(r["c"].boolean(), false);
+  ASSERT_EQ(r["d"].type(), type::Int);
+  ASSERT_EQ(r["d"].int64(), -12);
+  ASSERT_EQ(r["e"].type(), type::Real);
+  ASSERT_EQ(r["e"].real(), 1500.0f);
+  ASSERT_EQ(r["f"].str(), "x\\\"y");  // escapes are kept as is
+  ASSERT_EQ(r["g"].type(), type::Obj);
+  ASSERT_EQ(r["g"].children()->size(), 0u);
+  ASSERT_EQ(r["h"].array().size(), 0u);
+  ASSERT_EQ(r["k"].str(), "{[,:]}");
+
+  JsonNode j = r["i"].array()[0]["j"];
+  ASSERT_EQ(j.array().size(), 2u);
+  ASSERT_EQ(j.array()[0].int32(), 1);
+  ASSERT_EQ(j.array()[1].array()[1].int32(), 3);
+  ASSERT_EQ(string(j.start(), j.end()), "[1,[2,3]]");
+
+  // keys are kept in the children
+  auto children = r.children();
+  ASSERT_EQ(children->size(), 10u);
+  ASSERT_EQ(string(children->at(5).key_start(), children->at(5).key_end()), "f");
+
+  // range-for over a temporary lookup stays valid
+  int sum = 0;
+  for (JsonNode &node : r["i"].array()[0]["j"].array()) {
+    sum += (node.type() == type::Int) ? node.int32() : 0;
+  }
+  ASSERT_EQ(sum, 1);
+
+  // root scalar, and bytes after the first value are ignored
+  JsonNode n;
+  const string t = "[1] garbage";
+  ASSERT_TRUE(JsonNode::parse(t.data(), t.data() + t.size(), n));
+  ASSERT_EQ(n.array().size(), 1u);
+  const string u = " 42\n";
+  ASSERT_TRUE(JsonNode::parse(u.data(), u.data() + u.size(), n));
+  ASSERT_EQ(n.int32(), 42);
+  const string v = "\"abc\"";
+  ASSERT_TRUE(JsonNode::parse(v.data(), v.data() + v.size(), n));
+  ASSERT_EQ(n.str(), "abc");
+}
+
+TEST(JsonNode, Invalid) {
+  const char *bad[] = {
+    "", "   ", "{", "[1,2", "{\"a\":1,}", "[1,]", "{\"a\" 1}", "{\"a\":}",
+    "{1:2}", "[1 2]", "{\"a\":1]", "[\"abc]", "[tru]", "[nul]", "[1x]",
+    "[-]", "[1.]", "[1e]", "[\"a\" \"b\"]", "abc", "}",
+  };
+  for (const char *s : bad) {
+    JsonNode r;
+    ASSERT_FALSE(JsonNode::parse(s, s + strlen(s), r)) << s;
+    ASSERT_EQ(r.type(), type::Undefined);
+  }
+}
+
+TEST(JsonNode, LargeObject) {
+  // more than kLinearLookupMax keys, looked up by binary search
+  string s = "{";
+  for (int i = 0; i < 1000; i++) {
+    s += Strings::Format("%s\"k%d\":%d", i ? "," : "", (i * 7919) % 1000, i);
+  }
+  s += "}";
+
+  JsonNode r;
+  ASSERT_TRUE(JsonNode::parse(s.data(), s.data() + s.size(), r));
+  for (int i = 0; i < 1000; i++) {
+    const string key = Strings::Format("k%d", (i * 7919) % 1000);
+    ASSERT_EQ(r[key.c_str()].int32(), i);
+  }
+  ASSERT_EQ(r["k1000"].type(), type::Undefined);
+}
+
+TEST(JsonNode, Escapes) {
+  // strings of quotes and backslashes that cross the 64-byte blocks,
+  // checked against a plain scan
+  std::mt19937 rng(20180601);
+  const char alphabet[] = {'\\', '\\', '"', 'a', ' ', ',', '{', ']'};
+
+  for (int round = 0; round < 2000; round++) {
+    string body;
+    const int len = rng() % 150;
+    for (int i = 0; i < len; i++) {
+      body += alphabet[rng() % sizeof(alphabet)];
+    }
+    // make it a valid string body: escape bare quotes, close odd runs
+    string str;
+    for (size_t i = 0; i < body.size(); i++) {
+      if (body[i] == '\\') {
+        str += '\\';
+        str += (i + 1 < body.size()) ? body[++i] : '\\';
+      } else if (body[i] == '"') {
+        str += "\\\"";
+      } else {
+        str += body[i];
+      }
+    }
+    const string pad(rng() % 64, ' ');
+    const string s = pad + "[\"" + str + "\", 1]";
+
+    const char *end = JsonNode::parse_string(s.data() + pad.size() + 2, s.data() + s.size());
+    JsonNode r;
+    ASSERT_TRUE(JsonNode::parse(s.data(), s.data() + s.size(), r)) << s;
+    ASSERT_EQ(r.array().size(), 2u) << s;
+    ASSERT_EQ(r.array()[0].end(), end) << s;
+    ASSERT_EQ(r.array()[0].str(), str) << s;
+    ASSERT_EQ(r.array()[1].int32(), 1) << s;
+  }
+}
+
+// benchmark, run by: unittest --gtest_also_run_disabled_tests --gtest_filter='*Benchmark'
+TEST(JsonNode, DISABLED_Benchmark) {
+  // a block template about 4 MB large
+  std::mt19937 rng(1);
+  string gbt = "{\"result\":{\"capabilities\":[\"proposal\"],\"version\":536870912,"
+  "\"rules\":[\"csv\",\"segwit\"],\"previousblockhash\":"
+  "\"0000000000000000002b4ba4a3d9ee1be6d66e9b4d0b2e07b1ab7fbc3e86ff1c\","
+  "\"transactions\":[";
+  int txCount = 0;
+  while (gbt.size() < 4 * 1024 * 1024) {
+    string data;
+    const int dataLen = 200 + rng() % 1000;
+    for (int i = 0; i < dataLen; i++) {
+      data += "0123456789abcdef"[rng() % 16];
+    }
+    gbt += Strings::Format("%s{\"data\":\"%s\",\"txid\":\"%064x\",\"hash\":\"%064x\","
+                           "\"depends\":[%d,%d],\"fee\":%d,\"sigops\":%d,\"weight\":%d}",
+                           txCount ? "," : "", data.c_str(), txCount, txCount,
+                           txCount / 2, txCount / 3, rng() % 100000, rng() % 20,
+                           dataLen * 2);
+    txCount++;
+  }
+  gbt += "],\"coinbasevalue\":1250000000,\"target\":"
+  "\"00000000000000000040ce000000000000000000000000000000000000000000\","
+  "\"mintime\":1527811200,\"curtime\":1527811800,\"bits\":\"17376f56\","
+  "\"height\":526000},\"error\":null,\"id\":1}";
+
+  const int kGbtRounds = 20;
+  uint64_t t0 = getMonotonicTimeUs();
+  size_t dataSize = 0;
+  for (int i = 0; i < kGbtRounds; i++) {
+    JsonNode r;
+    ASSERT_TRUE(JsonNode::parse(gbt.data(), gbt.data() + gbt.size(), r));
+    JsonNode jgbt = r["result"];
+    ASSERT_EQ(jgbt["height"].uint32(), 526000u);
+    for (JsonNode &node : jgbt["transactions"].array()) {
+      dataSize += node["data"].size();
+    }
+  }
+  uint64_t t1 = getMonotonicTimeUs();
+  ASSERT_GT(dataSize, 0u);
+
+  const string line = "{\"params\": [\"slush.miner1\", \"bf\", \"00000001\", "
+  "\"504e86ed\", \"b2957c02\"], \"id\": 4, \"method\": \"mining.submit\"}\n";
+  const int kLineRounds = 200000;
+  uint64_t t2 = getMonotonicTimeUs();
+  for (int i = 0; i < kLineRounds; i++) {
+    JsonNode jnode;
+    ASSERT_TRUE(JsonNode::parse(line.data(), line.data() + line.size(), jnode));
+    JsonNode jparams = jnode["params"];
+    ASSERT_EQ(jparams.children()->size(), 5u);
+    ASSERT_EQ(jnode["method"].size(), 13u);
+  }
+  uint64_t t3 = getMonotonicTimeUs();
+
+  LOG(INFO) << "gbt json size: " << gbt.size() << ", txs: " << txCount
+  << ", parse and read: " << (t1 - t0) / kGbtRounds << "us"
+  << ", " << (double)gbt.size() * kGbtRounds / (t1 - t0) << " MB/s";
+  LOG(INFO) << "stratum line size: " << line.size()
+  << ", parse and read: " << (t3 - t2) * 1000 / kLineRounds << "ns";
+}
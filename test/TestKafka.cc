@@ -0,0 +1,220 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include <glog/logging.h>
+
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "Utils.h"
+#include "Kafka.h"
+
+#include <errno.h>
+
+//
+// a producer with a fake local queue of maxQueue_ messages, _poll() delivers
+// the oldest one. when the queue is full _produce() fails with ENOBUFS, which
+// is what rd_kafka_produce() does.
+//
+class FakeQueueProducer : public KafkaProducer {
+public:
+  size_t maxQueue_;
+  vector<string> queue_;
+  vector<string> sent_;
+  int polls_;
+
+  FakeQueueProducer(size_t maxQueue):
+  KafkaProducer("127.0.0.1:9092", "TestTopic", 0), maxQueue_(maxQueue), polls_(0) {}
+
+  using KafkaProducer::spill;
+  using KafkaProducer::replaySpillFile;
+  using KafkaProducer::spilledNum;
+
+protected:
+  int _produce(const void *payload, size_t len) {
+    if (queue_.size() >= maxQueue_) {
+      errno = ENOBUFS;
+      return -1;
+    }
+    queue_.push_back(string((const char *)payload, len));
+    return 0;
+  }
+
+  void _poll(int timeoutMs) {
+    polls_++;
+    if (!queue_.empty()) {
+      sent_.push_back(queue_.front());
+      queue_.erase(queue_.begin());
+    }
+  }
+};
+
+static string readFile(const string &path) {
+  string data;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == nullptr) {
+    return data;
+  }
+  char buf[1024];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.append(buf, n);
+  }
+  fclose(f);
+  return data;
+}
+
+// [uint32_t len][payload]
+static string spillRecord(const string &payload) {
+  const uint32_t len = (uint32_t)payload.size();
+  return string((const char *)&len, sizeof(len)) + payload;
+}
+
+TEST(KafkaProducer, QueueFullPolicy) {
+  const string spillFile = Strings::Format("/tmp/test_kafka_spill_%d", (int)getpid());
+  unlink(spillFile.c_str());
+  unlink((spillFile + ".replay").c_str());
+
+  {
+    FakeQueueProducer p(1);
+    ASSERT_EQ(p.queueFullPolicy(), KafkaProducer::QUEUE_FULL_DROP);
+
+    p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_BLOCK);
+    ASSERT_EQ(p.queueFullPolicy(), KafkaProducer::QUEUE_FULL_BLOCK);
+
+    // spill without a file blocks instead
+    p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL);
+    ASSERT_EQ(p.queueFullPolicy(), KafkaProducer::QUEUE_FULL_BLOCK);
+
+    p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL, spillFile);
+    ASSERT_EQ(p.queueFullPolicy(), KafkaProducer::QUEUE_FULL_SPILL);
+    ASSERT_EQ(p.spilledNum(), 0u);
+  }
+
+  // a spill file or a replay file left by the last run is re-produced
+  const string leftovers[] = {spillFile, spillFile + ".replay"};
+  for (const string &leftover : leftovers) {
+    FILE *f = fopen(leftover.c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    fclose(f);
+
+    FakeQueueProducer p(1);
+    p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL, spillFile);
+    ASSERT_EQ(p.spilledNum(), 1u);
+
+    // only the spill policy looks for it
+    FakeQueueProducer p2(1);
+    p2.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_BLOCK, spillFile);
+    ASSERT_EQ(p2.spilledNum(), 0u);
+
+    unlink(leftover.c_str());
+  }
+}
+
+TEST(KafkaProducer, QueueFullDrop) {
+  FakeQueueProducer p(1);
+  p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_DROP);
+
+  ASSERT_EQ(p.produce("a", 1), true);
+  ASSERT_EQ(p.produce("b", 1), false);
+  ASSERT_EQ(p.produce("c", 1), false);
+  ASSERT_EQ(p.dropped(), 2u);
+  ASSERT_EQ(p.polls_, 0);
+  ASSERT_EQ(p.queue_, vector<string>({"a"}));
+}
+
+TEST(KafkaProducer, QueueFullBlock) {
+  FakeQueueProducer p(2);
+  p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_BLOCK);
+
+  ASSERT_EQ(p.produce("a", 1), true);
+  ASSERT_EQ(p.produce("b", 1), true);
+  ASSERT_EQ(p.polls_, 0);
+
+  // polls until a message is delivered, nothing is lost
+  ASSERT_EQ(p.produce("c", 1), true);
+  ASSERT_EQ(p.polls_, 1);
+  ASSERT_EQ(p.produce("d", 1), true);
+  ASSERT_EQ(p.polls_, 2);
+
+  ASSERT_EQ(p.dropped(), 0u);
+  ASSERT_EQ(p.spilled(), 0u);
+  ASSERT_EQ(p.sent_,  vector<string>({"a", "b"}));
+  ASSERT_EQ(p.queue_, vector<string>({"c", "d"}));
+}
+
+TEST(KafkaProducer, QueueFullSpill) {
+  const string spillFile  = Strings::Format("/tmp/test_kafka_spill_%d", (int)getpid());
+  const string replayFile = spillFile + ".replay";
+  unlink(spillFile.c_str());
+  unlink(replayFile.c_str());
+
+  FakeQueueProducer p(1);
+  p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL, spillFile);
+
+  ASSERT_EQ(p.produce("a", 1), true);
+  ASSERT_EQ(p.produce("bb", 2), true);
+  ASSERT_EQ(p.produce("ccc", 3), true);
+  ASSERT_EQ(p.dropped(), 0u);
+  ASSERT_EQ(p.spilled(), 2u);
+  ASSERT_EQ(p.spilledNum(), 2u);
+  ASSERT_EQ(p.polls_, 0);
+  ASSERT_EQ(p.queue_, vector<string>({"a"}));
+  ASSERT_EQ(readFile(spillFile), spillRecord("bb") + spillRecord("ccc"));
+
+  // the queue is still full, the replay puts them back to the spill file
+  p.replaySpillFile();
+  ASSERT_EQ(fileExists(replayFile.c_str()), false);
+  ASSERT_EQ(readFile(spillFile), spillRecord("bb") + spillRecord("ccc"));
+  ASSERT_EQ(p.spilledNum(), 2u);
+  ASSERT_EQ(p.queue_, vector<string>({"a"}));
+
+  // room for them now
+  p.maxQueue_ = 10;
+  p.replaySpillFile();
+  ASSERT_EQ(fileExists(spillFile.c_str()),  false);
+  ASSERT_EQ(fileExists(replayFile.c_str()), false);
+  ASSERT_EQ(p.spilledNum(), 0u);
+  ASSERT_EQ(p.queue_, vector<string>({"a", "bb", "ccc"}));
+}
+
+TEST(KafkaProducer, ReplayLeftFile) {
+  const string spillFile  = Strings::Format("/tmp/test_kafka_spill_%d", (int)getpid());
+  const string replayFile = spillFile + ".replay";
+  unlink(spillFile.c_str());
+
+  // a replay file interrupted by the last run, the truncated record is skipped
+  const string data = spillRecord("x") + spillRecord("yy") + spillRecord("zzz").substr(0, 6);
+  FILE *f = fopen(replayFile.c_str(), "wb");
+  ASSERT_TRUE(f != nullptr);
+  ASSERT_EQ(fwrite(data.data(), 1, data.size(), f), data.size());
+  fclose(f);
+
+  FakeQueueProducer p(10);
+  p.setQueueFullPolicy(KafkaProducer::QUEUE_FULL_SPILL, spillFile);
+  ASSERT_EQ(p.spilledNum(), 1u);
+
+  p.replaySpillFile();
+  ASSERT_EQ(fileExists(replayFile.c_str()), false);
+  ASSERT_EQ(fileExists(spillFile.c_str()),  false);
+  ASSERT_EQ(p.queue_, vector<string>({"x", "yy"}));
+}
@@ -0,0 +1,78 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "MySQLConnection.h"
+
+#include <fstream>
+
+TEST(MySQLConnection, DurableSqlQueue) {
+  const string file = "./TestMySQLConnection_retry.sql";
+  remove(file.c_str());
+
+  {
+    DurableSqlQueue q(file);
+    ASSERT_EQ(q.load(), true);  // no file
+    ASSERT_EQ(q.size(), 0u);
+
+    ASSERT_EQ(q.push("INSERT INTO `t` VALUES (1);"), true);
+    ASSERT_EQ(q.push("INSERT INTO `t`\n VALUES (2);"), true);
+    ASSERT_EQ(q.size(), 2u);
+  }
+
+  // one statement a line
+  {
+    std::ifstream f(file);
+    string line;
+    ASSERT_EQ((bool)std::getline(f, line), true);
+    ASSERT_EQ(line, "INSERT INTO `t` VALUES (1);");
+    ASSERT_EQ((bool)std::getline(f, line), true);
+    ASSERT_EQ(line, "INSERT INTO `t`  VALUES (2);");
+    ASSERT_EQ((bool)std::getline(f, line), false);
+  }
+
+  // left by the last run, kept if the DB is down
+  {
+    DurableSqlQueue q(file);
+    ASSERT_EQ(q.load(), true);
+    ASSERT_EQ(q.size(), 2u);
+
+    MySQLConnection db(MysqlConnectInfo("127.0.0.1", 1, "root", "root", "test"));
+    ASSERT_EQ(q.retry(db), 2u);
+  }
+
+  remove(file.c_str());
+}
+
+TEST(MySQLConnection, IsStatementError) {
+  // dropped by DurableSqlQueue::retry()
+  ASSERT_EQ(MySQLConnection::isStatementError(1062), true);  // Duplicate entry
+  ASSERT_EQ(MySQLConnection::isStatementError(1064), true);  // syntax error
+
+  // kept to retry
+  ASSERT_EQ(MySQLConnection::isStatementError(0), false);
+  ASSERT_EQ(MySQLConnection::isStatementError(1205), false);  // Lock wait timeout
+  ASSERT_EQ(MySQLConnection::isStatementError(2006), false);  // server has gone away
+  ASSERT_EQ(MySQLConnection::isStatementError(2013), false);  // Lost connection
+}
@@ -0,0 +1,130 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "PriorityExecutor.h"
+
+// counts down to 0, the waiters are woken up then
+class Latch {
+  mutex lock_;
+  Condition cond_;
+  size_t count_;
+
+public:
+  explicit Latch(size_t count): count_(count) {}
+
+  void countDown() {
+    ScopeLock sl(lock_);
+    if (count_ > 0 && --count_ == 0)
+      cond_.notify_all();
+  }
+  // returns false if it's not 0 in 10 seconds
+  bool wait() {
+    UniqueLock ul(lock_);
+    return cond_.wait_for(ul, std::chrono::seconds(10),
+                          [this] { return count_ == 0; });
+  }
+};
+
+TEST(PriorityExecutor, Priority) {
+  // one thread, so the tasks run one by one
+  PriorityExecutor executor(1, 0, 100);
+
+  mutex lock;
+  vector<string> done;
+  auto task = [&](const string &name) {
+    return [&, name](size_t threadIdx) {
+      ASSERT_EQ(threadIdx, 0u);
+      ScopeLock sl(lock);
+      done.push_back(name);
+    };
+  };
+
+  // not started
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW, task("low0")), false);
+
+  executor.start();
+  // block the thread until all tasks are queued
+  Latch started(1), queued(1);
+  auto waitTask = [&](size_t) { started.countDown(); queued.wait(); };
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW, waitTask), true);
+  ASSERT_EQ(started.wait(), true);
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW,  task("low1")),  true);
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_HIGH, task("high1")), true);
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW,  task("low2")),  true);
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_HIGH, task("high2")), true);
+  ASSERT_EQ(executor.queueSize(PriorityExecutor::PRIORITY_LOW),  2u);
+  ASSERT_EQ(executor.queueSize(PriorityExecutor::PRIORITY_HIGH), 2u);
+  queued.countDown();
+
+  // runs the queued tasks
+  executor.stop();
+  ASSERT_EQ(done, vector<string>({"high1", "high2", "low1", "low2"}));
+
+  // stopped
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_HIGH, task("high3")), false);
+}
+
+TEST(PriorityExecutor, HighOnlyThreads) {
+  // thread 0 only runs high priority tasks
+  PriorityExecutor executor(2, 1, 2);
+  ASSERT_EQ(executor.isLowPriorityThread(0), false);
+  ASSERT_EQ(executor.isLowPriorityThread(1), true);
+  executor.start();
+
+  // the low priority thread is busy, high priority tasks still run
+  Latch lowStarted(1), lowReleased(1);
+  atomic<size_t> lowThreadIdx(100);
+  auto lowTask = [&](size_t threadIdx) {
+    lowThreadIdx = threadIdx;
+    lowStarted.countDown();
+    lowReleased.wait();
+  };
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW, lowTask), true);
+  ASSERT_EQ(lowStarted.wait(), true);
+  ASSERT_EQ(lowThreadIdx, 1u);
+
+  // one at a time, the queue holds 2
+  for (int i = 0; i < 10; i++) {
+    Latch highDone(1);
+    atomic<size_t> highThreadIdx(100);
+    auto highTask = [&](size_t threadIdx) {
+      highThreadIdx = threadIdx;
+      highDone.countDown();
+    };
+    ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_HIGH, highTask), true);
+    ASSERT_EQ(highDone.wait(), true);
+    ASSERT_EQ(highThreadIdx, 0u);
+  }
+
+  // the low queue is full
+  auto emptyTask = [](size_t) {};
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW, emptyTask), true);
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW, emptyTask), true);
+  ASSERT_EQ(executor.post(PriorityExecutor::PRIORITY_LOW, emptyTask), false);
+
+  lowReleased.countDown();
+  executor.stop();
+  ASSERT_EQ(executor.queueSize(PriorityExecutor::PRIORITY_LOW), 0u);
+}
@@ -0,0 +1,279 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include <glog/logging.h>
+
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "Utils.h"
+#include "RpcClient.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+//
+// a HTTP/1.1 server on 127.0.0.1 with keep-alive, a thread per connection.
+// it answers every request with body_, or with 500 to the first failRequests_
+// requests.
+//
+class LocalHttpServer {
+  int listenFd_;
+  uint16_t port_;
+  atomic<bool> running_;
+  thread threadAccept_;
+
+  mutex lock_;
+  vector<int> connFds_;
+  vector<thread> threadConns_;
+
+  void runThreadAccept() {
+    while (running_) {
+      const int fd = accept(listenFd_, nullptr, nullptr);
+      if (fd == -1) {
+        break;
+      }
+      accepts_++;
+      ScopeLock sl(lock_);
+      connFds_.push_back(fd);
+      threadConns_.push_back(thread(&LocalHttpServer::runThreadConn, this, fd));
+    }
+  }
+
+  bool recvMore(int fd, string &buf) {
+    char tmp[4096];
+    const ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0) {
+      return false;
+    }
+    buf.append(tmp, n);
+    return true;
+  }
+
+  void runThreadConn(int fd) {
+    string buf;
+    while (running_) {
+      size_t headerEnd;
+      while ((headerEnd = buf.find("\r\n\r\n")) == string::npos) {
+        if (!recvMore(fd, buf)) {
+          return;
+        }
+      }
+      size_t contentLen = 0;
+      const size_t pos = buf.find("Content-Length: ");
+      if (pos != string::npos && pos < headerEnd) {
+        contentLen = strtoul(buf.c_str() + pos + 16, nullptr, 10);
+      }
+      const size_t requestLen = headerEnd + 4 + contentLen;
+      while (buf.size() < requestLen) {
+        if (!recvMore(fd, buf)) {
+          return;
+        }
+      }
+      buf.erase(0, requestLen);
+      requests_++;
+
+      if (delayMs_ > 0) {
+        usleep(delayMs_ * 1000);
+      }
+      int code = 200;
+      if (failRequests_ > 0) {
+        failRequests_--;
+        code = 500;
+      }
+      const string response = Strings::Format("HTTP/1.1 %d %s\r\n"
+                                              "Content-Type: application/json\r\n"
+                                              "Content-Length: %d\r\n\r\n%s",
+                                              code, code == 200 ? "OK" : "Error",
+                                              (int)body_.size(), body_.c_str());
+      // the client may have gone because of a timeout
+      if (send(fd, response.data(), response.size(), MSG_NOSIGNAL) == -1) {
+        return;
+      }
+    }
+  }
+
+public:
+  string body_;
+  atomic<int> accepts_;
+  atomic<int> requests_;
+  atomic<int> failRequests_;
+  atomic<int> delayMs_;
+
+  LocalHttpServer(): listenFd_(-1), port_(0), running_(false),
+  body_("{\"result\":1,\"error\":null,\"id\":\"1\"}"),
+  accepts_(0), requests_(0), failRequests_(0), delayMs_(0) {}
+
+  ~LocalHttpServer() {
+    stop();
+  }
+
+  bool start() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ == -1) {
+      return false;
+    }
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family      = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port        = 0;  // any port
+    socklen_t len = sizeof(sin);
+    if (bind(listenFd_, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+        listen(listenFd_, 16) == -1 ||
+        getsockname(listenFd_, (struct sockaddr *)&sin, &len) == -1) {
+      return false;
+    }
+    port_ = ntohs(sin.sin_port);
+
+    running_ = true;
+    threadAccept_ = thread(&LocalHttpServer::runThreadAccept, this);
+    return true;
+  }
+
+  void stop() {
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+    shutdown(listenFd_, SHUT_RDWR);
+    threadAccept_.join();
+    close(listenFd_);
+
+    for (int fd : connFds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    for (thread &t : threadConns_) {
+      t.join();
+    }
+    for (int fd : connFds_) {
+      close(fd);
+    }
+  }
+
+  string url() const {
+    return Strings::Format("http://127.0.0.1:%d", (int)port_);
+  }
+};
+
+static const string kRequest = "{\"id\":\"1\",\"method\":\"getblockcount\",\"params\":[]}";
+
+TEST(RpcClient, ReuseConnection) {
+  LocalHttpServer server;
+  ASSERT_EQ(server.start(), true);
+
+  RpcClient client(server.url(), "user:pass");
+  for (int i = 0; i < 5; i++) {
+    string response;
+    ASSERT_EQ(client.call(kRequest, response), true);
+    ASSERT_EQ(response, server.body_);
+  }
+  ASSERT_EQ(server.requests_, 5);
+  ASSERT_EQ(server.accepts_, 1);
+  ASSERT_EQ(client.idleConns(), 1u);
+
+  // a server error keeps the connection
+  server.failRequests_ = 1;
+  string response;
+  ASSERT_EQ(client.call(kRequest, response), false);
+  ASSERT_EQ(client.call(kRequest, response), true);
+  ASSERT_EQ(server.accepts_, 1);
+
+  // callAll() uses the idle connections as well
+  vector<RpcClient *> clients = {&client};
+  vector<bool> results;
+  vector<string> responses;
+  ASSERT_EQ(RpcClient::callAll(clients, kRequest, results, responses), 1u);
+  ASSERT_EQ(results, vector<bool>({true}));
+  ASSERT_EQ(responses, vector<string>({server.body_}));
+  ASSERT_EQ(server.accepts_, 1);
+
+  // warmUp() opens the connections it's asked for and they are kept. the
+  // server is slow, or the requests may go over one connection in turn.
+  server.delayMs_ = 50;
+  ASSERT_EQ(client.warmUp(3, kRequest), 3u);
+  ASSERT_EQ(server.accepts_, 3);
+  ASSERT_EQ(client.warmUp(3, kRequest), 3u);
+  ASSERT_EQ(server.accepts_, 3);
+  ASSERT_EQ(client.idleConns(), 3u);
+}
+
+TEST(RpcClient, Timeout) {
+  LocalHttpServer server;
+  ASSERT_EQ(server.start(), true);
+  server.delayMs_ = 500;
+
+  RpcClient client(server.url(), "");
+  string response;
+  const uint64_t begin = getMonotonicTimeUs();
+  ASSERT_EQ(client.call(kRequest, response, 100/* timeout ms */), false);
+  ASSERT_LT(getMonotonicTimeUs() - begin, 400 * 1000u);
+
+  // the connection which timed out is dropped
+  ASSERT_EQ(client.idleConns(), 0u);
+  server.delayMs_ = 0;
+  ASSERT_EQ(client.call(kRequest, response), true);
+  ASSERT_EQ(server.accepts_, 2);
+
+  // a timeout of callAll() fails the slow one only
+  LocalHttpServer slowServer;
+  ASSERT_EQ(slowServer.start(), true);
+  slowServer.delayMs_ = 500;
+  RpcClient slowClient(slowServer.url(), "");
+
+  vector<RpcClient *> clients = {&client, &slowClient};
+  vector<bool> results;
+  vector<string> responses;
+  ASSERT_EQ(RpcClient::callAll(clients, kRequest, results, responses, 100), 1u);
+  ASSERT_EQ(results, vector<bool>({true, false}));
+  ASSERT_EQ(responses[0], server.body_);
+}
+
+TEST(RpcClient, CallAllRetry) {
+  LocalHttpServer good, flaky, bad;
+  ASSERT_EQ(good.start(),  true);
+  ASSERT_EQ(flaky.start(), true);
+  ASSERT_EQ(bad.start(),   true);
+  flaky.failRequests_ = 1;
+  bad.failRequests_   = 100;
+
+  RpcClient goodClient(good.url(), ""), flakyClient(flaky.url(), ""),
+            badClient(bad.url(), "");
+  vector<RpcClient *> clients = {&goodClient, &flakyClient, &badClient};
+
+  vector<bool> results;
+  vector<string> responses;
+  ASSERT_EQ(RpcClient::callAllRetry(clients, kRequest, 3, results, responses), 2u);
+  ASSERT_EQ(results, vector<bool>({true, true, false}));
+  ASSERT_EQ(responses[0], good.body_);
+  ASSERT_EQ(responses[1], flaky.body_);
+
+  // a retry goes to the failed ones only
+  ASSERT_EQ(good.requests_,  1);
+  ASSERT_EQ(flaky.requests_, 2);
+  ASSERT_EQ(bad.requests_,   3);
+
+  // no retry if all succeeded
+  ASSERT_EQ(RpcClient::callAllRetry({&goodClient}, kRequest, 3, results, responses), 1u);
+  ASSERT_EQ(good.requests_, 2);
+}
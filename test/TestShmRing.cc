@@ -0,0 +1,186 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include <glog/logging.h>
+
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "Utils.h"
+#include "ShmRing.h"
+
+#include <fcntl.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+TEST(ShmRing, ReadWrite) {
+  const string name = Strings::Format("/btcpool_test_ring_%d", getpid());
+  ShmRing::unlink(name);
+
+  ShmRing writer, reader;
+  ASSERT_EQ(reader.openReader(name), false);  // not exist
+  ASSERT_EQ(writer.openWriter(name, 4, 64), true);
+  ASSERT_EQ(reader.openReader(name), true);
+
+  string data;
+  ASSERT_EQ(reader.read(data, 0), false);   // empty
+  ASSERT_EQ(reader.read(data, 10), false);  // timeout
+
+  ASSERT_EQ(writer.write("hello", 5), true);
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, "hello");
+  ASSERT_EQ(reader.read(data, 0), false);
+
+  // too large
+  ASSERT_EQ(writer.write(string(65, 'a').data(), 65), false);
+
+  // reader falls behind, skip to the oldest one
+  for (int i = 0; i < 10; i++) {
+    const string s = Strings::Format("msg%d", i);
+    ASSERT_EQ(writer.write(s.data(), s.size()), true);
+  }
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, "msg6");
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, "msg7");
+
+  // a new reader starts from the latest one
+  ShmRing reader2;
+  ASSERT_EQ(reader2.openReader(name), true);
+  ASSERT_EQ(reader2.read(data, 0), true);
+  ASSERT_EQ(data, "msg9");
+
+  // a restarted writer continues the sequence
+  writer.close();
+  ASSERT_EQ(writer.openWriter(name, 4, 64), true);
+  ASSERT_EQ(writer.write("again", 5), true);
+  ASSERT_EQ(reader2.read(data, 0), true);
+  ASSERT_EQ(data, "again");
+
+  ShmRing::unlink(name);
+}
+
+TEST(ShmRing, NewGeneration) {
+  const string name = Strings::Format("/btcpool_test_ring_gen_%d", getpid());
+  ShmRing::unlink(name);
+
+  ShmRing writer, reader;
+  ASSERT_EQ(writer.openWriter(name, 4, 64), true);
+  ASSERT_EQ(writer.write("old", 3), true);
+  ASSERT_EQ(reader.openReader(name), true);
+
+  string data;
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, "old");
+
+  // only one writer
+  ShmRing writer2;
+  ASSERT_EQ(writer2.openWriter(name, 4, 64), false);
+
+  // a writer with another size creates a new ring, the old one is removed
+  // but the reader still has it mapped
+  writer.close();
+  ASSERT_EQ(writer2.openWriter(name, 8, 128), true);
+  const string gen1 = name + ".1";
+  const int fd = shm_open(gen1.c_str(), O_RDONLY, 0644);
+  ASSERT_EQ(fd, -1);
+  ASSERT_EQ(reader.read(data, 0), false);
+
+  // the reader switches to the new ring and reads it from the beginning
+  ASSERT_EQ(writer2.write("new1", 4), true);
+  ASSERT_EQ(writer2.write(string(100, 'a').data(), 100), true);
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, "new1");
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, string(100, 'a'));
+  ASSERT_EQ(reader.read(data, 0), false);
+
+  // a waiting reader is woken up by the switch
+  thread t([&]() {
+    usleep(10000);
+    writer2.close();
+    ASSERT_EQ(writer2.openWriter(name, 4, 64), true);
+    ASSERT_EQ(writer2.write("new2", 4), true);
+  });
+  ASSERT_EQ(reader.read(data, 1000), true);
+  ASSERT_EQ(data, "new2");
+  t.join();
+
+  ShmRing::unlink(name);
+}
+
+TEST(ShmRing, ReplaceVersion1) {
+  const string name = Strings::Format("/btcpool_test_ring_v1_%d", getpid());
+  ShmRing::unlink(name);
+
+  // a ring of version 1 was the object itself
+  const int fd = shm_open(name.c_str(), O_CREAT|O_RDWR, 0644);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(ftruncate(fd, 4096), 0);
+  close(fd);
+
+  ShmRing writer, reader;
+  ASSERT_EQ(reader.openReader(name), false);
+  ASSERT_EQ(writer.openWriter(name, 4, 64), true);
+  ASSERT_EQ(writer.write("hello", 5), true);
+  ASSERT_EQ(reader.openReader(name), true);
+
+  string data;
+  ASSERT_EQ(reader.read(data, 0), true);
+  ASSERT_EQ(data, "hello");
+
+  ShmRing::unlink(name);
+}
+
+TEST(ShmRing, Wakeup) {
+  const string name = Strings::Format("/btcpool_test_ring_wakeup_%d", getpid());
+  ShmRing::unlink(name);
+
+  ShmRing writer, reader;
+  ASSERT_EQ(writer.openWriter(name, 16, 64), true);
+  ASSERT_EQ(reader.openReader(name), true);
+
+  const int kNum = 1000;
+  uint64_t totalLatency = 0;
+  int received = 0;
+  thread t([&]() {
+    string data;
+    while (received < kNum && reader.read(data, 1000)) {
+      uint64_t sendTime;
+      memcpy(&sendTime, data.data(), sizeof(sendTime));
+      totalLatency += getMonotonicTimeUs() - sendTime;
+      received++;
+    }
+  });
+
+  for (int i = 0; i < kNum; i++) {
+    const uint64_t now = getMonotonicTimeUs();
+    ASSERT_EQ(writer.write(&now, sizeof(now)), true);
+    usleep(100);
+  }
+  t.join();
+
+  ASSERT_EQ(received, kNum);
+  LOG(INFO) << "shm ring wakeup, avg latency: " << totalLatency / kNum << "us";
+
+  ShmRing::unlink(name);
+}
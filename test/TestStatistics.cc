@@ -25,6 +25,11 @@
 #include "gtest/gtest.h"
 #include "Common.h"
 #include "Statistics.h"
+#include "Utils.h"
+
+#include <glog/logging.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 
 ////////////////////////////////  StatsWindow  /////////////////////////////////
@@ -247,3 +252,871 @@ TEST(ShareStatsDay, ShareStatsDay) {
     #endif
   }
 }
+
+////////////////////////////////  StatsServer  ////////////////////////////////
+TEST(StatsServer, ParseWorkerUpdates) {
+  vector<StatsServer::WorkerUpdate> updates;
+  string s;
+
+  s = "{\"created_at\":\"2018-01-01 00:00:00\",\"type\":\"worker_update\","
+      "\"content\":{\"user_id\":1,\"worker_id\":-100,"
+      "\"worker_name\":\"s19.001\",\"miner_agent\":\"cgminer/4.10\"}}";
+  ASSERT_TRUE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  ASSERT_EQ(updates.size(), 1u);
+  ASSERT_EQ(updates[0].userId_, 1);
+  ASSERT_EQ(updates[0].workerId_, -100);
+  ASSERT_EQ(updates[0].workerName_, "s19.001");
+  ASSERT_EQ(updates[0].minerAgent_, "cgminer/4.10");
+
+  // a batch, the broken one is skipped
+  s = "{\"created_at\":\"2018-01-01 00:00:00\",\"type\":\"worker_update_batch\","
+      "\"content\":["
+      "{\"user_id\":1,\"worker_id\":100,\"worker_name\":\"w1\",\"miner_agent\":\"a\"},"
+      "{\"user_id\":1,\"worker_id\":101,\"worker_name\":\"w2\"},"
+      "{\"user_id\":2,\"worker_id\":102,\"worker_name\":\"w3\",\"miner_agent\":\"b\"}]}";
+  ASSERT_TRUE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  ASSERT_EQ(updates.size(), 2u);
+  ASSERT_EQ(updates[0].workerId_, 100);
+  ASSERT_EQ(updates[0].workerName_, "w1");
+  ASSERT_EQ(updates[1].userId_, 2);
+  ASSERT_EQ(updates[1].workerId_, 102);
+  ASSERT_EQ(updates[1].minerAgent_, "b");
+
+  s = "{\"type\":\"worker_update_batch\",\"content\":[]}";
+  ASSERT_TRUE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  ASSERT_EQ(updates.size(), 0u);
+
+  // not a worker update
+  s = "{\"type\":\"miner_connect\",\"content\":{}}";
+  ASSERT_TRUE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  ASSERT_EQ(updates.size(), 0u);
+
+  // broken
+  s = "{\"type\":\"worker_update_batch\",\"content\":{}}";
+  ASSERT_FALSE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  s = "{\"type\":\"worker_update\",\"content\":{\"user_id\":1}}";
+  ASSERT_FALSE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  s = "{\"content\":{}}";
+  ASSERT_FALSE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+  s = "{\"type\":";
+  ASSERT_FALSE(StatsServer::parseWorkerUpdates(s.c_str(), s.size(), updates));
+}
+
+////////////////////////////  ShareLogFileWriter  /////////////////////////////
+// the sharelog dir of a test, removed with its files after it
+class ShareLogDirTest : public ::testing::Test {
+protected:
+  string dataDir_;
+  uint32_t day_;
+  string filePath_;          // of day_
+  MysqlConnectInfo dbInfo_;  // never connected
+
+  ShareLogDirTest():
+  dataDir_("./TestStatistics_sharelog"), day_(1500000000 - (1500000000 % 86400)),
+  filePath_(getStatsFilePath(dataDir_, day_)),
+  dbInfo_("127.0.0.1", 3306, "root", "root", "test")
+  {
+  }
+
+  virtual void SetUp() {
+    removeDataDir();
+    mkdir(dataDir_.c_str(), 0755);
+  }
+  virtual void TearDown() {
+    removeDataDir();
+  }
+
+  void removeDataDir() {
+    DIR *dir = opendir(dataDir_.c_str());
+    if (dir == nullptr)
+      return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.')
+        remove((dataDir_ + "/" + entry->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(dataDir_.c_str());
+  }
+};
+
+TEST_F(ShareLogDirTest, WriteFile) {
+  const uint32_t day1 = day_;
+  const uint32_t day2 = day_ + 86400;
+
+  vector<Share> shares;
+  for (uint32_t i = 0; i < 1000; i++) {
+    Share share;
+    share.jobId_     = i;
+    share.share_     = 1000 + i;
+    share.timestamp_ = (i % 10 == 9) ? day2 + i : day1 + i;  // some of day 2
+    share.result_    = Share::ACCEPT;
+    shares.push_back(share);
+  }
+
+  {
+    ShareLogFileWriter writer(dataDir_, true);
+    for (size_t i = 0; i < 500; i++) {
+      ASSERT_EQ(writer.addShare(shares[i]), true);
+    }
+    ASSERT_EQ(writer.pendingBytes(), 500 * sizeof(Share));
+    ASSERT_EQ(writer.commit(), true);
+    ASSERT_EQ(writer.pendingBytes(), 0u);
+
+    // the size is the size of the shares, not the preallocated one
+    struct stat st;
+    ASSERT_EQ(stat(getStatsFilePath(dataDir_, day1).c_str(), &st), 0);
+    ASSERT_EQ((size_t)st.st_size, 450 * sizeof(Share));
+
+    // the rest is written when it's closed
+    for (size_t i = 500; i < shares.size(); i++) {
+      ASSERT_EQ(writer.addShare(shares[i]), true);
+    }
+  }
+
+  // appended by a new writer
+  {
+    ShareLogFileWriter writer(dataDir_, false);
+    ASSERT_EQ(writer.addShare(shares[0]), true);
+    ASSERT_EQ(writer.commit(), true);
+  }
+
+  for (const uint32_t day : {day1, day2}) {
+    vector<Share> expected;
+    for (const auto &share : shares) {
+      if (share.timestamp_ - (share.timestamp_ % 86400) == day)
+        expected.push_back(share);
+    }
+    if (day == day1)
+      expected.push_back(shares[0]);
+
+    FILE *f = fopen(getStatsFilePath(dataDir_, day).c_str(), "rb");
+    ASSERT_NE(f, nullptr);
+    vector<Share> read(expected.size() + 1);
+    ASSERT_EQ(fread(read.data(), sizeof(Share), read.size(), f), expected.size());
+    fclose(f);
+
+    for (size_t i = 0; i < expected.size(); i++) {
+      ASSERT_EQ(read[i].jobId_,     expected[i].jobId_);
+      ASSERT_EQ(read[i].share_,     expected[i].share_);
+      ASSERT_EQ(read[i].timestamp_, expected[i].timestamp_);
+    }
+  }
+}
+
+TEST_F(ShareLogDirTest, WriteTornShare) {
+  vector<Share> shares;
+  for (uint32_t i = 0; i < 11; i++) {
+    Share share;
+    share.jobId_     = i;
+    share.share_     = 1000 + i;
+    share.timestamp_ = day_ + i;
+    share.result_    = Share::ACCEPT;
+    shares.push_back(share);
+  }
+
+  // a v1 file ending with the torn share of a crashed writer
+  FILE *f = fopen(filePath_.c_str(), "wb");
+  ASSERT_TRUE(f != nullptr);
+  fwrite(shares.data(), sizeof(Share), 10, f);
+  fwrite(&shares[10], 1, sizeof(Share) / 2, f);
+  fclose(f);
+
+  // dropped, the share appended by a new writer stays aligned
+  {
+    ShareLogFileWriter writer(dataDir_, false);
+    ASSERT_EQ(writer.addShare(shares[10]), true);
+    ASSERT_EQ(writer.commit(), true);
+  }
+
+  struct stat st;
+  ASSERT_EQ(stat(filePath_.c_str(), &st), 0);
+  ASSERT_EQ((size_t)st.st_size, shares.size() * sizeof(Share));
+
+  f = fopen(filePath_.c_str(), "rb");
+  ASSERT_TRUE(f != nullptr);
+  vector<Share> read(shares.size());
+  ASSERT_EQ(fread(read.data(), sizeof(Share), read.size(), f), shares.size());
+  fclose(f);
+
+  for (size_t i = 0; i < shares.size(); i++) {
+    ASSERT_EQ(read[i].jobId_,     shares[i].jobId_);
+    ASSERT_EQ(read[i].share_,     shares[i].share_);
+    ASSERT_EQ(read[i].timestamp_, shares[i].timestamp_);
+  }
+}
+
+TEST_F(ShareLogDirTest, WriteInvalidFile) {
+  Share share;
+  share.share_     = 1000;
+  share.timestamp_ = day_;
+  share.result_    = Share::ACCEPT;
+  {
+    ShareLogFileWriter writer(dataDir_, false, 2);
+    ASSERT_EQ(writer.addShare(share), true);
+    ASSERT_EQ(writer.commit(), true);
+  }
+  struct stat st;
+  ASSERT_EQ(stat(filePath_.c_str(), &st), 0);
+  const uint64_t goodSize = st.st_size;
+
+  // a broken block after the good ones
+  ShareLogV2::BlockHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic_ = 0xdeadbeef;
+  FILE *f = fopen(filePath_.c_str(), "ab");
+  ASSERT_TRUE(f != nullptr);
+  fwrite(&header, 1, sizeof(header), f);
+  fclose(f);
+
+  // cut off and copied aside, the share is appended after the good blocks
+  share.share_ = 2000;
+  {
+    ShareLogFileWriter writer(dataDir_, false, 2);
+    ASSERT_EQ(writer.addShare(share), true);
+    ASSERT_EQ(writer.commit(), true);
+  }
+
+  ShareLogReader reader(filePath_);
+  vector<Share> read;
+  ASSERT_EQ(reader.read(read, 10), 2);
+  ASSERT_EQ(read[0].share_, 1000u);
+  ASSERT_EQ(read[1].share_, 2000u);
+
+  vector<string> tailFiles;
+  DIR *dir = opendir(dataDir_.c_str());
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (strstr(entry->d_name, ".tail.") != nullptr)
+      tailFiles.push_back(dataDir_ + "/" + entry->d_name);
+  }
+  closedir(dir);
+  ASSERT_EQ(tailFiles.size(), 1u);
+  ASSERT_EQ(stat(tailFiles[0].c_str(), &st), 0);
+  ASSERT_EQ((size_t)st.st_size, sizeof(header));
+
+  // the file isn't renamed
+  ASSERT_EQ(stat(filePath_.c_str(), &st), 0);
+  ASSERT_GT((uint64_t)st.st_size, goodSize);
+}
+
+// benchmark, run by: unittest --gtest_also_run_disabled_tests --gtest_filter='*Benchmark'
+TEST_F(ShareLogDirTest, DISABLED_WriteBenchmark) {
+  // 2M shares, committed every 100k shares
+  const size_t kShares = 2000000;
+  const size_t kCommitShares = 100000;
+  Share share;
+  share.share_     = 1000;
+  share.timestamp_ = day_;
+  share.result_    = Share::ACCEPT;
+
+  // fwrite() a share and fflush() every commit, as ShareLogWriter did
+  {
+    LatencyHistogram flushLatency;
+    FILE *f = fopen(filePath_.c_str(), "ab");
+    ASSERT_NE(f, nullptr);
+    const uint64_t startUs = getMonotonicTimeUs();
+    for (size_t i = 0; i < kShares; i++) {
+      fwrite((uint8_t *)&share, sizeof(Share), 1, f);
+      if ((i + 1) % kCommitShares == 0) {
+        const uint64_t flushStartUs = getMonotonicTimeUs();
+        fflush(f);
+        flushLatency.add(getMonotonicTimeUs() - flushStartUs);
+      }
+    }
+    const uint64_t usedUs = getMonotonicTimeUs() - startUs;
+    fclose(f);
+    LOG(INFO) << "fwrite: " << kShares * 1000000 / std::max<uint64_t>(usedUs, 1)
+    << " shares/s, flush: " << flushLatency.toString();
+  }
+
+  for (const bool isFsync : {false, true}) {
+    remove(filePath_.c_str());
+    ShareLogFileWriter writer(dataDir_, isFsync);
+    const uint64_t startUs = getMonotonicTimeUs();
+    for (size_t i = 0; i < kShares; i++) {
+      writer.addShare(share);
+      if ((i + 1) % kCommitShares == 0) {
+        ASSERT_EQ(writer.commit(), true);
+      }
+    }
+    const uint64_t usedUs = getMonotonicTimeUs() - startUs;
+    LOG(INFO) << "ShareLogFileWriter" << (isFsync ? " with fsync: " : ": ")
+    << kShares * 1000000 / std::max<uint64_t>(usedUs, 1) << " shares/s, "
+    << writer.toString();
+  }
+
+}
+
+
+////////////////////////////////  ShareLogV2  /////////////////////////////////
+static void makeShares(uint32_t day, size_t num, vector<Share> &shares) {
+  // like a pool: 5000 users of 10 workers, a new job every 30 seconds
+  shares.resize(num);
+  uint64_t r = 1;
+  for (size_t i = 0; i < num; i++) {
+    r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+    Share &s = shares[i];
+    s.timestamp_    = day + (uint32_t)(i * 86400 / num);
+    s.jobId_        = ((uint64_t)(s.timestamp_ / 30 * 30) << 32) + (r >> 62);
+    s.userId_       = (int32_t)((r >> 33) % 5000) + 1;
+    s.workerHashId_ = (int64_t)(s.userId_ * 1000003LL + (r >> 20) % 10);
+    s.ip_           = 0x0a000000u + (uint32_t)s.userId_;
+    s.share_        = 1ULL << (10 + s.userId_ % 8);
+    s.blkBits_      = 0x1800b0edu;
+    s.result_       = ((r >> 16) % 100 == 0) ? Share::REJECT : Share::ACCEPT;
+  }
+}
+
+static bool isSameShare(const Share &a, const Share &b) {
+  return a.jobId_ == b.jobId_ && a.workerHashId_ == b.workerHashId_ &&
+         a.ip_ == b.ip_ && a.userId_ == b.userId_ && a.share_ == b.share_ &&
+         a.timestamp_ == b.timestamp_ && a.blkBits_ == b.blkBits_ &&
+         a.result_ == b.result_;
+}
+
+TEST(ShareLogV2, EncodeDecode) {
+  vector<Share> shares;
+  makeShares(1500000000, 10000, shares);
+
+  string buf;
+  ShareLogV2::encodeBlock(shares.data(), shares.size(), buf);
+  ASSERT_LT(buf.size(), shares.size() * sizeof(Share) / 2);
+
+  ShareLogV2::BlockHeader header;
+  memcpy(&header, buf.data(), sizeof(header));
+  const uint8_t *payload = (const uint8_t *)buf.data() + sizeof(header);
+  ASSERT_EQ(header.count_, shares.size());
+  ASSERT_EQ(header.size_, buf.size() - sizeof(header));
+  ASSERT_EQ(header.checksum_, ShareLogV2::checksum(payload, header.size_));
+  ASSERT_EQ(header.minTimestamp_, shares.front().timestamp_);
+  ASSERT_EQ(header.maxTimestamp_, shares.back().timestamp_);
+
+  vector<Share> decoded;
+  ASSERT_EQ(ShareLogV2::decodeBlock(header, payload, decoded), true);
+  ASSERT_EQ(decoded.size(), shares.size());
+  for (size_t i = 0; i < shares.size(); i++) {
+    ASSERT_EQ(isSameShare(decoded[i], shares[i]), true);
+    ASSERT_EQ(ShareLogV2::mayHaveUser(header, shares[i].userId_), true);
+  }
+
+  // the shares of a user only
+  std::set<int32_t> uids = {shares[0].userId_};
+  decoded.clear();
+  ASSERT_EQ(ShareLogV2::decodeBlock(header, payload, decoded, &uids), true);
+  ASSERT_GT(decoded.size(), 0u);
+  for (const auto &share : decoded) {
+    ASSERT_EQ(share.userId_, shares[0].userId_);
+  }
+  uids = {99999};
+  decoded.clear();
+  ASSERT_EQ(ShareLogV2::decodeBlock(header, payload, decoded, &uids), true);
+  ASSERT_EQ(decoded.size(), 0u);
+
+  // a short block only has a few users
+  vector<Share> one(shares.begin(), shares.begin() + 1);
+  buf.clear();
+  ShareLogV2::encodeBlock(one.data(), one.size(), buf);
+  memcpy(&header, buf.data(), sizeof(header));
+  size_t hits = 0;
+  for (int32_t uid = 1; uid <= 5000; uid++) {
+    if (ShareLogV2::mayHaveUser(header, uid))
+      hits++;
+  }
+  ASSERT_LT(hits, 10u);
+
+  // corrupted
+  header.size_--;
+  decoded.clear();
+  ASSERT_EQ(ShareLogV2::decodeBlock(header, (const uint8_t *)buf.data() + sizeof(header), decoded), false);
+  ASSERT_EQ(decoded.size(), 0u);
+}
+
+TEST_F(ShareLogDirTest, ReadGrowingFile) {
+  vector<Share> shares;
+  makeShares(day_, 1000, shares);
+  vector<Share> read;
+
+  ShareLogReader reader(filePath_);
+  {
+    ShareLogFileWriter writer(dataDir_, true, 2);
+    for (size_t i = 0; i < 600; i++) {
+      ASSERT_EQ(writer.addShare(shares[i]), true);
+    }
+    ASSERT_EQ(writer.commit(), true);
+
+    ASSERT_EQ(reader.read(read, 1000), 600);
+    ASSERT_EQ(reader.version(), 2);
+    ASSERT_EQ(reader.isReachEOF(), true);
+    for (size_t i = 0; i < read.size(); i++) {
+      ASSERT_EQ(isSameShare(read[i], shares[i]), true);
+    }
+
+    // two blocks, the second one is read after it's complete
+    for (size_t i = 600; i < shares.size(); i++) {
+      ASSERT_EQ(writer.addShare(shares[i]), true);
+      if (i == 799) {
+        ASSERT_EQ(writer.commit(), true);
+      }
+    }
+  }
+
+  // the rest, then the index and the trailer which have no share
+  ASSERT_EQ(reader.read(read, 1000), 400);
+  ASSERT_EQ(isSameShare(read[0], shares[600]), true);
+  ASSERT_EQ(reader.read(read, 1000), 0);
+  ASSERT_EQ(reader.isReachEOF(), true);
+
+  // appended by the next writer
+  {
+    ShareLogFileWriter writer(dataDir_, true, 1);  // in the format of the file
+    ASSERT_EQ(writer.addShare(shares[0]), true);
+  }
+  ASSERT_EQ(reader.read(read, 1000), 1);
+  ASSERT_EQ(isSameShare(read[0], shares[0]), true);
+
+  // an incomplete block at the end
+  string block;
+  ShareLogV2::encodeBlock(shares.data(), 10, block);
+  FILE *f = fopen(filePath_.c_str(), "ab");
+  ASSERT_NE(f, nullptr);
+  fwrite(block.data(), 1, block.size() - 1, f);
+  fflush(f);
+  ASSERT_EQ(reader.read(read, 1000), 0);
+  ASSERT_EQ(reader.isReachEOF(), false);
+  fwrite(block.data() + block.size() - 1, 1, 1, f);
+  fclose(f);
+  ASSERT_EQ(reader.read(read, 1000), 10);
+  ASSERT_EQ(reader.isReachEOF(), true);
+
+  // a new reader of the closed file uses the index, a crashed writer's
+  // incomplete block is dropped by the next writer
+  f = fopen(filePath_.c_str(), "ab");
+  fwrite(block.data(), 1, block.size() / 2, f);
+  fclose(f);
+  Share other = shares[1];
+  other.userId_ = 99999;
+  {
+    ShareLogFileWriter writer(dataDir_, true, 2);
+    ASSERT_EQ(writer.addShare(other), true);
+  }
+  ShareLogReader reader2(filePath_);
+  ASSERT_EQ(reader2.read(read, 10000), 1000 + 1 + 10 + 1);
+  ASSERT_EQ(isSameShare(read.back(), other), true);
+  ASSERT_EQ(reader2.isReachEOF(), true);
+
+  // only the user's shares, the blocks without the user are skipped
+  ShareLogReader reader3(filePath_);
+  std::set<int32_t> uids = {other.userId_};
+  ASSERT_EQ(reader3.read(read, 10000, &uids), 1);
+  ASSERT_EQ(isSameShare(read[0], other), true);
+  ASSERT_GT(reader3.skippedBlocks(), 0u);
+  ASSERT_EQ(reader3.read(read, 10000, &uids), 0);
+
+}
+
+TEST_F(ShareLogDirTest, WatchFile) {
+  ShareLogWatcher watcher(dataDir_);
+  ASSERT_EQ(watcher.init(), true);
+  ASSERT_EQ(watcher.wait(0), 0);
+
+  // created
+  FILE *f = fopen(filePath_.c_str(), "ab");
+  ASSERT_TRUE(f != nullptr);
+  ASSERT_EQ(watcher.wait(1000), ShareLogWatcher::kFileCreated_);
+
+  // appended, every write is seen once
+  const char data[] = "0123456789";
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_EQ(fwrite(data, 1, sizeof(data), f), sizeof(data));
+    fflush(f);
+  }
+  ASSERT_EQ(watcher.wait(1000), ShareLogWatcher::kFileModified_);
+
+  // nothing new, timeout
+  const uint64_t startUs = getMonotonicTimeUs();
+  ASSERT_EQ(watcher.wait(100), 0);
+  ASSERT_GE(getMonotonicTimeUs() - startUs, 90000u);
+
+  fclose(f);
+}
+
+TEST_F(ShareLogDirTest, DISABLED_ReadBenchmark) {
+  // 4M shares of a day, committed every 20k shares (~ 2s of a large pool)
+  const size_t kShares = 4000000;
+  const size_t kCommitShares = 20000;
+  vector<Share> shares;
+  makeShares(day_, kShares, shares);
+
+  for (const int version : {1, 2}) {
+    remove(filePath_.c_str());
+    uint64_t startUs = getMonotonicTimeUs();
+    {
+      ShareLogFileWriter writer(dataDir_, false, version);
+      for (size_t i = 0; i < kShares; i++) {
+        writer.addShare(shares[i]);
+        if ((i + 1) % kCommitShares == 0) {
+          ASSERT_EQ(writer.commit(), true);
+        }
+      }
+    }
+    const uint64_t writeUs = getMonotonicTimeUs() - startUs;
+
+    struct stat st;
+    ASSERT_EQ(stat(filePath_.c_str(), &st), 0);
+
+    // as ShareLogParser::processUnchangedShareLog()
+    startUs = getMonotonicTimeUs();
+    size_t readNum = 0;
+    {
+      ShareLogReader reader(filePath_);
+      vector<Share> read;
+      int64_t n;
+      while ((n = reader.read(read, 2000000)) > 0) {
+        readNum += n;
+      }
+    }
+    const uint64_t readUs = getMonotonicTimeUs() - startUs;
+    ASSERT_EQ(readNum, kShares);
+
+    LOG(INFO) << "sharelog v" << version << ": " << st.st_size / 1024 << " KB ("
+    << Strings::Format("%.1f", st.st_size * 1.0 / kShares) << " bytes/share), write: "
+    << kShares * 1000000 / std::max<uint64_t>(writeUs, 1) << " shares/s, parse: "
+    << kShares * 1000000 / std::max<uint64_t>(readUs, 1) << " shares/s";
+
+    // as ShareLogDumper::dump2stdout(), an active user and an inactive one
+    for (const int32_t uid : {42, 99999}) {
+      startUs = getMonotonicTimeUs();
+      size_t userShares = 0;
+      ShareLogReader reader(filePath_);
+      std::set<int32_t> uids = {uid};
+      vector<Share> read;
+      int64_t n;
+      while ((n = reader.read(read, 2000000, &uids)) > 0) {
+        userShares += n;
+      }
+      LOG(INFO) << "sharelog v" << version << " dump uid " << uid << ": "
+      << (getMonotonicTimeUs() - startUs) / 1000 << " ms, shares: " << userShares
+      << ", skipped blocks: " << reader.skippedBlocks();
+    }
+  }
+
+}
+
+
+///////////////////////////////  ShareLogParser  ///////////////////////////////
+TEST_F(ShareLogDirTest, ParseUnchangedShareLog) {
+  vector<Share> shares;
+  makeShares(day_, 200000, shares);
+
+  // expected accept shares of a worker, a user and the pool
+  const WorkerKey wkey(shares[0].userId_, shares[0].workerHashId_);
+  const WorkerKey ukey(shares[0].userId_, 0);
+  const WorkerKey pkey(0, 0);
+  uint64_t workerAccept = 0, userAccept = 0, poolAccept = 0, poolReject = 0;
+  for (const auto &share : shares) {
+    if (share.result_ != Share::ACCEPT) {
+      poolReject += share.share_;
+      continue;
+    }
+    poolAccept += share.share_;
+    if (share.userId_ == wkey.userId_) {
+      userAccept += share.share_;
+      if (share.workerHashId_ == wkey.workerId_)
+        workerAccept += share.share_;
+    }
+  }
+
+  for (const int version : {1, 2}) {
+    remove(filePath_.c_str());
+    {
+      ShareLogFileWriter writer(dataDir_, false, version);
+      for (size_t i = 0; i < shares.size(); i++) {
+        writer.addShare(shares[i]);
+        if ((i + 1) % 20000 == 0) {
+          ASSERT_EQ(writer.commit(), true);
+        }
+      }
+    }
+
+    // 50k workers, merged in stages by the threads which see more than 4096
+    for (const uint32_t threadNum : {1u, 3u, 64u}) {
+      ShareLogParser parser(dataDir_, day_, dbInfo_);
+      ASSERT_EQ(parser.processUnchangedShareLog(threadNum, threadNum * 4096), true);
+
+      ShareStats stats;
+      parser.getShareStatsDayHandler(wkey)->getShareStatsDay(&stats);
+      ASSERT_EQ(stats.shareAccept_, workerAccept);
+      parser.getShareStatsDayHandler(ukey)->getShareStatsDay(&stats);
+      ASSERT_EQ(stats.shareAccept_, userAccept);
+      parser.getShareStatsDayHandler(pkey)->getShareStatsDay(&stats);
+      ASSERT_EQ(stats.shareAccept_, poolAccept);
+      ASSERT_EQ(stats.shareReject_, poolReject);
+
+      ShareStats hour;
+      parser.getShareStatsDayHandler(pkey)->getShareStatsHour(23, &hour);
+      ASSERT_GT(hour.shareAccept_, 0u);
+      ASSERT_LT(hour.shareAccept_, stats.shareAccept_);
+    }
+  }
+
+}
+
+TEST_F(ShareLogDirTest, DISABLED_ParseBenchmark) {
+  // 10M shares, a day of a large pool has ~1000M. the time scales with
+  // the shares, and the threads up to the cores and the disk bandwidth
+  const size_t kShares = 10000000;
+  const size_t kChunkShares = 1000000;
+  vector<Share> shares;
+  makeShares(day_, kChunkShares, shares);
+
+  for (const int version : {1, 2}) {
+    // one thread, the parser reads every 10k shares the writer appends
+    {
+      remove(filePath_.c_str());
+      ShareLogParser parser(dataDir_, day_, dbInfo_);
+      uint64_t usedUs = 0;
+      {
+        ShareLogFileWriter writer(dataDir_, false, version);
+        for (size_t i = 0; i < kChunkShares; i += 10000) {
+          for (size_t j = i; j < i + 10000; j++) {
+            writer.addShare(shares[j]);
+          }
+          ASSERT_EQ(writer.commit(), true);
+          const uint64_t startUs = getMonotonicTimeUs();
+          ASSERT_EQ(parser.processGrowingShareLog(), 10000);
+          usedUs += getMonotonicTimeUs() - startUs;
+        }
+      }
+      const uint64_t startUs = getMonotonicTimeUs();
+      parser.mergeGrowingShares();
+      usedUs += getMonotonicTimeUs() - startUs;
+      LOG(INFO) << "sharelog v" << version << " processGrowingShareLog, 10k shares a read: "
+      << kChunkShares * 1000000 / std::max<uint64_t>(usedUs, 1) << " shares/s";
+    }
+
+    remove(filePath_.c_str());
+    {
+      ShareLogFileWriter writer(dataDir_, false, version);
+      for (size_t i = 0; i < kShares; i++) {
+        writer.addShare(shares[i % kChunkShares]);
+        if ((i + 1) % 20000 == 0) {
+          ASSERT_EQ(writer.commit(), true);
+        }
+      }
+    }
+
+    // one thread, up to 1M shares a batch
+    {
+      ShareLogParser parser(dataDir_, day_, dbInfo_);
+      const uint64_t startUs = getMonotonicTimeUs();
+      size_t readNum = 0;
+      int64_t n;
+      while ((n = parser.processGrowingShareLog()) > 0) {
+        readNum += n;
+      }
+      const uint64_t usedUs = getMonotonicTimeUs() - startUs;
+      ASSERT_EQ(readNum, kShares);
+      LOG(INFO) << "sharelog v" << version << " processGrowingShareLog: "
+      << kShares * 1000000 / std::max<uint64_t>(usedUs, 1) << " shares/s";
+    }
+
+    const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (const uint32_t threadNum : {1u, 2u, 4u, cores}) {
+      ShareLogParser parser(dataDir_, day_, dbInfo_);
+      const uint64_t startUs = getMonotonicTimeUs();
+      ASSERT_EQ(parser.processUnchangedShareLog(threadNum), true);
+      const uint64_t usedUs = getMonotonicTimeUs() - startUs;
+      LOG(INFO) << "sharelog v" << version << " processUnchangedShareLog, threads: "
+      << threadNum << ", cores: " << cores << ": "
+      << kShares * 1000000 / std::max<uint64_t>(usedUs, 1) << " shares/s";
+    }
+  }
+
+}
+
+TEST_F(ShareLogDirTest, ParseGrowingShareLog) {
+  // 200k shares of 50k workers, the parser reads every 10k shares appended
+  const size_t kShares = 200000;
+  const size_t kReadShares = 10000;
+  vector<Share> shares;
+  makeShares(day_, kShares, shares);
+
+  ShareLogParser parser(dataDir_, day_, dbInfo_);
+  {
+    ShareLogFileWriter writer(dataDir_, false, 1);
+    for (size_t i = 0; i < kShares; i += kReadShares) {
+      for (size_t j = i; j < i + kReadShares; j++) {
+        writer.addShare(shares[j]);
+      }
+      ASSERT_EQ(writer.commit(), true);
+      ASSERT_EQ(parser.processGrowingShareLog(), (int64_t)kReadShares);
+    }
+  }
+  ASSERT_EQ(parser.isReachEOF(), true);
+  parser.mergeGrowingShares();
+
+  // expected stats of the workers, the users and the pool
+  std::unordered_map<WorkerKey, shared_ptr<ShareStatsDay>> expected;
+  for (const auto &share : shares) {
+    if (!share.isValid())
+      continue;
+    const uint32_t hourIdx = (share.timestamp_ % 86400) / 3600;
+    for (const WorkerKey &key : {WorkerKey(share.userId_, share.workerHashId_),
+                                 WorkerKey(share.userId_, 0), WorkerKey(0, 0)}) {
+      if (expected.find(key) == expected.end()) {
+        expected[key] = std::make_shared<ShareStatsDay>();
+      }
+      expected[key]->processShare(hourIdx, share);
+    }
+  }
+
+  for (const auto &itr : expected) {
+    const ShareStatsDay &e = *itr.second;
+    shared_ptr<ShareStatsDay> stats = parser.getShareStatsDayHandler(itr.first);
+    ASSERT_TRUE(stats != nullptr);
+    ASSERT_EQ(stats->shareAccept1d_, e.shareAccept1d_);
+    ASSERT_EQ(stats->shareReject1d_, e.shareReject1d_);
+    // summed up in another order
+    ASSERT_NEAR(stats->score1d_, e.score1d_, e.score1d_ * 1e-12);
+    for (uint32_t i = 0; i < 24; i++) {
+      ASSERT_EQ(stats->shareAccept1h_[i], e.shareAccept1h_[i]);
+      ASSERT_EQ(stats->shareReject1h_[i], e.shareReject1h_[i]);
+      ASSERT_NEAR(stats->score1h_[i], e.score1h_[i], e.score1h_[i] * 1e-12);
+    }
+    ASSERT_EQ(stats->modifyHoursFlag_, e.modifyHoursFlag_);
+  }
+}
+
+
+////////////////////////////////  ShareLogBatchParser  ////////////////////////////////
+// records the stats of the pool instead of flushing them to DB
+class ShareLogBatchParserNoDB : public ShareLogBatchParser {
+protected:
+  bool flushDay(ShareLogParser &slparser, time_t day, bool removeExpiredData) {
+    ShareStats stats;
+    slparser.getShareStatsDayHandler(WorkerKey(0, 0))->getShareStatsDay(&stats);
+
+    ScopeLock sl(lock_);
+    poolAccept_[day] = stats.shareAccept_;
+    if (removeExpiredData)
+      removeExpiredDays_.push_back(day);
+    return true;
+  }
+
+public:
+  mutex lock_;
+  std::map<time_t, uint64_t> poolAccept_;
+  vector<time_t> removeExpiredDays_;
+
+  ShareLogBatchParserNoDB(const string &dataDir, const MysqlConnectInfo &dbInfo)
+  : ShareLogBatchParser(dataDir, dbInfo, 2, 1) {}
+};
+
+TEST_F(ShareLogDirTest, BatchParserRun) {
+  // 3 days of 10k shares
+  std::map<time_t, uint64_t> poolAccept;
+  {
+    ShareLogFileWriter writer(dataDir_, false, 2);
+    for (uint32_t i = 0; i < 3; i++) {
+      const uint32_t day = day_ + i * 86400;
+      vector<Share> shares;
+      makeShares(day, 10000, shares);
+      for (const auto &share : shares) {
+        writer.addShare(share);
+        if (share.result_ == Share::ACCEPT)
+          poolAccept[day] += share.share_;
+      }
+      ASSERT_EQ(writer.commit(), true);
+    }
+  }
+
+  // a time of the day is the day
+  ShareLogBatchParserNoDB parser(dataDir_, dbInfo_);
+  ASSERT_EQ(parser.run(day_ + 3600, day_ + 2 * 86400 + 7200), true);
+  ASSERT_EQ(parser.poolAccept_ == poolAccept, true);
+  // once a run, by the last day
+  ASSERT_EQ(parser.removeExpiredDays_.size(), 1u);
+  ASSERT_EQ(parser.removeExpiredDays_[0], (time_t)day_ + 2 * 86400);
+
+  // the days of a range ending before it begins
+  ShareLogBatchParserNoDB parser2(dataDir_, dbInfo_);
+  ASSERT_EQ(parser2.run(day_ + 86400, day_), false);
+  ASSERT_EQ(parser2.poolAccept_.size(), 0u);
+
+  // a missing day fails the run, the other days are still parsed
+  const string missingFile = getStatsFilePath(dataDir_, day_ + 86400);
+  remove(missingFile.c_str());
+  ShareLogBatchParserNoDB parser3(dataDir_, dbInfo_);
+  ASSERT_EQ(parser3.run(day_, day_ + 2 * 86400), false);
+  ASSERT_EQ(parser3.poolAccept_.size(), 2u);
+  ASSERT_EQ(parser3.poolAccept_[day_], poolAccept[day_]);
+  ASSERT_EQ(parser3.poolAccept_[day_ + 2 * 86400], poolAccept[day_ + 2 * 86400]);
+  // and it's not created
+  struct stat st;
+  ASSERT_NE(stat(missingFile.c_str(), &st), 0);
+}
+
+TEST(ShareLogParser, MakePartitionsPlan) {
+  const time_t now = 1508328000;  // 2017-10-18 12:00:00 UTC
+  typedef std::pair<string, string> Row;
+
+  // by day, the expired ones are dropped and the next days are created
+  {
+    PartitionsPlan plan;
+    makePartitionsPlan({Row("p20171016", "20171017"), Row("p20171017", "20171018"),
+                        Row("p20171018", "20171019"), Row("pmax", "MAXVALUE")},
+                       false, now, "20171018", 3, &plan);
+    ASSERT_EQ(plan.maxPartition_, "pmax");
+    ASSERT_EQ(plan.createPartitions_,
+              "PARTITION `p20171019` VALUES LESS THAN (20171020),"
+              "PARTITION `p20171020` VALUES LESS THAN (20171021),"
+              "PARTITION `p20171021` VALUES LESS THAN (20171022)");
+    ASSERT_EQ(plan.dropPartitions_.size(), 2u);
+    ASSERT_EQ(plan.dropPartitions_[0], "p20171016");
+    ASSERT_EQ(plan.dropPartitions_[1], "p20171017");
+  }
+
+  // by hour, the bounds are YYYYMMDD00
+  {
+    PartitionsPlan plan;
+    makePartitionsPlan({Row("p20171017", "2017101800"), Row("p20171018", "2017101900"),
+                        Row("p20171019", "2017102000"), Row("pmax", "MAXVALUE")},
+                       true, now, "2017101812", 2, &plan);
+    ASSERT_EQ(plan.createPartitions_,
+              "PARTITION `p20171020` VALUES LESS THAN (2017102100)");
+    // p20171018 has the rows of 2017101812 ~ 2017101823
+    ASSERT_EQ(plan.dropPartitions_.size(), 1u);
+    ASSERT_EQ(plan.dropPartitions_[0], "p20171017");
+
+    PartitionsPlan plan2;
+    makePartitionsPlan({Row("p20171018", "2017101900"), Row("pmax", "MAXVALUE")},
+                       true, now, "2017101900", 0, &plan2);
+    ASSERT_EQ(plan2.createPartitions_, "");
+    ASSERT_EQ(plan2.dropPartitions_.size(), 1u);
+    ASSERT_EQ(plan2.dropPartitions_[0], "p20171018");
+  }
+
+  // the days cross a month, no max partition
+  {
+    PartitionsPlan plan;
+    makePartitionsPlan({Row("p20171030", "2017103100")},
+                       true, 1509490800 /* 2017-10-31 23:00:00 UTC */, "2017102823",
+                       1, &plan);
+    ASSERT_EQ(plan.maxPartition_, "");
+    ASSERT_EQ(plan.createPartitions_,
+              "PARTITION `p20171031` VALUES LESS THAN (2017110100),"
+              "PARTITION `p20171101` VALUES LESS THAN (2017110200)");
+    ASSERT_EQ(plan.dropPartitions_.size(), 0u);
+  }
+
+  // a table keeps one partition at least
+  {
+    PartitionsPlan plan;
+    makePartitionsPlan({Row("p20171030", "20171031"), Row("p20171031", "20171101")},
+                       false, now, "20171101", 3, &plan);
+    ASSERT_EQ(plan.createPartitions_, "");
+    ASSERT_EQ(plan.dropPartitions_.size(), 1u);
+    ASSERT_EQ(plan.dropPartitions_[0], "p20171030");
+  }
+}
@@ -27,6 +27,7 @@
 #include "Utils.h"
 #include "BitcoinUtils.h"
 #include "Stratum.h"
+#include "GbtMaker.h"
 
 #include <chainparams.h>
 #include <hash.h>
@@ -259,7 +260,385 @@ TEST(Stratum, StratumJob) {
     ASSERT_EQ(sjob2.minTime_,  1469001544U);
     ASSERT_EQ(sjob2.coinbaseValue_, 312659655);
     ASSERT_GE(time(nullptr), jobId2Time(sjob2.jobId_));
+
+    // the txid in gbt is used as is, decoding the tx gives the same one
+    StratumJob sjob3;
+    res = sjob3.initFromGbt(gbt.c_str(), poolCoinbaseInfo, poolPayoutAddrTestnet, blockVersion, "", RskWork(), 1, false, true);
+    ASSERT_EQ(res, true);
+    ASSERT_EQ(sjob3.merkleBranch_, sjob2.merkleBranch_);
+
+    ASSERT_EQ(StratumJob::verifyGbtTxids(gbt.data(), gbt.size()), true);
+    string badGbt = gbt;
+    badGbt.replace(badGbt.find("\"bd36bd4f") + 1, 8, "00000000");
+    ASSERT_EQ(StratumJob::verifyGbtTxids(badGbt.data(), badGbt.size()), false);
+  }
+}
+
+TEST(Stratum, StratumJobMerkleBranch) {
+  // enough txs to hash the lower levels with several threads
+  for (const size_t txCount : {1000, 1024, 1025}) {
+    vector<uint256> txids;
+    string gbt = "{\"result\":{\"transactions\":[";
+    for (size_t i = 0; i < txCount; i++) {
+      txids.push_back(Hash(BEGIN(i), END(i)));
+      gbt += Strings::Format("%s{\"data\":\"00\",\"txid\":\"%s\"}",
+                             i ? "," : "", txids.back().ToString().c_str());
+    }
+    gbt += "],\"previousblockhash\":\"000000004f2ea239532b2e77bb46c03b86643caac3fe92959a31fd2d03979c34\","
+    "\"version\":536870912,\"bits\":\"1a018ae2\",\"curtime\":1469006933,"
+    "\"mintime\":1469001544,\"coinbasevalue\":312659655,\"height\":898487}}";
+
+    // steps of the branch, serially
+    vector<uint256> steps;
+    vector<uint256> hashs = txids;
+    while (hashs.size() > 1) {
+      steps.push_back(hashs[0]);
+      if (hashs.size() % 2 == 0) {
+        hashs.push_back(hashs.back());
+      }
+      for (size_t i = 0; i < (hashs.size() - 1) / 2; i++) {
+        hashs[i] = Hash(BEGIN(hashs[i*2 + 1]), END(hashs[i*2 + 1]),
+                        BEGIN(hashs[i*2 + 2]), END(hashs[i*2 + 2]));
+      }
+      hashs.resize((hashs.size() - 1) / 2);
+    }
+    steps.push_back(hashs[0]);
+
+    SelectParams(CBaseChainParams::TESTNET);
+    CTxDestination poolPayoutAddrTestnet = DecodeDestination("myxopLJB19oFtNBdrAxD5Z34Aw6P8o9P8U");
+    StratumJob sjob;
+    ASSERT_EQ(sjob.initFromGbt(gbt.c_str(), "/BTC.COM/", poolPayoutAddrTestnet, 0, "", RskWork(), 1, false), true);
+    ASSERT_EQ(sjob.merkleBranch_, steps);
+  }
+}
+
+TEST(Stratum, GbtTemplateIncrementalMerkle) {
+  auto makeGbt = [](const vector<uint256> &txids) {
+    string gbt = "{\"result\":{\"transactions\":[";
+    for (size_t i = 0; i < txids.size(); i++) {
+      gbt += Strings::Format("%s{\"data\":\"00\",\"txid\":\"%s\"}",
+                             i ? "," : "", txids[i].ToString().c_str());
+    }
+    gbt += "],\"previousblockhash\":\"000000004f2ea239532b2e77bb46c03b86643caac3fe92959a31fd2d03979c34\","
+    "\"version\":536870912,\"bits\":\"1a018ae2\",\"curtime\":1469006933,"
+    "\"mintime\":1469001544,\"coinbasevalue\":312659655,\"height\":898487}}";
+    return gbt;
+  };
+
+  vector<uint256> txids;
+  for (size_t i = 0; i < 1000; i++) {
+    txids.push_back(Hash(BEGIN(i), END(i)));
+  }
+  GbtTemplate first;
+  ASSERT_EQ(first.initFromGbt(makeGbt(txids).c_str(), false, nullptr), true);
+  ASSERT_EQ(first.txCount(), 1000u);
+  ASSERT_EQ(first.reusedTxCount_, 0u);
+
+  // txs appended, removed from the tail, replaced in the middle
+  vector<vector<uint256> > nexts(4, txids);
+  for (size_t i = 1000; i < 1300; i++) {
+    nexts[0].push_back(Hash(BEGIN(i), END(i)));
+  }
+  nexts[1].push_back(nexts[0].back());
+  nexts[2].resize(700);
+  nexts[3][500] = nexts[0].back();
+  const size_t reused[] = {1000, 1000, 700, 500};
+
+  for (size_t k = 0; k < nexts.size(); k++) {
+    const string gbt = makeGbt(nexts[k]);
+    GbtTemplate next, fresh;
+    ASSERT_EQ(next.initFromGbt(gbt.c_str(), false, &first), true);
+    ASSERT_EQ(fresh.initFromGbt(gbt.c_str(), false, nullptr), true);
+    ASSERT_EQ(next.reusedTxCount_, reused[k]);
+    ASSERT_EQ(next.merkleBranch_, fresh.merkleBranch_);
+    ASSERT_EQ(next.merkleLevels_, fresh.merkleLevels_);
+  }
+}
+
+TEST(Stratum, CompactRawGbt) {
+  // txs [first, first + count)
+  auto makeGbt = [](size_t first, size_t count) {
+    string gbt = "{\"result\":{\"transactions\":[";
+    for (size_t i = first; i < first + count; i++) {
+      gbt += Strings::Format("%s{\"data\":\"0100%08x\",\"txid\":\"%s\",\"fee\":%u}",
+                             i > first ? "," : "", (uint32_t)i,
+                             Hash(BEGIN(i), END(i)).ToString().c_str(), (uint32_t)i);
+    }
+    gbt += "],\"previousblockhash\":\"000000004f2ea239532b2e77bb46c03b86643caac3fe92959a31fd2d03979c34\","
+    "\"version\":536870912,\"bits\":\"1a018ae2\",\"curtime\":1469006933,"
+    "\"mintime\":1469001544,\"coinbasevalue\":312659655,\"height\":898487},"
+    "\"error\":null,\"id\":\"1\"}";
+    return gbt;
+  };
+  RawGbtEncoder encoder;
+  auto encode = [&encoder](const string &gbt, string &msg) {
+    JsonNode r;
+    ASSERT_EQ(JsonNode::parse(gbt.c_str(), gbt.c_str() + gbt.length(), r), true);
+    JsonNode jgbt = r["result"];
+    ASSERT_EQ(encoder.encode(gbt, jgbt, Hash(gbt.begin(), gbt.end()), 1469006933, msg), true);
+  };
+  // the rebuilt gbt has the same txs, and the hash of the original gbt
+  auto checkGbt = [](const string &gbt, const CompactGbt &cgbt, bool hasData) {
+    JsonNode r1, r2;
+    const string rebuilt = cgbt.toGbt();
+    ASSERT_EQ(JsonNode::parse(gbt.c_str(), gbt.c_str() + gbt.length(), r1), true);
+    ASSERT_EQ(JsonNode::parse(rebuilt.c_str(), rebuilt.c_str() + rebuilt.length(), r2), true);
+    ASSERT_EQ(r2["gbthash"].str(), Hash(gbt.begin(), gbt.end()).ToString());
+    ASSERT_EQ(r2["id"].str(), "1");
+    ASSERT_EQ(r2["result"]["height"].uint32(), 898487u);
+    vector<JsonNode> &txs1 = r1["result"]["transactions"].array();
+    vector<JsonNode> &txs2 = r2["result"]["transactions"].array();
+    ASSERT_EQ(txs1.size(), txs2.size());
+    for (size_t i = 0; i < txs1.size(); i++) {
+      ASSERT_EQ(txs1[i]["txid"].str(), txs2[i]["txid"].str());
+      if (hasData) {
+        ASSERT_EQ(txs1[i]["data"].str(), txs2[i]["data"].str());
+      } else {
+        ASSERT_EQ(txs2[i]["data"].type(), Utilities::JS::type::Undefined);
+      }
+    }
+
+    GbtTemplate tpl1, tpl2;
+    ASSERT_EQ(tpl1.initFromGbt(gbt.c_str(), false, nullptr), true);
+    ASSERT_EQ(tpl2.initFromGbt(rebuilt.c_str(), false, nullptr), true);
+    ASSERT_EQ(tpl1.gbtHash_, tpl2.gbtHash_);
+    ASSERT_EQ(tpl1.merkleBranch_, tpl2.merkleBranch_);
+  };
+
+  RawGbtDecoder decoder(true), txidDecoder(false);
+  CompactGbt cgbt;
+  string msg;
+
+  // the first message has all txs
+  const string gbt1 = makeGbt(0, 100);
+  encode(gbt1, msg);
+  ASSERT_EQ(decoder.decode(msg.data(), msg.size(), cgbt), true);
+  ASSERT_EQ(cgbt.isFull_, true);
+  checkGbt(gbt1, cgbt, true);
+  ASSERT_EQ(decoder.txCount(), 100u);
+
+  // then only the new txs, half of them were sent
+  const string gbt2 = makeGbt(50, 100);
+  string msg2;
+  encode(gbt2, msg2);
+  ASSERT_EQ(CompactGbt::isCompactFormat(msg2.data(), msg2.size()), true);
+  ASSERT_LT(msg2.size(), msg.size());
+  ASSERT_EQ(decoder.decode(msg2.data(), msg2.size(), cgbt), true);
+  ASSERT_EQ(cgbt.isFull_, false);
+  checkGbt(gbt2, cgbt, true);
+  ASSERT_EQ(decoder.txCount(), 150u);
+
+  // a decoder starting from here misses the referenced txs, unless it
+  // only needs the txids
+  RawGbtDecoder lateDecoder(true);
+  ASSERT_EQ(lateDecoder.decode(msg2.data(), msg2.size(), cgbt), false);
+  ASSERT_EQ(txidDecoder.decode(msg2.data(), msg2.size(), cgbt), true);
+  checkGbt(gbt2, cgbt, false);
+
+  // until the next full message
+  for (uint32_t i = 2; i < RawGbtEncoder::kFullInterval_; i++) {
+    encode(gbt2, msg);
+    ASSERT_EQ(lateDecoder.decode(msg.data(), msg.size(), cgbt), false);
+  }
+  encode(gbt2, msg);
+  ASSERT_EQ(lateDecoder.decode(msg.data(), msg.size(), cgbt), true);
+  ASSERT_EQ(cgbt.isFull_, true);
+  checkGbt(gbt2, cgbt, true);
+
+  // the txs of a dropped message are sent again by the next one
+  const string gbt3 = makeGbt(120, 100);
+  encode(gbt3, msg);
+  encoder.forceFull();
+  encode(gbt3, msg);
+  ASSERT_EQ(decoder.decode(msg.data(), msg.size(), cgbt), true);
+  ASSERT_EQ(cgbt.isFull_, true);
+  checkGbt(gbt3, cgbt, true);
+  ASSERT_EQ(decoder.txCount(), 220u);
+
+  // broken messages
+  ASSERT_EQ(decoder.decode(msg.data(), msg.size() - 1, cgbt), false);
+  ASSERT_EQ(decoder.decode(msg.data(), 10, cgbt), false);
+  ASSERT_EQ(CompactGbt::isCompactFormat("{\"created_at_ts\":1}", 18), false);
+}
+
+TEST(GbtMaker, EmptyGbt) {
+  SelectParams(CBaseChainParams::MAIN);
+  const string blockHash = "00000000000000000024fb37364cbf81fd49cc2d51c09c75c35433c3a1945d04";
+  auto makeHeader = [](int32_t height) {
+    return Strings::Format("{\"result\":{\"hash\":\"00000000000000000024fb37364cbf81fd49cc2d51c09c75c35433c3a1945d04\","
+                           "\"height\":%d,\"version\":536870912,\"time\":1513622125,"
+                           "\"mediantime\":1513620262,\"bits\":\"18009645\"},"
+                           "\"error\":null,\"id\":\"1\"}", height);
+  };
+
+  // on the block 500000
+  {
+    const string gbt = GbtMaker::makeEmptyGbt(blockHash, makeHeader(500000),
+                                              0x20000000u, 1513622200u);
+    JsonNode r;
+    ASSERT_EQ(JsonNode::parse(gbt.c_str(), gbt.c_str() + gbt.length(), r), true);
+    JsonNode jgbt = r["result"];
+    ASSERT_EQ(jgbt["previousblockhash"].str(), blockHash);
+    ASSERT_EQ(jgbt["height"].uint32(), 500001u);
+    ASSERT_EQ(jgbt["coinbasevalue"].int64(), 1250000000);  // 12.5 BTC
+    ASSERT_EQ(jgbt["bits"].str(), "18009645");
+    ASSERT_EQ(jgbt["mintime"].uint32(), 1513620263u);  // the median time past + 1
+    ASSERT_EQ(jgbt["curtime"].uint32(), 1513622200u);
+    ASSERT_EQ(jgbt["version"].uint32(), 0x20000000u);
+    ASSERT_EQ(jgbt["transactions"].type(), Utilities::JS::type::Array);
+    ASSERT_EQ(jgbt["transactions"].array().size(), 0u);
+
+    GbtTemplate tpl;
+    ASSERT_EQ(tpl.initFromGbt(gbt.c_str(), false, nullptr), true);
+    ASSERT_EQ(tpl.height_, 500001);
+    ASSERT_EQ(tpl.nBits_, 0x18009645u);
+    ASSERT_EQ(tpl.coinbaseValue_, 1250000000);
+  }
+
+  // the subsidy is halved, and the time is not before the mintime
+  {
+    const string gbt = GbtMaker::makeEmptyGbt(blockHash, makeHeader(629999),
+                                              0x20000000u, 1513620000u);
+    JsonNode r;
+    ASSERT_EQ(JsonNode::parse(gbt.c_str(), gbt.c_str() + gbt.length(), r), true);
+    ASSERT_EQ(r["result"]["height"].uint32(), 630000u);
+    ASSERT_EQ(r["result"]["coinbasevalue"].int64(), 625000000);
+    ASSERT_EQ(r["result"]["curtime"].uint32(), 1513620263u);
   }
+
+  // the bits are adjusted
+  ASSERT_EQ(GbtMaker::makeEmptyGbt(blockHash, makeHeader(503999), 0x20000000u, 1513622200u), "");
+  // broken response
+  ASSERT_EQ(GbtMaker::makeEmptyGbt(blockHash, "{\"result\":null,\"error\":{\"code\":-5}}",
+                                   0x20000000u, 1513622200u), "");
+
+  // the min difficulty blocks of testnet
+  SelectParams(CBaseChainParams::TESTNET);
+  ASSERT_EQ(GbtMaker::makeEmptyGbt(blockHash, makeHeader(500000), 0x20000000u, 1513622200u), "");
+}
+
+// the job of a testnet gbt with one tx
+static bool initBinaryTestJob(StratumJob &sjob) {
+  const string poolCoinbaseInfo = "/BTC.COM/";
+  string gbt;
+  gbt += "{\"result\":{";
+  gbt += "  \"capabilities\": [";
+  gbt += "    \"proposal\"";
+  gbt += "  ],";
+  gbt += "  \"version\": 536870912,";
+  gbt += "  \"previousblockhash\": \"000000004f2ea239532b2e77bb46c03b86643caac3fe92959a31fd2d03979c34\",";
+  gbt += "  \"transactions\": [";
+  gbt += "    {";
+  gbt += "      \"data\": \"01000000010291939c5ae8191c2e7d4ce8eba7d6616a66482e3200037cb8b8c2d0af45b445000000006a47304402204df709d9e149804e358de4b082e41d8bb21b3c9d347241b728b1362aafcb153602200d06d9b6f2eca899f43dcd62ec2efb2d9ce2e10adf02738bb908420d7db93ede012103cae98ab925e20dd6ae1f76e767e9e99bc47b3844095c68600af9c775104fb36cffffffff0290f1770b000000001976a91400dc5fd62f6ee48eb8ecda749eaec6824a780fdd88aca08601000000000017a914eb65573e5dd52d3d950396ccbe1a47daf8f400338700000000\",";
+  gbt += "      \"hash\": \"bd36bd4fff574b573152e7d4f64adf2bb1c9ab0080a12f8544c351f65aca79ff\",";
+  gbt += "      \"depends\": [";
+  gbt += "      ],";
+  gbt += "      \"fee\": 10000,";
+  gbt += "      \"sigops\": 1";
+  gbt += "    }";
+  gbt += "  ],";
+  gbt += "  \"coinbaseaux\": {";
+  gbt += "    \"flags\": \"\"";
+  gbt += "  },";
+  gbt += "  \"coinbasevalue\": 312659655,";
+  gbt += "  \"longpollid\": \"000000004f2ea239532b2e77bb46c03b86643caac3fe92959a31fd2d03979c341911\",";
+  gbt += "  \"target\": \"000000000000018ae20000000000000000000000000000000000000000000000\",";
+  gbt += "  \"mintime\": 1469001544,";
+  gbt += "  \"mutable\": [";
+  gbt += "    \"time\",";
+  gbt += "    \"transactions\",";
+  gbt += "    \"prevblock\"";
+  gbt += "  ],";
+  gbt += "  \"noncerange\": \"00000000ffffffff\",";
+  gbt += "  \"sigoplimit\": 20000,";
+  gbt += "  \"sizelimit\": 1000000,";
+  gbt += "  \"curtime\": 1469006933,";
+  gbt += "  \"bits\": \"1a018ae2\",";
+  gbt += "  \"height\": 898487";
+  gbt += "}}";
+
+  SelectParams(CBaseChainParams::TESTNET);
+  CTxDestination poolPayoutAddrTestnet = DecodeDestination("myxopLJB19oFtNBdrAxD5Z34Aw6P8o9P8U");
+  return sjob.initFromGbt(gbt.c_str(), poolCoinbaseInfo, poolPayoutAddrTestnet, 0, "", RskWork(), 1, false);
+}
+
+TEST(Stratum, StratumJobBinary) {
+  StratumJob sjob;
+  ASSERT_EQ(initBinaryTestJob(sjob), true);
+
+  const string jsonStr = sjob.serializeToJson();
+  const string binStr  = sjob.serializeToBinary();
+  ASSERT_EQ(StratumJob::isBinaryFormat(jsonStr.data(), jsonStr.size()), false);
+  ASSERT_EQ(StratumJob::isBinaryFormat(binStr.data(), binStr.size()), true);
+  ASSERT_LT(binStr.size(), jsonStr.size());
+
+  // unserialize() accepts both of them
+  StratumJob sjob1, sjob2;
+  ASSERT_EQ(sjob1.unserialize(jsonStr.data(), jsonStr.size()), true);
+  ASSERT_EQ(sjob2.unserialize(binStr.data(), binStr.size()), true);
+
+  ASSERT_EQ(sjob2.jobId_,         sjob1.jobId_);
+  ASSERT_EQ(sjob2.gbtHash_,       sjob1.gbtHash_);
+  ASSERT_EQ(sjob2.prevHash_,      sjob1.prevHash_);
+  ASSERT_EQ(sjob2.prevHashBeStr_, sjob1.prevHashBeStr_);
+  ASSERT_EQ(sjob2.height_,        sjob1.height_);
+  ASSERT_EQ(sjob2.coinbase1_,     sjob1.coinbase1_);
+  ASSERT_EQ(sjob2.coinbase2_,     sjob1.coinbase2_);
+  ASSERT_EQ(sjob2.merkleBranch_,  sjob1.merkleBranch_);
+  ASSERT_EQ(sjob2.nVersion_,      sjob1.nVersion_);
+  ASSERT_EQ(sjob2.nBits_,         sjob1.nBits_);
+  ASSERT_EQ(sjob2.nTime_,         sjob1.nTime_);
+  ASSERT_EQ(sjob2.minTime_,       sjob1.minTime_);
+  ASSERT_EQ(sjob2.coinbaseValue_, sjob1.coinbaseValue_);
+  ASSERT_EQ(sjob2.witnessCommitment_, sjob1.witnessCommitment_);
+  ASSERT_EQ(sjob2.networkTarget_, sjob1.networkTarget_);
+  ASSERT_EQ(sjob2.nmcAuxBlockHash_,  sjob1.nmcAuxBlockHash_);
+  ASSERT_EQ(sjob2.rskNetworkTarget_, sjob1.rskNetworkTarget_);
+  ASSERT_EQ(sjob2.isMergedMiningCleanJob_, sjob1.isMergedMiningCleanJob_);
+  ASSERT_EQ(sjob2.serializeToBinary(), binStr);
+
+  // truncated or unknown version
+  StratumJob sjob3;
+  ASSERT_EQ(sjob3.unserialize(binStr.data(), binStr.size() - 1), false);
+  string badVersion = binStr;
+  badVersion[STRATUM_JOB_BINARY_MAGIC_LEN] = 0x7f;
+  ASSERT_EQ(sjob3.unserialize(badVersion.data(), badVersion.size()), false);
+}
+
+// benchmark, run by: unittest --gtest_also_run_disabled_tests --gtest_filter='*Benchmark'
+TEST(Stratum, DISABLED_StratumJobBinaryBenchmark) {
+  StratumJob sjob;
+  ASSERT_EQ(initBinaryTestJob(sjob), true);
+  const string jsonStr = sjob.serializeToJson();
+  const string binStr  = sjob.serializeToBinary();
+
+  const int kRounds = 1000;
+  uint64_t t0 = getMonotonicTimeUs();
+  for (int i = 0; i < kRounds; i++) {
+    StratumJob j;
+    j.unserializeFromJson(jsonStr.data(), jsonStr.size());
+  }
+  uint64_t t1 = getMonotonicTimeUs();
+  for (int i = 0; i < kRounds; i++) {
+    StratumJob j;
+    j.unserializeFromBinary(binStr.data(), binStr.size());
+  }
+  uint64_t t2 = getMonotonicTimeUs();
+  for (int i = 0; i < kRounds; i++) {
+    sjob.serializeToJson();
+  }
+  uint64_t t3 = getMonotonicTimeUs();
+  for (int i = 0; i < kRounds; i++) {
+    sjob.serializeToBinary();
+  }
+  uint64_t t4 = getMonotonicTimeUs();
+
+  LOG(INFO) << "StratumJob json size: " << jsonStr.size()
+  << ", encode: " << (t3 - t2) * 1000 / kRounds << "ns"
+  << ", decode: " << (t1 - t0) * 1000 / kRounds << "ns";
+  LOG(INFO) << "StratumJob binary size: " << binStr.size()
+  << ", encode: " << (t4 - t3) * 1000 / kRounds << "ns"
+  << ", decode: " << (t2 - t1) * 1000 / kRounds << "ns";
 }
 
 #ifdef CHAIN_TYPE_BTC
@@ -27,6 +27,7 @@
 #include "Utils.h"
 
 #include "StratumServer.h"
+#include "utilities_js.hpp"
 
 
 #ifndef WORK_WITH_STRATUM_SWITCHER
@@ -61,3 +62,287 @@ TEST(StratumServer, SessionIDManager) {
 }
 
 #endif // #ifndef WORK_WITH_STRATUM_SWITCHER
+
+
+static UserInfo::UserUpdate makeUserUpdate(const string &userName,
+                                           const int32_t userId) {
+  UserInfo::UserUpdate update;
+  update.userName_ = userName;
+  update.userId_   = userId;
+#ifdef USER_DEFINED_COINBASE
+  update.hasCoinbaseInfo_ = false;
+#endif
+  return update;
+}
+
+TEST(StratumServer, UserInfoDirectory) {
+  UserInfo userInfo("", nullptr);
+  ASSERT_EQ(userInfo.getUserId("jack"), 0);
+
+  userInfo.applyUpdates({makeUserUpdate("jack", 1), makeUserUpdate("rose", 2)});
+  ASSERT_EQ(userInfo.getUserId("jack"), 1);
+  ASSERT_EQ(userInfo.getUserId("rose"), 2);
+
+  // a known name keeps its id
+  userInfo.applyUpdates({makeUserUpdate("jack", 3)});
+  ASSERT_EQ(userInfo.getUserId("jack"), 1);
+
+  // readers see every published user while the writer is publishing
+  const int32_t kUsers = 1000;
+  atomic<bool> isWriting(true);
+  atomic<int32_t> errors(0);
+  thread writer([&]() {
+    for (int32_t i = 0; i < kUsers; i++) {
+      userInfo.applyUpdates({makeUserUpdate(Strings::Format("user%d", i), 100 + i)});
+    }
+    isWriting = false;
+  });
+  vector<thread> readers;
+  for (int32_t r = 0; r < 2; r++) {
+    readers.push_back(thread([&]() {
+      int32_t published = 0;  // user0 ~ user(published-1) are known
+      while (isWriting || published < kUsers) {
+        if (userInfo.getUserId("jack") != 1) {
+          errors++;
+        }
+        for (int32_t i = 0; i < published; i += 97) {
+          if (userInfo.getUserId(Strings::Format("user%d", i)) != 100 + i) {
+            errors++;
+          }
+        }
+        while (published < kUsers &&
+               userInfo.getUserId(Strings::Format("user%d", published)) == 100 + published) {
+          published++;
+        }
+      }
+    }));
+  }
+  writer.join();
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  ASSERT_EQ(errors, 0);
+  ASSERT_EQ(userInfo.getUserId(Strings::Format("user%d", kUsers - 1)), 100 + kUsers - 1);
+}
+
+// the response of the user list api
+static string makeUsersResponse(const std::map<string, int32_t> &users) {
+  string data;
+  for (const auto &itr : users) {
+    if (!data.empty())
+      data += ",";
+#ifdef USER_DEFINED_COINBASE
+    data += Strings::Format("\"%s\":{\"puid\":%d}", itr.first.c_str(), itr.second);
+#else
+    data += Strings::Format("\"%s\":%d", itr.first.c_str(), itr.second);
+#endif
+  }
+#ifdef USER_DEFINED_COINBASE
+  return "{\"err_no\":0,\"data\":{\"users\":{" + data + "},\"time\":1}}";
+#else
+  return "{\"err_no\":0,\"data\":{" + data + "}}";
+#endif
+}
+
+TEST(StratumServer, UserInfoUnknownUser) {
+  UserInfo userInfo("http://127.0.0.1/users", nullptr);
+  std::map<string, int32_t> apiUsers;
+  atomic<int32_t> apiCalls(0);
+  userInfo.setHttpGetter([&](const string &url, string &response, long timeoutMs) {
+    apiCalls++;
+    response = makeUsersResponse(apiUsers);
+    return true;
+  });
+  atomic<int32_t> fetched(0);
+  userInfo.setUnknownUsersFetchedCallback([&]() { fetched++; });
+
+  ASSERT_EQ(userInfo.getUserId("jack"), 0);
+  ASSERT_TRUE(userInfo.fetchUnknownUser("jack"));
+  ASSERT_TRUE(userInfo.isFetchingUser("jack"));
+  ASSERT_FALSE(userInfo.isFetchingUser("rose"));
+
+  // what the update thread does, jack is not in the api either
+  userInfo.fetchUnknownUsers();
+  ASSERT_EQ(apiCalls, 1);
+  ASSERT_EQ(fetched, 1);
+  ASSERT_FALSE(userInfo.isFetchingUser("jack"));
+  ASSERT_EQ(userInfo.getUserId("jack"), 0);
+
+  // negative cached, rejected without asking the api again
+  ASSERT_FALSE(userInfo.fetchUnknownUser("jack"));
+  ASSERT_FALSE(userInfo.isFetchingUser("jack"));
+  userInfo.fetchUnknownUsers();
+  ASSERT_EQ(apiCalls, 1);
+  ASSERT_EQ(fetched, 1);  // nothing to fetch
+
+  // a new user of the api
+  apiUsers["rose"] = 2;
+  ASSERT_TRUE(userInfo.fetchUnknownUser("rose"));
+  userInfo.fetchUnknownUsers();
+  ASSERT_EQ(apiCalls, 2);
+  ASSERT_EQ(fetched, 2);
+  ASSERT_FALSE(userInfo.isFetchingUser("rose"));
+  ASSERT_EQ(userInfo.getUserId("rose"), 2);
+
+  // pushed by kafka, it's not unknown any more
+  userInfo.applyUpdates({makeUserUpdate("jack", 1)});
+  ASSERT_EQ(userInfo.getUserId("jack"), 1);
+  ASSERT_TRUE(userInfo.fetchUnknownUser("jack"));
+
+  // without the api, unknown users are rejected at once
+  UserInfo userInfoNoApi("", nullptr);
+  ASSERT_FALSE(userInfoNoApi.fetchUnknownUser("jack"));
+}
+
+TEST(StratumServer, UserInfoParseUserUpdate) {
+  UserInfo userInfo("", nullptr);
+  UserInfo::UserUpdate update;
+  string s;
+
+  s = "{\"user_name\":\"jack\",\"user_id\":1}";
+  ASSERT_TRUE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  ASSERT_EQ(update.userName_, "jack");
+  ASSERT_EQ(update.userId_, 1);
+#ifdef USER_DEFINED_COINBASE
+  ASSERT_FALSE(update.hasCoinbaseInfo_);
+#endif
+
+  s = "{\"user_name\":\"jack\"}";
+  ASSERT_FALSE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  s = "{\"user_name\":\"jack\",\"user_id\":\"1\"}";
+  ASSERT_FALSE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  s = "{\"user_name\":\"\",\"user_id\":1}";
+  ASSERT_FALSE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  s = "{\"user_name\":\"jack\",\"user_id\":0}";
+  ASSERT_FALSE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  s = "{\"user_name\":\"jack\",";
+  ASSERT_FALSE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+
+#ifdef USER_DEFINED_COINBASE
+  s = "{\"user_name\":\"jack\",\"user_id\":1,\"coinbase\":\"/jack/\"}";
+  ASSERT_TRUE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  ASSERT_TRUE(update.hasCoinbaseInfo_);
+  userInfo.applyUpdates({update});
+  const string coinbaseInfo = userInfo.getCoinbaseInfo(1);
+  ASSERT_EQ(coinbaseInfo.size(), (size_t)USER_DEFINED_COINBASE_SIZE);
+  ASSERT_NE(coinbaseInfo.find("/jack/"), string::npos);
+
+  // an update without "coinbase" keeps the user's coinbase info
+  s = "{\"user_name\":\"jack\",\"user_id\":1}";
+  ASSERT_TRUE(userInfo.parseUserUpdate(s.c_str(), s.size(), update));
+  userInfo.applyUpdates({update});
+  ASSERT_EQ(userInfo.getCoinbaseInfo(1), coinbaseInfo);
+#endif
+}
+
+
+#ifdef USER_DEFINED_COINBASE
+
+// the workers of the 'worker_update_batch' events
+static vector<vector<int64_t>> parseWorkerUpdateEvents(const vector<string> &events) {
+  vector<vector<int64_t>> workerIds;
+  for (const auto &event : events) {
+    JsonNode r;
+    workerIds.push_back(vector<int64_t>());
+    if (!JsonNode::parse(event.c_str(), event.c_str() + event.size(), r) ||
+        r["type"].str() != "worker_update_batch" ||
+        r["content"].type() != Utilities::JS::type::Array) {
+      continue;
+    }
+    for (JsonNode &content : *r["content"].children()) {
+      workerIds.back().push_back(content["worker_id"].int64());
+    }
+  }
+  return workerIds;
+}
+
+TEST(StratumServer, UserInfoWorkerUpdates) {
+  UserInfo userInfo("", nullptr);
+  vector<string> events;
+  userInfo.setEventSender([&](const string &eventJson) { events.push_back(eventJson); });
+  const time_t now = 1500000000;
+
+  // at most 500 workers an event
+  for (int64_t i = 0; i < 1201; i++) {
+    userInfo.addWorker(1, i, Strings::Format("w%d", (int)i), "cgminer");
+  }
+  ASSERT_EQ(userInfo.insertWorkerName(now), 1201);
+  vector<vector<int64_t>> workerIds = parseWorkerUpdateEvents(events);
+  ASSERT_EQ(workerIds.size(), 3u);
+  ASSERT_EQ(workerIds[0].size(), 500u);
+  ASSERT_EQ(workerIds[1].size(), 500u);
+  ASSERT_EQ(workerIds[2].size(), 201u);
+  ASSERT_EQ(workerIds[0][0], 0);
+  ASSERT_EQ(workerIds[2][200], 1200);
+  ASSERT_EQ(userInfo.insertWorkerName(now), 0);  // nothing queued
+
+  // registered again in 600 seconds: only the ones of a new agent are sent
+  events.clear();
+  userInfo.addWorker(1, 0, "w0", "cgminer");
+  userInfo.addWorker(1, 1, "w1", "bmminer");
+  userInfo.addWorker(2, 0, "w0", "cgminer");  // another user
+  ASSERT_EQ(userInfo.insertWorkerName(now + 599), 3);
+  workerIds = parseWorkerUpdateEvents(events);
+  ASSERT_EQ(workerIds.size(), 1u);
+  ASSERT_EQ(workerIds[0], vector<int64_t>({1, 0}));
+
+  // sent again after 600 seconds
+  events.clear();
+  userInfo.addWorker(1, 0, "w0", "cgminer");
+  userInfo.addWorker(1, 1, "w1", "bmminer");
+  ASSERT_EQ(userInfo.insertWorkerName(now + 600), 2);
+  workerIds = parseWorkerUpdateEvents(events);
+  ASSERT_EQ(workerIds.size(), 1u);
+  ASSERT_EQ(workerIds[0], vector<int64_t>({0}));  // w1 was sent at now + 599
+}
+
+TEST(StratumServer, UserCoinbase1Cache) {
+  StratumJob *sjob = new StratumJob();
+  sjob->coinbase1_ = string(2 * (100 + USER_DEFINED_COINBASE_SIZE), '0');
+  sjob->coinbase2_ = string(2 * 100, '0');
+  sjob->merkleBranch_.resize(12);
+  StratumJobEx exJob(sjob, true);  // owns sjob
+  UserInfo userInfo("", nullptr);
+
+  shared_ptr<const string> c1 = exJob.getUserCoinbase1(1, &userInfo);
+  shared_ptr<const string> c2 = exJob.getUserCoinbase1(1, &userInfo);
+  shared_ptr<const string> c3 = exJob.getUserCoinbase1(2, &userInfo);
+  ASSERT_EQ(c1.get(), c2.get());  // built only once
+  ASSERT_NE(c1.get(), c3.get());
+  ASSERT_EQ(*c1, sjob->coinbase1_);  // no coinbase info of the user
+
+  // broadcast a job to 10k users x 10 workers
+  const int32_t kUsers = 10000, kWorkers = 10;
+  uint64_t t0 = getMonotonicTimeUs();
+  for (int32_t w = 0; w < kWorkers; w++) {
+    for (int32_t u = 0; u < kUsers; u++) {
+      // the old way: lookup, hex and replace for every session
+      const string userCoinbaseInfo = userInfo.getCoinbaseInfo(u);
+      string userCoinbaseHex;
+      Bin2Hex((const uint8_t *)userCoinbaseInfo.c_str(), userCoinbaseInfo.size(), userCoinbaseHex);
+      string coinbase1 = exJob.coinbase1_;
+      coinbase1.replace(coinbase1.size()-userCoinbaseHex.size(), userCoinbaseHex.size(), userCoinbaseHex);
+      string notifyStr;
+      notifyStr.reserve(2048);
+      notifyStr.append(exJob.miningNotify1_).append(exJob.miningNotify2_);
+      notifyStr.append(coinbase1).append(exJob.miningNotify3_);
+    }
+  }
+  uint64_t t1 = getMonotonicTimeUs();
+  for (int32_t w = 0; w < kWorkers; w++) {
+    for (int32_t u = 0; u < kUsers; u++) {
+      shared_ptr<const string> coinbase1 = exJob.getUserCoinbase1(u, &userInfo);
+      string notifyStr;
+      notifyStr.reserve(2048);
+      notifyStr.append(exJob.miningNotify1_).append(exJob.miningNotify2_);
+      notifyStr.append(*coinbase1).append(exJob.miningNotify3_);
+    }
+  }
+  uint64_t t2 = getMonotonicTimeUs();
+
+  LOG(INFO) << "broadcast to " << kUsers << " users x " << kWorkers << " workers"
+  << ", without cache: " << (t1 - t0) / 1000 << "ms"
+  << ", with cache: " << (t2 - t1) / 1000 << "ms";
+}
+
+#endif // #ifdef USER_DEFINED_COINBASE
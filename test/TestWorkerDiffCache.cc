@@ -0,0 +1,83 @@
+/*
+ The MIT License (MIT)
+
+ Copyright (c) [2016] [BTC.COM]
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ */
+#include "gtest/gtest.h"
+#include "Common.h"
+#include "Utils.h"
+#include "WorkerDiffCache.h"
+
+#include <unistd.h>
+
+TEST(WorkerDiffCache, SetGet) {
+  WorkerDiffCache cache("", nullptr, "");
+  ASSERT_EQ(cache.get(1, 100), 0u);
+
+  cache.set(1, 100, 65536);
+  cache.set(1, -100, 1024);
+  cache.set(2, 100, 4096);
+  ASSERT_EQ(cache.size(), 3u);
+  ASSERT_EQ(cache.get(1, 100),  65536u);
+  ASSERT_EQ(cache.get(1, -100), 1024u);
+  ASSERT_EQ(cache.get(2, 100),  4096u);
+
+  cache.set(1, 100, 131072);
+  ASSERT_EQ(cache.get(1, 100), 131072u);
+}
+
+TEST(WorkerDiffCache, Merge) {
+  WorkerDiffCache cache("", nullptr, "");
+  const uint32_t now = (uint32_t)time(nullptr);
+
+  cache.merge(1, 100, 65536, now - 10);
+  ASSERT_EQ(cache.get(1, 100), 65536u);
+
+  // older one is ignored
+  cache.merge(1, 100, 1024, now - 20);
+  ASSERT_EQ(cache.get(1, 100), 65536u);
+
+  // newer one wins
+  cache.merge(1, 100, 2048, now);
+  ASSERT_EQ(cache.get(1, 100), 2048u);
+
+  // expired
+  cache.merge(1, 200, 2048, now - WorkerDiffCache::kEntryExpireSeconds_ - 1);
+  ASSERT_EQ(cache.get(1, 200), 0u);
+}
+
+TEST(WorkerDiffCache, File) {
+  const string file = Strings::Format("/tmp/test_worker_diff_cache_%d.txt", (int)getpid());
+  {
+    WorkerDiffCache cache(file, nullptr, "");
+    cache.set(1, 100, 65536);
+    cache.set(3, -9223372036854775807LL, 1ull << 40);
+    ASSERT_EQ(cache.saveToFile(), true);
+  }
+  {
+    WorkerDiffCache cache(file, nullptr, "");
+    ASSERT_EQ(cache.loadFromFile(), true);
+    ASSERT_EQ(cache.size(), 2u);
+    ASSERT_EQ(cache.get(1, 100), 65536u);
+    ASSERT_EQ(cache.get(3, -9223372036854775807LL), 1ull << 40);
+  }
+  unlink(file.c_str());
+}